@@ -1,251 +1,435 @@
-#include "account.hpp"
-
-Account::Account(int account_id, string password, int initial_amount)
-    : account_id(account_id), password(password), balance(initial_amount), read_count(0)
-{
-    if (pthread_mutex_init(&(this->read_lock_mutex), nullptr)) {
-        perror("Bank error: pthread_mutex_init failed");
-    }
-
-    if (pthread_mutex_init(&(this->write_lock_mutex), nullptr)) {
-        perror("Bank error: pthread_mutex_init failed");
-    }
-}
-
-Account::~Account()
-{
-    if (pthread_mutex_destroy(&(this->read_lock_mutex))) {
-        perror("Bank error: pthread_mutex_destroy failed");
-    }
-
-    if (pthread_mutex_destroy(&(this->write_lock_mutex))) {
-        perror("Bank error: pthread_mutex_destroy failed");
-    }
-}
-
-bool Account::operator<(const Account& other) const
-{
-    return account_id < other.account_id;
-}
-
-void Account::account_read_lock()
-{
-    if (pthread_mutex_lock(&(this->read_lock_mutex))) {
-        perror("Bank error: pthread_mutex_lock failed");
-        exit(1);
-    }
-
-    read_count++;
-
-    if (read_count == 1) {
-        if (pthread_mutex_lock(&(this->write_lock_mutex))) {
-            perror("Bank error: pthread_mutex_lock failed");
-            exit(1);
-        }
-    }
-
-    if (pthread_mutex_unlock(&(this->read_lock_mutex))) {
-        perror("Bank error: pthread_mutex_unlock failed");
-        exit(1);
-    }
-}
-
-void Account::account_read_unlock()
-{
-    if (pthread_mutex_lock(&(this->read_lock_mutex))) {
-        perror("Bank error: pthread_mutex_lock failed");
-        exit(1);
-    }
-
-    read_count--;
-
-    if (read_count == 0) {
-        if (pthread_mutex_unlock(&(this->write_lock_mutex))) {
-            perror("Bank error: pthread_mutex_unlock failed");
-            exit(1);
-        }
-    }
-
-    if (pthread_mutex_unlock(&(this->read_lock_mutex))) {
-        perror("Bank error: pthread_mutex_unlock failed");
-        exit(1);
-    }
-}
-
-void Account::account_write_lock()
-{
-    if (pthread_mutex_lock(&(this->write_lock_mutex))) {
-        perror("Bank error: pthread_mutex_lock failed");
-        exit(1);
-    }
-}
-
-void Account::account_write_unlock()
-{
-    if (pthread_mutex_unlock(&(this->write_lock_mutex))) {
-        perror("Bank error: pthread_mutex_unlock failed");
-        exit(1);
-    }
-}
-
-int Account::get_id()
-{
-    return this->account_id;
-}
-
-bool Account::check_password(string password)
-{
-    return this->password == password;
-}
-
-int Account::get_balance(string password, int* balance, int atm_id)
-{
-    account_read_lock();
-    sleep(1);
-
-    stringstream log_line;
-
-    if (!check_password(password)) {
-        log_line << "Error " << atm_id << ": Your transaction failed - password for account id " << this->account_id << " is incorrect";
-        write_to_log_file(log_line.str());
-
-        account_read_unlock();
-        return WRONG_PASSWORD;
-    }
-
-    *balance = this->balance;
-
-    log_line << atm_id << ": Account " << this->account_id << " balance is " << this->balance;
-    write_to_log_file(log_line.str());
-
-    account_read_unlock();
-    return SUCCESS;
-}
-
-int Account::get_balance_no_print(string password, int* balance, int atm_id)
-{
-    account_read_lock();
-    sleep(1);
-
-    if (!check_password(password)) {
-        account_read_unlock();
-        return WRONG_PASSWORD;
-    }
-
-    *balance = this->balance;
-    account_read_unlock();
-    return SUCCESS;
-}
-
-int Account::deposit(int amount, string password, int* new_balance, int atm_id)
-{
-    account_write_lock();
-    sleep(1);
-
-    stringstream log_line;
-
-    if (!check_password(password)) {
-        log_line << "Error " << atm_id << ": Your transaction failed - password for account id " << this->account_id << " is incorrect";
-        write_to_log_file(log_line.str());
-
-        account_write_unlock();
-        return WRONG_PASSWORD;
-    }
-
-    this->balance += amount;
-    *new_balance = this->balance;
-
-    log_line << atm_id << ": Account " << this->account_id << " new balance is " << this->balance << " after " << amount << " $ was deposited";
-    write_to_log_file(log_line.str());
-
-    account_write_unlock();
-    return SUCCESS;
-}
-
-void Account::deposit_without_lock(int amount, int* new_balance)
-{
-    this->balance += amount;
-    *new_balance = this->balance;
-}
-
-int Account::withdraw(int amount, string password, int* new_balance, int atm_id)
-{
-    account_write_lock();
-    sleep(1);
-
-    stringstream log_line;
-
-    if (!check_password(password)) {
-        log_line << "Error " << atm_id << ": Your transaction failed - password for account id " << this->account_id << " is incorrect";
-        write_to_log_file(log_line.str());
-
-        account_write_unlock();
-        return WRONG_PASSWORD;
-    }
-
-    if (this->balance < amount) {
-        *new_balance = this->balance;
-
-        log_line << "Error " << atm_id << ": Your transaction failed - account id " << this->account_id << " balance is lower than " << amount;
-        write_to_log_file(log_line.str());
-
-        account_write_unlock();
-        return NOT_ENOUGH_MONEY;
-    }
-
-    this->balance -= amount;
-    *new_balance = this->balance;
-
-    log_line << atm_id << ": Account " << this->account_id << " new balance is " << this->balance << " after " << amount << " $ was withdrew";
-    write_to_log_file(log_line.str());
-
-    account_write_unlock();
-    return SUCCESS;
-}
-
-int Account::withdraw_without_lock(int amount, int* new_balance)
-{
-    if (this->balance < amount) {
-        *new_balance = this->balance;
-        return NOT_ENOUGH_MONEY;
-    }
-
-    this->balance -= amount;
-    *new_balance = this->balance;
-
-    return SUCCESS;
-}
-
-int Account::commission(int commission_percentage)
-{
-    account_write_lock();
-
-    int commision = round(static_cast<double>(this->balance) * (static_cast<double>(commission_percentage) / 100));
-    this->balance -= commision;
-
-    stringstream log_line;
-    log_line << "Bank: commissions of " << to_string(commission_percentage) << " % were charged, the bank gained " << to_string(commision) << " $ from account " << this->account_id;
-    write_to_log_file(log_line.str());
-
-    account_write_unlock();
-    return commision;
-}
-
-string Account::print_status()
-{
-    account_read_lock();
-
-    string line = "Account " + to_string(account_id)  + ": Balance - " + to_string(this->balance) + " $, Account Password - " + this->password;
-
-    account_read_unlock();
-    return line;
-}
-
-void write_to_log_file(string line)
-{
-    pthread_mutex_lock(&log_file_lock);
-    if (log_file.is_open()) {
-        log_file << line << endl;
-    }
-    pthread_mutex_unlock(&log_file_lock);
-}
\ No newline at end of file
+#include "account.hpp"
+#include "replay.hpp"
+#include "handlers.hpp"
+#include <sched.h>
+#include <cstdlib>
+#include <new>
+
+bool latency_injection_enabled = true;
+
+Account::Account(int account_id, string password, int initial_amount)
+    : account_id(account_id), password(password), balance(initial_amount), deposit_stripes(nullptr), fold_sequence(0)
+{
+}
+
+// Copies get their own locks and a copy of the stripes, pending deposits included
+Account::Account(const Account& other)
+    : account_id(other.account_id), password(other.password), balance(other.balance.load()), deposit_stripes(nullptr), fold_sequence(0), history(other.history)
+{
+    copy_stripes(other);
+}
+
+Account& Account::operator=(const Account& other)
+{
+    if (this == &other) {
+        return *this;
+    }
+
+    this->account_id = other.account_id;
+    this->password = other.password;
+    this->balance = other.balance.load();
+    this->history = other.history;
+    copy_stripes(other);
+
+    return *this;
+}
+
+// The moved account gets its own locks, like a copy, and takes over the pending stripes
+Account::Account(Account&& other) noexcept
+    : account_id(other.account_id), password(move(other.password)), balance(other.balance.load()), deposit_stripes(other.deposit_stripes), fold_sequence(0), history(move(other.history))
+{
+    other.deposit_stripes = nullptr;
+}
+
+Account& Account::operator=(Account&& other) noexcept
+{
+    if (this == &other) {
+        return *this;
+    }
+
+    this->account_id = other.account_id;
+    this->password = move(other.password);
+    this->balance = other.balance.load();
+    this->history = move(other.history);
+    destroy_stripes();
+    this->deposit_stripes = other.deposit_stripes;
+    other.deposit_stripes = nullptr;
+
+    return *this;
+}
+
+Account::~Account()
+{
+    destroy_stripes();
+}
+
+void Account::enable_deposit_stripes()
+{
+    if (this->deposit_stripes != nullptr) {
+        return;
+    }
+
+    // new[] does not align past max_align_t before C++17
+    void* memory;
+    if (posix_memalign(&memory, CACHE_LINE_SIZE, sizeof(Deposit_Stripe) * DEPOSIT_STRIPES)) {
+        perror("Bank error: posix_memalign failed");
+        exit(1);
+    }
+    this->deposit_stripes = static_cast<Deposit_Stripe*>(memory);
+    for (int i = 0; i < DEPOSIT_STRIPES; i++) {
+        Deposit_Stripe* stripe = new (&this->deposit_stripes[i]) Deposit_Stripe;
+        stripe->amount.store(0);
+        stripe->reserved.store(0);
+        stripe->folded.store(0);
+        for (int slot = 0; slot < STRIPE_LOG_SIZE; slot++) {
+            stripe->log[slot].landed.store(false);
+        }
+    }
+}
+
+void Account::destroy_stripes()
+{
+    if (this->deposit_stripes == nullptr) {
+        return;
+    }
+
+    for (int i = 0; i < DEPOSIT_STRIPES; i++) {
+        this->deposit_stripes[i].~Deposit_Stripe();
+    }
+    free(this->deposit_stripes);
+    this->deposit_stripes = nullptr;
+}
+
+void Account::copy_stripes(const Account& other)
+{
+    if (other.deposit_stripes == nullptr) {
+        destroy_stripes();
+        return;
+    }
+
+    enable_deposit_stripes();
+    for (int i = 0; i < DEPOSIT_STRIPES; i++) {
+        Deposit_Stripe& from = other.deposit_stripes[i];
+        Deposit_Stripe& to = this->deposit_stripes[i];
+        to.amount.store(from.amount.load());
+        to.reserved.store(from.reserved.load());
+        to.folded.store(from.folded.load());
+        for (int slot = 0; slot < STRIPE_LOG_SIZE; slot++) {
+            to.log[slot].atm_id = from.log[slot].atm_id;
+            to.log[slot].amount = from.log[slot].amount;
+            to.log[slot].landed.store(from.log[slot].landed.load());
+        }
+    }
+}
+
+bool Account::has_deposit_stripes()
+{
+    return this->deposit_stripes != nullptr;
+}
+
+// Balance including pending stripes, without moving them. Deposits may land
+// meanwhile; a read that overlaps a fold is retried.
+int Account::exact_balance() const
+{
+    if (this->deposit_stripes == nullptr) {
+        return this->balance.load(memory_order_acquire);
+    }
+
+    while (true) {
+        unsigned before = this->fold_sequence.load(memory_order_acquire);
+        if ((before & 1) == 0) {
+            int total = this->balance.load(memory_order_acquire);
+            for (int i = 0; i < DEPOSIT_STRIPES; i++) {
+                total += this->deposit_stripes[i].amount.load(memory_order_acquire);
+            }
+            if (this->fold_sequence.load(memory_order_acquire) == before) {
+                return total;
+            }
+        }
+        sched_yield();
+    }
+}
+
+// Moves landed deposits into the balance; caller holds the write lock. Each
+// deposit enters the history with its ATM and a version taken now, in slot
+// order per stripe. The audit counted the deposits when they landed.
+void Account::fold_deposits()
+{
+    if (this->deposit_stripes == nullptr) {
+        return;
+    }
+
+    bool folding = false;
+    for (int i = 0; i < DEPOSIT_STRIPES; i++) {
+        Deposit_Stripe& stripe = this->deposit_stripes[i];
+        unsigned slot = stripe.folded.load(memory_order_relaxed);
+        unsigned end = stripe.reserved.load(memory_order_acquire);
+        if (slot == end) {
+            continue;
+        }
+        if (!folding) {
+            this->fold_sequence.fetch_add(1);
+            folding = true;
+        }
+
+        for (; slot != end; slot++) {
+            Striped_Deposit& deposit = stripe.log[slot % STRIPE_LOG_SIZE];
+            // Reserved but not written yet: its depositor is a few instructions away
+            while (!deposit.landed.load(memory_order_acquire)) {
+                sched_yield();
+            }
+            this->balance.fetch_add(deposit.amount);
+            stripe.amount.fetch_sub(deposit.amount);
+            this->history.record(this->account_id, this->balance.load(memory_order_relaxed), deposit.amount, deposit.atm_id, false);
+            deposit.landed.store(false, memory_order_relaxed);
+        }
+        stripe.folded.store(end, memory_order_release);
+    }
+    if (folding) {
+        this->fold_sequence.fetch_add(1);
+    }
+}
+
+void Account::record_change(int delta, int atm_id)
+{
+    if (delta != 0) {
+        this->history.record(this->account_id, this->balance, delta, atm_id, false);
+        audit_change(delta);
+    }
+}
+
+bool Account::operator<(const Account& other) const
+{
+    return account_id < other.account_id;
+}
+
+void Account::account_read_lock()
+{
+    Trace_Span span("account lock");
+    this->lock.read_lock();
+}
+
+void Account::account_read_unlock()
+{
+    this->lock.read_unlock();
+}
+
+void Account::account_write_lock()
+{
+    Trace_Span span("account lock");
+    this->lock.write_lock();
+}
+
+void Account::account_write_unlock()
+{
+    this->lock.write_unlock();
+}
+
+int Account::get_id() const
+{
+    return this->account_id;
+}
+
+bool Account::check_password(string password)
+{
+    return this->password == password;
+}
+
+const string& Account::get_password() const
+{
+    return this->password;
+}
+
+int Account::get_balance(string password, int* balance, int atm_id)
+{
+    return Operation_Handler<Balance_Op, Password_Auth, Account_Lock, Text_Log>::run(*this, password, 0, balance, atm_id);
+}
+
+int Account::get_balance_no_print(string password, int* balance, int atm_id)
+{
+    return Operation_Handler<Balance_Op, Password_Auth, Account_Lock, No_Log>::run(*this, password, 0, balance, atm_id);
+}
+
+int Account::deposit(int amount, string password, int* new_balance, int atm_id)
+{
+    // Striped deposits commute, so they take no lock. While recording a replay
+    // they take the write lock, which orders them against withdrawals.
+    int status;
+    if (this->deposit_stripes != nullptr && replay_recorder == nullptr) {
+        status = Operation_Handler<Deposit_Op, Password_Auth, Stripe_Lock, Text_Log>::run(*this, password, amount, new_balance, atm_id);
+    } else {
+        status = Operation_Handler<Deposit_Op, Password_Auth, Account_Lock, Text_Log>::run(*this, password, amount, new_balance, atm_id);
+    }
+
+    if (status == SUCCESS) {
+        audit_flow(AUDIT_DEPOSITED, amount);
+    }
+    return status;
+}
+
+void Account::land_deposit(int amount, int atm_id)
+{
+    int cpu = sched_getcpu();
+    if (cpu < 0) {
+        cpu = static_cast<int>(pthread_self() % DEPOSIT_STRIPES);
+    }
+    Deposit_Stripe& stripe = this->deposit_stripes[cpu % DEPOSIT_STRIPES];
+
+    unsigned slot = stripe.reserved.load(memory_order_relaxed);
+    do {
+        if (slot - stripe.folded.load(memory_order_acquire) >= STRIPE_LOG_SIZE) {
+            // The stripe's log is full until the next fold, so fold now
+            int new_balance;
+            account_write_lock();
+            deposit_without_lock(amount, &new_balance, atm_id);
+            account_write_unlock();
+            return;
+        }
+    } while (!stripe.reserved.compare_exchange_weak(slot, slot + 1, memory_order_acq_rel, memory_order_relaxed));
+
+    Striped_Deposit& deposit = stripe.log[slot % STRIPE_LOG_SIZE];
+    deposit.atm_id = atm_id;
+    deposit.amount = amount;
+    stripe.amount.fetch_add(amount, memory_order_release);
+    deposit.landed.store(true, memory_order_release);
+    audit_change(amount);
+}
+
+void Account::deposit_without_lock(int amount, int* new_balance, int atm_id)
+{
+    fold_deposits();
+    this->balance += amount;
+    record_change(amount, atm_id);
+    *new_balance = this->balance;
+}
+
+int Account::withdraw(int amount, string password, int* new_balance, int atm_id)
+{
+    int status = Operation_Handler<Withdraw_Op, Password_Auth, Account_Lock, Text_Log>::run(*this, password, amount, new_balance, atm_id);
+    if (status == SUCCESS) {
+        audit_flow(AUDIT_WITHDRAWN, amount);
+    }
+    return status;
+}
+
+int Account::withdraw_without_lock(int amount, int* new_balance, int atm_id)
+{
+    fold_deposits();
+    if (this->balance < amount) {
+        *new_balance = this->balance;
+        return NOT_ENOUGH_MONEY;
+    }
+
+    this->balance -= amount;
+    record_change(-amount, atm_id);
+    *new_balance = this->balance;
+
+    return SUCCESS;
+}
+
+int Account::peek_balance()
+{
+    account_read_lock();
+    int current_balance = exact_balance();
+    account_read_unlock();
+    return current_balance;
+}
+
+int Account::balance_without_lock()
+{
+    return exact_balance();
+}
+
+int Account::commission(int commission_percentage)
+{
+    account_write_lock();
+    fold_deposits();
+
+    int commision = round(static_cast<double>(this->balance) * (static_cast<double>(commission_percentage) / 100));
+    this->balance -= commision;
+    record_change(-commision, 0);
+
+    stringstream log_line;
+    log_line << "Bank: commissions of " << to_string(commission_percentage) << " % were charged, the bank gained " << to_string(commision) << " $ from account " << this->account_id;
+    write_to_log_file(log_line.str());
+
+    account_write_unlock();
+    return commision;
+}
+
+bool Account::balance_at_version(long long version, int* balance)
+{
+    fold_deposits();
+    return this->history.balance_at(version, this->balance, balance);
+}
+
+// The restore itself is recorded as undone, so an ATM scoped rollback never reverts it.
+// Pending stripes are folded first, so they do not stay on top of the restored
+// balance. Returns the change made to the balance.
+int Account::restore_without_lock(long long version, int balance, int atm_id)
+{
+    fold_deposits();
+    int delta = balance - this->balance;
+    this->balance = balance;
+    this->history.undo_after(version);
+    if (delta != 0) {
+        this->history.record(this->account_id, this->balance, delta, atm_id, true);
+    }
+    return delta;
+}
+
+bool Account::atm_changes_after(int target_atm_id, long long version, int* delta)
+{
+    fold_deposits();
+    return this->history.atm_changes_after(target_atm_id, version, delta);
+}
+
+int Account::undo_atm_without_lock(int target_atm_id, long long version, int atm_id)
+{
+    int delta;
+    fold_deposits();
+    this->history.atm_changes_after(target_atm_id, version, &delta);
+    this->history.undo_atm_after(target_atm_id, version);
+    this->balance -= delta;
+    if (delta != 0) {
+        this->history.record(this->account_id, this->balance, -delta, atm_id, true);
+    }
+    return -delta;
+}
+
+string Account::print_status()
+{
+    account_read_lock();
+
+    string line = "Account " + to_string(account_id)  + ": Balance - " + to_string(exact_balance()) + " $, Account Password - " + this->password;
+
+    account_read_unlock();
+    return line;
+}
+
+void write_to_log_file(const string& line)
+{
+    Trace_Span span("log");
+    pthread_mutex_lock(&log_file_lock);
+    if (log_file.is_open()) {
+        log_file << line << endl;
+    }
+    replay_record_commit();
+    pthread_mutex_unlock(&log_file_lock);
+}
+
+void inject_sleep(unsigned int seconds)
+{
+    if (latency_injection_enabled) {
+        Trace_Span span("sleep");
+        sleep(seconds);
+    }
+}
+
+void inject_usleep(useconds_t microseconds)
+{
+    if (latency_injection_enabled) {
+        Trace_Span span("sleep");
+        usleep(microseconds);
+    }
+}
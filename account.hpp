@@ -1,60 +1,132 @@
- #ifndef ACCOUNT_H
-#define ACCOUNT_H
-
-#include <iostream>
-#include <string>
-#include <cmath>
-#include <pthread.h>
-#include <sstream>
-#include <fstream>
-#include <unistd.h>
-
-#define SUCCESS 0
-#define ACCOUNT_EXIST -1
-#define ACCOUNT_NOT_EXIST -2
-#define WRONG_PASSWORD -3
-#define NOT_ENOUGH_MONEY -4
-#define TARGET_ACCOUNT_NOT_EXIST -5
-
-using namespace std;
-
-/* Global Variables */
-extern std::ofstream log_file;
-extern pthread_mutex_t log_file_lock;
-
-void write_to_log_file(string line);
-
-class Account {
-private:
-    int account_id;
-    string password;
-    int balance;
-    pthread_mutex_t read_lock_mutex;
-    pthread_mutex_t write_lock_mutex;
-    int read_count;
-
-public:
-    Account(int account_id, string password, int initial_amount);
-    ~Account();
-
-    bool operator<(const Account& other) const;
-
-    // Readers-writers mechanism
-    void account_read_lock();
-    void account_read_unlock();
-    void account_write_lock();
-    void account_write_unlock();
-
-    int get_id();
-    bool check_password(string password);
-    int get_balance(string password, int* balance, int atm_id);
-    int get_balance_no_print(string password, int* balance, int atm_id);
-    int deposit(int amount, string password, int* new_balance, int atm_id);
-    void deposit_without_lock(int amount, int* new_balance);
-    int withdraw(int amount, string password, int* new_balance, int atm_id);
-    int withdraw_without_lock(int amount, int* new_balance);
-    int commission(int commission_percentage);
-    string print_status();
-};
-
-#endif
+ #ifndef ACCOUNT_H
+#define ACCOUNT_H
+
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <pthread.h>
+#include <sstream>
+#include <fstream>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include "history.hpp"
+#include "log_segments.hpp"
+#include "trace.hpp"
+#include "audit.hpp"
+#include "rw_lock.hpp"
+
+#define SUCCESS 0
+#define ACCOUNT_EXIST -1
+#define ACCOUNT_NOT_EXIST -2
+#define WRONG_PASSWORD -3
+#define NOT_ENOUGH_MONEY -4
+#define TARGET_ACCOUNT_NOT_EXIST -5
+#define CACHE_LINE_SIZE 64
+#define DEPOSIT_STRIPES 16
+#define STRIPE_LOG_SIZE 256   // deposits a stripe holds between two folds
+
+using namespace std;
+
+/* Global Variables */
+extern Segmented_Log log_file;
+extern pthread_mutex_t log_file_lock;
+extern bool latency_injection_enabled;
+
+void write_to_log_file(const string& line);
+
+// Simulated processing delays, skipped when latency injection is off
+void inject_sleep(unsigned int seconds);
+void inject_usleep(useconds_t microseconds);
+
+/* A striped deposit waiting for the next fold */
+struct Striped_Deposit {
+    int atm_id;
+    int amount;
+    atomic<bool> landed;   // set once atm_id and amount are written
+};
+
+/*
+ * Per-core deposit sub-balance, aligned so stripes never share a cache line.
+ * A deposit reserves a slot of the stripe's log and adds to amount without a
+ * lock; the fold drains the log in slot order and frees the slots.
+ */
+struct alignas(CACHE_LINE_SIZE) Deposit_Stripe {
+    atomic<int> amount;          // landed and not folded yet
+    atomic<unsigned> reserved;   // log slots handed out
+    atomic<unsigned> folded;     // log slots folded
+    Striped_Deposit log[STRIPE_LOG_SIZE];
+};
+
+struct Account_Lock;
+struct Stripe_Lock;
+
+class Account {
+    // The lock policy of the operation handlers, see handlers.hpp
+    friend struct Account_Lock;
+    friend struct Stripe_Lock;
+
+private:
+    int account_id;
+    string password;
+    // Atomic so a striped deposit can read it, under fold_sequence, without a lock
+    atomic<int> balance;
+    Readers_Writers_Lock lock;
+    // Striped mode: deposits land here without a lock, see fold_deposits()
+    Deposit_Stripe* deposit_stripes;
+    atomic<unsigned> fold_sequence;   // odd while a fold moves stripes into balance
+    // Committed changes for account scoped rollback, see history.hpp
+    Account_History history;
+
+    int exact_balance() const;
+    void fold_deposits();
+    void destroy_stripes();
+    // Appends a change to the history and the audit ledger; caller holds the write lock
+    void record_change(int delta, int atm_id);
+    // Adds a deposit to the current CPU's stripe; takes the write lock only when its log is full
+    void land_deposit(int amount, int atm_id);
+    // Copies other's stripes, pending deposits included; no deposit may land meanwhile
+    void copy_stripes(const Account& other);
+
+public:
+    Account(int account_id, string password, int initial_amount);
+    Account(const Account& other);
+    Account& operator=(const Account& other);
+    // Moves keep the history and the stripes; the bank write lock is held
+    Account(Account&& other) noexcept;
+    Account& operator=(Account&& other) noexcept;
+    ~Account();
+
+    bool operator<(const Account& other) const;
+
+    // Readers-writers mechanism
+    void account_read_lock();
+    void account_read_unlock();
+    void account_write_lock();
+    void account_write_unlock();
+
+    int get_id() const;
+    bool check_password(string password);
+    const string& get_password() const;
+    int get_balance(string password, int* balance, int atm_id);
+    int get_balance_no_print(string password, int* balance, int atm_id);
+    int deposit(int amount, string password, int* new_balance, int atm_id);
+    void deposit_without_lock(int amount, int* new_balance, int atm_id);
+    int withdraw(int amount, string password, int* new_balance, int atm_id);
+    int withdraw_without_lock(int amount, int* new_balance, int atm_id);
+    int peek_balance();
+    int balance_without_lock();
+    void enable_deposit_stripes();
+    bool has_deposit_stripes();
+    int commission(int commission_percentage);
+
+    // Account scoped rollback; the caller holds the write lock. The restores
+    // return the change they made, which excludes deposits landing meanwhile.
+    bool balance_at_version(long long version, int* balance);
+    int restore_without_lock(long long version, int balance, int atm_id);
+    bool atm_changes_after(int target_atm_id, long long version, int* delta);
+    int undo_atm_without_lock(int target_atm_id, long long version, int atm_id);
+    string print_status();
+};
+
+#endif
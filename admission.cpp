@@ -0,0 +1,210 @@
+#include "admission.hpp"
+#include <ctime>
+#include <cstdio>
+#include <iomanip>
+#include <algorithm>
+
+static long long admission_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+Admission_Controller::Admission_Controller(int atm_count, double rate, double burst, int slots, double vip_share, int queue_limit)
+    : rate(rate), burst(max(burst, 1.0)), slots(slots), queue_limit(queue_limit),
+      bucket_tokens(atm_count + 1, max(burst, 1.0)), bucket_refill_ns(atm_count + 1, admission_now_ns()),
+      atm_stats(atm_count + 1, Atm_Admission_Stats()), busy_slots(0), last_virtual_time(0)
+{
+    vip_share = min(max(vip_share, 0.01), 0.99);
+    class_weight[ADMISSION_REGULAR] = 1.0 - vip_share;
+    class_weight[ADMISSION_VIP] = vip_share;
+    for (int i = 0; i < ADMISSION_CLASSES; i++) {
+        virtual_time[i] = 0;
+        class_stats[i] = Class_Admission_Stats();
+    }
+
+    if (pthread_mutex_init(&admission_mutex, nullptr)) {
+        perror("Bank error: pthread_mutex_init failed");
+    }
+    if (pthread_cond_init(&admission_cond, nullptr)) {
+        perror("Bank error: pthread_cond_init failed");
+    }
+}
+
+Admission_Controller::~Admission_Controller()
+{
+    pthread_mutex_destroy(&admission_mutex);
+    pthread_cond_destroy(&admission_cond);
+}
+
+int Admission_Controller::command_cost(const vector<string>& operation_words)
+{
+    if (operation_words.empty()) {
+        return 1;
+    }
+    switch (operation_words[0][0]) {
+        case 'O': case 'Q': case 'C': case 'R': case 'I':
+            return ADMISSION_WRITE_LOCK_COST;
+        default:
+            return 1;
+    }
+}
+
+bool Admission_Controller::rate_limited() const
+{
+    return rate > 0;
+}
+
+bool Admission_Controller::gated() const
+{
+    return slots > 0;
+}
+
+bool Admission_Controller::queue_full(size_t queued) const
+{
+    return queue_limit > 0 && queued >= static_cast<size_t>(queue_limit);
+}
+
+useconds_t Admission_Controller::throttle(int atm_id, int cost)
+{
+    if (!rate_limited() || atm_id < 0 || atm_id >= static_cast<int>(bucket_tokens.size())) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&admission_mutex);
+    long long now = admission_now_ns();
+    double& tokens = bucket_tokens[atm_id];
+    tokens = min(burst, tokens + (now - bucket_refill_ns[atm_id]) * rate / 1e9);
+    bucket_refill_ns[atm_id] = now;
+
+    // The command always takes its tokens; a debt is paid off by waiting
+    tokens -= cost;
+    useconds_t wait = tokens < 0 ? static_cast<useconds_t>(-tokens / rate * 1e6) : 0;
+    pthread_mutex_unlock(&admission_mutex);
+    return wait;
+}
+
+void Admission_Controller::record_throttle_wait(int atm_id, useconds_t waited)
+{
+    pthread_mutex_lock(&admission_mutex);
+    atm_stats[atm_id].throttled++;
+    atm_stats[atm_id].throttle_wait_us += waited;
+    pthread_mutex_unlock(&admission_mutex);
+}
+
+// Hands free slots to the waiting class with the lowest virtual time; called with admission_mutex held
+void Admission_Controller::grant_slots()
+{
+    bool granted = false;
+    while (busy_slots < slots) {
+        int next_class = -1;
+        for (int c = 0; c < ADMISSION_CLASSES; c++) {
+            if (!waiters[c].empty() && (next_class == -1 || virtual_time[c] < virtual_time[next_class])) {
+                next_class = c;
+            }
+        }
+        if (next_class == -1) {
+            break;
+        }
+
+        Slot_Waiter* waiter = waiters[next_class].front();
+        waiters[next_class].pop_front();
+        waiter->granted = true;
+        busy_slots++;
+        last_virtual_time = virtual_time[next_class];
+        virtual_time[next_class] += 1.0 / class_weight[next_class];
+        granted = true;
+    }
+    if (granted) {
+        pthread_cond_broadcast(&admission_cond);
+    }
+}
+
+int Admission_Controller::enter(int admission_class, int atm_id)
+{
+    pthread_mutex_lock(&admission_mutex);
+    Class_Admission_Stats& stats = class_stats[admission_class];
+
+    if (!gated()) {
+        stats.admitted++;
+        atm_stats[atm_id].admitted++;
+        pthread_mutex_unlock(&admission_mutex);
+        return ADMISSION_ADMITTED;
+    }
+
+    if (busy_slots >= slots && queue_full(waiters[admission_class].size())) {
+        stats.shed++;
+        pthread_mutex_unlock(&admission_mutex);
+        return ADMISSION_SHED;
+    }
+
+    // A class coming back from idle starts at the current virtual time, without saved up credit
+    if (waiters[admission_class].empty()) {
+        virtual_time[admission_class] = max(virtual_time[admission_class], last_virtual_time);
+    }
+
+    Slot_Waiter waiter = {admission_class, false};
+    waiters[admission_class].push_back(&waiter);
+    long long start = admission_now_ns();
+    grant_slots();
+    if (!waiter.granted) {
+        stats.waited++;
+        while (!waiter.granted) {
+            pthread_cond_wait(&admission_cond, &admission_mutex);
+        }
+        long long waited_us = (admission_now_ns() - start) / 1000;
+        stats.wait_us += waited_us;
+        stats.max_wait_us = max(stats.max_wait_us, waited_us);
+    }
+    stats.admitted++;
+    atm_stats[atm_id].admitted++;
+    pthread_mutex_unlock(&admission_mutex);
+    return ADMISSION_ADMITTED;
+}
+
+void Admission_Controller::leave()
+{
+    if (!gated()) {
+        return;
+    }
+
+    pthread_mutex_lock(&admission_mutex);
+    busy_slots--;
+    grant_slots();
+    pthread_mutex_unlock(&admission_mutex);
+}
+
+void Admission_Controller::record_deferred(int atm_id)
+{
+    pthread_mutex_lock(&admission_mutex);
+    atm_stats[atm_id].deferred++;
+    pthread_mutex_unlock(&admission_mutex);
+}
+
+void Admission_Controller::record_shed(int atm_id)
+{
+    pthread_mutex_lock(&admission_mutex);
+    atm_stats[atm_id].shed++;
+    pthread_mutex_unlock(&admission_mutex);
+}
+
+void Admission_Controller::print_metrics(ostream& out)
+{
+    static const char* class_names[ADMISSION_CLASSES] = {"regular", "vip"};
+
+    pthread_mutex_lock(&admission_mutex);
+    for (size_t atm_id = 1; atm_id < atm_stats.size(); atm_id++) {
+        const Atm_Admission_Stats& stats = atm_stats[atm_id];
+        out << "Admission: ATM " << atm_id << " admitted " << stats.admitted << ", throttled " << stats.throttled
+            << " (" << stats.throttle_wait_us / 1000 << " ms), shed " << stats.shed << ", deferred " << stats.deferred << endl;
+    }
+    for (int c = 0; c < ADMISSION_CLASSES; c++) {
+        const Class_Admission_Stats& stats = class_stats[c];
+        out << "Admission: " << class_names[c] << " admitted " << stats.admitted << ", waited " << stats.waited
+            << ", mean wait " << fixed << setprecision(3) << (stats.waited ? stats.wait_us / 1000.0 / stats.waited : 0.0)
+            << " ms, max wait " << stats.max_wait_us / 1000.0 << " ms, shed " << stats.shed << endl;
+    }
+    out.unsetf(ios::floatfield);
+    pthread_mutex_unlock(&admission_mutex);
+}
@@ -0,0 +1,110 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <iostream>
+#include <pthread.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define ADMISSION_REGULAR 0
+#define ADMISSION_VIP 1
+#define ADMISSION_CLASSES 2
+
+#define ADMISSION_ADMITTED 0
+#define ADMISSION_SHED 1       // the class's wait queue is full, the command is dropped
+
+#define ADMISSION_WRITE_LOCK_COST 4 // tokens for O, Q, C and R, which take the bank write lock
+
+struct Atm_Admission_Stats {
+    long long admitted;
+    long long throttled;          // commands that waited for tokens
+    long long throttle_wait_us;
+    long long shed;
+    long long deferred;           // PERSISTENT commands parked for retry instead of shed
+};
+
+struct Class_Admission_Stats {
+    long long admitted;
+    long long waited;             // commands that queued for an execution slot
+    long long wait_us;
+    long long max_wait_us;
+    long long shed;
+};
+
+/*
+ * Scheduler layer between the ATM command streams and the Bank.
+ *
+ * Rate limits: every ATM has a token bucket of `burst` tokens refilled at
+ * `rate` tokens per second. A command costs one token, or
+ * ADMISSION_WRITE_LOCK_COST if it takes the bank write lock, so an ATM looping
+ * on open/delete cannot monopolize that lock. A command that overdraws the bucket
+ * waits in its own ATM thread until the debt is repaid.
+ *
+ * Fair share: when `slots` > 0, at most that many commands execute at once.
+ * Free slots go to the waiting class (regular or VIP) with the lowest virtual
+ * time; a class's virtual time advances by 1/weight per admitted command, so
+ * while both classes wait VIP gets at most vip_share of the slots. An idle
+ * class does not bank credit, and a class alone may use every slot.
+ *
+ * Shedding: a command that finds queue_limit commands of its class already
+ * waiting for a slot is not admitted; the caller sheds or defers it.
+ */
+class Admission_Controller {
+private:
+    struct Slot_Waiter {
+        int admission_class;
+        bool granted;
+    };
+
+    double rate;
+    double burst;
+    int slots;
+    int queue_limit;
+    double class_weight[ADMISSION_CLASSES];
+
+    pthread_mutex_t admission_mutex;
+    pthread_cond_t admission_cond;
+    vector<double> bucket_tokens;
+    vector<long long> bucket_refill_ns;
+    vector<Atm_Admission_Stats> atm_stats;
+
+    int busy_slots;
+    double virtual_time[ADMISSION_CLASSES];
+    double last_virtual_time;     // virtual time of the latest grant
+    deque<Slot_Waiter*> waiters[ADMISSION_CLASSES];
+    Class_Admission_Stats class_stats[ADMISSION_CLASSES];
+
+    void grant_slots();
+
+public:
+    // rate <= 0 turns the rate limits off, slots <= 0 the fair share gate
+    Admission_Controller(int atm_count, double rate, double burst, int slots, double vip_share, int queue_limit);
+    ~Admission_Controller();
+
+    // Token cost of a command
+    static int command_cost(const vector<string>& operation_words);
+
+    // Takes the command's tokens; returns the microseconds the ATM must wait first
+    useconds_t throttle(int atm_id, int cost);
+    void record_throttle_wait(int atm_id, useconds_t waited);
+
+    // Waits for an execution slot; ADMISSION_SHED if the class's queue is full
+    int enter(int admission_class, int atm_id);
+    void leave();
+    void record_deferred(int atm_id);
+    void record_shed(int atm_id);
+    // True if a queue already holding `queued` commands is full
+    bool queue_full(size_t queued) const;
+
+    bool rate_limited() const;
+    bool gated() const;
+
+    // One line per ATM and per class
+    void print_metrics(ostream& out);
+};
+
+#endif
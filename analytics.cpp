@@ -0,0 +1,209 @@
+#include "analytics.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+
+// Below this many accounts a scan runs on the calling thread
+#define ANALYTICS_PARALLEL_THRESHOLD 65536
+// Balances per cache block in the distribution scan
+#define ANALYTICS_BLOCK 4096
+
+template <typename Chunk_Function>
+struct Analytics_Chunk {
+    Chunk_Function* function;
+    int worker;
+    size_t begin;
+    size_t end;
+};
+
+template <typename Chunk_Function>
+static void* analytics_chunk_thread(void* arg)
+{
+    Analytics_Chunk<Chunk_Function>* chunk = static_cast<Analytics_Chunk<Chunk_Function>*>(arg);
+    (*chunk->function)(chunk->worker, chunk->begin, chunk->end);
+    return nullptr;
+}
+
+/* Splits [0, count) into one contiguous chunk per worker; returns the worker count used */
+template <typename Chunk_Function>
+static int parallel_chunks(size_t count, int threads, Chunk_Function function)
+{
+    int workers = count < ANALYTICS_PARALLEL_THRESHOLD || threads < 1 ? 1 : threads;
+    if (workers == 1) {
+        function(0, 0, count);
+        return 1;
+    }
+
+    vector<Analytics_Chunk<Chunk_Function>> chunks(workers);
+    vector<pthread_t> thread_ids(workers);
+    for (int i = 0; i < workers; i++) {
+        chunks[i].function = &function;
+        chunks[i].worker = i;
+        chunks[i].begin = count * i / workers;
+        chunks[i].end = count * (i + 1) / workers;
+        if (pthread_create(&thread_ids[i], nullptr, analytics_chunk_thread<Chunk_Function>, &chunks[i])) {
+            perror("Bank error: pthread_create failed for analytics thread");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < workers; i++) {
+        if (pthread_join(thread_ids[i], nullptr)) {
+            perror("Bank error: pthread_join failed for analytics thread");
+            exit(1);
+        }
+    }
+    return workers;
+}
+
+static int worker_count(size_t count, int threads)
+{
+    return count < ANALYTICS_PARALLEL_THRESHOLD || threads < 1 ? 1 : threads;
+}
+
+long long total_balance(const Balance_Snapshot& snapshot, int threads)
+{
+    const int* balances = snapshot.balances.data();
+    vector<long long> partial(worker_count(snapshot.balances.size(), threads), 0);
+
+    parallel_chunks(snapshot.balances.size(), threads, [&](int worker, size_t begin, size_t end) {
+        long long sum = 0;
+        for (size_t i = begin; i < end; i++) {
+            sum += balances[i];
+        }
+        partial[worker] = sum;
+    });
+
+    long long total = 0;
+    for (long long sum : partial) {
+        total += sum;
+    }
+    return total;
+}
+
+long long count_below(const Balance_Snapshot& snapshot, int threshold, int threads)
+{
+    const int* balances = snapshot.balances.data();
+    vector<long long> partial(worker_count(snapshot.balances.size(), threads), 0);
+
+    parallel_chunks(snapshot.balances.size(), threads, [&](int worker, size_t begin, size_t end) {
+        long long count = 0;
+        for (size_t i = begin; i < end; i++) {
+            count += balances[i] < threshold; // branch free, vectorizes
+        }
+        partial[worker] = count;
+    });
+
+    long long count = 0;
+    for (long long part : partial) {
+        count += part;
+    }
+    return count;
+}
+
+void balance_distribution(const Balance_Snapshot& snapshot, const vector<int>& bucket_bounds,
+                          Balance_Distribution& distribution, int threads)
+{
+    const int* balances = snapshot.balances.data();
+    size_t buckets = bucket_bounds.size() + 1;
+    int workers = worker_count(snapshot.balances.size(), threads);
+    vector<long long> sums(workers, 0);
+    vector<int> mins(workers, INT_MAX);
+    vector<int> maxes(workers, INT_MIN);
+    vector<vector<long long>> counts(workers, vector<long long>(buckets, 0));
+
+    parallel_chunks(snapshot.balances.size(), threads, [&](int worker, size_t begin, size_t end) {
+        long long sum = 0;
+        int low = INT_MAX;
+        int high = INT_MIN;
+        for (size_t i = begin; i < end; i++) {
+            sum += balances[i];
+            low = min(low, balances[i]);
+            high = max(high, balances[i]);
+        }
+        // Per bound, a branch free count of balances at or above it; done block
+        // by block so every pass over a block hits cache. Bucket b then holds
+        // at_or_above[b - 1] - at_or_above[b].
+        vector<long long> at_or_above(bucket_bounds.size(), 0);
+        for (size_t block = begin; block < end; block += ANALYTICS_BLOCK) {
+            size_t block_end = min(end, block + ANALYTICS_BLOCK);
+            for (size_t b = 0; b < bucket_bounds.size(); b++) {
+                int bound = bucket_bounds[b];
+                long long count = 0;
+                for (size_t i = block; i < block_end; i++) {
+                    count += balances[i] >= bound;
+                }
+                at_or_above[b] += count;
+            }
+        }
+        vector<long long>& bucket_counts = counts[worker];
+        long long previous = end - begin;
+        for (size_t b = 0; b < bucket_bounds.size(); b++) {
+            bucket_counts[b] = previous - at_or_above[b];
+            previous = at_or_above[b];
+        }
+        bucket_counts[bucket_bounds.size()] = previous;
+        sums[worker] = sum;
+        mins[worker] = low;
+        maxes[worker] = high;
+    });
+
+    distribution.accounts = snapshot.balances.size();
+    distribution.total = 0;
+    distribution.min_balance = INT_MAX;
+    distribution.max_balance = INT_MIN;
+    distribution.bucket_bounds = bucket_bounds;
+    distribution.bucket_counts.assign(buckets, 0);
+    for (int i = 0; i < workers; i++) {
+        distribution.total += sums[i];
+        distribution.min_balance = min(distribution.min_balance, mins[i]);
+        distribution.max_balance = max(distribution.max_balance, maxes[i]);
+        for (size_t b = 0; b < buckets; b++) {
+            distribution.bucket_counts[b] += counts[i][b];
+        }
+    }
+    if (distribution.accounts == 0) {
+        distribution.min_balance = 0;
+        distribution.max_balance = 0;
+    }
+    distribution.mean_balance = distribution.accounts == 0 ? 0.0 : static_cast<double>(distribution.total) / distribution.accounts;
+}
+
+/* Richest first; equal balances by lower account id */
+static bool richer(const pair<int, int>& a, const pair<int, int>& b)
+{
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
+}
+
+void top_k_accounts(const Balance_Snapshot& snapshot, size_t k, vector<pair<int, int>>& top, int threads)
+{
+    const int* balances = snapshot.balances.data();
+    const int* account_ids = snapshot.account_ids.data();
+    vector<vector<pair<int, int>>> partial(worker_count(snapshot.balances.size(), threads));
+
+    // Every worker keeps a heap of its own k best; the heap top is the worst of them
+    parallel_chunks(snapshot.balances.size(), threads, [&](int worker, size_t begin, size_t end) {
+        vector<pair<int, int>>& heap = partial[worker];
+        for (size_t i = begin; i < end; i++) {
+            pair<int, int> account(account_ids[i], balances[i]);
+            if (heap.size() < k) {
+                heap.push_back(account);
+                push_heap(heap.begin(), heap.end(), richer);
+            } else if (k > 0 && richer(account, heap.front())) {
+                pop_heap(heap.begin(), heap.end(), richer);
+                heap.back() = account;
+                push_heap(heap.begin(), heap.end(), richer);
+            }
+        }
+    });
+
+    top.clear();
+    for (const vector<pair<int, int>>& heap : partial) {
+        top.insert(top.end(), heap.begin(), heap.end());
+    }
+    sort(top.begin(), top.end(), richer);
+    if (top.size() > k) {
+        top.resize(k);
+    }
+}
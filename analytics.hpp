@@ -0,0 +1,40 @@
+#ifndef ANALYTICS_H
+#define ANALYTICS_H
+
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+/*
+ * Column copy of the account book, taken by Bank::snapshot_balances one
+ * account at a time. Each balance is exact, but the copy is not atomic across
+ * accounts: a transfer running during the copy may show on one side only, and
+ * the total can be off by its amount. The aggregates below only read the
+ * snapshot and take no bank locks, so they never hold up ATM traffic. Large scans are split across
+ * threads; the inner loops are plain column loops the compiler can vectorize.
+ */
+struct Balance_Snapshot {
+    vector<int> account_ids;  // ascending
+    vector<int> balances;     // balances[i] belongs to account_ids[i]
+    int bank_balance;
+};
+
+struct Balance_Distribution {
+    long long accounts;
+    long long total;
+    int min_balance;
+    int max_balance;
+    double mean_balance;
+    vector<int> bucket_bounds;      // ascending upper bounds, exclusive
+    vector<long long> bucket_counts; // bucket_bounds.size() + 1 buckets, the last is open ended
+};
+
+long long total_balance(const Balance_Snapshot& snapshot, int threads);
+long long count_below(const Balance_Snapshot& snapshot, int threshold, int threads);
+void balance_distribution(const Balance_Snapshot& snapshot, const vector<int>& bucket_bounds,
+                          Balance_Distribution& distribution, int threads);
+// The k richest accounts as (account id, balance), richest first, ties by lower id
+void top_k_accounts(const Balance_Snapshot& snapshot, size_t k, vector<pair<int, int>>& top, int threads);
+
+#endif
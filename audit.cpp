@@ -0,0 +1,221 @@
+#include "audit.hpp"
+#include "bank.hpp"
+#include "lifecycle.hpp"
+#include <atomic>
+#include <vector>
+#include <sstream>
+
+/* One thread's counters; owned by the registry so they outlive the thread */
+struct Audit_Thread {
+    atomic<unsigned> sequence;   // odd while the owner publishes
+    atomic<long long> flows[AUDIT_FLOWS];
+    atomic<long long> ledger;
+    // Owner only: the running operation's totals, not yet published
+    long long pending_flows[AUDIT_FLOWS];
+    long long pending_ledger;
+    bool pending;
+    char padding[CACHE_LINE_SIZE]; // keeps the next thread's counters off these lines
+};
+
+bool audit_enabled = false;
+useconds_t audit_interval = 0;
+
+static pthread_mutex_t audit_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+// Never destroyed, so the counters stay reachable at exit
+static vector<Audit_Thread*>& audit_threads = *new vector<Audit_Thread*>();
+static thread_local Audit_Thread* current_thread = nullptr;
+
+static Audit_Thread* this_thread()
+{
+    if (current_thread == nullptr) {
+        Audit_Thread* thread = new Audit_Thread();
+        thread->sequence.store(0, memory_order_relaxed);
+        for (int i = 0; i < AUDIT_FLOWS; i++) {
+            thread->flows[i].store(0, memory_order_relaxed);
+            thread->pending_flows[i] = 0;
+        }
+        thread->ledger.store(0, memory_order_relaxed);
+        thread->pending_ledger = 0;
+        thread->pending = false;
+
+        pthread_mutex_lock(&audit_threads_lock);
+        audit_threads.push_back(thread);
+        pthread_mutex_unlock(&audit_threads_lock);
+        current_thread = thread;
+    }
+    return current_thread;
+}
+
+void audit_start(useconds_t interval)
+{
+    audit_interval = interval;
+    audit_enabled = true;
+}
+
+void audit_record_flow(int kind, long long amount)
+{
+    Audit_Thread* thread = this_thread();
+    thread->pending_flows[kind] += amount;
+    thread->pending = true;
+}
+
+void audit_record_change(long long delta)
+{
+    Audit_Thread* thread = this_thread();
+    thread->pending_ledger += delta;
+    thread->pending = true;
+}
+
+void audit_publish()
+{
+    Audit_Thread* thread = current_thread;
+    if (thread == nullptr || !thread->pending) {
+        return;
+    }
+
+    // Single writer seqlock, as in Seqlock_Lock: the auditor never sees half an operation
+    thread->sequence.fetch_add(1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int i = 0; i < AUDIT_FLOWS; i++) {
+        if (thread->pending_flows[i] != 0) {
+            thread->flows[i].store(thread->flows[i].load(memory_order_relaxed) + thread->pending_flows[i], memory_order_relaxed);
+            thread->pending_flows[i] = 0;
+        }
+    }
+    thread->ledger.store(thread->ledger.load(memory_order_relaxed) + thread->pending_ledger, memory_order_relaxed);
+    thread->pending_ledger = 0;
+    thread->pending = false;
+    thread->sequence.fetch_add(1, memory_order_release);
+}
+
+long long Audit_Totals::expected() const
+{
+    return flows[AUDIT_OPENED] - flows[AUDIT_CLOSED] + flows[AUDIT_DEPOSITED] - flows[AUDIT_WITHDRAWN] + flows[AUDIT_ADJUSTED];
+}
+
+void audit_collect(Audit_Totals& totals)
+{
+    for (int i = 0; i < AUDIT_FLOWS; i++) {
+        totals.flows[i] = 0;
+    }
+    totals.ledger = 0;
+
+    // Each thread's counters balance on their own, so they need not be read at one instant
+    pthread_mutex_lock(&audit_threads_lock);
+    for (Audit_Thread* thread : audit_threads) {
+        long long flows[AUDIT_FLOWS];
+        long long ledger;
+        unsigned before;
+        do {
+            before = thread->sequence.load(memory_order_acquire);
+            for (int i = 0; i < AUDIT_FLOWS; i++) {
+                flows[i] = thread->flows[i].load(memory_order_relaxed);
+            }
+            ledger = thread->ledger.load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+        } while ((before & 1) || thread->sequence.load(memory_order_relaxed) != before);
+
+        for (int i = 0; i < AUDIT_FLOWS; i++) {
+            totals.flows[i] += flows[i];
+        }
+        totals.ledger += ledger;
+    }
+    pthread_mutex_unlock(&audit_threads_lock);
+}
+
+Balance_Auditor::Balance_Auditor(Bank* bank, const string& name)
+    : bank(bank), name(name), lifecycle(new Bank_Lifecycle(0)), reported_drift(0), checks(0), violations(0)
+{
+}
+
+Balance_Auditor::~Balance_Auditor()
+{
+    delete lifecycle;
+}
+
+void Balance_Auditor::start()
+{
+    if (pthread_create(&thread, nullptr, run, this)) {
+        perror("Bank error: pthread_create failed for audit thread");
+        exit(1);
+    }
+}
+
+void* Balance_Auditor::run(void* arg)
+{
+    Balance_Auditor* auditor = static_cast<Balance_Auditor*>(arg);
+    trace_thread_name("audit");
+    while (!auditor->lifecycle->wait_for_termination(audit_interval)) {
+        auditor->check();
+    }
+    return nullptr;
+}
+
+void Balance_Auditor::report(const string& text)
+{
+    cerr << "Bank error: audit of " << name << " " << text << endl;
+    write_to_log_file("Bank: audit of " + name + " " + text);
+}
+
+bool Balance_Auditor::check()
+{
+    Audit_Totals totals;
+    audit_collect(totals);
+    checks++;
+
+    // A drift is reported once when it appears and again whenever it changes
+    long long drift = totals.ledger - totals.expected();
+    if (drift == reported_drift) {
+        return drift == 0;
+    }
+    reported_drift = drift;
+
+    stringstream text;
+    if (drift == 0) {
+        text << "recovered - the ledger balances again at " << totals.ledger << " $";
+    } else {
+        violations++;
+        text << "failed - balance changes sum to " << totals.ledger << " $ but opens " << totals.flows[AUDIT_OPENED]
+             << ", closes " << totals.flows[AUDIT_CLOSED] << ", deposits " << totals.flows[AUDIT_DEPOSITED]
+             << ", withdrawals " << totals.flows[AUDIT_WITHDRAWN] << " and rollbacks " << totals.flows[AUDIT_ADJUSTED]
+             << " account for " << totals.expected() << " $";
+    }
+    report(text.str());
+    return drift == 0;
+}
+
+bool Balance_Auditor::stop()
+{
+    lifecycle->request_termination();
+    pthread_join(thread, nullptr);
+    check();
+
+    // Nothing runs any more, so the balances can be summed directly
+    vector<pair<int, int>> balances;
+    int bank_balance;
+    bank->get_balances(balances, &bank_balance);
+    long long actual = bank_balance;
+    for (const pair<int, int>& balance : balances) {
+        actual += balance.second;
+    }
+
+    Audit_Totals totals;
+    audit_collect(totals);
+    if (actual != totals.ledger) {
+        stringstream text;
+        text << "failed - the accounts and the bank hold " << actual << " $ but the ledger says " << totals.ledger << " $";
+        violations++;
+        report(text.str());
+    }
+    return violations == 0;
+}
+
+unsigned long long Balance_Auditor::get_checks() const
+{
+    return checks;
+}
+
+unsigned long long Balance_Auditor::get_violations() const
+{
+    return violations;
+}
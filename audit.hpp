@@ -0,0 +1,111 @@
+#ifndef AUDIT_H
+#define AUDIT_H
+
+#include <string>
+#include <pthread.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define AUDIT_OPENED 0     // initial amounts of opened accounts
+#define AUDIT_CLOSED 1     // balances paid out by closed accounts
+#define AUDIT_DEPOSITED 2
+#define AUDIT_WITHDRAWN 3
+#define AUDIT_ADJUSTED 4   // net change of rollbacks and restores
+#define AUDIT_FLOWS 5
+
+/*
+ * Optional balance invariant audit (--audit MS). Two running totals are kept
+ * in per-thread counters:
+ *
+ *   flows   what the operations said they did: opens minus closes plus
+ *           deposits minus withdrawals plus rollback adjustments
+ *   ledger  every change actually made to an account balance, a deposit
+ *           stripe or bank_balance, measured where it is made
+ *
+ * A thread adds to private pending totals while it runs an operation and
+ * publishes them when the operation ends, under its own sequence counter; an
+ * operation moves money in one thread only (a combiner records the requests it
+ * applies), so every published pair balances on its own. The auditor thread
+ * sums the published counters without taking any bank or account lock and
+ * reports as soon as the ledger drifts from the flows. When it stops, the
+ * bank is idle and the ledger is also checked against the balances themselves.
+ *
+ * Disabled, every hook is a test of audit_enabled.
+ */
+
+extern bool audit_enabled;
+extern useconds_t audit_interval;
+
+// Turns the hooks on; call before the audited threads start
+void audit_start(useconds_t interval);
+
+void audit_record_flow(int kind, long long amount);
+void audit_record_change(long long delta);
+void audit_publish();
+
+// An operation's flow of money into or out of the bank
+inline void audit_flow(int kind, long long amount) {
+    if (audit_enabled) {
+        audit_record_flow(kind, amount);
+    }
+}
+
+// A change of an account balance, a deposit stripe or bank_balance
+inline void audit_change(long long delta) {
+    if (audit_enabled) {
+        audit_record_change(delta);
+    }
+}
+
+// Ends the calling thread's operation: its pending totals become visible to the auditor
+inline void audit_commit() {
+    if (audit_enabled) {
+        audit_publish();
+    }
+}
+
+struct Audit_Totals {
+    long long flows[AUDIT_FLOWS];
+    long long ledger;
+
+    // Money the flows say the bank holds
+    long long expected() const;
+};
+
+// Sum of every thread's published counters
+void audit_collect(Audit_Totals& totals);
+
+class Bank;
+class Bank_Lifecycle;
+
+/* The auditor thread of one bank (the bank of this process, or of a partition) */
+class Balance_Auditor {
+private:
+    Bank* bank;
+    string name;
+    Bank_Lifecycle* lifecycle;
+    pthread_t thread;
+    long long reported_drift;   // last drift reported; 0 while the ledger balances
+    unsigned long long checks;
+    unsigned long long violations;
+
+    static void* run(void* arg);
+    // Writes to stderr and the log; text starts with "failed - " or "recovered - "
+    void report(const string& text);
+
+public:
+    Balance_Auditor(Bank* bank, const string& name);
+    ~Balance_Auditor();
+
+    void start();
+    // Compares the published ledger with the flows; false on a drift
+    bool check();
+    // Stops the thread and checks once more, also against the bank's balances;
+    // call once no operation runs. False if any check failed.
+    bool stop();
+    unsigned long long get_checks() const;
+    unsigned long long get_violations() const;
+};
+
+#endif
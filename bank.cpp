@@ -1,494 +1,1363 @@
-#include "bank.hpp"
-
-pthread_mutex_t log_file_lock = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
-Bank* Bank::bank_instance = nullptr;
-
-Bank::Bank() : bank_balance(0), read_count(0) {
-    // Initializing mutexes for read and write locks
-    if (pthread_mutex_init(&(this->read_lock_mutex), nullptr)) {
-        perror("Bank error: pthread_mutex_init failed");
-    }
-
-    if (pthread_mutex_init(&(this->write_lock_mutex), nullptr)) {
-        perror("Bank error: pthread_mutex_init failed");
-    }
-    pthread_mutex_init(&status_mutex, nullptr);
-    pthread_mutex_init(&vip_queue_mutex, nullptr);
-}
-
-Bank::~Bank() {
-    // Destroying mutexes for read and write locks
-    if (pthread_mutex_destroy(&(this->read_lock_mutex))) {
-        perror("Bank error: pthread_mutex_destroy failed");
-    }
-
-    if (pthread_mutex_destroy(&(this->write_lock_mutex))) {
-        perror("Bank error: pthread_mutex_destroy failed");
-    }
-    pthread_mutex_destroy(&status_mutex);
-    pthread_mutex_destroy(&vip_queue_mutex);
-}
-
-void Bank::bank_read_lock() {
-    if (pthread_mutex_lock(&(this->read_lock_mutex))) {
-        perror("Bank error: pthread_mutex_lock failed");
-        exit(1);
-    }
-
-    read_count++;
-    if (read_count == 1) {
-        if (pthread_mutex_lock(&(this->write_lock_mutex))) {
-            perror("Bank error: pthread_mutex_lock failed");
-            exit(1);
-        }
-    }
-
-    if (pthread_mutex_unlock(&(this->read_lock_mutex))) {
-        perror("Bank error: pthread_mutex_unlock failed");
-        exit(1);
-    }
-}
-
-void Bank::bank_read_unlock() {
-    if (pthread_mutex_lock(&(this->read_lock_mutex))) {
-        perror("Bank error: pthread_mutex_lock failed");
-        exit(1);
-    }
-
-    read_count--;
-    if (read_count == 0) {
-        if (pthread_mutex_unlock(&(this->write_lock_mutex))) {
-            perror("Bank error: pthread_mutex_unlock failed");
-            exit(1);
-        }
-    }
-
-    if (pthread_mutex_unlock(&(this->read_lock_mutex))) {
-        perror("Bank error: pthread_mutex_unlock failed");
-        exit(1);
-    }
-}
-
-void Bank::bank_write_lock() {
-    if (pthread_mutex_lock(&(this->write_lock_mutex))) {
-        perror("Bank error: pthread_mutex_lock failed");
-        exit(1);
-    }
-}
-
-void Bank::bank_write_unlock() {
-    if (pthread_mutex_unlock(&(this->write_lock_mutex))) {
-        perror("Bank error: pthread_mutex_unlock failed");
-        exit(1);
-    }
-}
-
-int Bank::create_account(int account_id, string password, int initial_amount, int atm_id) {
-    bank_write_lock();
-    stringstream log_line;
-
-    if (is_account_exist(account_id) != ACCOUNT_NOT_EXIST) {
-        sleep(1);
-        log_line << "Error " << atm_id << ": Your transaction failed - account with the same id exists";
-        write_to_log_file(log_line.str());
-
-        bank_write_unlock();
-        return ACCOUNT_EXIST;
-    }
-
-    Account a(account_id, password, initial_amount);
-    this->accounts.push_back(a);
-    sort(accounts.begin(), accounts.end());
-
-    sleep(1);
-    log_line << atm_id << ": New account id is " << account_id << " with password " << password << " and initial balance " << initial_amount;
-    write_to_log_file(log_line.str());
-
-    bank_write_unlock();
-    return SUCCESS;
-}
-
-int Bank::delete_account(int account_id, string password, int* balance, int atm_id) {
-    bank_write_lock();
-    stringstream log_line;
-
-    int index = is_account_exist(account_id);
-    if (index == ACCOUNT_NOT_EXIST) {
-        sleep(1);
-        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
-        write_to_log_file(log_line.str());
-
-        bank_write_unlock();
-        return ACCOUNT_NOT_EXIST;
-    }
-
-    int status = accounts[index].get_balance_no_print(password, balance, atm_id);
-    if (status == SUCCESS) {
-        accounts.erase(accounts.begin() + index);
-        log_line << atm_id << ": Account " << account_id << " is now closed. Balance was " << *balance;
-        write_to_log_file(log_line.str());
-
-        bank_write_unlock();
-        return status;
-    } else {
-        log_line << "Error " << atm_id << ": Your transaction failed - password for account id " << account_id << " is incorrect";
-        write_to_log_file(log_line.str());
-
-        bank_write_unlock();
-        return status;
-    }
-}
-
-int Bank::deposit(int account_id, string password, int amount, int* new_balance, int atm_id) {
-    bank_read_lock();
-    int index = is_account_exist(account_id);
-
-    if (index == ACCOUNT_NOT_EXIST) {
-        sleep(1);
-        stringstream log_line;
-        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
-        write_to_log_file(log_line.str());
-
-        bank_read_unlock();
-        return ACCOUNT_NOT_EXIST;
-    }
-
-    int status = accounts[index].deposit(amount, password, new_balance, atm_id);
-
-    bank_read_unlock();
-    return status;
-}
-
-int Bank::withdraw(int account_id, string password, int amount, int* new_balance, int atm_id) {
-    bank_read_lock();
-    int index = is_account_exist(account_id);
-
-    if (index == ACCOUNT_NOT_EXIST) {
-        sleep(1);
-        stringstream log_line;
-        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
-        write_to_log_file(log_line.str());
-
-        bank_read_unlock();
-        return ACCOUNT_NOT_EXIST;
-    }
-
-    int status = accounts[index].withdraw(amount, password, new_balance, atm_id);
-
-    bank_read_unlock();
-    return status;
-}
-
-int Bank::get_balance(int account_id, string password, int* new_balance, int atm_id) {
-    bank_read_lock();
-    int index = is_account_exist(account_id);
-
-    if (index == ACCOUNT_NOT_EXIST) {
-        sleep(1);
-        stringstream log_line;
-        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
-        write_to_log_file(log_line.str());
-
-        bank_read_unlock();
-        return ACCOUNT_NOT_EXIST;
-    }
-
-    int status = accounts[index].get_balance(password, new_balance, atm_id);
-
-    bank_read_unlock();
-    return status;
-}
-
-int Bank::transfer_money(int account_id, string password, int target_account, int amount, int* new_balance, int* new_target_balance, int atm_id) {
-    bank_read_lock();
-    stringstream log_line;
-
-    int index = is_account_exist(account_id);
-    if (index == ACCOUNT_NOT_EXIST) {
-        sleep(1);
-        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
-        write_to_log_file(log_line.str());
-
-        bank_read_unlock();
-        return ACCOUNT_NOT_EXIST;
-    }
-    int target_index = is_account_exist(target_account);
-    if (target_index == ACCOUNT_NOT_EXIST) {
-        sleep(1);
-        log_line << "Error " << atm_id << ": Your transaction failed - account id " << target_account << " does not exist";
-        write_to_log_file(log_line.str());
-
-        bank_read_unlock();
-        return TARGET_ACCOUNT_NOT_EXIST;
-    }
-
-    if (!accounts[index].check_password(password)) {
-        sleep(1);
-        log_line << "Error " << atm_id << ": Your transaction failed - password for account id " << account_id << " is incorrect";
-        write_to_log_file(log_line.str());
-
-        bank_read_unlock();
-        return WRONG_PASSWORD;
-    }
-
-    if (index < target_index) {
-        accounts[index].account_write_lock();
-        accounts[target_index].account_write_lock();
-    }
-    else {
-        accounts[target_index].account_write_lock();
-        accounts[index].account_write_lock();
-    }
-
-    sleep(1);
-    int status = accounts[index].withdraw_without_lock(amount, new_balance);
-    accounts[target_index].deposit_without_lock(amount, new_target_balance);
-
-    if (status == NOT_ENOUGH_MONEY) {
-        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " balance is lower than " << amount;
-    }
-    else { // SUCCESS
-        log_line << atm_id << ": Transfer " << amount << " from account " << account_id << " to account " << target_account << " new account balance is " << *new_balance << " new target account balance is " << *new_target_balance;
-    }
-    write_to_log_file(log_line.str());
-
-    accounts[index].account_write_unlock();
-    accounts[target_index].account_write_unlock();
-
-    bank_read_unlock();
-    return status;
-}
-
-void Bank::commission() {
-    srand(static_cast<unsigned int>(time(nullptr)));
-    int commission_percentage = (rand() % 5) + 1;
-
-    bank_read_lock();
-
-    for (unsigned i = 0; i < accounts.size(); i++) {
-        int commission = accounts[i].commission(commission_percentage);
-        this->bank_balance += commission;
-    }
-
-    bank_read_unlock();
-}
-
-void Bank::print_status() {
-    bank_read_lock();
-    string print_out;
-
-    for (unsigned i = 0; i < accounts.size(); i++) {
-        print_out.append(accounts[i].print_status());
-        print_out.append("\n");
-    }
-
-    cout << "\033[2J";
-    cout << "\033[1;1H";
-    cout << "Current Bank Status" << endl;
-    cout << print_out;
-
-    bank_read_unlock();
-}
-
-int Bank::is_account_exist(int account_id) {
-    for (unsigned i = 0; i < accounts.size(); i++) {
-        if (accounts[i].get_id() == account_id) {
-            return i;
-        }
-    }
-    return ACCOUNT_NOT_EXIST;
-}
-
-bool Bank::close_atm(int source_atm_id, int target_atm_id) {
-    sleep(1);
-   if (target_atm_id > static_cast<int>(atm_files.size())) {
-       log_file << "Error " << source_atm_id << ": Your transaction failed – ATM ID " << target_atm_id << " does not exist" << endl;
-       return false;
-   }
-
-   if (atm_closed[target_atm_id - 1]) {
-       log_file << "Error " << source_atm_id << ": Your close operation failed – ATM ID " << target_atm_id << " is already in a closed state" << endl;
-       return false;
-   }
-
-   atm_closed[target_atm_id - 1] = true;
-    log_file << "Bank: ATM " << source_atm_id << " closed " << target_atm_id << " successfully" << endl;
-   return true;
-}
-
-
-void Bank::save_current_status() {
-    pthread_mutex_lock(&status_mutex);
-
-    Bank_Status current_status;
-    current_status.accounts = accounts; // accounts הוא וקטור החשבונות
-
-    statuses.push_back(current_status);
-
-    if (statuses.size() > 120) {
-        statuses.pop_front();
-    }
-
-    pthread_mutex_unlock(&status_mutex);
-}
-
-void Bank::rollback(int atm_id, int iterations) {
-    sleep(1);
-    pthread_mutex_lock(&status_mutex);
-
-    if (static_cast<size_t>(iterations) > statuses.size()) {
-        pthread_mutex_unlock(&status_mutex);
-        return;
-    }
-
-    Bank_Status target_status = statuses[statuses.size() - iterations];
-    accounts = target_status.accounts;
-
-    pthread_mutex_unlock(&status_mutex);
-
-    pthread_mutex_lock(&log_mutex);
-    log_file << atm_id << ": Rollback to " << iterations << " bank iterations ago was completed successfully" << endl;
-    pthread_mutex_unlock(&log_mutex);
-}
-
-
-void Bank::load_atms(std::string& atm_file_path) {
-    ifstream atm_file(atm_file_path);
-    string line;
-    while (getline(atm_file, line)) {
-        atm_files.push_back(line);
-    }
-}
-
-void Bank::set_atm_file (const string file_name) {
-    atm_files.push_back(file_name);
-}
-
- void Bank::set_atm_closed_to_false(int size){
-    for(int i =0; i<size; i++)
-    atm_closed.push_back (false);
- }
-
-void* Bank::vip_thread(void* arg) {
-    while (true) {
-        pthread_mutex_lock(&vip_queue_mutex);
-        if (!vip_queue.empty()) {
-            auto vip_command = vip_queue.back();
-            vip_queue.pop_back();
-            pthread_mutex_unlock(&vip_queue_mutex);
-
-            // Process the VIP command
-            // Use a function to execute the command (similar to the ATM threads)
-            // e.g., execute_command(vip_command.first);
-        } else {
-            pthread_mutex_unlock(&vip_queue_mutex);
-            usleep(500000);  // Sleep before checking the queue again
-        }
-    }
-    pthread_exit(nullptr);
-}
-
-void* Bank::atm_thread(void* arg) {
-    string operation_line = "some_operation"; // This should come from the ATM operations file
-    bool is_persistent = false;
-    int retry_count = 0;
-
-    while (true) {
-        if (is_persistent) {
-            bool success = false;
-            while (!success && retry_count < 2) {
-                // Try to execute the operation
-                // If failed, retry after waiting
-                success = true;  // Assume the command succeeds here (add actual logic)
-                if (!success) {
-                    retry_count++;
-                    usleep(100000);  // Wait before retrying
-                }
-            }
-            if (!success) {
-                cout << "Persistent command failed: " << operation_line << endl;
-            }
-        }
-
-        // Process normal ATM operations
-        // If command is VIP, add to VIP queue
-        if (operation_line.find("VIP") != string::npos) {
-            int priority = 90;  // Extract priority from operation_line, e.g., "VIP=90"
-            pthread_mutex_lock(&vip_queue_mutex);
-            vip_queue.push_back({operation_line, priority});
-            sort(vip_queue.begin(), vip_queue.end(), [](std::pair<std::string, int>& a, std::pair<std::string, int>& b) {
-               return a.second > b.second;
-           });
-            pthread_mutex_unlock(&vip_queue_mutex);
-        }
-    }
-    pthread_exit(nullptr);
-}
-
-
-void Bank::process_command(const Command& cmd, pthread_t atm_id) {
-    Command modified_cmd = cmd;
-    modified_cmd.parse_command();
-   
-    if (modified_cmd.is_persistent) {
-        process_persistent(modified_cmd, atm_id);
-    } else if (modified_cmd.vip_priority != -1) {
-        process_vip(modified_cmd, atm_id);
-    } else {
-        process_regular(modified_cmd, atm_id);
-    }
-}
-
-void Command::parse_command() {
-   if (command.find("VIP=") != string::npos) {
-       size_t pos = command.find("VIP=") + 4;
-       vip_priority = stoi(command.substr(pos));
-       command = command.substr(0, pos - 4);
-   }
-
-   if (command.find("PERSISTENT") != string::npos) {
-       is_persistent = true;
-       command = command.substr(0, command.find("PERSISTENT") - 1);
-   }
-}
-
-
-void Bank::process_persistent(const Command& cmd, pthread_t atm_id) {
-   bool success = false; 
-   int max_retries = 2;
-   int retry_count = 0;
-   while (!success && retry_count < max_retries) {
-       process_regular(cmd, atm_id);
-       retry_count++;
-   }
-}
-
-void Bank::process_vip(const Command& cmd, pthread_t atm_id) {
-    std::cout << "VIP command processing for " << cmd.get_command() << std::endl;
-    process_regular(cmd, atm_id);
-}
-
-void Bank::process_regular(const Command& cmd, pthread_t atm_id) {
-    std::cout << "Processing regular command: " << cmd.get_command() << std::endl;
-    // return success
-}
-
-bool Bank::process_operation(const std::string& operation_line) {
-    Command cmd(operation_line);
-    bool success = false;
-
-    if (cmd.has_persistent()) {
-        process_persistent(cmd, pthread_self());
-        success = true;
-    } else if (cmd.is_vip()) {
-        process_vip(cmd, pthread_self());
-        success = true;
-    } else {
-        process_regular(cmd, pthread_self());
-        success = true;
-    }
-
-    return success;
-}
-
+#include "bank.hpp"
+#include "replay.hpp"
+#include "import.hpp"
+#include <cctype>
+
+pthread_mutex_t log_file_lock = PTHREAD_MUTEX_INITIALIZER;
+Bank* Bank::bank_instance = nullptr;
+
+Bank::Bank() : bank_balance(0), commission_seed(static_cast<unsigned int>(time(nullptr))), rollback_window(ROLLBACK_ITERATIONS) {
+    pthread_mutex_init(&status_mutex, nullptr);
+    pthread_mutex_init(&pending_mutex, nullptr);
+    pthread_cond_init(&pending_cond, nullptr);
+    statuses.configure(rollback_window, STATUS_HISTORY_MEMORY, STATUS_HISTORY_FILE);
+}
+
+Bank::~Bank() {
+    pthread_mutex_destroy(&status_mutex);
+    pthread_mutex_destroy(&pending_mutex);
+    pthread_cond_destroy(&pending_cond);
+
+    for (auto& hot_account : hot_accounts) {
+        delete hot_account.second;
+    }
+}
+
+void Bank::bank_read_lock() {
+    Trace_Span span("bank lock");
+    this->lock.read_lock();
+}
+
+void Bank::bank_read_unlock() {
+    this->lock.read_unlock();
+}
+
+void Bank::bank_write_lock() {
+    Trace_Span span("bank lock");
+    this->lock.write_lock();
+}
+
+void Bank::bank_write_unlock() {
+    this->lock.write_unlock();
+}
+
+int Bank::create_account(int account_id, string password, int initial_amount, int atm_id) {
+    bank_write_lock();
+    stringstream log_line;
+
+    if (is_account_exist(account_id) != ACCOUNT_NOT_EXIST) {
+        inject_sleep(1);
+        log_line << "Error " << atm_id << ": Your transaction failed - account with the same id exists";
+        write_to_log_file(log_line.str());
+
+        bank_write_unlock();
+        return ACCOUNT_EXIST;
+    }
+
+    Account a(account_id, password, initial_amount);
+    if (striped_accounts.count(account_id)) {
+        a.enable_deposit_stripes();
+    }
+    audit_flow(AUDIT_OPENED, initial_amount);
+    audit_change(a.balance_without_lock());
+    // Accounts stay sorted by id; the later ones move up by one
+    this->accounts.insert(lower_bound(accounts.begin(), accounts.end(), a), move(a));
+
+    inject_sleep(1);
+    log_line << atm_id << ": New account id is " << account_id << " with password " << password << " and initial balance " << initial_amount;
+    write_to_log_file(log_line.str());
+
+    bank_write_unlock();
+    return SUCCESS;
+}
+
+int Bank::delete_account(int account_id, string password, int* balance, int atm_id) {
+    bank_write_lock();
+    wait_for_pending_credits(account_id);
+    stringstream log_line;
+
+    int index = is_account_exist(account_id);
+    if (index == ACCOUNT_NOT_EXIST) {
+        inject_sleep(1);
+        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
+        write_to_log_file(log_line.str());
+
+        bank_write_unlock();
+        return ACCOUNT_NOT_EXIST;
+    }
+
+    int status = accounts[index].get_balance_no_print(password, balance, atm_id);
+    if (status == SUCCESS) {
+        audit_flow(AUDIT_CLOSED, *balance);
+        audit_change(-accounts[index].balance_without_lock());
+        accounts.erase(accounts.begin() + index);
+        log_line << atm_id << ": Account " << account_id << " is now closed. Balance was " << *balance;
+        write_to_log_file(log_line.str());
+
+        bank_write_unlock();
+        return status;
+    } else {
+        log_line << "Error " << atm_id << ": Your transaction failed - password for account id " << account_id << " is incorrect";
+        write_to_log_file(log_line.str());
+
+        bank_write_unlock();
+        return status;
+    }
+}
+
+int Bank::deposit(int account_id, string password, int amount, int* new_balance, int atm_id) {
+    bank_read_lock();
+    int index = is_account_exist(account_id);
+
+    if (index == ACCOUNT_NOT_EXIST) {
+        inject_sleep(1);
+        stringstream log_line;
+        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return ACCOUNT_NOT_EXIST;
+    }
+
+    int status;
+    auto hot_account = hot_accounts.find(account_id);
+    if (hot_account != hot_accounts.end()) {
+        status = hot_account->second->submit(accounts[index], 'D', amount, password, new_balance, atm_id);
+    } else {
+        status = accounts[index].deposit(amount, password, new_balance, atm_id);
+    }
+
+    bank_read_unlock();
+    return status;
+}
+
+int Bank::withdraw(int account_id, string password, int amount, int* new_balance, int atm_id) {
+    bank_read_lock();
+    int index = is_account_exist(account_id);
+
+    if (index == ACCOUNT_NOT_EXIST) {
+        inject_sleep(1);
+        stringstream log_line;
+        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return ACCOUNT_NOT_EXIST;
+    }
+
+    int status;
+    auto hot_account = hot_accounts.find(account_id);
+    if (hot_account != hot_accounts.end()) {
+        status = hot_account->second->submit(accounts[index], 'W', amount, password, new_balance, atm_id);
+    } else {
+        status = accounts[index].withdraw(amount, password, new_balance, atm_id);
+    }
+
+    bank_read_unlock();
+    return status;
+}
+
+int Bank::get_balance(int account_id, string password, int* new_balance, int atm_id) {
+    bank_read_lock();
+    int index = is_account_exist(account_id);
+
+    if (index == ACCOUNT_NOT_EXIST) {
+        inject_sleep(1);
+        stringstream log_line;
+        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return ACCOUNT_NOT_EXIST;
+    }
+
+    int status = accounts[index].get_balance(password, new_balance, atm_id);
+
+    bank_read_unlock();
+    return status;
+}
+
+int Bank::transfer_money(int account_id, string password, int target_account, int amount, int* new_balance, int* new_target_balance, int atm_id) {
+    bank_read_lock();
+    stringstream log_line;
+
+    int index = is_account_exist(account_id);
+    if (index == ACCOUNT_NOT_EXIST) {
+        inject_sleep(1);
+        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return ACCOUNT_NOT_EXIST;
+    }
+    int target_index = is_account_exist(target_account);
+    if (target_index == ACCOUNT_NOT_EXIST) {
+        inject_sleep(1);
+        log_line << "Error " << atm_id << ": Your transaction failed - account id " << target_account << " does not exist";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return TARGET_ACCOUNT_NOT_EXIST;
+    }
+
+    if (!accounts[index].check_password(password)) {
+        inject_sleep(1);
+        log_line << "Error " << atm_id << ": Your transaction failed - password for account id " << account_id << " is incorrect";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return WRONG_PASSWORD;
+    }
+
+    if (index == target_index) { // Transfer to itself, the account is locked once
+        accounts[index].account_write_lock();
+    }
+    else if (index < target_index) {
+        accounts[index].account_write_lock();
+        accounts[target_index].account_write_lock();
+    }
+    else {
+        accounts[target_index].account_write_lock();
+        accounts[index].account_write_lock();
+    }
+
+    inject_sleep(1);
+    int status;
+    {
+        Trace_Span span("mutate");
+        status = accounts[index].withdraw_without_lock(amount, new_balance, atm_id);
+        if (status == SUCCESS) {
+            accounts[target_index].deposit_without_lock(amount, new_target_balance, atm_id);
+        }
+    }
+
+    if (status == NOT_ENOUGH_MONEY) {
+        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " balance is lower than " << amount;
+    }
+    else { // SUCCESS
+        log_line << atm_id << ": Transfer " << amount << " from account " << account_id << " to account " << target_account << " new account balance is " << *new_balance << " new target account balance is " << *new_target_balance;
+    }
+    write_to_log_file(log_line.str());
+
+    accounts[index].account_write_unlock();
+    if (index != target_index) {
+        accounts[target_index].account_write_unlock();
+    }
+
+    bank_read_unlock();
+    return status;
+}
+
+int Bank::import_accounts(const string& path, int atm_id) {
+    // Parsed, sorted and built before the bank lock is taken, so readers only
+    // wait for the merge
+    vector<Account_State> states;
+    size_t bad_line;
+    stringstream log_line;
+    if (!load_account_file(path, states, &bad_line)) {
+        inject_sleep(1);
+        if (bad_line == 0) {
+            log_line << "Error " << atm_id << ": Your transaction failed - account file " << path << " cannot be read";
+        } else {
+            log_line << "Error " << atm_id << ": Your transaction failed - line " << bad_line << " of account file " << path << " is not an account";
+        }
+        write_to_log_file(log_line.str());
+        return OPERATION_FAILED;
+    }
+
+    vector<Account> imported;
+    imported.reserve(states.size());
+    long long total = 0;
+    for (size_t i = 0; i < states.size(); i++) {
+        if (i > 0 && states[i].account_id == states[i - 1].account_id) {
+            inject_sleep(1);
+            log_line << "Error " << atm_id << ": Your transaction failed - account id " << states[i].account_id << " appears twice in account file " << path;
+            write_to_log_file(log_line.str());
+            return ACCOUNT_EXIST;
+        }
+        imported.emplace_back(states[i].account_id, states[i].password, states[i].balance);
+        total += states[i].balance;
+    }
+
+    bank_write_lock();
+
+    // All or nothing: the ids are checked against the bank before any account moves
+    size_t current = 0;
+    for (const Account& account : imported) {
+        while (current < accounts.size() && accounts[current].get_id() < account.get_id()) {
+            current++;
+        }
+        if (current < accounts.size() && accounts[current].get_id() == account.get_id()) {
+            inject_sleep(1);
+            log_line << "Error " << atm_id << ": Your transaction failed - account with the same id exists";
+            write_to_log_file(log_line.str());
+
+            bank_write_unlock();
+            return ACCOUNT_EXIST;
+        }
+    }
+
+    for (Account& account : imported) {
+        if (striped_accounts.count(account.get_id())) {
+            account.enable_deposit_stripes();
+        }
+    }
+    if (accounts.empty()) {
+        accounts.swap(imported);
+    } else {
+        vector<Account> merged;
+        merged.reserve(accounts.size() + imported.size());
+        merge(make_move_iterator(accounts.begin()), make_move_iterator(accounts.end()),
+              make_move_iterator(imported.begin()), make_move_iterator(imported.end()), back_inserter(merged));
+        accounts.swap(merged);
+    }
+    audit_flow(AUDIT_OPENED, total);
+    audit_change(total);
+
+    inject_sleep(1);
+    log_line << atm_id << ": Imported " << states.size() << " accounts from " << path << " with a total balance of " << total;
+    write_to_log_file(log_line.str());
+
+    bank_write_unlock();
+    return SUCCESS;
+}
+
+void Bank::wait_for_pending_credits(int account_id) {
+    pthread_mutex_lock(&pending_mutex);
+    while (pending_credits.count(account_id)) {
+        bank_write_unlock();
+        pthread_cond_wait(&pending_cond, &pending_mutex);
+        pthread_mutex_unlock(&pending_mutex);
+        bank_write_lock();
+        pthread_mutex_lock(&pending_mutex);
+    }
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+int Bank::reserve_credit(int account_id) {
+    bank_read_lock();
+    if (is_account_exist(account_id) == ACCOUNT_NOT_EXIST) {
+        bank_read_unlock();
+        return TARGET_ACCOUNT_NOT_EXIST;
+    }
+    pthread_mutex_lock(&pending_mutex);
+    pending_credits[account_id]++;
+    pthread_mutex_unlock(&pending_mutex);
+    bank_read_unlock();
+    return SUCCESS;
+}
+
+int Bank::transfer_out(int account_id, string password, int target_account, bool target_exists, int amount, int* new_balance, int atm_id) {
+    bank_read_lock();
+    stringstream log_line;
+
+    int index = is_account_exist(account_id);
+    if (index == ACCOUNT_NOT_EXIST) {
+        inject_sleep(1);
+        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return ACCOUNT_NOT_EXIST;
+    }
+    if (!target_exists) {
+        inject_sleep(1);
+        log_line << "Error " << atm_id << ": Your transaction failed - account id " << target_account << " does not exist";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return TARGET_ACCOUNT_NOT_EXIST;
+    }
+
+    if (!accounts[index].check_password(password)) {
+        inject_sleep(1);
+        log_line << "Error " << atm_id << ": Your transaction failed - password for account id " << account_id << " is incorrect";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return WRONG_PASSWORD;
+    }
+
+    accounts[index].account_write_lock();
+    inject_sleep(1);
+    int status;
+    {
+        Trace_Span span("mutate");
+        status = accounts[index].withdraw_without_lock(amount, new_balance, atm_id);
+    }
+    if (status == NOT_ENOUGH_MONEY) {
+        log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " balance is lower than " << amount;
+        write_to_log_file(log_line.str());
+    } else {
+        // To this partition's audit the debit is money leaving it
+        audit_flow(AUDIT_WITHDRAWN, amount);
+        audit_commit();
+    }
+    accounts[index].account_write_unlock();
+
+    bank_read_unlock();
+    return status;
+}
+
+int Bank::transfer_in(int account_id, int amount, int* new_balance, int atm_id) {
+    bank_read_lock();
+    // The reserved credit keeps the account from being closed
+    int index = is_account_exist(account_id);
+    accounts[index].account_write_lock();
+    {
+        Trace_Span span("mutate");
+        accounts[index].deposit_without_lock(amount, new_balance, atm_id);
+    }
+    audit_flow(AUDIT_DEPOSITED, amount);
+    audit_commit();
+    accounts[index].account_write_unlock();
+    bank_read_unlock();
+
+    release_credit(account_id);
+    return SUCCESS;
+}
+
+void Bank::release_credit(int account_id) {
+    pthread_mutex_lock(&pending_mutex);
+    auto pending = pending_credits.find(account_id);
+    if (pending != pending_credits.end() && --pending->second == 0) {
+        pending_credits.erase(pending);
+        pthread_cond_broadcast(&pending_cond);
+    }
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+void Bank::set_hot_account(int account_id) {
+    bank_write_lock();
+    if (hot_accounts.find(account_id) == hot_accounts.end()) {
+        hot_accounts[account_id] = new Account_Combiner();
+    }
+    bank_write_unlock();
+}
+
+void Bank::set_striped_account(int account_id) {
+    bank_write_lock();
+    striped_accounts.insert(account_id);
+    int index = is_account_exist(account_id);
+    if (index != ACCOUNT_NOT_EXIST) {
+        accounts[index].enable_deposit_stripes();
+    }
+    bank_write_unlock();
+}
+
+void Bank::commission() {
+    Trace_Span span("commission");
+    int commission_percentage = (rand_r(&commission_seed) % 5) + 1;
+
+    bank_read_lock();
+
+    for (unsigned i = 0; i < accounts.size(); i++) {
+        // Each account's commission commits separately, so it is recorded as its own operation
+        replay_begin_operation(0, "K " + to_string(commission_percentage) + " " + to_string(accounts[i].get_id()));
+        int commission = accounts[i].commission(commission_percentage);
+        this->bank_balance += commission;
+        audit_change(commission);
+        audit_commit();
+    }
+    replay_end_operation();
+
+    bank_read_unlock();
+}
+
+int Bank::commission_account(int account_id, int commission_percentage) {
+    bank_read_lock();
+
+    int index = is_account_exist(account_id);
+    if (index == ACCOUNT_NOT_EXIST) {
+        bank_read_unlock();
+        return ACCOUNT_NOT_EXIST;
+    }
+    int commission = accounts[index].commission(commission_percentage);
+    this->bank_balance += commission;
+    audit_change(commission);
+
+    bank_read_unlock();
+    return SUCCESS;
+}
+
+void Bank::set_commission_seed(unsigned int seed) {
+    this->commission_seed = seed;
+}
+
+unsigned int Bank::get_commission_seed() {
+    return this->commission_seed;
+}
+
+void Bank::print_status() {
+    bank_read_lock();
+    string print_out;
+
+    for (unsigned i = 0; i < accounts.size(); i++) {
+        print_out.append(accounts[i].print_status());
+        print_out.append("\n");
+    }
+
+    cout << "\033[2J";
+    cout << "\033[1;1H";
+    cout << "Current Bank Status" << endl;
+    cout << print_out;
+
+    bank_read_unlock();
+}
+
+// Binary search: accounts are kept sorted by id
+int Bank::is_account_exist(int account_id) {
+    auto account = lower_bound(accounts.begin(), accounts.end(), account_id,
+                               [](const Account& a, int id) { return a.get_id() < id; });
+    if (account != accounts.end() && account->get_id() == account_id) {
+        return account - accounts.begin();
+    }
+    return ACCOUNT_NOT_EXIST;
+}
+
+bool Bank::close_atm(int source_atm_id, int target_atm_id) {
+    inject_sleep(1);
+    stringstream log_line;
+
+   if (target_atm_id < 1 || target_atm_id > static_cast<int>(atm_files.size())) {
+       log_line << "Error " << source_atm_id << ": Your transaction failed – ATM ID " << target_atm_id << " does not exist";
+       write_to_log_file(log_line.str());
+       return false;
+   }
+
+   if (atm_closed[target_atm_id - 1]) {
+       log_line << "Error " << source_atm_id << ": Your close operation failed – ATM ID " << target_atm_id << " is already in a closed state";
+       write_to_log_file(log_line.str());
+       return false;
+   }
+
+   atm_closed[target_atm_id - 1] = true;
+    log_line << "Bank: ATM " << source_atm_id << " closed " << target_atm_id << " successfully";
+    write_to_log_file(log_line.str());
+   return true;
+}
+
+
+void Bank::save_current_status() {
+    bank_read_lock();
+
+    // One account at a time, so no writer waits for more than one copy; the
+    // snapshot is not atomic, a transfer in flight may show on one side only
+    vector<Account_State> current(accounts.size());
+    for (unsigned i = 0; i < accounts.size(); i++) {
+        current[i].account_id = accounts[i].get_id();
+        current[i].balance = accounts[i].peek_balance();
+        current[i].password = accounts[i].get_password();
+    }
+
+    pthread_mutex_lock(&status_mutex);
+    statuses.push(current);
+    pthread_mutex_unlock(&status_mutex);
+
+    bank_read_unlock();
+}
+
+void Bank::configure_rollback(int window, size_t memory_bytes, const string& spill_path) {
+    pthread_mutex_lock(&status_mutex);
+    rollback_window = window;
+    statuses.configure(window, memory_bytes, spill_path);
+    pthread_mutex_unlock(&status_mutex);
+}
+
+void Bank::rollback(int atm_id, int iterations) {
+    inject_sleep(1);
+    bank_write_lock();
+    pthread_mutex_lock(&status_mutex);
+
+    vector<Account_State> target_status;
+    if (iterations < 1 || !statuses.get(iterations, target_status)) {
+        pthread_mutex_unlock(&status_mutex);
+        bank_write_unlock();
+        return;
+    }
+
+    pthread_mutex_unlock(&status_mutex);
+
+    // A replay has no snapshots, so the record holds the restored state
+    if (replay_recorder != nullptr) {
+        string record_line = "Z";
+        for (const Account_State& state : target_status) {
+            record_line += " " + to_string(state.account_id) + " " + state.password + " " + to_string(state.balance);
+        }
+        replay_begin_operation(atm_id, record_line);
+    }
+    restore_accounts(target_status, atm_id);
+
+    stringstream log_line;
+    log_line << atm_id << ": Rollback to " << iterations << " bank iterations ago was completed successfully";
+    write_to_log_file(log_line.str());
+
+    bank_write_unlock();
+}
+
+void Bank::restore_accounts(const vector<Account_State>& target_status, int atm_id) {
+    // Accounts still open keep their history and record the restore in it;
+    // closed or reopened ones come back as new accounts
+    vector<Account> restored;
+    restored.reserve(target_status.size());
+    long long before = 0, target = 0, after = 0;
+    for (Account& account : accounts) {
+        before += account.balance_without_lock();
+    }
+    size_t current = 0;
+    for (const Account_State& state : target_status) {
+        target += state.balance;
+        while (current < accounts.size() && accounts[current].get_id() < state.account_id) {
+            current++;
+        }
+        if (current < accounts.size() && accounts[current].get_id() == state.account_id &&
+            accounts[current].check_password(state.password)) {
+            restored.push_back(accounts[current]);
+            restored.back().restore_without_lock(current_account_version(), state.balance, atm_id);
+        } else {
+            restored.push_back(Account(state.account_id, state.password, state.balance));
+            if (striped_accounts.count(state.account_id)) {
+                restored.back().enable_deposit_stripes();
+            }
+        }
+    }
+    accounts.swap(restored);
+
+    for (Account& account : accounts) {
+        after += account.balance_without_lock();
+    }
+    audit_flow(AUDIT_ADJUSTED, target - before);
+    audit_change(after - before);
+}
+
+int Bank::restore_bank(int atm_id, const vector<Account_State>& target_status) {
+    bank_write_lock();
+    restore_accounts(target_status, atm_id);
+
+    stringstream log_line;
+    log_line << atm_id << ": Rollback of the bank was completed successfully";
+    write_to_log_file(log_line.str());
+
+    bank_write_unlock();
+    return SUCCESS;
+}
+
+void Bank::mark_iteration() {
+    pthread_mutex_lock(&status_mutex);
+
+    iteration_versions.push_back(advance_account_version());
+    while (iteration_versions.size() > rollback_window) {
+        iteration_versions.pop_front();
+    }
+    // Account histories only need to reach back to the oldest iteration
+    set_account_history_floor(iteration_versions.front());
+
+    pthread_mutex_unlock(&status_mutex);
+}
+
+bool Bank::iteration_version(int iterations, long long* version) {
+    pthread_mutex_lock(&status_mutex);
+
+    bool in_range = iterations >= 1 && static_cast<size_t>(iterations) <= iteration_versions.size();
+    if (in_range) {
+        *version = iteration_versions[iteration_versions.size() - iterations];
+    }
+
+    pthread_mutex_unlock(&status_mutex);
+    return in_range;
+}
+
+bool Bank::lock_rollback_accounts(const vector<int>& account_ids, vector<int>& indexes, int atm_id) {
+    indexes.clear();
+    for (int account_id : account_ids) {
+        int index = is_account_exist(account_id);
+        if (index == ACCOUNT_NOT_EXIST) {
+            stringstream log_line;
+            log_line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
+            write_to_log_file(log_line.str());
+            return false;
+        }
+        indexes.push_back(index);
+    }
+
+    // Index order, the order transfers and batches lock in
+    sort(indexes.begin(), indexes.end());
+    indexes.erase(unique(indexes.begin(), indexes.end()), indexes.end());
+    for (int index : indexes) {
+        accounts[index].account_write_lock();
+    }
+    return true;
+}
+
+void Bank::unlock_rollback_accounts(const vector<int>& indexes) {
+    for (auto index = indexes.rbegin(); index != indexes.rend(); ++index) {
+        accounts[*index].account_write_unlock();
+    }
+}
+
+int Bank::rollback_accounts(int atm_id, int iterations, const vector<int>& account_ids) {
+    inject_sleep(1);
+    bank_read_lock();
+    stringstream log_line;
+
+    long long version;
+    if (!iteration_version(iterations, &version)) {
+        log_line << "Error " << atm_id << ": Your transaction failed - rollback of " << iterations << " bank iterations is out of range";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return OPERATION_FAILED;
+    }
+
+    vector<int> indexes;
+    if (!lock_rollback_accounts(account_ids, indexes, atm_id)) {
+        bank_read_unlock();
+        return ACCOUNT_NOT_EXIST;
+    }
+
+    // Every account is checked first, so the rollback applies to all of them or none
+    vector<int> balances(indexes.size());
+    for (size_t i = 0; i < indexes.size(); i++) {
+        if (!accounts[indexes[i]].balance_at_version(version, &balances[i])) {
+            log_line << "Error " << atm_id << ": Your transaction failed - the history of account id " << accounts[indexes[i]].get_id() << " does not reach " << iterations << " bank iterations back";
+            write_to_log_file(log_line.str());
+
+            unlock_rollback_accounts(indexes);
+            bank_read_unlock();
+            return OPERATION_FAILED;
+        }
+    }
+
+    string record_line = "S";
+    log_line << atm_id << ": Rollback of accounts ";
+    for (size_t i = 0; i < indexes.size(); i++) {
+        Account& account = accounts[indexes[i]];
+        int delta = account.restore_without_lock(version, balances[i], atm_id);
+        audit_flow(AUDIT_ADJUSTED, delta);
+        audit_change(delta);
+        record_line += " " + to_string(account.get_id()) + " " + to_string(balances[i]);
+        log_line << (i > 0 ? ", " : "") << account.get_id();
+    }
+    log_line << " to " << iterations << " bank iterations ago was completed successfully";
+
+    // A replay has no bank iterations to resolve, so the record holds the balances
+    replay_begin_operation(atm_id, record_line);
+    write_to_log_file(log_line.str());
+
+    unlock_rollback_accounts(indexes);
+    bank_read_unlock();
+    return SUCCESS;
+}
+
+int Bank::rollback_atm(int atm_id, int iterations, int target_atm_id) {
+    inject_sleep(1);
+    bank_read_lock();
+    stringstream log_line;
+
+    long long version;
+    if (!iteration_version(iterations, &version)) {
+        log_line << "Error " << atm_id << ": Your transaction failed - rollback of " << iterations << " bank iterations is out of range";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return OPERATION_FAILED;
+    }
+
+    vector<int> changed_ids;
+    if (target_atm_id < 1 || target_atm_id > static_cast<int>(atm_files.size()) ||
+        !atm_changed_accounts(target_atm_id, version, changed_ids)) {
+        log_line << "Error " << atm_id << ": Your transaction failed - the history of ATM ID " << target_atm_id << " does not reach " << iterations << " bank iterations back";
+        write_to_log_file(log_line.str());
+
+        bank_read_unlock();
+        return OPERATION_FAILED;
+    }
+
+    // Accounts closed since then are gone, with their history
+    vector<int> account_ids;
+    for (int account_id : changed_ids) {
+        if (is_account_exist(account_id) != ACCOUNT_NOT_EXIST) {
+            account_ids.push_back(account_id);
+        }
+    }
+    vector<int> indexes;
+    lock_rollback_accounts(account_ids, indexes, atm_id);
+
+    vector<int> deltas;
+    for (int index : indexes) {
+        Account& account = accounts[index];
+        int delta;
+        int status = SUCCESS;
+        if (!account.atm_changes_after(target_atm_id, version, &delta)) {
+            log_line << "Error " << atm_id << ": Your transaction failed - the history of account id " << account.get_id() << " does not reach " << iterations << " bank iterations back";
+            status = OPERATION_FAILED;
+        } else if (account.balance_without_lock() < delta) {
+            log_line << "Error " << atm_id << ": Your transaction failed - account id " << account.get_id() << " balance is lower than " << delta;
+            status = NOT_ENOUGH_MONEY;
+        }
+
+        if (status != SUCCESS) {
+            write_to_log_file(log_line.str());
+
+            unlock_rollback_accounts(indexes);
+            bank_read_unlock();
+            return status;
+        }
+        deltas.push_back(delta);
+    }
+
+    string record_line = "S";
+    for (size_t i = 0; i < indexes.size(); i++) {
+        Account& account = accounts[indexes[i]];
+        int change = account.undo_atm_without_lock(target_atm_id, version, atm_id);
+        audit_flow(AUDIT_ADJUSTED, -deltas[i]);
+        audit_change(change);
+        record_line += " " + to_string(account.get_id()) + " " + to_string(account.balance_without_lock());
+    }
+    log_line << atm_id << ": Rollback of ATM " << target_atm_id << " operations of the last " << iterations << " bank iterations was completed successfully";
+
+    if (!indexes.empty()) {
+        replay_begin_operation(atm_id, record_line);
+    }
+    write_to_log_file(log_line.str());
+
+    unlock_rollback_accounts(indexes);
+    bank_read_unlock();
+    return SUCCESS;
+}
+
+int Bank::restore_balances(int atm_id, const vector<pair<int, int>>& balances) {
+    bank_read_lock();
+
+    vector<int> account_ids;
+    for (const pair<int, int>& balance : balances) {
+        account_ids.push_back(balance.first);
+    }
+    vector<int> indexes;
+    if (!lock_rollback_accounts(account_ids, indexes, atm_id)) {
+        bank_read_unlock();
+        return ACCOUNT_NOT_EXIST;
+    }
+
+    stringstream log_line;
+    log_line << atm_id << ": Rollback of accounts ";
+    for (size_t i = 0; i < balances.size(); i++) {
+        Account& account = accounts[is_account_exist(balances[i].first)];
+        int delta = account.restore_without_lock(current_account_version(), balances[i].second, atm_id);
+        audit_flow(AUDIT_ADJUSTED, delta);
+        audit_change(delta);
+        log_line << (i > 0 ? ", " : "") << balances[i].first;
+    }
+    log_line << " was completed successfully";
+    write_to_log_file(log_line.str());
+
+    unlock_rollback_accounts(indexes);
+    bank_read_unlock();
+    return SUCCESS;
+}
+
+
+void Bank::load_atms(std::string& atm_file_path) {
+    ifstream atm_file(atm_file_path);
+    string line;
+    while (getline(atm_file, line)) {
+        atm_files.push_back(line);
+    }
+}
+
+void Bank::set_atm_file (const string file_name) {
+    atm_files.push_back(file_name);
+}
+
+ void Bank::set_atm_closed_to_false(int size){
+    for(int i =0; i<size; i++)
+    atm_closed.push_back (false);
+ }
+
+void Bank::process_command(const Command& cmd, pthread_t atm_id) {
+    Command modified_cmd = cmd;
+    modified_cmd.parse_command();
+   
+    if (modified_cmd.is_persistent) {
+        process_persistent(modified_cmd, atm_id);
+    } else if (modified_cmd.vip_priority != -1) {
+        process_vip(modified_cmd, atm_id);
+    } else {
+        process_regular(modified_cmd, atm_id);
+    }
+}
+
+void Command::parse_command() {
+   if (command.find("VIP=") != string::npos) {
+       size_t pos = command.find("VIP=") + 4;
+       vip_priority = stoi(command.substr(pos));
+       command = command.substr(0, pos - 4);
+   }
+
+   if (command.find("PERSISTENT") != string::npos) {
+       is_persistent = true;
+       command = command.substr(0, command.find("PERSISTENT") - 1);
+   }
+}
+
+
+void Bank::process_persistent(const Command& cmd, pthread_t atm_id) {
+   bool success = false; 
+   int max_retries = 2;
+   int retry_count = 0;
+   while (!success && retry_count < max_retries) {
+       process_regular(cmd, atm_id);
+       retry_count++;
+   }
+}
+
+void Bank::process_vip(const Command& cmd, pthread_t atm_id) {
+    std::cout << "VIP command processing for " << cmd.get_command() << std::endl;
+    process_regular(cmd, atm_id);
+}
+
+void Bank::process_regular(const Command& cmd, pthread_t atm_id) {
+    std::cout << "Processing regular command: " << cmd.get_command() << std::endl;
+    // return success
+}
+
+bool Bank::process_operation(const std::string& operation_line) {
+    Command cmd(operation_line);
+    bool success = false;
+
+    if (cmd.has_persistent()) {
+        process_persistent(cmd, pthread_self());
+        success = true;
+    } else if (cmd.is_vip()) {
+        process_vip(cmd, pthread_self());
+        success = true;
+    } else {
+        process_regular(cmd, pthread_self());
+        success = true;
+    }
+
+    return success;
+}
+
+
+
+vector<string> tokenize_operation(const string& operation_line) {
+    vector<string> operation_words;
+    tokenize_operation(operation_line, operation_words);
+    return operation_words;
+}
+
+void tokenize_operation(const string& operation_line, vector<string>& operation_words) {
+    size_t word_count = 0;
+    size_t i = 0;
+
+    while (i < operation_line.size()) {
+        char c = operation_line[i];
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while (i < operation_line.size() && operation_line[i] != ' ' && operation_line[i] != '\t' &&
+               operation_line[i] != '\n' && operation_line[i] != '\r') {
+            i++;
+        }
+        if (word_count == operation_words.size()) {
+            operation_words.emplace_back();
+        }
+        operation_words[word_count++].assign(operation_line, start, i - start);
+    }
+    operation_words.resize(word_count);
+}
+
+// U <iterations> ATM=<atm id>: the ATM whose changes are rolled back
+static bool rollback_target_atm(const vector<string>& operation_words, int* target_atm_id) {
+    if (operation_words.size() > 2 && operation_words[2].compare(0, 4, "ATM=") == 0) {
+        *target_atm_id = stoi(operation_words[2].substr(4));
+        return true;
+    }
+    return false;
+}
+
+// U <iterations> <account> [<account> ...]; trailing VIP= and PERSISTENT words end the list
+static void rollback_target_accounts(const vector<string>& operation_words, vector<int>& accounts) {
+    for (size_t i = 2; i < operation_words.size(); i++) {
+        char first = operation_words[i][0];
+        if (!isdigit(static_cast<unsigned char>(first)) && first != '-') {
+            break;
+        }
+        accounts.push_back(stoi(operation_words[i]));
+    }
+}
+
+bool operation_accounts(const vector<string>& operation_words, vector<int>& accounts) {
+    accounts.clear();
+    if (!operation_words.empty() && operation_words[0][0] == 'Z') {
+        return false; // a restored bank may have no accounts at all
+    }
+    if (operation_words.size() < 2) {
+        return true;
+    }
+
+    switch (operation_words[0][0]) {
+        case 'C':
+        case 'R':
+        case 'I':
+            return false;
+        case 'K': // Commission on one account: K <percentage> <account>
+            if (operation_words.size() > 2) {
+                accounts.push_back(stoi(operation_words[2]));
+            }
+            return true;
+        case 'U': {
+            int target_atm_id;
+            if (rollback_target_atm(operation_words, &target_atm_id)) {
+                return false; // the ATM's accounts are only known when it runs
+            }
+            rollback_target_accounts(operation_words, accounts);
+            return true;
+        }
+        case 'S': // Restored balances: S <account> <balance> [<account> <balance> ...]
+            for (size_t i = 1; i + 1 < operation_words.size(); i += 2) {
+                accounts.push_back(stoi(operation_words[i]));
+            }
+            return true;
+        case 'T':
+            accounts.push_back(stoi(operation_words[1]));
+            if (operation_words.size() > 3 && stoi(operation_words[3]) != accounts[0]) {
+                accounts.push_back(stoi(operation_words[3]));
+            }
+            return true;
+        default:
+            accounts.push_back(stoi(operation_words[1]));
+            return true;
+    }
+}
+
+bool batchable_operation(const vector<string>& operation_words) {
+    if (operation_words.empty()) {
+        return false;
+    }
+    // A keyed command must claim its key in the dedup table first, so it runs alone
+    for (const string& word : operation_words) {
+        if (word.compare(0, 4, "KEY=") == 0) {
+            return false;
+        }
+    }
+    switch (operation_words[0][0]) {
+        case 'D': case 'W': return operation_words.size() >= 4;
+        case 'B': return operation_words.size() >= 3;
+        case 'T': return operation_words.size() >= 5;
+        default: return false;
+    }
+}
+
+int Bank::execute_operation(const vector<string>& operation_words, int atm_id, int* new_balance, int* new_target_balance) {
+    int balance_out, target_balance_out;
+    if (new_balance == nullptr) {
+        new_balance = &balance_out;
+    }
+    if (new_target_balance == nullptr) {
+        new_target_balance = &target_balance_out;
+    }
+
+    if (operation_words.empty()) {
+        return OPERATION_FAILED;
+    }
+
+    Trace_Command command(trace_operation_name(operation_words[0][0]), atm_id);
+    replay_begin_operation(atm_id, operation_words);
+    int status = dispatch_operation(operation_words, atm_id, new_balance, new_target_balance);
+    replay_end_operation();
+    audit_commit();
+
+    return status;
+}
+
+int Bank::dispatch_operation(const vector<string>& operation_words, int atm_id, int* new_balance, int* new_target_balance) {
+    char operation = operation_words[0][0];
+    size_t needed_words = 0;
+    switch (operation) {
+        case 'O': case 'D': case 'W': needed_words = 4; break;
+        case 'B': case 'Q': needed_words = 3; break;
+        case 'T': needed_words = 5; break;
+        case 'C': case 'R': case 'I': needed_words = 2; break;
+        case 'K': case 'U': case 'S': needed_words = 3; break;
+        case 'Z': needed_words = 1; break;
+        default: return OPERATION_FAILED;
+    }
+    if (operation_words.size() < needed_words) {
+        return OPERATION_FAILED;
+    }
+
+    switch (operation) {
+        case 'O': // Open account
+            return create_account(stoi(operation_words[1]), operation_words[2], stoi(operation_words[3]), atm_id);
+
+        case 'D': // Deposit
+            return deposit(stoi(operation_words[1]), operation_words[2], stoi(operation_words[3]), new_balance, atm_id);
+
+        case 'W': // Withdraw
+            return withdraw(stoi(operation_words[1]), operation_words[2], stoi(operation_words[3]), new_balance, atm_id);
+
+        case 'B': // Balance inquiry
+            return get_balance(stoi(operation_words[1]), operation_words[2], new_balance, atm_id);
+
+        case 'Q': // Delete account
+            return delete_account(stoi(operation_words[1]), operation_words[2], new_balance, atm_id);
+
+        case 'T': // Transfer money
+            return transfer_money(stoi(operation_words[1]), operation_words[2], stoi(operation_words[3]), stoi(operation_words[4]), new_balance, new_target_balance, atm_id);
+
+        case 'C': // Close ATM
+            return close_atm(atm_id, stoi(operation_words[1])) ? SUCCESS : OPERATION_FAILED;
+
+        case 'R': // Rollback
+            rollback(atm_id, stoi(operation_words[1]));
+            return SUCCESS;
+
+        case 'I': // Bulk import of an account file
+            return import_accounts(operation_words[1], atm_id);
+
+        case 'U': { // Account or ATM scoped rollback
+            int target_atm_id;
+            if (rollback_target_atm(operation_words, &target_atm_id)) {
+                return rollback_atm(atm_id, stoi(operation_words[1]), target_atm_id);
+            }
+            vector<int> account_ids;
+            rollback_target_accounts(operation_words, account_ids);
+            return rollback_accounts(atm_id, stoi(operation_words[1]), account_ids);
+        }
+
+        case 'K': // Commission on a single account, only found in replay records
+            return commission_account(stoi(operation_words[2]), stoi(operation_words[1]));
+
+        case 'S': { // Restored balances of a U rollback, only found in replay records
+            vector<pair<int, int>> balances;
+            for (size_t i = 1; i + 1 < operation_words.size(); i += 2) {
+                balances.push_back(make_pair(stoi(operation_words[i]), stoi(operation_words[i + 1])));
+            }
+            return restore_balances(atm_id, balances);
+        }
+
+        case 'Z': { // Whole bank state after an R, only found in replay records
+            vector<Account_State> target_status;
+            for (size_t i = 1; i + 2 < operation_words.size(); i += 3) {
+                Account_State state;
+                state.account_id = stoi(operation_words[i]);
+                state.password = operation_words[i + 1];
+                state.balance = stoi(operation_words[i + 2]);
+                target_status.push_back(state);
+            }
+            return restore_bank(atm_id, target_status);
+        }
+    }
+
+    return OPERATION_FAILED;
+}
+
+/* Hot accounts go through their combiner and striped ones through their stripes, so they stay out of runs */
+bool Bank::joins_batch_run(const vector<string>& operation_words) {
+    if (!batchable_operation(operation_words)) {
+        return false;
+    }
+    vector<int> account_ids;
+    operation_accounts(operation_words, account_ids);
+    for (int account_id : account_ids) {
+        if (hot_accounts.count(account_id) || striped_accounts.count(account_id)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Bank::execute_batch(const vector<vector<string>>& batch, int atm_id, vector<int>& statuses) {
+    statuses.assign(batch.size(), OPERATION_FAILED);
+
+    size_t begin = 0;
+    while (begin < batch.size()) {
+        if (!joins_batch_run(batch[begin])) {
+            statuses[begin] = execute_operation(batch[begin], atm_id);
+            begin++;
+            continue;
+        }
+
+        size_t end = begin + 1;
+        while (end < batch.size() && joins_batch_run(batch[end])) {
+            end++;
+        }
+        execute_batch_run(batch, begin, end, atm_id, statuses);
+        begin = end;
+    }
+}
+
+void Bank::execute_batch_run(const vector<vector<string>>& batch, size_t begin, size_t end, int atm_id, vector<int>& statuses) {
+    bank_read_lock();
+
+    // Look every account up once and lock the existing ones in index order,
+    // the order transfer_money uses, so batches never deadlock with it
+    unordered_map<int, int> account_index;
+    vector<int> locked_indexes;
+    vector<int> account_ids;
+    for (size_t i = begin; i < end; i++) {
+        operation_accounts(batch[i], account_ids);
+        for (int account_id : account_ids) {
+            if (account_index.count(account_id) == 0) {
+                int index = is_account_exist(account_id);
+                account_index[account_id] = index;
+                if (index != ACCOUNT_NOT_EXIST) {
+                    locked_indexes.push_back(index);
+                }
+            }
+        }
+    }
+    sort(locked_indexes.begin(), locked_indexes.end());
+    for (int index : locked_indexes) {
+        accounts[index].account_write_lock();
+    }
+
+    // Each operation still pays its own simulated delay, as it would unbatched
+    vector<string> log_lines(end - begin);
+    for (size_t i = begin; i < end; i++) {
+        inject_sleep(1);
+        statuses[i] = apply_batched_operation(batch[i], atm_id, account_index, log_lines[i - begin]);
+    }
+
+    // One log block; each line is still the commit point of its operation
+    pthread_mutex_lock(&log_file_lock);
+    for (size_t i = begin; i < end; i++) {
+        replay_begin_operation(atm_id, batch[i]);
+        if (log_file.is_open()) {
+            log_file << log_lines[i - begin] << '\n';
+        }
+        replay_record_commit();
+    }
+    log_file.flush();
+    pthread_mutex_unlock(&log_file_lock);
+    audit_commit();
+
+    for (auto index = locked_indexes.rbegin(); index != locked_indexes.rend(); ++index) {
+        accounts[*index].account_write_unlock();
+    }
+    bank_read_unlock();
+}
+
+/* One D/W/B/T of a batch run, with its accounts already locked; mirrors the unbatched paths */
+int Bank::apply_batched_operation(const vector<string>& operation_words, int atm_id, const unordered_map<int, int>& account_index, string& log_line) {
+    stringstream line;
+    char operation = operation_words[0][0];
+    int account_id = stoi(operation_words[1]);
+    const string& password = operation_words[2];
+    int index = account_index.at(account_id);
+    int status = SUCCESS;
+    int new_balance;
+
+    if (index == ACCOUNT_NOT_EXIST) {
+        line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " does not exist";
+        log_line = line.str();
+        return ACCOUNT_NOT_EXIST;
+    }
+    Account& account = accounts[index];
+
+    if (operation == 'T') {
+        int target_account = stoi(operation_words[3]);
+        int amount = stoi(operation_words[4]);
+        int target_index = account_index.at(target_account);
+        int new_target_balance = 0;
+
+        if (target_index == ACCOUNT_NOT_EXIST) {
+            line << "Error " << atm_id << ": Your transaction failed - account id " << target_account << " does not exist";
+            status = TARGET_ACCOUNT_NOT_EXIST;
+        } else if (!account.check_password(password)) {
+            line << "Error " << atm_id << ": Your transaction failed - password for account id " << account_id << " is incorrect";
+            status = WRONG_PASSWORD;
+        } else {
+            status = account.withdraw_without_lock(amount, &new_balance, atm_id);
+            if (status == SUCCESS) {
+                accounts[target_index].deposit_without_lock(amount, &new_target_balance, atm_id);
+                line << atm_id << ": Transfer " << amount << " from account " << account_id << " to account " << target_account << " new account balance is " << new_balance << " new target account balance is " << new_target_balance;
+            } else {
+                line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " balance is lower than " << amount;
+            }
+        }
+    } else if (!account.check_password(password)) {
+        line << "Error " << atm_id << ": Your transaction failed - password for account id " << account_id << " is incorrect";
+        status = WRONG_PASSWORD;
+    } else if (operation == 'D') {
+        int amount = stoi(operation_words[3]);
+        account.deposit_without_lock(amount, &new_balance, atm_id);
+        audit_flow(AUDIT_DEPOSITED, amount);
+        line << atm_id << ": Account " << account_id << " new balance is " << new_balance << " after " << amount << " $ was deposited";
+    } else if (operation == 'W') {
+        int amount = stoi(operation_words[3]);
+        status = account.withdraw_without_lock(amount, &new_balance, atm_id);
+        if (status == NOT_ENOUGH_MONEY) {
+            line << "Error " << atm_id << ": Your transaction failed - account id " << account_id << " balance is lower than " << amount;
+        } else {
+            audit_flow(AUDIT_WITHDRAWN, amount);
+            line << atm_id << ": Account " << account_id << " new balance is " << new_balance << " after " << amount << " $ was withdrew";
+        }
+    } else { // 'B'
+        line << atm_id << ": Account " << account_id << " balance is " << account.balance_without_lock();
+    }
+
+    log_line = line.str();
+    return status;
+}
+
+void Bank::snapshot_balances(Balance_Snapshot& snapshot) {
+    bank_read_lock();
+
+    // Each account is read-locked only for its own copy, so ATM traffic waits
+    // for one account at a time, never for the whole scan
+    size_t count = accounts.size();
+    snapshot.account_ids.resize(count);
+    snapshot.balances.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        snapshot.account_ids[i] = accounts[i].get_id();
+        snapshot.balances[i] = accounts[i].peek_balance();
+    }
+    snapshot.bank_balance = this->bank_balance;
+
+    bank_read_unlock();
+}
+
+void Bank::get_balances(vector<pair<int, int>>& balances, int* bank_balance) {
+    bank_read_lock();
+
+    balances.clear();
+    for (unsigned i = 0; i < accounts.size(); i++) {
+        balances.push_back(make_pair(accounts[i].get_id(), accounts[i].peek_balance()));
+    }
+    *bank_balance = this->bank_balance;
+
+    bank_read_unlock();
+}
+
+void Bank::get_account_states(vector<Account_State>& states, int* bank_balance) {
+    bank_read_lock();
+
+    states.resize(accounts.size());
+    for (unsigned i = 0; i < accounts.size(); i++) {
+        states[i].account_id = accounts[i].get_id();
+        states[i].balance = accounts[i].peek_balance();
+        states[i].password = accounts[i].get_password();
+    }
+    *bank_balance = this->bank_balance;
+
+    bank_read_unlock();
+}
+
+unsigned long long balances_checksum(const vector<pair<int, int>>& balances) {
+    unsigned long long fnv = 14695981039346656037ULL;
+
+    for (const pair<int, int>& account : balances) {
+        int fields[2] = {account.first, account.second};
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(fields);
+        for (unsigned i = 0; i < sizeof(fields); i++) {
+            fnv = (fnv ^ bytes[i]) * 1099511628211ULL;
+        }
+    }
+
+    return fnv;
+}
@@ -1,114 +1,189 @@
- #ifndef BANK_H
-#define BANK_H
-
-#include <iostream>
-#include <vector>
-#include <algorithm>
-#include <cstdlib>
-#include <unistd.h>
-#include <pthread.h>
-#include <unordered_map>
-#include <utility>
-#include <deque>
-#include <vector>
-#include "account.hpp"
-
-#define SUCCESS 0
-#define ACCOUNT_EXIST -1
-#define ACCOUNT_NOT_EXIST -2
-#define WRONG_PASSWORD -3
-#define NOT_ENOUGH_MONEY -4
-#define TARGET_ACCOUNT_NOT_EXIST -5
-
-using namespace std;
-
-class Command {
-private:
-   std::string command_line;
-   bool persistent_flag = false;
-   bool vip_flag = false; 
-   
-public:
-   string command;
-   int vip_priority;
-   bool is_persistent; 
-
-   //Command(string cmd, int vip = -1, bool persistent = false);
-   bool operator<(const Command& other) const;
-   void parse_command(); 
-   std::string get_command() const{
-	   return this->command;
-   }
-
-
-   Command(const std::string& operation_line) : command_line(operation_line) {}
-  
-   bool has_persistent() const {
-       return command_line.find("PERSISTENT") != std::string::npos;
-   }
-
-   bool is_vip() const {
-       return command_line.find("VIP") != std::string::npos;
-   }
-
-};
-
-struct Bank_Status {
-	std::vector<Account> accounts;
-};
-
-class Bank {
-private:
-    int bank_balance;
-    vector<Account> accounts;
-    pthread_mutex_t read_lock_mutex;
-    pthread_mutex_t write_lock_mutex;
-    int read_count;
-    vector<string> atm_files;
-    vector<bool> atm_closed;
-    vector<Bank_Status> status_history;
-    static Bank* bank_instance;
-    std::deque<Bank_Status> statuses;
-	pthread_mutex_t status_mutex;
-
-    //std::vector<std::string> atm_files;
-    std::vector<std::string> operations;
-    pthread_mutex_t vip_queue_mutex;
-    std::vector<std::pair<std::string, int>> vip_queue;
-
-    // Readers-writers mechanism
-    void bank_read_lock();
-    void bank_read_unlock();
-    void bank_write_lock();
-    void bank_write_unlock();
-
-public:
-    Bank();
-    ~Bank();
-
-    void set_atm_file (const string file_name);// add file name to atm_files
-    void set_atm_closed_to_false(int size);  
-    int create_account(int account_id, string password, int initial_amount, int atm_id);
-    int delete_account(int account_id, string password, int* balance, int atm_id);
-    int deposit(int account_id, string password, int amount, int* new_balance, int atm_id);
-    int withdraw(int account_id, string password, int amount, int* new_balance, int atm_id);
-    int get_balance(int account_id, string password, int* new_balance, int atm_id);
-    int transfer_money(int account_id, string password, int target_account, int amount, int* new_balance, int* new_target_balance, int atm_id);
-    void commission();
-    void print_status();
-    int is_account_exist(int account_id);
-    bool close_atm(int source_atm_id, int target_atm_id);
-    void rollback(int atm_id, int iterations);
-    void save_current_status();
-    void load_atms(std::string& atm_file_path);
-    void* atm_thread(void* arg);
-    void* vip_thread(void* arg);
-    void process_command(const Command& cmd, pthread_t atm_id);
-    void process_persistent(const Command& cmd, pthread_t atm_id);
-    void process_vip(const Command& cmd, pthread_t atm_id);
-    void process_regular(const Command& cmd, pthread_t atm_id);
-    bool process_operation(const std::string& operation_line);
-};
-
-
+ #ifndef BANK_H
+#define BANK_H
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+#include <pthread.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <deque>
+#include <vector>
+#include "account.hpp"
+#include "combiner.hpp"
+#include "analytics.hpp"
+#include "status_history.hpp"
+
+#define SUCCESS 0
+#define ACCOUNT_EXIST -1
+#define ACCOUNT_NOT_EXIST -2
+#define WRONG_PASSWORD -3
+#define NOT_ENOUGH_MONEY -4
+#define TARGET_ACCOUNT_NOT_EXIST -5
+#define OPERATION_FAILED -6
+#define MAX_RETRIES 2
+#define RETRY_DELAY 1000000
+#define ROLLBACK_ITERATIONS 120 // default bank iterations (status prints) a rollback can reach back
+
+using namespace std;
+
+// Splits an ATM file line into its whitespace separated words
+vector<string> tokenize_operation(const string& operation_line);
+// Same, into operation_words, reusing the strings already in it
+void tokenize_operation(const string& operation_line, vector<string>& operation_words);
+
+// Accounts an operation reads or writes; false for whole bank operations (C, R, I, Z, U ATM=)
+bool operation_accounts(const vector<string>& operation_words, vector<int>& accounts);
+
+// D, W, B and T with all their words and no KEY=: the operations Bank::execute_batch groups
+bool batchable_operation(const vector<string>& operation_words);
+
+class Command {
+private:
+   std::string command_line;
+   bool persistent_flag = false;
+   bool vip_flag = false; 
+   
+public:
+   string command;
+   int vip_priority;
+   bool is_persistent; 
+
+   //Command(string cmd, int vip = -1, bool persistent = false);
+   bool operator<(const Command& other) const;
+   void parse_command(); 
+   std::string get_command() const{
+	   return this->command;
+   }
+
+
+   Command(const std::string& operation_line) : command_line(operation_line) {}
+  
+   bool has_persistent() const {
+       return command_line.find("PERSISTENT") != std::string::npos;
+   }
+
+   bool is_vip() const {
+       return command_line.find("VIP") != std::string::npos;
+   }
+
+};
+
+class Bank {
+private:
+    int bank_balance;
+    unsigned int commission_seed;
+    vector<Account> accounts;
+    Readers_Writers_Lock lock;
+    vector<string> atm_files;
+    vector<bool> atm_closed;
+    static Bank* bank_instance;
+    Status_History statuses;             // snapshots for R, one per bank iteration
+    deque<long long> iteration_versions; // account history version at each bank iteration
+    size_t rollback_window;
+	pthread_mutex_t status_mutex;
+    unordered_map<int, int> pending_credits; // account id -> cross-partition transfers reserved into it
+    pthread_mutex_t pending_mutex;
+    pthread_cond_t pending_cond;
+
+    //std::vector<std::string> atm_files;
+    std::vector<std::string> operations;
+    unordered_map<int, Account_Combiner*> hot_accounts; // account id -> its flat combiner
+    unordered_set<int> striped_accounts; // ids whose deposits go to per-core stripes
+
+    // Readers-writers mechanism
+    void bank_read_lock();
+    void bank_read_unlock();
+    void bank_write_lock();
+    void bank_write_unlock();
+
+    int dispatch_operation(const vector<string>& operation_words, int atm_id, int* new_balance, int* new_target_balance);
+    bool iteration_version(int iterations, long long* version);
+    // Replaces the accounts with a snapshot; caller holds the bank write lock
+    void restore_accounts(const vector<Account_State>& target_status, int atm_id);
+    // Looks the accounts up and write-locks them in index order; false if one is missing
+    bool lock_rollback_accounts(const vector<int>& account_ids, vector<int>& indexes, int atm_id);
+    void unlock_rollback_accounts(const vector<int>& indexes);
+    // Caller holds the bank write lock; it is released while reserved credits are outstanding
+    void wait_for_pending_credits(int account_id);
+    // Batchable and on no hot or striped account
+    bool joins_batch_run(const vector<string>& operation_words);
+    void execute_batch_run(const vector<vector<string>>& batch, size_t begin, size_t end, int atm_id, vector<int>& statuses);
+    int apply_batched_operation(const vector<string>& operation_words, int atm_id, const unordered_map<int, int>& account_index, string& log_line);
+
+public:
+    Bank();
+    ~Bank();
+
+    void set_atm_file (const string file_name);// add file name to atm_files
+    void set_atm_closed_to_false(int size);  
+    int create_account(int account_id, string password, int initial_amount, int atm_id);
+    // Opens every account of an account file (see import.hpp) at once, or none of them
+    int import_accounts(const string& path, int atm_id);
+    int delete_account(int account_id, string password, int* balance, int atm_id);
+    int deposit(int account_id, string password, int amount, int* new_balance, int atm_id);
+    int withdraw(int account_id, string password, int amount, int* new_balance, int atm_id);
+    int get_balance(int account_id, string password, int* new_balance, int atm_id);
+    int transfer_money(int account_id, string password, int target_account, int amount, int* new_balance, int* new_target_balance, int atm_id);
+    void set_hot_account(int account_id);
+    void set_striped_account(int account_id);
+    void commission();
+    int commission_account(int account_id, int commission_percentage);
+    void set_commission_seed(unsigned int seed);
+    unsigned int get_commission_seed();
+    void print_status();
+    int is_account_exist(int account_id);
+    bool close_atm(int source_atm_id, int target_atm_id);
+    void rollback(int atm_id, int iterations);
+    void save_current_status();
+    // Iterations R and U reach back, and the memory and spill file of R's snapshots
+    void configure_rollback(int window, size_t memory_bytes, const string& spill_path);
+    // Marks the end of a bank iteration, after save_current_status
+    void mark_iteration();
+    // Restores the listed accounts to their balances of `iterations` bank iterations ago
+    int rollback_accounts(int atm_id, int iterations, const vector<int>& account_ids);
+    // Reverts what target_atm_id changed in the last `iterations` bank iterations
+    int rollback_atm(int atm_id, int iterations, int target_atm_id);
+    // Sets balances directly; the resolved form of a U rollback in replay records
+    int restore_balances(int atm_id, const vector<pair<int, int>>& balances);
+    // Sets the whole bank to a snapshot; the resolved form of an R in replay records
+    int restore_bank(int atm_id, const vector<Account_State>& target_status);
+    void load_atms(std::string& atm_file_path);
+    void process_command(const Command& cmd, pthread_t atm_id);
+    void process_persistent(const Command& cmd, pthread_t atm_id);
+    void process_vip(const Command& cmd, pthread_t atm_id);
+    void process_regular(const Command& cmd, pthread_t atm_id);
+    bool process_operation(const std::string& operation_line);
+
+    // Runs one tokenized ATM line (O/D/W/B/Q/T/C/R/I) and returns its status
+    int execute_operation(const vector<string>& operation_words, int atm_id, int* new_balance = nullptr, int* new_target_balance = nullptr);
+    // Runs one ATM's commands in order with the same results as execute_operation.
+    // Runs of D/W/B/T take the bank lock and every account lock they touch once
+    // and log in one block; other commands, and those on hot or striped
+    // accounts, run one by one between the runs.
+    void execute_batch(const vector<vector<string>>& batch, int atm_id, vector<int>& statuses);
+    // Column copy of all balances for the analytics queries; not atomic across accounts
+    void snapshot_balances(Balance_Snapshot& snapshot);
+    // Copies (account id, balance) pairs and the bank's own balance, for checksums
+    void get_balances(vector<pair<int, int>>& balances, int* bank_balance);
+    // Same, with passwords, for the status of a partitioned bank
+    void get_account_states(vector<Account_State>& states, int* bank_balance);
+
+    // Two-phase transfers between partitions. The target partition reserves a
+    // credit first, which keeps its account from being closed; the source
+    // partition then checks and debits like transfer_money, logging the same
+    // errors; finally the target applies or releases the credit.
+    int reserve_credit(int account_id);
+    int transfer_out(int account_id, string password, int target_account, bool target_exists, int amount, int* new_balance, int atm_id);
+    int transfer_in(int account_id, int amount, int* new_balance, int atm_id);
+    void release_credit(int account_id);
+};
+
+// FNV-1a hash over (account id, balance) pairs, used to compare final states
+unsigned long long balances_checksum(const vector<pair<int, int>>& balances);
+
+
 #endif
\ No newline at end of file
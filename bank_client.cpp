@@ -0,0 +1,288 @@
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <ctime>
+#include <iomanip>
+#include <algorithm>
+#include <deque>
+#include <pthread.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "protocol.hpp"
+#include "workload.hpp"
+
+/*
+ * Load generator for the bank's server mode. Opens the workload's accounts,
+ * then drives every ATM stream of the workload over its own connection, keeping
+ * up to --pipeline requests in flight, and reports throughput and end to end
+ * request latency as JSON.
+ */
+
+#define CLIENT_READ_SIZE 65536
+
+struct Client_Worker {
+    int atm_id;
+    const vector<string>* lines;
+    vector<long long> latencies;
+    long long failed;
+};
+
+static string server_address;
+static bool use_binary = false;
+static int pipeline_depth = 16;
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static long long percentile(const vector<long long>& sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(ceil(fraction * sorted.size()));
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+static int connect_to_server() {
+    int fd = -1;
+    if (server_address.compare(0, 5, "unix:") == 0) {
+        struct sockaddr_un remote;
+        memset(&remote, 0, sizeof(remote));
+        remote.sun_family = AF_UNIX;
+        strncpy(remote.sun_path, server_address.c_str() + 5, sizeof(remote.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd != -1 && connect(fd, reinterpret_cast<struct sockaddr*>(&remote), sizeof(remote)) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    } else if (server_address.compare(0, 4, "tcp:") == 0) {
+        struct sockaddr_in remote;
+        memset(&remote, 0, sizeof(remote));
+        remote.sin_family = AF_INET;
+        remote.sin_port = htons(atoi(server_address.c_str() + 4));
+        remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int no_delay = 1;
+        if (fd != -1 && (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay)) == -1 ||
+                         connect(fd, reinterpret_cast<struct sockaddr*>(&remote), sizeof(remote)) == -1)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (fd == -1) {
+        perror("Bank error: unable to connect to server");
+        exit(1);
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t count = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        written += count;
+    }
+    return true;
+}
+
+/* Sends the lines with a sliding window of pipeline_depth outstanding requests */
+static void run_stream(int fd, int atm_id, const vector<string>& lines, Client_Worker* worker) {
+    deque<long long> sent_at;
+    string input, output;
+    char buffer[CLIENT_READ_SIZE];
+    size_t next = 0;
+    size_t answered = 0;
+
+    while (answered < lines.size()) {
+        // Top the window up with one write
+        output.clear();
+        long long now = now_ns();
+        while (next < lines.size() && sent_at.size() < static_cast<size_t>(pipeline_depth)) {
+            istringstream line(lines[next++]);
+            vector<string> operation_words;
+            string word;
+            while (line >> word) {
+                operation_words.push_back(word);
+            }
+            if (operation_words.empty()) {
+                answered++;
+                continue;
+            }
+            if (use_binary) {
+                append_binary_request(output, atm_id, operation_words);
+            } else {
+                append_text_request(output, atm_id, operation_words);
+            }
+            sent_at.push_back(now);
+        }
+        if (!output.empty() && !send_all(fd, output)) {
+            perror("Bank error: send failed");
+            exit(1);
+        }
+        if (sent_at.empty()) {
+            continue;
+        }
+
+        ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            cerr << "Bank error: server closed the connection" << endl;
+            exit(1);
+        }
+        input.append(buffer, count);
+
+        size_t offset = 0;
+        int status, balance, consumed;
+        now = now_ns();
+        while ((consumed = parse_response(input.data() + offset, input.size() - offset, &status, &balance)) > 0) {
+            offset += consumed;
+            if (worker != nullptr) {
+                worker->latencies.push_back(now - sent_at.front());
+                if (status != 0) {
+                    worker->failed++;
+                }
+            }
+            sent_at.pop_front();
+            answered++;
+        }
+        input.erase(0, offset);
+    }
+}
+
+static void* client_thread(void* arg) {
+    Client_Worker* worker = static_cast<Client_Worker*>(arg);
+    int fd = connect_to_server();
+    run_stream(fd, worker->atm_id, *worker->lines, worker);
+    close(fd);
+    return nullptr;
+}
+
+static struct option long_options[] = {
+    {"accounts", required_argument, nullptr, 0},
+    {"atms", required_argument, nullptr, 0},
+    {"ops", required_argument, nullptr, 0},
+    {"zipf", required_argument, nullptr, 0},
+    {"vip", required_argument, nullptr, 0},
+    {"persistent", required_argument, nullptr, 0},
+    {"mix", required_argument, nullptr, 0},
+    {"initial-balance", required_argument, nullptr, 0},
+    {"seed", required_argument, nullptr, 0},
+    {"server", required_argument, nullptr, 'x'},
+    {"pipeline", required_argument, nullptr, 'p'},
+    {"binary", no_argument, nullptr, 'b'},
+    {"no-setup", no_argument, nullptr, 'n'},
+    {nullptr, 0, nullptr, 0}
+};
+
+void print_usage() {
+    cerr << "Usage: bank_client --server unix:PATH|tcp:PORT [workload options] [--pipeline N] [--binary] [--no-setup]" << endl;
+    cerr << "Workload options are those of bank_workload; ATM n of the workload is sent as ATM n, so start" << endl;
+    cerr << "the server with at least as many --server-atms as --atms." << endl;
+}
+
+int main(int argc, char *argv[]) {
+    Workload_Config config;
+    bool run_setup = true;
+    int option, option_index;
+
+    while ((option = getopt_long(argc, argv, "", long_options, &option_index)) != -1) {
+        switch (option) {
+            case 0:
+                if (!parse_workload_option(long_options[option_index].name, optarg, config)) {
+                    print_usage();
+                    exit(1);
+                }
+                break;
+            case 'x':
+                server_address = optarg;
+                break;
+            case 'p':
+                pipeline_depth = max(1, atoi(optarg));
+                break;
+            case 'b':
+                use_binary = true;
+                break;
+            case 'n':
+                run_setup = false;
+                break;
+            default:
+                print_usage();
+                exit(1);
+        }
+    }
+    if (server_address.empty()) {
+        print_usage();
+        exit(1);
+    }
+
+    Workload workload;
+    generate_workload(config, workload);
+
+    // Accounts are opened from ATM 1 before the load starts
+    if (run_setup) {
+        int fd = connect_to_server();
+        run_stream(fd, 1, workload.setup_lines, nullptr);
+        close(fd);
+    }
+
+    int num_atms = workload.atm_lines.size();
+    vector<Client_Worker> workers(num_atms);
+    vector<pthread_t> threads(num_atms);
+
+    long long start = now_ns();
+    for (int i = 0; i < num_atms; i++) {
+        workers[i].atm_id = i + 1;
+        workers[i].lines = &workload.atm_lines[i];
+        workers[i].failed = 0;
+        if (pthread_create(&threads[i], nullptr, client_thread, &workers[i])) {
+            perror("Bank error: pthread_create failed");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < num_atms; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+    long long elapsed = now_ns() - start;
+
+    vector<long long> latencies;
+    long long failed = 0;
+    for (const Client_Worker& worker : workers) {
+        latencies.insert(latencies.end(), worker.latencies.begin(), worker.latencies.end());
+        failed += worker.failed;
+    }
+    sort(latencies.begin(), latencies.end());
+
+    double seconds = elapsed / 1e9;
+    cout << "{" << endl;
+    cout << "  \"config\": {\"server\": \"" << server_address << "\", \"accounts\": " << config.accounts
+         << ", \"atms\": " << num_atms << ", \"ops_per_atm\": " << config.operations_per_atm
+         << ", \"pipeline\": " << pipeline_depth << ", \"binary\": " << (use_binary ? "true" : "false") << "}," << endl;
+    cout << "  \"requests\": " << latencies.size() << "," << endl;
+    cout << "  \"failed\": " << failed << "," << endl;
+    cout << "  \"elapsed_seconds\": " << fixed << setprecision(6) << seconds << "," << endl;
+    cout << "  \"requests_per_sec\": " << setprecision(1) << (seconds > 0 ? latencies.size() / seconds : 0.0) << "," << endl;
+    cout << "  \"latency_ns\": {\"p50\": " << percentile(latencies, 0.50) << ", \"p99\": " << percentile(latencies, 0.99)
+         << ", \"p999\": " << percentile(latencies, 0.999) << ", \"max\": " << (latencies.empty() ? 0 : latencies.back()) << "}" << endl;
+    cout << "}" << endl;
+
+    return 0;
+}
@@ -0,0 +1,184 @@
+#include "batch.hpp"
+#include <atomic>
+#include <fstream>
+#include <unordered_map>
+#include <pthread.h>
+#include "bank.hpp"
+
+struct Batch_Loader {
+    string file_name;
+    int atm_id;
+    vector<Batch_Operation> operations;
+    bool loaded;
+};
+
+static void* batch_loader_thread(void* arg)
+{
+    Batch_Loader* loader = static_cast<Batch_Loader*>(arg);
+    ifstream atm_file(loader->file_name);
+    loader->loaded = atm_file.is_open();
+
+    string operation_line;
+    while (loader->loaded && getline(atm_file, operation_line)) {
+        Batch_Operation operation;
+        operation.atm_id = loader->atm_id;
+        operation.operation_words = tokenize_operation(operation_line);
+        if (!operation.operation_words.empty()) {
+            loader->operations.push_back(operation);
+        }
+    }
+    return nullptr;
+}
+
+bool load_batch(const vector<string>& atm_files, Batch_Plan& plan)
+{
+    vector<Batch_Loader> loaders(atm_files.size());
+    vector<pthread_t> threads(atm_files.size());
+    for (size_t i = 0; i < atm_files.size(); i++) {
+        loaders[i].file_name = atm_files[i];
+        loaders[i].atm_id = i + 1;
+        loaders[i].loaded = false;
+        if (pthread_create(&threads[i], nullptr, batch_loader_thread, &loaders[i])) {
+            perror("Bank error: pthread_create failed for batch loader thread");
+            exit(1);
+        }
+    }
+    for (size_t i = 0; i < atm_files.size(); i++) {
+        if (pthread_join(threads[i], nullptr)) {
+            perror("Bank error: pthread_join failed for batch loader thread");
+            exit(1);
+        }
+    }
+
+    plan.atm_count = atm_files.size();
+    plan.operations.clear();
+    plan.waves.clear();
+
+    // Round-robin merge across ATMs
+    size_t total = 0;
+    for (const Batch_Loader& loader : loaders) {
+        if (!loader.loaded) {
+            return false;
+        }
+        total += loader.operations.size();
+    }
+    plan.operations.reserve(total);
+    for (size_t line = 0; plan.operations.size() < total; line++) {
+        for (Batch_Loader& loader : loaders) {
+            if (line < loader.operations.size()) {
+                plan.operations.push_back(move(loader.operations[line]));
+            }
+        }
+    }
+    return true;
+}
+
+void plan_batch_waves(Batch_Plan& plan)
+{
+    unordered_map<int, size_t> next_wave_for_account; // first wave after the account's last operation
+    size_t first_free_wave = 0;   // first wave after the last barrier
+    size_t wave_count = 0;
+    vector<size_t> operation_wave(plan.operations.size());
+    vector<int> accounts;
+
+    for (size_t i = 0; i < plan.operations.size(); i++) {
+        size_t wave;
+        if (!operation_accounts(plan.operations[i].operation_words, accounts)) {
+            wave = wave_count;
+            first_free_wave = wave + 1;
+            next_wave_for_account.clear();
+        } else {
+            wave = first_free_wave;
+            for (int account : accounts) {
+                auto next = next_wave_for_account.find(account);
+                if (next != next_wave_for_account.end() && next->second > wave) {
+                    wave = next->second;
+                }
+            }
+            for (int account : accounts) {
+                next_wave_for_account[account] = wave + 1;
+            }
+        }
+        operation_wave[i] = wave;
+        if (wave + 1 > wave_count) {
+            wave_count = wave + 1;
+        }
+    }
+
+    plan.waves.assign(wave_count, vector<size_t>());
+    for (size_t i = 0; i < plan.operations.size(); i++) {
+        plan.waves[operation_wave[i]].push_back(i);
+    }
+}
+
+/* Shared state of a batch run */
+struct Batch_Run {
+    Bank* bank;
+    const Batch_Plan* plan;
+    vector<char> closed_atms;       // only written by C, which runs alone in its wave
+    vector<atomic<size_t>> cursors; // per wave, next operation to claim
+    pthread_barrier_t wave_barrier;
+
+    Batch_Run(size_t wave_count) : cursors(wave_count) {}
+};
+
+static void execute_batch_operation(Batch_Run* run, const Batch_Operation& operation)
+{
+    if (run->closed_atms[operation.atm_id - 1]) {
+        return;
+    }
+
+    int status = run->bank->execute_operation(operation.operation_words, operation.atm_id);
+    if (operation.operation_words[0][0] == 'C' && status == SUCCESS) {
+        int target_atm_id = stoi(operation.operation_words[1]);
+        run->closed_atms[target_atm_id - 1] = 1;
+    }
+}
+
+static void* batch_worker_thread(void* arg)
+{
+    Batch_Run* run = static_cast<Batch_Run*>(arg);
+    const Batch_Plan* plan = run->plan;
+
+    for (size_t wave = 0; wave < plan->waves.size(); wave++) {
+        const vector<size_t>& operations = plan->waves[wave];
+        size_t next;
+        while ((next = run->cursors[wave].fetch_add(1)) < operations.size()) {
+            execute_batch_operation(run, plan->operations[operations[next]]);
+        }
+        pthread_barrier_wait(&run->wave_barrier);
+    }
+    return nullptr;
+}
+
+void run_batch(Bank* bank, const Batch_Plan& plan, int worker_count)
+{
+    if (worker_count < 1) {
+        worker_count = 1;
+    }
+
+    Batch_Run run(plan.waves.size());
+    run.bank = bank;
+    run.plan = &plan;
+    run.closed_atms.assign(plan.atm_count, 0);
+    for (atomic<size_t>& cursor : run.cursors) {
+        cursor = 0;
+    }
+    pthread_barrier_init(&run.wave_barrier, nullptr, worker_count);
+
+    vector<pthread_t> threads(worker_count);
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&threads[i], nullptr, batch_worker_thread, &run)) {
+            perror("Bank error: pthread_create failed for batch thread");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_join(threads[i], nullptr)) {
+            perror("Bank error: pthread_join failed for batch thread");
+            exit(1);
+        }
+    }
+
+    pthread_barrier_destroy(&run.wave_barrier);
+}
@@ -0,0 +1,37 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Bank;
+
+struct Batch_Operation {
+    int atm_id;
+    vector<string> operation_words;
+};
+
+/*
+ * Bulk reprocessing of a set of ATM files. All files are read up front and
+ * merged round-robin (line 1 of every ATM, then line 2, ...), which fixes one
+ * deterministic order. Every operation is placed in the first wavefront after
+ * the last earlier operation on any of its accounts; C and R are barriers that
+ * run alone. Waves run in parallel on a worker pool, so operations on
+ * different accounts overlap while conflicting ones keep their order and the
+ * final balances match the sequential run of the merged order.
+ */
+struct Batch_Plan {
+    vector<Batch_Operation> operations;  // merged order
+    vector<vector<size_t>> waves;        // indexes into operations
+    int atm_count;
+};
+
+// Reads and tokenizes the ATM files, one thread per file
+bool load_batch(const vector<string>& atm_files, Batch_Plan& plan);
+void plan_batch_waves(Batch_Plan& plan);
+// Runs the plan; operations of an ATM closed by an earlier C are skipped
+void run_batch(Bank* bank, const Batch_Plan& plan, int worker_count);
+
+#endif
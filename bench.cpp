@@ -0,0 +1,1146 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <queue>
+#include <deque>
+#include <unordered_set>
+#include <random>
+#include <pthread.h>
+#include <sched.h>
+#include <getopt.h>
+#include "account.hpp"
+#include "bank.hpp"
+#include "workload.hpp"
+#include "handlers.hpp"
+#include "command_pool.hpp"
+#include "mpmc_queue.hpp"
+#include "dedup.hpp"
+
+/*
+ * Throughput benchmark: runs a workload against an in-process Bank with latency
+ * injection off and reports ops/sec, latency percentiles and a final balance
+ * checksum as JSON, so two builds can be compared on identical work.
+ */
+
+Segmented_Log log_file;
+
+struct Bench_Worker {
+    int atm_id;
+    const vector<string>* lines;
+    vector<long long> latencies;
+    long long failed;
+};
+
+static Bank* bench_bank;
+static Mpmc_Priority_Queue<Queued_Command*> bench_vip_commands(VIP_PRIORITY_LEVELS, VIP_LEVEL_CAPACITY);
+static Queue_Waiters bench_vip_waiters;
+static int bench_vip_workers = 0;
+
+#define VIP_PUSH_WAIT_NS 10000000 // same bound as the bank's ATMs
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static bool run_bench_operation(const vector<string>& operation_words, int atm_id, bool is_persistent) {
+    int attempts = is_persistent ? MAX_RETRIES : 1;
+    for (int i = 0; i < attempts; i++) {
+        if (bench_bank->execute_operation(operation_words, atm_id) == SUCCESS) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool has_word(const vector<string>& operation_words, const string& prefix) {
+    for (const string& word : operation_words) {
+        if (word.compare(0, prefix.size(), prefix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int bench_batch_size = 1;
+
+static void* bench_atm_thread(void* arg) {
+    Bench_Worker* worker = static_cast<Bench_Worker*>(arg);
+    vector<vector<string>> pending_batch;
+    vector<long long> pending_starts;
+    vector<int> batch_statuses;
+    vector<string> operation_words;
+
+    // A command's latency runs from reading it to the end of its batch
+    auto flush_batch = [&]() {
+        if (pending_batch.empty()) {
+            return;
+        }
+        bench_bank->execute_batch(pending_batch, worker->atm_id, batch_statuses);
+        long long end = now_ns();
+        for (size_t i = 0; i < pending_batch.size(); i++) {
+            if (batch_statuses[i] != SUCCESS) {
+                worker->failed++;
+            }
+            worker->latencies.push_back(end - pending_starts[i]);
+        }
+        pending_batch.clear();
+        pending_starts.clear();
+    };
+
+    for (const string& line : *worker->lines) {
+        long long start = now_ns();
+        tokenize_operation(line, operation_words);
+        if (operation_words.empty()) {
+            continue;
+        }
+
+        for (const string& word : operation_words) {
+            if (word.compare(0, 4, "VIP=") == 0) {
+                int vip_level = atoi(word.c_str() + 4);
+                Queued_Command* command = Queued_Command_Pool::acquire();
+                command->set(line, worker->atm_id, vip_level, has_word(operation_words, "PERSISTENT"));
+                command->enqueue_ns = start;
+                // Like the bank: no VIP threads, or a level still full after
+                // VIP_PUSH_WAIT_NS, and the ATM runs the command itself
+                bool queued = bench_vip_workers > 0;
+                while (queued && !bench_vip_commands.try_push(vip_level, command)) {
+                    queued = now_ns() - start <= VIP_PUSH_WAIT_NS;
+                    sched_yield();
+                }
+                if (queued) {
+                    bench_vip_waiters.notify();
+                } else {
+                    bool is_persistent = command->is_persistent;
+                    Queued_Command_Pool::release(command);
+                    if (!run_bench_operation(operation_words, worker->atm_id, is_persistent)) {
+                        worker->failed++;
+                    }
+                    worker->latencies.push_back(now_ns() - start);
+                }
+                operation_words.clear();
+                break;
+            }
+        }
+        if (operation_words.empty()) {
+            continue;
+        }
+
+        bool is_persistent = has_word(operation_words, "PERSISTENT");
+        if (bench_batch_size > 1 && !is_persistent && batchable_operation(operation_words)) {
+            pending_batch.push_back(operation_words);
+            pending_starts.push_back(start);
+            if (static_cast<int>(pending_batch.size()) >= bench_batch_size) {
+                flush_batch();
+            }
+            continue;
+        }
+        flush_batch();
+
+        if (!run_bench_operation(operation_words, worker->atm_id, is_persistent)) {
+            worker->failed++;
+        }
+        worker->latencies.push_back(now_ns() - start);
+    }
+    flush_batch();
+
+    return nullptr;
+}
+
+static void* bench_vip_thread(void* arg) {
+    Bench_Worker* worker = static_cast<Bench_Worker*>(arg);
+    vector<string> operation_words;
+
+    while (true) {
+        Queued_Command* command;
+        if (!bench_vip_commands.try_pop(command)) {
+            if (!bench_vip_waiters.wait([]() { return bench_vip_commands.size() > 0; })) {
+                break;
+            }
+            continue;
+        }
+
+        command->get_words(operation_words);
+        if (!run_bench_operation(operation_words, command->atm_id, command->is_persistent)) {
+            worker->failed++;
+        }
+        // VIP latency includes the time spent waiting in the queue
+        worker->latencies.push_back(now_ns() - command->enqueue_ns);
+        Queued_Command_Pool::release(command);
+    }
+
+    return nullptr;
+}
+
+static long long percentile(const vector<long long>& sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(ceil(fraction * sorted.size()));
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+static bool read_lines(const string& path, vector<string>& lines) {
+    ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    string line;
+    while (getline(file, line)) {
+        lines.push_back(line);
+    }
+    return true;
+}
+
+/* Times one analytics query, best of a few runs */
+template <typename Query>
+static double time_query_ms(Query query) {
+    double best = 0;
+    for (int run = 0; run < 5; run++) {
+        long long start = now_ns();
+        query();
+        double elapsed = (now_ns() - start) / 1e6;
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+/*
+ * Analytics benchmark: the aggregates over a synthetic snapshot of analytics_accounts
+ * balances (drawn from the workload seed), plus the cost of taking a real snapshot
+ * of the bench bank after its setup.
+ */
+static string analytics_bench_json(const Workload_Config& config, long long analytics_accounts, int threads) {
+    Balance_Snapshot snapshot;
+    long long start = now_ns();
+    bench_bank->snapshot_balances(snapshot);
+    double bank_snapshot_ms = (now_ns() - start) / 1e6;
+    size_t bank_accounts = snapshot.balances.size();
+
+    mt19937 random(config.seed);
+    snapshot.account_ids.resize(analytics_accounts);
+    snapshot.balances.resize(analytics_accounts);
+    for (long long i = 0; i < analytics_accounts; i++) {
+        snapshot.account_ids[i] = i + 1;
+        snapshot.balances[i] = random_int(random, 0, 2 * config.initial_balance);
+    }
+
+    long long total = 0, below = 0;
+    Balance_Distribution distribution;
+    vector<pair<int, int>> top;
+    vector<int> bounds;
+    for (int bound = config.initial_balance / 5; bound <= 2 * config.initial_balance; bound += config.initial_balance / 5) {
+        bounds.push_back(bound);
+    }
+
+    double total_ms = time_query_ms([&]() { total = total_balance(snapshot, threads); });
+    double below_ms = time_query_ms([&]() { below = count_below(snapshot, config.initial_balance / 10, threads); });
+    double distribution_ms = time_query_ms([&]() { balance_distribution(snapshot, bounds, distribution, threads); });
+    double top_ms = time_query_ms([&]() { top_k_accounts(snapshot, 10, top, threads); });
+
+    stringstream json;
+    json << "{" << endl;
+    json << "  \"config\": {\"accounts\": " << analytics_accounts << ", \"threads\": " << threads << ", \"seed\": " << config.seed << "}," << endl;
+    json << "  \"bank_snapshot\": {\"accounts\": " << bank_accounts << ", \"ms\": " << fixed << setprecision(3) << bank_snapshot_ms << "}," << endl;
+    json << "  \"total\": {\"ms\": " << total_ms << ", \"value\": " << total << "}," << endl;
+    json << "  \"count_below\": {\"ms\": " << below_ms << ", \"threshold\": " << config.initial_balance / 10 << ", \"value\": " << below << "}," << endl;
+    json << "  \"distribution\": {\"ms\": " << distribution_ms << ", \"min\": " << distribution.min_balance << ", \"max\": " << distribution.max_balance
+         << ", \"mean\": " << setprecision(2) << distribution.mean_balance << ", \"buckets\": [";
+    for (size_t i = 0; i < distribution.bucket_counts.size(); i++) {
+        json << (i ? ", " : "") << distribution.bucket_counts[i];
+    }
+    json << "]}," << endl;
+    json << "  \"top_10\": {\"ms\": " << setprecision(3) << top_ms << ", \"accounts\": [";
+    for (size_t i = 0; i < top.size(); i++) {
+        json << (i ? ", " : "") << "[" << top[i].first << ", " << top[i].second << "]";
+    }
+    json << "]}" << endl;
+    json << "}" << endl;
+    return json.str();
+}
+
+/* Average cost of one handler call, over the same account picks for every combination */
+template <typename Op, typename Lock, typename Log, typename Cell>
+static double time_handler_ns(vector<Cell*>& cells, const vector<int>& picks) {
+    int balance;
+    long long start = now_ns();
+    for (int pick : picks) {
+        Operation_Handler<Op, Password_Auth, Lock, Log>::run(*cells[pick], "0000", 1, &balance, 1);
+    }
+    return static_cast<double>(now_ns() - start) / picks.size();
+}
+
+template <typename Lock, typename Log, typename Cell>
+static void handler_row_json(stringstream& json, const char* lock_name, const char* log_name,
+                             vector<Cell*>& cells, const vector<int>& picks) {
+    double deposit_ns = time_handler_ns<Deposit_Op, Lock, Log>(cells, picks);
+    double withdraw_ns = time_handler_ns<Withdraw_Op, Lock, Log>(cells, picks);
+    double balance_ns = time_handler_ns<Balance_Op, Lock, Log>(cells, picks);
+    json << (json.tellp() > 0 ? ",\n" : "") << "    {\"lock\": \"" << lock_name << "\", \"log\": \"" << log_name << "\", \"deposit_ns\": "
+         << fixed << setprecision(1) << deposit_ns << ", \"withdraw_ns\": " << withdraw_ns << ", \"balance_ns\": " << balance_ns << "}";
+}
+
+template <typename Lock, typename Cell>
+static void handler_rows_json(stringstream& json, const char* lock_name, vector<Cell*>& cells, const vector<int>& picks) {
+    handler_row_json<Lock, No_Log>(json, lock_name, "off", cells, picks);
+    handler_row_json<Lock, Text_Log>(json, lock_name, "text", cells, picks);
+    handler_row_json<Lock, Binary_Log>(json, lock_name, "binary", cells, picks);
+}
+
+/*
+ * Handler benchmark: single threaded cost of every operation handler
+ * combination (operation x lock mode x log mode, see handlers.hpp) over
+ * config.accounts cells. "account" is the Account path the bank itself runs.
+ */
+static string handlers_bench_json(const Workload_Config& config, int operations) {
+    vector<Account*> accounts;
+    vector<Balance_Cell*> cells;
+    for (int id = 1; id <= config.accounts; id++) {
+        accounts.push_back(new Account(id, "0000", config.initial_balance));
+        cells.push_back(new Balance_Cell(id, "0000", config.initial_balance));
+    }
+    mt19937 random(config.seed);
+    vector<int> picks(operations);
+    for (int& pick : picks) {
+        pick = random_int(random, 0, config.accounts - 1);
+    }
+
+    stringstream rows;
+    handler_rows_json<Account_Lock>(rows, "account", accounts, picks);
+    handler_rows_json<Mutex_Lock>(rows, "mutex", cells, picks);
+    handler_rows_json<Atomic_Lock>(rows, "atomic", cells, picks);
+    handler_rows_json<Seqlock_Lock>(rows, "seqlock", cells, picks);
+
+    for (Account* cell : accounts) {
+        delete cell;
+    }
+    for (Balance_Cell* cell : cells) {
+        delete cell;
+    }
+
+    stringstream json;
+    json << "{" << endl;
+    json << "  \"config\": {\"accounts\": " << config.accounts << ", \"ops\": " << operations << ", \"seed\": " << config.seed << "}," << endl;
+    json << "  \"handlers\": [" << endl << rows.str() << endl << "  ]" << endl;
+    json << "}" << endl;
+    return json.str();
+}
+
+/* The mutex-guarded containers the lock-free queues replaced, behind the queue benchmark's interface */
+struct Mutex_Fifo_Queue {
+    static const int order = 1; // per producer
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    deque<long long> items;
+    bool closed;
+
+    explicit Mutex_Fifo_Queue(size_t) : closed(false) {
+        pthread_mutex_init(&mutex, nullptr);
+        pthread_cond_init(&cond, nullptr);
+    }
+    ~Mutex_Fifo_Queue() {
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&cond);
+    }
+    void push(int, long long item) {
+        pthread_mutex_lock(&mutex);
+        items.push_back(item);
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+    bool pop(long long& item) {
+        pthread_mutex_lock(&mutex);
+        while (items.empty() && !closed) {
+            pthread_cond_wait(&cond, &mutex);
+        }
+        bool popped = !items.empty();
+        if (popped) {
+            item = items.front();
+            items.pop_front();
+        }
+        pthread_mutex_unlock(&mutex);
+        return popped;
+    }
+    void close() {
+        pthread_mutex_lock(&mutex);
+        closed = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+};
+
+struct Mutex_Priority_Queue {
+    static const int order = 0; // priority_queue is not stable
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    priority_queue<pair<int, long long>> items;
+    bool closed;
+
+    explicit Mutex_Priority_Queue(size_t) : closed(false) {
+        pthread_mutex_init(&mutex, nullptr);
+        pthread_cond_init(&cond, nullptr);
+    }
+    ~Mutex_Priority_Queue() {
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&cond);
+    }
+    void push(int level, long long item) {
+        pthread_mutex_lock(&mutex);
+        items.push(make_pair(level, item));
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+    bool pop(long long& item) {
+        pthread_mutex_lock(&mutex);
+        while (items.empty() && !closed) {
+            pthread_cond_wait(&cond, &mutex);
+        }
+        bool popped = !items.empty();
+        if (popped) {
+            item = items.top().second;
+            items.pop();
+        }
+        pthread_mutex_unlock(&mutex);
+        return popped;
+    }
+    void close() {
+        pthread_mutex_lock(&mutex);
+        closed = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+};
+
+struct Lockfree_Fifo_Queue {
+    static const int order = 1;
+    Mpmc_Queue<long long> queue;
+    Queue_Waiters waiters;
+
+    explicit Lockfree_Fifo_Queue(size_t capacity) : queue(capacity) {}
+    void push(int, long long item) {
+        while (!queue.try_push(item)) {
+            sched_yield();
+        }
+        waiters.notify();
+    }
+    bool pop(long long& item) {
+        while (!queue.try_pop(item)) {
+            if (!waiters.wait([this]() { return !queue.empty(); })) {
+                return false;
+            }
+        }
+        return true;
+    }
+    void close() {
+        waiters.close();
+    }
+};
+
+struct Lockfree_Priority_Queue {
+    static const int order = 2; // per producer within a level
+    Mpmc_Priority_Queue<long long> queue;
+    Queue_Waiters waiters;
+
+    explicit Lockfree_Priority_Queue(size_t capacity) : queue(VIP_PRIORITY_LEVELS, capacity) {}
+    void push(int level, long long item) {
+        while (!queue.try_push(level, item)) {
+            sched_yield();
+        }
+        waiters.notify();
+    }
+    bool pop(long long& item) {
+        while (!queue.try_pop(item)) {
+            if (!waiters.wait([this]() { return queue.size() > 0; })) {
+                return false;
+            }
+        }
+        return true;
+    }
+    void close() {
+        waiters.close();
+    }
+};
+
+struct Queue_Bench_Result {
+    double ops_per_sec;
+    long long lost;
+    long long duplicated;
+    long long out_of_order;
+};
+
+/*
+ * Producers push items 0..ops-1 (producer p owns one contiguous range, each
+ * item with a VIP level); consumers pop until the queue is closed and drained.
+ * Every item must arrive exactly once, and in the order the queue promises.
+ */
+template <typename Queue>
+struct Queue_Bench {
+    struct Thread {
+        Queue_Bench* bench;
+        int index;
+        vector<long long> received;
+        long long out_of_order;
+    };
+
+    Queue queue;
+    long long items_per_producer;
+    int producers;
+    const vector<int>& levels;
+
+    Queue_Bench(size_t capacity, long long items_per_producer, int producers, const vector<int>& levels)
+        : queue(capacity), items_per_producer(items_per_producer), producers(producers), levels(levels) {}
+
+    static void* producer_main(void* arg) {
+        Thread* thread = static_cast<Thread*>(arg);
+        Queue_Bench* bench = thread->bench;
+        long long first = thread->index * bench->items_per_producer;
+        for (long long item = first; item < first + bench->items_per_producer; item++) {
+            bench->queue.push(bench->levels[item], item);
+        }
+        return nullptr;
+    }
+
+    static void* consumer_main(void* arg) {
+        Thread* thread = static_cast<Thread*>(arg);
+        Queue_Bench* bench = thread->bench;
+        int streams = Queue::order == 2 ? VIP_PRIORITY_LEVELS : 1;
+        vector<long long> last(bench->producers * streams, -1);
+        long long item;
+        while (bench->queue.pop(item)) {
+            thread->received.push_back(item);
+            if (Queue::order > 0) {
+                int stream = static_cast<int>(item / bench->items_per_producer) * streams +
+                             (Queue::order == 2 ? bench->levels[item] : 0);
+                if (item < last[stream]) {
+                    thread->out_of_order++;
+                }
+                last[stream] = item;
+            }
+        }
+        return nullptr;
+    }
+};
+
+template <typename Queue>
+static Queue_Bench_Result run_queue_bench(int threads, long long operations, const vector<int>& levels, size_t capacity) {
+    Queue_Bench<Queue> bench(capacity, operations / threads, threads, levels);
+    vector<typename Queue_Bench<Queue>::Thread> producers(threads), consumers(threads);
+    vector<pthread_t> producer_threads(threads), consumer_threads(threads);
+
+    long long start = now_ns();
+    for (int i = 0; i < threads; i++) {
+        consumers[i].bench = producers[i].bench = &bench;
+        consumers[i].index = producers[i].index = i;
+        consumers[i].out_of_order = 0;
+        if (pthread_create(&consumer_threads[i], nullptr, Queue_Bench<Queue>::consumer_main, &consumers[i]) ||
+            pthread_create(&producer_threads[i], nullptr, Queue_Bench<Queue>::producer_main, &producers[i])) {
+            perror("Bank error: pthread_create failed");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(producer_threads[i], nullptr);
+    }
+    bench.queue.close();
+    for (int i = 0; i < threads; i++) {
+        pthread_join(consumer_threads[i], nullptr);
+    }
+    long long elapsed = now_ns() - start;
+
+    long long total = bench.items_per_producer * threads;
+    vector<unsigned char> seen(total, 0);
+    Queue_Bench_Result result = {total * 1e9 / elapsed, 0, 0, 0};
+    for (const auto& consumer : consumers) {
+        result.out_of_order += consumer.out_of_order;
+        for (long long item : consumer.received) {
+            if (seen[item]++) {
+                result.duplicated++;
+            }
+        }
+    }
+    for (unsigned char count : seen) {
+        if (count == 0) {
+            result.lost++;
+        }
+    }
+    return result;
+}
+
+static void queue_row_json(stringstream& json, const char* name, const Queue_Bench_Result& result) {
+    json << (json.tellp() > 0 ? ",\n" : "") << "    {\"queue\": \"" << name << "\", \"ops_per_sec\": " << fixed << setprecision(1)
+         << result.ops_per_sec << ", \"lost\": " << result.lost << ", \"duplicated\": " << result.duplicated
+         << ", \"out_of_order\": " << result.out_of_order << "}";
+}
+
+/*
+ * Queue benchmark and stress test: `threads` producers hand `operations` items
+ * to `threads` consumers through each queue, the mutex-guarded containers the
+ * VIP queue used before and the lock-free ones it uses now. Items carry VIP
+ * levels 1..100 drawn from the workload seed. *failures counts lost,
+ * duplicated and misordered items.
+ */
+static string queue_bench_json(const Workload_Config& config, long long operations, int threads, long long* failures) {
+    threads = max(threads, 1);
+    operations = max(operations / threads, 1LL) * threads;
+    mt19937 random(config.seed);
+    vector<int> levels(operations);
+    for (int& item_level : levels) {
+        item_level = random_int(random, 1, 100);
+    }
+
+    stringstream rows;
+    Queue_Bench_Result results[4] = {
+        run_queue_bench<Mutex_Fifo_Queue>(threads, operations, levels, VIP_LEVEL_CAPACITY),
+        run_queue_bench<Lockfree_Fifo_Queue>(threads, operations, levels, VIP_LEVEL_CAPACITY),
+        run_queue_bench<Mutex_Priority_Queue>(threads, operations, levels, VIP_LEVEL_CAPACITY),
+        run_queue_bench<Lockfree_Priority_Queue>(threads, operations, levels, VIP_LEVEL_CAPACITY)
+    };
+    const char* names[4] = {"mutex_deque", "mpmc", "mutex_priority_queue", "mpmc_priority"};
+    *failures = 0;
+    for (int i = 0; i < 4; i++) {
+        queue_row_json(rows, names[i], results[i]);
+        *failures += results[i].lost + results[i].duplicated + results[i].out_of_order;
+    }
+
+    stringstream json;
+    json << "{" << endl;
+    json << "  \"config\": {\"ops\": " << operations << ", \"producers\": " << threads << ", \"consumers\": " << threads
+         << ", \"capacity\": " << VIP_LEVEL_CAPACITY << ", \"seed\": " << config.seed << "}," << endl;
+    json << "  \"queues\": [" << endl << rows.str() << endl << "  ]" << endl;
+    json << "}" << endl;
+    return json.str();
+}
+
+/* The global-lock alternative to Dedup_Table: keys in a mutex-guarded hash set */
+struct Mutex_Dedup_Set {
+    pthread_mutex_t mutex;
+    unordered_set<unsigned long long> keys;
+
+    Mutex_Dedup_Set() {
+        pthread_mutex_init(&mutex, nullptr);
+    }
+    ~Mutex_Dedup_Set() {
+        pthread_mutex_destroy(&mutex);
+    }
+    bool claim(unsigned long long key) {
+        pthread_mutex_lock(&mutex);
+        bool added = keys.insert(key).second;
+        pthread_mutex_unlock(&mutex);
+        return added;
+    }
+};
+
+/*
+ * Every thread claims the same `keys` keys, as ATMs resending one command
+ * would; each key must be claimed exactly once over all threads.
+ */
+struct Dedup_Bench {
+    struct Thread {
+        Dedup_Bench* bench;
+        long long claimed;
+    };
+
+    Dedup_Table* table;
+    Mutex_Dedup_Set* set;
+    long long keys;
+
+    static void* table_main(void* arg) {
+        Thread* thread = static_cast<Thread*>(arg);
+        Dedup_Claim claim;
+        for (long long key = 1; key <= thread->bench->keys; key++) {
+            if (thread->bench->table->claim(key, &claim) == DEDUP_NEW) {
+                thread->bench->table->finish(claim, true);
+                thread->claimed++;
+            }
+        }
+        return nullptr;
+    }
+
+    static void* set_main(void* arg) {
+        Thread* thread = static_cast<Thread*>(arg);
+        for (long long key = 1; key <= thread->bench->keys; key++) {
+            if (thread->bench->set->claim(key)) {
+                thread->claimed++;
+            }
+        }
+        return nullptr;
+    }
+};
+
+// Claims per second over all threads; *duplicated counts keys claimed more than once
+static double run_dedup_bench(Dedup_Bench& bench, int threads, void* (*thread_main)(void*), long long* duplicated) {
+    vector<Dedup_Bench::Thread> workers(threads);
+    vector<pthread_t> worker_threads(threads);
+    long long start = now_ns();
+    for (int i = 0; i < threads; i++) {
+        workers[i].bench = &bench;
+        workers[i].claimed = 0;
+        if (pthread_create(&worker_threads[i], nullptr, thread_main, &workers[i])) {
+            perror("Bank error: pthread_create failed");
+            exit(1);
+        }
+    }
+    long long claimed = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(worker_threads[i], nullptr);
+        claimed += workers[i].claimed;
+    }
+    long long elapsed = now_ns() - start;
+    *duplicated = claimed - bench.keys;
+    return bench.keys * threads * 1e9 / elapsed;
+}
+
+/*
+ * Dedup table benchmark: the table's memory, the cost of claiming `operations`
+ * fresh keys, of resending committed ones and of looking up present and
+ * absent keys, the bloom filter's false pass rate, and claim throughput of
+ * `threads` threads against a mutex-guarded hash set. *failures counts keys
+ * claimed twice.
+ */
+static string dedup_bench_json(long long operations, int threads, long long* failures) {
+    threads = max(threads, 1);
+    Dedup_Table table;
+    Dedup_Claim claim;
+    int atm_id = 1;
+    vector<string> words(1);
+    unsigned long long key;
+
+    // Keys as ATMs send them: ATM 1, sequence numbers 1..operations
+    vector<unsigned long long> present(operations), absent(operations);
+    for (long long i = 0; i < operations; i++) {
+        words[0] = "KEY=" + to_string(i + 1);
+        idempotency_key(words, atm_id, &key);
+        present[i] = key;
+        idempotency_key(words, atm_id + 1, &key);
+        absent[i] = key;
+    }
+
+    long long start = now_ns();
+    for (unsigned long long present_key : present) {
+        table.claim(present_key, &claim);
+        table.finish(claim, true);
+    }
+    double claim_ns = static_cast<double>(now_ns() - start) / operations;
+
+    // Only the newest keys are sure to be remembered
+    long long remembered = min(operations, static_cast<long long>(DEDUP_CAPACITY));
+    long long resent = 0;
+    start = now_ns();
+    for (long long i = operations - remembered; i < operations; i++) {
+        resent += table.claim(present[i], &claim) == DEDUP_COMMITTED;
+    }
+    double resend_ns = static_cast<double>(now_ns() - start) / remembered;
+
+    long long hits = 0;
+    start = now_ns();
+    for (long long i = operations - remembered; i < operations; i++) {
+        hits += table.state(present[i]) == DEDUP_COMMITTED;
+    }
+    double hit_ns = static_cast<double>(now_ns() - start) / remembered;
+
+    long long misses = 0;
+    start = now_ns();
+    for (unsigned long long absent_key : absent) {
+        misses += table.state(absent_key) == DEDUP_NEW;
+    }
+    double miss_ns = static_cast<double>(now_ns() - start) / operations;
+
+    long long bloom_passes = 0;
+    for (unsigned long long absent_key : absent) {
+        bloom_passes += table.bloom_passes(absent_key);
+    }
+
+    // Contended claims, within one generation so no key is forgotten midway
+    Dedup_Table shared_table;
+    Mutex_Dedup_Set shared_set;
+    Dedup_Bench bench = {&shared_table, &shared_set, min(operations, static_cast<long long>(DEDUP_CAPACITY) - 1)};
+    long long table_duplicated, set_duplicated;
+    double table_ops = run_dedup_bench(bench, threads, Dedup_Bench::table_main, &table_duplicated);
+    double set_ops = run_dedup_bench(bench, threads, Dedup_Bench::set_main, &set_duplicated);
+    size_t set_bytes = shared_set.keys.bucket_count() * sizeof(void*) +
+                       shared_set.keys.size() * (sizeof(unsigned long long) + 2 * sizeof(void*));
+
+    *failures = (remembered - resent) + (remembered - hits) + (operations - misses) + table_duplicated + set_duplicated;
+
+    stringstream json;
+    json << fixed << setprecision(1);
+    json << "{" << endl;
+    json << "  \"config\": {\"ops\": " << operations << ", \"threads\": " << threads << ", \"capacity\": " << DEDUP_CAPACITY
+         << ", \"bloom_bits\": " << DEDUP_BLOOM_BITS << ", \"bloom_hashes\": " << DEDUP_BLOOM_HASHES << "}," << endl;
+    json << "  \"memory_bytes\": " << table.memory_bytes() << "," << endl;
+    json << "  \"claim_ns\": " << claim_ns << "," << endl;
+    json << "  \"resend_ns\": " << resend_ns << "," << endl;
+    json << "  \"lookup_hit_ns\": " << hit_ns << "," << endl;
+    json << "  \"lookup_miss_ns\": " << miss_ns << "," << endl;
+    json << "  \"bloom_false_pass_rate\": " << setprecision(4) << static_cast<double>(bloom_passes) / operations << "," << endl;
+    json << setprecision(1);
+    json << "  \"contended\": [" << endl;
+    json << "    {\"table\": \"dedup_table\", \"keys\": " << bench.keys << ", \"claims_per_sec\": " << table_ops
+         << ", \"memory_bytes\": " << shared_table.memory_bytes() << ", \"duplicated\": " << table_duplicated << "}," << endl;
+    json << "    {\"table\": \"mutex_set\", \"keys\": " << bench.keys << ", \"claims_per_sec\": " << set_ops
+         << ", \"memory_bytes\": " << set_bytes << ", \"duplicated\": " << set_duplicated << "}" << endl;
+    json << "  ]" << endl;
+    json << "}" << endl;
+    return json.str();
+}
+
+// Writes `ids` as an account file, in the given order
+static bool write_account_file(const string& path, const vector<int>& ids) {
+    ofstream file(path.c_str());
+    for (int id : ids) {
+        file << id << ",pw" << id << "," << id % 1000 << '\n';
+    }
+    return file.good();
+}
+
+/* Fisher-Yates with random_int, since std::shuffle differs between standard libraries */
+static void shuffle_ids(vector<int>& ids, mt19937& random) {
+    for (int i = static_cast<int>(ids.size()) - 1; i > 0; i--) {
+        swap(ids[i], ids[random_int(random, 0, i)]);
+    }
+}
+
+/*
+ * Bulk import benchmark: opens `accounts` accounts from a shuffled account
+ * file into an empty bank, then as many again between them (the merge path),
+ * and compares the per-account cost with one O command per account. *failures
+ * counts imports that failed or left the wrong number of accounts.
+ */
+static string import_bench_json(const Workload_Config& config, long long accounts, long long* failures) {
+    mt19937 random(config.seed);
+    vector<int> first_ids, second_ids;
+    for (long long id = 1; id <= 2 * accounts; id++) {
+        (id % 2 ? first_ids : second_ids).push_back(id);
+    }
+    shuffle_ids(first_ids, random);
+    shuffle_ids(second_ids, random);
+
+    char first_path[] = "/tmp/bank_import_XXXXXX";
+    char second_path[] = "/tmp/bank_import_XXXXXX";
+    int first_fd = mkstemp(first_path), second_fd = mkstemp(second_path);
+    if (first_fd < 0 || second_fd < 0 || !write_account_file(first_path, first_ids) || !write_account_file(second_path, second_ids)) {
+        perror("Bank error: unable to write account file");
+        exit(1);
+    }
+    close(first_fd);
+    close(second_fd);
+
+    Bank* bank = new Bank();
+    vector<pair<int, int>> balances;
+    int bank_balance;
+    *failures = 0;
+
+    long long start = now_ns();
+    *failures += bank->import_accounts(first_path, 1) != SUCCESS;
+    double import_seconds = (now_ns() - start) / 1e9;
+    start = now_ns();
+    *failures += bank->import_accounts(second_path, 1) != SUCCESS;
+    double merge_seconds = (now_ns() - start) / 1e9;
+    bank->get_balances(balances, &bank_balance);
+    *failures += static_cast<long long>(balances.size()) != 2 * accounts;
+    delete bank;
+    unlink(first_path);
+    unlink(second_path);
+
+    // O re-sorted the whole vector per account before; a few thousand show the trend
+    long long opened = min(accounts, 5000LL);
+    bank = new Bank();
+    start = now_ns();
+    for (long long i = 0; i < opened; i++) {
+        bank->create_account(first_ids[i], "pw", 0, 1);
+    }
+    double open_ns = static_cast<double>(now_ns() - start) / opened;
+    delete bank;
+
+    stringstream json;
+    json << fixed << setprecision(3);
+    json << "{" << endl;
+    json << "  \"config\": {\"accounts\": " << accounts << ", \"seed\": " << config.seed << "}," << endl;
+    json << "  \"import_seconds\": " << import_seconds << "," << endl;
+    json << "  \"merge_import_seconds\": " << merge_seconds << "," << endl;
+    json << setprecision(1);
+    json << "  \"import_ns_per_account\": " << import_seconds * 1e9 / accounts << "," << endl;
+    json << "  \"open_ns_per_account\": " << open_ns << "," << endl;
+    json << "  \"opened_accounts\": " << opened << "," << endl;
+    json << "  \"failures\": " << *failures << endl;
+    json << "}" << endl;
+    return json.str();
+}
+
+static struct option long_options[] = {
+    {"accounts", required_argument, nullptr, 0},
+    {"atms", required_argument, nullptr, 0},
+    {"ops", required_argument, nullptr, 0},
+    {"zipf", required_argument, nullptr, 0},
+    {"vip", required_argument, nullptr, 0},
+    {"persistent", required_argument, nullptr, 0},
+    {"mix", required_argument, nullptr, 0},
+    {"initial-balance", required_argument, nullptr, 0},
+    {"seed", required_argument, nullptr, 0},
+    {"vip-threads", required_argument, nullptr, 'v'},
+    {"setup", required_argument, nullptr, 's'},
+    {"output", required_argument, nullptr, 'o'},
+    {"log", required_argument, nullptr, 'l'},
+    {"hot-accounts", required_argument, nullptr, 'h'},
+    {"striped-accounts", required_argument, nullptr, 'S'},
+    {"atm-batch", required_argument, nullptr, 'b'},
+    {"analytics", required_argument, nullptr, 'a'},
+    {"analytics-threads", required_argument, nullptr, 't'},
+    {"handlers", required_argument, nullptr, 'H'},
+    {"queue", required_argument, nullptr, 'Q'},
+    {"queue-threads", required_argument, nullptr, 'q'},
+    {"dedup", required_argument, nullptr, 'd'},
+    {"dedup-threads", required_argument, nullptr, 'D'},
+    {"import", required_argument, nullptr, 'i'},
+    {nullptr, 0, nullptr, 0}
+};
+
+void print_usage() {
+    cerr << "Usage: bank_bench [workload options] [--vip-threads N] [--output FILE] [--log FILE] [--hot-accounts N]" << endl;
+    cerr << "                  [--striped-accounts N] [--atm-batch N] [--analytics ACCOUNTS [--analytics-threads N]]" << endl;
+    cerr << "                  [--handlers OPS] [--queue OPS [--queue-threads N]] [--dedup OPS [--dedup-threads N]]" << endl;
+    cerr << "                  [--import ACCOUNTS]" << endl;
+    cerr << "                  [--setup FILE <ATM input file 1> ...]" << endl;
+    cerr << "Workload options are those of bank_workload; ATM files replace the generated workload." << endl;
+}
+
+/* Prints a benchmark's JSON result, or writes it to --output */
+static void write_result(const string& json, const string& output_path) {
+    if (output_path.empty()) {
+        cout << json;
+    } else {
+        ofstream output(output_path.c_str());
+        output << json;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Workload_Config config;
+    int num_vip_threads = 2;
+    int num_hot_accounts = 0;
+    int num_striped_accounts = 0;
+    long long analytics_accounts = 0;
+    int analytics_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int handler_operations = 0;
+    long long queue_operations = 0;
+    int queue_threads = 4;
+    long long dedup_operations = 0;
+    int dedup_threads = 4;
+    long long import_accounts = 0;
+    string output_path, setup_path, log_path;
+    int option, option_index;
+
+    while ((option = getopt_long(argc, argv, "", long_options, &option_index)) != -1) {
+        switch (option) {
+            case 0:
+                if (!parse_workload_option(long_options[option_index].name, optarg, config)) {
+                    print_usage();
+                    exit(1);
+                }
+                break;
+            case 'v':
+                num_vip_threads = stoi(optarg);
+                break;
+            case 's':
+                setup_path = optarg;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            case 'l':
+                log_path = optarg;
+                break;
+            case 'h':
+                num_hot_accounts = stoi(optarg);
+                break;
+            case 'S':
+                num_striped_accounts = stoi(optarg);
+                break;
+            case 'b':
+                bench_batch_size = stoi(optarg);
+                break;
+            case 'a':
+                analytics_accounts = stoll(optarg);
+                break;
+            case 't':
+                analytics_threads = stoi(optarg);
+                break;
+            case 'H':
+                handler_operations = stoi(optarg);
+                break;
+            case 'Q':
+                queue_operations = stoll(optarg);
+                break;
+            case 'q':
+                queue_threads = stoi(optarg);
+                break;
+            case 'd':
+                dedup_operations = stoll(optarg);
+                break;
+            case 'D':
+                dedup_threads = stoi(optarg);
+                break;
+            case 'i':
+                import_accounts = stoll(optarg);
+                break;
+            default:
+                print_usage();
+                exit(1);
+        }
+    }
+
+    Workload workload;
+    if (optind < argc) {
+        if (!setup_path.empty() && !read_lines(setup_path, workload.setup_lines)) {
+            cerr << "Bank error: illegal arguments" << endl;
+            exit(1);
+        }
+        for (int i = optind; i < argc; i++) {
+            workload.atm_lines.push_back(vector<string>());
+            if (!read_lines(argv[i], workload.atm_lines.back())) {
+                cerr << "Bank error: illegal arguments" << endl;
+                exit(1);
+            }
+        }
+    } else {
+        generate_workload(config, workload);
+    }
+
+    latency_injection_enabled = false;
+    if (!log_path.empty()) {
+        log_file.open(log_path.c_str());
+    }
+
+    if (handler_operations > 0) {
+        // Both logs are written, to --log (and --log.bin) or else to /dev/null
+        log_file.close();
+        log_file.open(log_path.empty() ? "/dev/null" : log_path.c_str());
+        binary_log_file.open(log_path.empty() ? "/dev/null" : (log_path + ".bin").c_str(), ios::binary);
+        string json = handlers_bench_json(config, handler_operations);
+        write_result(json, output_path);
+        return 0;
+    }
+
+    if (queue_operations > 0) {
+        long long failures;
+        string json = queue_bench_json(config, queue_operations, queue_threads, &failures);
+        write_result(json, output_path);
+        return failures == 0 ? 0 : 1;
+    }
+
+    if (dedup_operations > 0) {
+        long long failures;
+        string json = dedup_bench_json(dedup_operations, dedup_threads, &failures);
+        write_result(json, output_path);
+        return failures == 0 ? 0 : 1;
+    }
+
+    if (import_accounts > 0) {
+        long long failures;
+        string json = import_bench_json(config, import_accounts, &failures);
+        write_result(json, output_path);
+        return failures == 0 ? 0 : 1;
+    }
+
+    bench_bank = new Bank();
+    // The lowest ids are the hottest under the Zipf generator
+    for (int id = 1; id <= num_hot_accounts; id++) {
+        bench_bank->set_hot_account(id);
+    }
+    for (int id = 1; id <= num_striped_accounts; id++) {
+        bench_bank->set_striped_account(id);
+    }
+    for (unsigned i = 0; i < workload.atm_lines.size(); i++) {
+        bench_bank->set_atm_file("atm_" + to_string(i + 1));
+    }
+    bench_bank->set_atm_closed_to_false(workload.atm_lines.size());
+
+    for (const string& line : workload.setup_lines) {
+        vector<string> operation_words = tokenize_operation(line);
+        if (!operation_words.empty()) {
+            bench_bank->execute_operation(operation_words, 0);
+        }
+    }
+
+    if (analytics_accounts > 0) {
+        string json = analytics_bench_json(config, analytics_accounts, analytics_threads);
+        write_result(json, output_path);
+        return 0;
+    }
+
+    int num_atms = workload.atm_lines.size();
+    vector<Bench_Worker> workers(num_atms + num_vip_threads);
+    vector<pthread_t> threads(workers.size());
+
+    bench_vip_workers = num_vip_threads;
+    long long start = now_ns();
+    for (unsigned i = 0; i < workers.size(); i++) {
+        bool is_atm = static_cast<int>(i) < num_atms;
+        workers[i].atm_id = is_atm ? i + 1 : 0;
+        workers[i].lines = is_atm ? &workload.atm_lines[i] : nullptr;
+        workers[i].failed = 0;
+        if (pthread_create(&threads[i], nullptr, is_atm ? bench_atm_thread : bench_vip_thread, &workers[i])) {
+            perror("Bank error: pthread_create failed");
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < num_atms; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+    bench_vip_waiters.close();
+    for (unsigned i = num_atms; i < threads.size(); i++) {
+        pthread_join(threads[i], nullptr);
+    }
+    long long elapsed = now_ns() - start;
+
+    vector<long long> latencies;
+    long long failed = 0;
+    for (const Bench_Worker& worker : workers) {
+        latencies.insert(latencies.end(), worker.latencies.begin(), worker.latencies.end());
+        failed += worker.failed;
+    }
+    sort(latencies.begin(), latencies.end());
+
+    // Checksum: order independent sum plus a hash over the sorted (id, balance) pairs
+    vector<pair<int, int>> balances;
+    int bank_balance;
+    bench_bank->get_balances(balances, &bank_balance);
+    long long balance_sum = 0;
+    for (const pair<int, int>& account : balances) {
+        balance_sum += account.second;
+    }
+    unsigned long long fnv = balances_checksum(balances);
+
+    double seconds = elapsed / 1e9;
+    stringstream json;
+    json << "{" << endl;
+    json << "  \"config\": {\"accounts\": " << config.accounts << ", \"atms\": " << num_atms
+         << ", \"ops_per_atm\": " << config.operations_per_atm << ", \"zipf\": " << config.zipf_skew
+         << ", \"vip\": " << config.vip_fraction << ", \"persistent\": " << config.persistent_fraction
+         << ", \"mix\": \"" << config.mix[0] << ":" << config.mix[1] << ":" << config.mix[2] << ":" << config.mix[3]
+         << ":" << config.mix[4] << ":" << config.mix[5] << "\", \"seed\": " << config.seed
+         << ", \"vip_threads\": " << num_vip_threads << ", \"hot_accounts\": " << num_hot_accounts << ", \"striped_accounts\": " << num_striped_accounts << ", \"atm_batch\": " << bench_batch_size << ", \"generated\": " << (optind < argc ? "false" : "true") << "}," << endl;
+    json << "  \"operations\": " << latencies.size() << "," << endl;
+    json << "  \"failed\": " << failed << "," << endl;
+    json << "  \"elapsed_seconds\": " << fixed << setprecision(6) << seconds << "," << endl;
+    json << "  \"ops_per_sec\": " << setprecision(1) << (seconds > 0 ? latencies.size() / seconds : 0.0) << "," << endl;
+    json << "  \"latency_ns\": {\"p50\": " << percentile(latencies, 0.50) << ", \"p99\": " << percentile(latencies, 0.99)
+         << ", \"p999\": " << percentile(latencies, 0.999) << ", \"max\": " << (latencies.empty() ? 0 : latencies.back()) << "}," << endl;
+    json << "  \"checksum\": {\"accounts\": " << balances.size() << ", \"balance_sum\": " << balance_sum
+         << ", \"bank_balance\": " << bank_balance << ", \"fnv1a\": \"" << hex << fnv << dec << "\"}" << endl;
+    json << "}" << endl;
+
+    write_result(json.str(), output_path);
+
+    log_file.close();
+    delete bench_bank;
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "combiner.hpp"
+#include <sched.h>
+#include "replay.hpp"
+
+#define REQUEST_EMPTY 0
+#define REQUEST_PENDING 1
+#define REQUEST_DONE 2
+
+/* Each thread owns the same slot index in every combiner */
+static atomic<int> registered_threads(0);
+static thread_local int thread_slot = -1;
+
+static int get_thread_slot()
+{
+    if (thread_slot == -1) {
+        thread_slot = registered_threads.fetch_add(1);
+    }
+    return thread_slot;
+}
+
+Account_Combiner::Account_Combiner()
+{
+    for (int i = 0; i < COMBINER_SLOTS; i++) {
+        slots[i].request.state.store(REQUEST_EMPTY);
+    }
+    if (pthread_mutex_init(&combiner_lock, nullptr)) {
+        perror("Bank error: pthread_mutex_init failed");
+    }
+}
+
+Account_Combiner::~Account_Combiner()
+{
+    if (pthread_mutex_destroy(&combiner_lock)) {
+        perror("Bank error: pthread_mutex_destroy failed");
+    }
+}
+
+int Account_Combiner::submit(Account& account, char operation, int amount, const string& password, int* new_balance, int atm_id)
+{
+    int slot = get_thread_slot();
+    if (slot >= COMBINER_SLOTS) {
+        // More threads than slots, fall back to the locked path
+        if (operation == 'D') {
+            return account.deposit(amount, password, new_balance, atm_id);
+        }
+        return account.withdraw(amount, password, new_balance, atm_id);
+    }
+
+    Request& request = slots[slot].request;
+    request.operation = operation;
+    request.amount = amount;
+    request.password = &password;
+    request.atm_id = atm_id;
+    request.recorded = replay_detach_operation(&request.record_atm_id, &request.record_line);
+    request.state.store(REQUEST_PENDING, memory_order_release);
+
+    while (request.state.load(memory_order_acquire) != REQUEST_DONE) {
+        if (pthread_mutex_trylock(&combiner_lock) == 0) {
+            combine(account);
+            pthread_mutex_unlock(&combiner_lock);
+        } else {
+            sched_yield();
+        }
+    }
+
+    *new_balance = request.new_balance;
+    int status = request.status;
+    request.state.store(REQUEST_EMPTY, memory_order_relaxed);
+    return status;
+}
+
+void Account_Combiner::combine(Account& account)
+{
+    int threads = min(registered_threads.load(memory_order_relaxed), COMBINER_SLOTS);
+
+    account.account_write_lock();
+    inject_sleep(1); // One simulated delay for the whole batch
+
+    // A few passes pick up requests published while the batch was running
+    for (int pass = 0; pass < COMBINER_PASSES; pass++) {
+        bool applied = false;
+        for (int i = 0; i < threads; i++) {
+            Request& request = slots[i].request;
+            if (request.state.load(memory_order_acquire) == REQUEST_PENDING) {
+                apply(account, request);
+                request.state.store(REQUEST_DONE, memory_order_release);
+                applied = true;
+            }
+        }
+        if (!applied) {
+            break;
+        }
+    }
+
+    account.account_write_unlock();
+}
+
+void Account_Combiner::apply(Account& account, Request& request)
+{
+    stringstream log_line;
+
+    if (request.recorded) {
+        replay_begin_operation(request.record_atm_id, request.record_line);
+    }
+
+    if (!account.check_password(*request.password)) {
+        request.status = WRONG_PASSWORD;
+        log_line << "Error " << request.atm_id << ": Your transaction failed - password for account id " << account.get_id() << " is incorrect";
+    } else if (request.operation == 'D') {
+        account.deposit_without_lock(request.amount, &request.new_balance, request.atm_id);
+        request.status = SUCCESS;
+        audit_flow(AUDIT_DEPOSITED, request.amount);
+        log_line << request.atm_id << ": Account " << account.get_id() << " new balance is " << request.new_balance << " after " << request.amount << " $ was deposited";
+    } else {
+        request.status = account.withdraw_without_lock(request.amount, &request.new_balance, request.atm_id);
+        if (request.status == NOT_ENOUGH_MONEY) {
+            log_line << "Error " << request.atm_id << ": Your transaction failed - account id " << account.get_id() << " balance is lower than " << request.amount;
+        } else {
+            log_line << request.atm_id << ": Account " << account.get_id() << " new balance is " << request.new_balance << " after " << request.amount << " $ was withdrew";
+            audit_flow(AUDIT_WITHDRAWN, request.amount);
+        }
+    }
+
+    write_to_log_file(log_line.str());
+}
@@ -0,0 +1,56 @@
+#ifndef COMBINER_H
+#define COMBINER_H
+
+#include <atomic>
+#include <string>
+#include <pthread.h>
+#include "account.hpp"
+
+#define COMBINER_SLOTS 64
+#define COMBINER_PASSES 3
+
+using namespace std;
+
+/*
+ * Flat combining for a hot account. Instead of every thread taking the account's
+ * write lock in turn, each thread publishes its deposit/withdraw in its own
+ * cache line sized slot; whichever thread wins the combiner lock takes the
+ * account lock once and applies every pending request in a batch, while the
+ * others spin on their slot until it is marked done. The combining thread
+ * records the audit flows of the requests it applies, next to their changes.
+ */
+class Account_Combiner {
+private:
+    struct Request {
+        atomic<int> state;
+        char operation;           // 'D' or 'W'
+        int amount;
+        const string* password;
+        int atm_id;
+        int status;
+        int new_balance;
+        bool recorded;            // carries a replay commit from the submitting thread
+        int record_atm_id;
+        string record_line;
+    };
+
+    struct Padded_Request {
+        Request request;
+        char padding[CACHE_LINE_SIZE - sizeof(Request) % CACHE_LINE_SIZE];
+    };
+
+    Padded_Request slots[COMBINER_SLOTS];
+    pthread_mutex_t combiner_lock;
+
+    void combine(Account& account);
+    void apply(Account& account, Request& request);
+
+public:
+    Account_Combiner();
+    ~Account_Combiner();
+
+    // Same contract as Account::deposit / Account::withdraw
+    int submit(Account& account, char operation, int amount, const string& password, int* new_balance, int atm_id);
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include "command_pool.hpp"
+#include "bank.hpp"
+
+static bool is_word_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+void Queued_Command::set(const string& operation_line, int atm_id, int vip_level, bool is_persistent)
+{
+    this->atm_id = atm_id;
+    this->vip_level = vip_level;
+    this->is_persistent = is_persistent;
+    this->enqueue_ns = 0;
+    this->line.assign(operation_line.data(), operation_line.size());
+
+    word_count = 0;
+    size_t i = 0;
+    while (i < operation_line.size()) {
+        if (is_word_separator(operation_line[i])) {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while (i < operation_line.size() && !is_word_separator(operation_line[i])) {
+            i++;
+        }
+        if (word_count == COMMAND_MAX_WORDS || i > 0xffff) {
+            word_count = -1;
+            return;
+        }
+        word_start[word_count] = start;
+        word_length[word_count] = i - start;
+        word_count++;
+    }
+}
+
+void Queued_Command::get_words(vector<string>& operation_words) const
+{
+    if (word_count < 0) {
+        string full_line;
+        get_line(full_line);
+        tokenize_operation(full_line, operation_words);
+        return;
+    }
+
+    operation_words.resize(word_count);
+    const char* text = line.data();
+    for (int i = 0; i < word_count; i++) {
+        operation_words[i].assign(text + word_start[i], word_length[i]);
+    }
+}
+
+void Queued_Command::get_line(string& operation_line) const
+{
+    operation_line.assign(line.data(), line.size());
+}
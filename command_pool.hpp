@@ -0,0 +1,182 @@
+#ifndef COMMAND_POOL_H
+#define COMMAND_POOL_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+
+using namespace std;
+
+#define COMMAND_POOL_BATCH 64       // objects moved between a thread cache and the depot at once
+#define COMMAND_INLINE_SIZE 96      // bytes of a queued command line kept inside its node
+#define COMMAND_MAX_WORDS 12        // words of a queued command kept as inline offsets
+
+/*
+ * Free lists for the objects commands are queued in (VIP queue nodes, retry
+ * chain nodes). Every thread keeps a cache of free objects and only touches
+ * the shared depot, under its mutex, once per COMMAND_POOL_BATCH acquires or
+ * releases; the depot grows by slabs of COMMAND_POOL_BATCH objects. Objects
+ * are recycled, not destroyed, so any string or vector capacity they grew is
+ * reused by the next command and a warmed-up pool does not call malloc.
+ * Objects may be released by another thread than the one that acquired them.
+ */
+template <typename T>
+class Object_Pool {
+private:
+    struct Depot {
+        pthread_mutex_t mutex;
+        vector<T*> free_objects;
+        vector<T*> slabs;
+
+        Depot() {
+            pthread_mutex_init(&mutex, nullptr);
+        }
+        ~Depot() {
+            for (T* slab : slabs) {
+                delete[] slab;
+            }
+            pthread_mutex_destroy(&mutex);
+        }
+    };
+
+    struct Cache {
+        vector<T*> free_objects;
+
+        Cache() {
+            free_objects.reserve(2 * COMMAND_POOL_BATCH + 1);
+        }
+        // A finishing thread hands its objects back to the depot
+        ~Cache() {
+            Depot& shared = depot();
+            pthread_mutex_lock(&shared.mutex);
+            shared.free_objects.insert(shared.free_objects.end(), free_objects.begin(), free_objects.end());
+            pthread_mutex_unlock(&shared.mutex);
+        }
+    };
+
+    static Depot& depot() {
+        static Depot shared;
+        return shared;
+    }
+
+    static Cache& cache() {
+        static thread_local Cache local;
+        return local;
+    }
+
+public:
+    static T* acquire() {
+        Cache& local = cache();
+        if (local.free_objects.empty()) {
+            Depot& shared = depot();
+            pthread_mutex_lock(&shared.mutex);
+            if (shared.free_objects.size() < COMMAND_POOL_BATCH) {
+                T* slab = new T[COMMAND_POOL_BATCH];
+                shared.slabs.push_back(slab);
+                for (int i = 0; i < COMMAND_POOL_BATCH; i++) {
+                    shared.free_objects.push_back(slab + i);
+                }
+            }
+            local.free_objects.assign(shared.free_objects.end() - COMMAND_POOL_BATCH, shared.free_objects.end());
+            shared.free_objects.resize(shared.free_objects.size() - COMMAND_POOL_BATCH);
+            pthread_mutex_unlock(&shared.mutex);
+        }
+        T* object = local.free_objects.back();
+        local.free_objects.pop_back();
+        return object;
+    }
+
+    static void release(T* object) {
+        Cache& local = cache();
+        local.free_objects.push_back(object);
+        if (local.free_objects.size() > 2 * COMMAND_POOL_BATCH) {
+            Depot& shared = depot();
+            pthread_mutex_lock(&shared.mutex);
+            shared.free_objects.insert(shared.free_objects.end(), local.free_objects.end() - COMMAND_POOL_BATCH, local.free_objects.end());
+            pthread_mutex_unlock(&shared.mutex);
+            local.free_objects.resize(local.free_objects.size() - COMMAND_POOL_BATCH);
+        }
+    }
+};
+
+/*
+ * String with inline storage for up to N - 1 bytes; only longer values go to
+ * the heap. Passwords and whole ATM command lines fit inline.
+ */
+template <size_t N>
+class Inline_String {
+private:
+    char inline_data[N];
+    char* heap_data;
+    size_t heap_capacity;
+    size_t length;
+
+public:
+    Inline_String() : heap_data(nullptr), heap_capacity(0), length(0) {
+        inline_data[0] = '\0';
+    }
+    ~Inline_String() {
+        free(heap_data);
+    }
+    Inline_String(const Inline_String&) = delete;
+    Inline_String& operator=(const Inline_String&) = delete;
+
+    void assign(const char* text, size_t text_length) {
+        char* target = inline_data;
+        if (text_length >= N) {
+            // A spilled buffer is kept for the next long value
+            if (text_length >= heap_capacity) {
+                char* grown = static_cast<char*>(realloc(heap_data, text_length + 1));
+                if (grown == nullptr) {
+                    perror("Bank error: realloc failed");
+                    exit(1);
+                }
+                heap_data = grown;
+                heap_capacity = text_length + 1;
+            }
+            target = heap_data;
+        }
+        memcpy(target, text, text_length);
+        target[text_length] = '\0';
+        length = text_length;
+    }
+
+    const char* data() const {
+        return length >= N ? heap_data : inline_data;
+    }
+    size_t size() const {
+        return length;
+    }
+    bool is_inline() const {
+        return length < N;
+    }
+};
+
+/*
+ * A command waiting in the VIP queue: the line is held inline and its words
+ * are offsets into it, so queueing a command and handing its words to the
+ * executor reuses memory instead of allocating.
+ */
+struct Queued_Command {
+    int atm_id;
+    int vip_level;
+    bool is_persistent;
+    long long enqueue_ns;
+    Inline_String<COMMAND_INLINE_SIZE> line;
+    int word_count;                     // -1: more than COMMAND_MAX_WORDS, re-tokenized on use
+    unsigned short word_start[COMMAND_MAX_WORDS];
+    unsigned short word_length[COMMAND_MAX_WORDS];
+
+    // Copies and tokenizes the line (ATM command syntax, see tokenize_operation)
+    void set(const string& operation_line, int atm_id, int vip_level, bool is_persistent);
+    // Fills operation_words, reusing the strings already in it
+    void get_words(vector<string>& operation_words) const;
+    void get_line(string& operation_line) const;
+};
+
+typedef Object_Pool<Queued_Command> Queued_Command_Pool;
+
+#endif
@@ -0,0 +1,202 @@
+#include "dedup.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+#define SLOT_EMPTY 0ULL
+#define SLOT_TOMBSTONE ~0ULL          // a claim whose command did not commit
+#define SLOT_RUNNING (1ULL << 63)     // set on a claimed key until finish()
+
+static unsigned long long mix_key(unsigned long long key)
+{
+    // splitmix64 finalizer: consecutive sequence numbers spread over the table
+    key += 0x9e3779b97f4a7c15ULL;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+bool idempotency_key(const vector<string>& operation_words, int atm_id, unsigned long long* key)
+{
+    for (const string& word : operation_words) {
+        if (word.compare(0, 4, "KEY=") == 0 && word.size() > 4) {
+            char* end;
+            unsigned long long sequence = strtoull(word.c_str() + 4, &end, 10);
+            if (*end != '\0') {
+                return false;
+            }
+            // 22 bits of ATM id and 40 of sequence; the + 1 keeps keys off SLOT_EMPTY
+            *key = ((static_cast<unsigned long long>(atm_id) & ((1ULL << 22) - 1)) << 40 |
+                    (sequence & ((1ULL << 40) - 1))) + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void add_idempotency_key(vector<string>& operation_words, string& operation_line, long long sequence)
+{
+    for (const string& word : operation_words) {
+        if (word.compare(0, 4, "KEY=") == 0) {
+            return;
+        }
+    }
+    operation_words.push_back("KEY=" + to_string(sequence));
+    operation_line += " " + operation_words.back();
+}
+
+Dedup_Table::Dedup_Table(size_t capacity) : capacity(capacity), current(0)
+{
+    size_t bits = capacity * DEDUP_BLOOM_BITS;
+    bloom_words = (bits + 63) / 64;
+    size_t slots = 2;
+    while (slots < 2 * capacity) {
+        slots <<= 1;
+    }
+    slot_mask = slots - 1;
+
+    for (Generation& generation : generations) {
+        generation.bloom = new atomic<unsigned long long>[bloom_words];
+        generation.slots = new atomic<unsigned long long>[slots];
+        for (size_t i = 0; i < bloom_words; i++) {
+            generation.bloom[i].store(0, memory_order_relaxed);
+        }
+        for (size_t i = 0; i < slots; i++) {
+            generation.slots[i].store(SLOT_EMPTY, memory_order_relaxed);
+        }
+        generation.count.store(0, memory_order_relaxed);
+    }
+
+    if (pthread_mutex_init(&rotate_mutex, nullptr)) {
+        perror("Bank error: pthread_mutex_init failed");
+    }
+}
+
+Dedup_Table::~Dedup_Table()
+{
+    for (Generation& generation : generations) {
+        delete[] generation.bloom;
+        delete[] generation.slots;
+    }
+    pthread_mutex_destroy(&rotate_mutex);
+}
+
+// Bloom bit i of a key, double hashing over the two halves of its mixed hash
+static size_t bloom_bit(unsigned long long hash, int i, size_t bloom_words)
+{
+    unsigned long long step = (hash >> 32) | 1;
+    return ((hash & 0xffffffffULL) + i * step) % (bloom_words * 64);
+}
+
+static bool bloom_test(const atomic<unsigned long long>* bloom, size_t bloom_words, unsigned long long hash)
+{
+    for (int i = 0; i < DEDUP_BLOOM_HASHES; i++) {
+        size_t bit = bloom_bit(hash, i, bloom_words);
+        if (!(bloom[bit / 64].load(memory_order_acquire) & (1ULL << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int Dedup_Table::lookup(const Generation& generation, unsigned long long key, unsigned long long hash) const
+{
+    if (!bloom_test(generation.bloom, bloom_words, hash)) {
+        return DEDUP_NEW;
+    }
+    for (size_t i = hash & slot_mask;; i = (i + 1) & slot_mask) {
+        unsigned long long slot = generation.slots[i].load(memory_order_acquire);
+        if (slot == key) {
+            return DEDUP_COMMITTED;
+        }
+        if (slot == (key | SLOT_RUNNING)) {
+            return DEDUP_RUNNING;
+        }
+        if (slot == SLOT_EMPTY) {
+            return DEDUP_NEW;
+        }
+    }
+}
+
+int Dedup_Table::state(unsigned long long key) const
+{
+    unsigned long long hash = mix_key(key);
+    int newest = current.load(memory_order_acquire);
+    int result = lookup(generations[newest], key, hash);
+    return result != DEDUP_NEW ? result : lookup(generations[1 - newest], key, hash);
+}
+
+bool Dedup_Table::bloom_passes(unsigned long long key) const
+{
+    unsigned long long hash = mix_key(key);
+    return bloom_test(generations[0].bloom, bloom_words, hash) || bloom_test(generations[1].bloom, bloom_words, hash);
+}
+
+int Dedup_Table::claim(unsigned long long key, Dedup_Claim* claim)
+{
+    unsigned long long hash = mix_key(key);
+    int newest = current.load(memory_order_acquire);
+    int older = lookup(generations[1 - newest], key, hash);
+    if (older != DEDUP_NEW) {
+        return older;
+    }
+
+    // Two claims of one key probe the same slots, so the second finds the first's mark
+    Generation& generation = generations[newest];
+    size_t i = hash & slot_mask;
+    while (true) {
+        unsigned long long expected = SLOT_EMPTY;
+        if (generation.slots[i].compare_exchange_strong(expected, key | SLOT_RUNNING, memory_order_acq_rel)) {
+            break;
+        }
+        if (expected == key) {
+            return DEDUP_COMMITTED;
+        }
+        if (expected == (key | SLOT_RUNNING)) {
+            return DEDUP_RUNNING;
+        }
+        i = (i + 1) & slot_mask;
+    }
+
+    // The slot is published before the bloom bits, so a lookup that passes the bloom finds it
+    for (int bit_index = 0; bit_index < DEDUP_BLOOM_HASHES; bit_index++) {
+        size_t bit = bloom_bit(hash, bit_index, bloom_words);
+        generation.bloom[bit / 64].fetch_or(1ULL << (bit % 64), memory_order_release);
+    }
+    claim->generation = newest;
+    claim->slot = i;
+    claim->key = key;
+
+    if (generation.count.fetch_add(1, memory_order_acq_rel) + 1 == capacity) {
+        rotate(newest);
+    }
+    return DEDUP_NEW;
+}
+
+void Dedup_Table::finish(const Dedup_Claim& claim, bool committed)
+{
+    // Tombstones are never reused, so a probe never stops short of a key placed after one
+    generations[claim.generation].slots[claim.slot].store(committed ? claim.key : SLOT_TOMBSTONE, memory_order_release);
+}
+
+// The full generation stays readable as the older one; the previous older one is cleared for new keys
+void Dedup_Table::rotate(int full)
+{
+    pthread_mutex_lock(&rotate_mutex);
+    if (current.load(memory_order_acquire) == full) {
+        Generation& oldest = generations[1 - full];
+        for (size_t i = 0; i < bloom_words; i++) {
+            oldest.bloom[i].store(0, memory_order_relaxed);
+        }
+        for (size_t i = 0; i <= slot_mask; i++) {
+            oldest.slots[i].store(SLOT_EMPTY, memory_order_relaxed);
+        }
+        oldest.count.store(0, memory_order_relaxed);
+        current.store(1 - full, memory_order_release);
+    }
+    pthread_mutex_unlock(&rotate_mutex);
+}
+
+size_t Dedup_Table::memory_bytes() const
+{
+    return 2 * (bloom_words + slot_mask + 1) * sizeof(unsigned long long);
+}
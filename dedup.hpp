@@ -0,0 +1,86 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <pthread.h>
+
+using namespace std;
+
+#define DEDUP_CAPACITY 65536   // keys a generation takes; at least this many recent keys are remembered
+#define DEDUP_BLOOM_BITS 8     // bloom filter bits per key
+#define DEDUP_BLOOM_HASHES 3
+
+#define DEDUP_NEW 0            // claimed: run the command, then finish() the claim
+#define DEDUP_COMMITTED 1      // a command with this key already committed
+#define DEDUP_RUNNING 2        // a command with this key is running right now
+
+/*
+ * Idempotency keys: a command carrying KEY=<sequence> is identified by its
+ * ATM id and that sequence number. ATM threads give every PERSISTENT command
+ * the key of its line in the ATM file, and server clients may send their own,
+ * so a retried or resent command that already committed is not applied again.
+ */
+// False if the command has no KEY= word
+bool idempotency_key(const vector<string>& operation_words, int atm_id, unsigned long long* key);
+// Gives a command without a KEY= word the key `sequence`, in its words and its line
+void add_idempotency_key(vector<string>& operation_words, string& operation_line, long long sequence);
+
+struct Dedup_Claim {
+    int generation;
+    size_t slot;
+    unsigned long long key;
+};
+
+/*
+ * Keys of running and committed commands. Two generations, each a bloom
+ * filter in front of an open-addressed table of atomic slots at most half
+ * full: a lookup that misses both blooms, the common case for a command seen
+ * for the first time, reads DEDUP_BLOOM_HASHES words and no table slot.
+ *
+ * claim() marks the key running with one compare-and-swap, so two attempts
+ * with the same key never run together; finish() turns the mark into the
+ * key once it committed, or into a tombstone so a later retry can claim it
+ * again. Neither takes a lock. When the current generation has taken its
+ * capacity the older one is cleared and becomes current, under rotate_mutex;
+ * keys are therefore forgotten only after at least `capacity` newer ones.
+ */
+class Dedup_Table {
+private:
+    struct Generation {
+        atomic<unsigned long long>* bloom;
+        atomic<unsigned long long>* slots;
+        atomic<size_t> count;
+    };
+
+    size_t capacity;
+    size_t bloom_words;
+    size_t slot_mask;
+    Generation generations[2];
+    atomic<int> current;
+    pthread_mutex_t rotate_mutex;
+
+    int lookup(const Generation& generation, unsigned long long key, unsigned long long hash) const;
+    void rotate(int full);
+
+public:
+    explicit Dedup_Table(size_t capacity = DEDUP_CAPACITY);
+    ~Dedup_Table();
+    Dedup_Table(const Dedup_Table&) = delete;
+    Dedup_Table& operator=(const Dedup_Table&) = delete;
+
+    // DEDUP_NEW (and *claim is set), DEDUP_COMMITTED or DEDUP_RUNNING
+    int claim(unsigned long long key, Dedup_Claim* claim);
+    void finish(const Dedup_Claim& claim, bool committed);
+    // DEDUP_NEW if the key is neither running nor committed
+    int state(unsigned long long key) const;
+
+    // Bytes of both generations
+    size_t memory_bytes() const;
+    // Whether a lookup of the key gets past the blooms to the tables
+    bool bloom_passes(unsigned long long key) const;
+};
+
+#endif
@@ -0,0 +1,14 @@
+#include "handlers.hpp"
+#include "replay.hpp"
+
+ofstream binary_log_file;
+
+void write_binary_log_record(const Binary_Log_Record& record)
+{
+    pthread_mutex_lock(&log_file_lock);
+    if (binary_log_file.is_open()) {
+        binary_log_file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    }
+    replay_record_commit();
+    pthread_mutex_unlock(&log_file_lock);
+}
@@ -0,0 +1,342 @@
+#ifndef HANDLERS_H
+#define HANDLERS_H
+
+#include <string>
+#include <fstream>
+#include <atomic>
+#include <cstdio>
+#include <pthread.h>
+#include "account.hpp"
+
+using namespace std;
+
+/*
+ * Account operations as a pipeline of compile-time policies:
+ *
+ *     auth -> lock -> mutate -> log/journal
+ *
+ * Operation_Handler<Op, Auth, Lock, Log>::run() is instantiated once per
+ * combination, so every handler is a straight-line function with the policy
+ * calls inlined; there are no virtual calls and no runtime mode switches.
+ *
+ * Op     Deposit_Op, Withdraw_Op, Balance_Op: the balance change and its log text
+ * Auth   Password_Auth, No_Auth
+ * Lock   Account_Lock (the Account readers-writer lock plus the simulated delay),
+ *        Stripe_Lock (striped deposits into an Account, without a lock),
+ *        and for Balance_Cell: Mutex_Lock, Atomic_Lock, Seqlock_Lock
+ * Log    No_Log, Text_Log (log.txt), Binary_Log (fixed-size records)
+ *
+ * The log call is the operation's commit point for replay recording (see
+ * replay.hpp), so Text_Log and Binary_Log also journal. Mutex_Lock,
+ * Seqlock_Lock and Account_Lock commit while the writer still holds the lock.
+ * Atomic_Lock has no lock to hold, so its log order can differ from its
+ * commit order; it is meant for unlogged or unrecorded use.
+ */
+
+/* Appends text and numbers to a log line in place, so a reused line does not allocate */
+inline void append_log(string&) {
+}
+
+template <typename... Rest>
+void append_log(string& line, const char* text, Rest... rest);
+
+template <typename... Rest>
+void append_log(string& line, int number, Rest... rest) {
+    char digits[16];
+    int length = snprintf(digits, sizeof(digits), "%d", number);
+    line.append(digits, length);
+    append_log(line, rest...);
+}
+
+template <typename... Rest>
+void append_log(string& line, const char* text, Rest... rest) {
+    line += text;
+    append_log(line, rest...);
+}
+
+/* --- Operations --- */
+
+struct Deposit_Op {
+    static const bool writes = true;
+    static int apply(int& balance, int amount) {
+        balance += amount;
+        return SUCCESS;
+    }
+    static void describe(string& line, int atm_id, int account_id, int amount, int balance) {
+        append_log(line, atm_id, ": Account ", account_id, " new balance is ", balance, " after ", amount, " $ was deposited");
+    }
+};
+
+struct Withdraw_Op {
+    static const bool writes = true;
+    static int apply(int& balance, int amount) {
+        if (balance < amount) {
+            return NOT_ENOUGH_MONEY;
+        }
+        balance -= amount;
+        return SUCCESS;
+    }
+    static void describe(string& line, int atm_id, int account_id, int amount, int balance) {
+        append_log(line, atm_id, ": Account ", account_id, " new balance is ", balance, " after ", amount, " $ was withdrew");
+    }
+};
+
+struct Balance_Op {
+    static const bool writes = false;
+    static int apply(int&, int) {
+        return SUCCESS;
+    }
+    static void describe(string& line, int atm_id, int account_id, int, int balance) {
+        append_log(line, atm_id, ": Account ", account_id, " balance is ", balance);
+    }
+};
+
+/* --- Authentication --- */
+
+struct Password_Auth {
+    template <typename Cell>
+    static bool check(Cell& cell, const string& password) {
+        return cell.check_password(password);
+    }
+};
+
+struct No_Auth {
+    template <typename Cell>
+    static bool check(Cell&, const string&) {
+        return true;
+    }
+};
+
+/* --- Locking --- */
+
+/*
+ * A lock policy runs mutate(balance) on a copy of the balance and stores the
+ * copy back when mutate returns true; commit(balance) runs exactly once, after
+ * the final balance is known and, where there is a lock, before it is released.
+ */
+
+// The Account's own readers-writer lock, with the simulated processing delay;
+// each change is added to the account's version history under the ATM's id
+struct Account_Lock {
+    template <bool Writes, typename Mutate, typename Commit>
+    static void access(Account& account, int atm_id, Mutate mutate, Commit commit) {
+        if (Writes) {
+            account.account_write_lock();
+            inject_sleep(1);
+            {
+                Trace_Span span("mutate");
+                account.fold_deposits();
+                int balance = account.balance;
+                if (mutate(balance)) {
+                    int delta = balance - account.balance;
+                    account.balance = balance;
+                    account.record_change(delta, atm_id);
+                }
+            }
+            commit(account.balance);
+            account.account_write_unlock();
+        } else {
+            account.account_read_lock();
+            inject_sleep(1);
+            int balance = account.exact_balance();
+            {
+                Trace_Span span("mutate");
+                mutate(balance);
+            }
+            commit(balance);
+            account.account_read_unlock();
+        }
+    }
+};
+
+// Striped deposits (--striped-account): the amount lands in one of the account's
+// deposit stripes without taking a lock, so deposits into the account run side
+// by side. The committed balance is read after landing; a deposit landing at the
+// same time may already be in it.
+struct Stripe_Lock {
+    template <bool Writes, typename Mutate, typename Commit>
+    static void access(Account& account, int atm_id, Mutate mutate, Commit commit) {
+        inject_sleep(1);
+        int balance = account.exact_balance();
+        {
+            Trace_Span span("mutate");
+            int landed = balance;
+            if (mutate(landed)) {
+                account.land_deposit(landed - balance, atm_id);
+                balance = account.exact_balance();
+            }
+        }
+        commit(balance);
+    }
+};
+
+/* A bare account record for the lock modes that do not need Account's lock */
+struct Balance_Cell {
+    int account_id;
+    string password;
+    atomic<int> balance;
+    atomic<unsigned> sequence;   // Seqlock_Lock: odd while a writer is inside
+    pthread_mutex_t mutex;       // Mutex_Lock, and the Seqlock_Lock writers
+
+    Balance_Cell(int account_id, const string& password, int initial_amount)
+        : account_id(account_id), password(password), balance(initial_amount), sequence(0) {
+        pthread_mutex_init(&mutex, nullptr);
+    }
+    ~Balance_Cell() {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    int get_id() const { return account_id; }
+    bool check_password(const string& candidate) const { return password == candidate; }
+};
+
+struct Mutex_Lock {
+    template <bool Writes, typename Mutate, typename Commit>
+    static void access(Balance_Cell& cell, int, Mutate mutate, Commit commit) {
+        pthread_mutex_lock(&cell.mutex);
+        int balance = cell.balance.load(memory_order_relaxed);
+        if (mutate(balance) && Writes) {
+            cell.balance.store(balance, memory_order_relaxed);
+        }
+        commit(cell.balance.load(memory_order_relaxed));
+        pthread_mutex_unlock(&cell.mutex);
+    }
+};
+
+// Lock free: compare-and-swap retries; mutate may run more than once
+struct Atomic_Lock {
+    template <bool Writes, typename Mutate, typename Commit>
+    static void access(Balance_Cell& cell, int, Mutate mutate, Commit commit) {
+        int current = cell.balance.load(memory_order_acquire);
+        while (true) {
+            int balance = current;
+            if (!mutate(balance) || !Writes) {
+                commit(current);
+                return;
+            }
+            if (cell.balance.compare_exchange_weak(current, balance, memory_order_acq_rel, memory_order_acquire)) {
+                commit(balance);
+                return;
+            }
+        }
+    }
+};
+
+// Writers serialize on the mutex; readers take no lock and retry if a writer overlapped
+struct Seqlock_Lock {
+    template <bool Writes, typename Mutate, typename Commit>
+    static void access(Balance_Cell& cell, int, Mutate mutate, Commit commit) {
+        if (Writes) {
+            pthread_mutex_lock(&cell.mutex);
+            int balance = cell.balance.load(memory_order_relaxed);
+            if (mutate(balance)) {
+                cell.sequence.fetch_add(1, memory_order_relaxed);
+                atomic_thread_fence(memory_order_release);
+                cell.balance.store(balance, memory_order_relaxed);
+                cell.sequence.fetch_add(1, memory_order_release);
+            }
+            commit(cell.balance.load(memory_order_relaxed));
+            pthread_mutex_unlock(&cell.mutex);
+            return;
+        }
+
+        int balance;
+        unsigned before;
+        do {
+            before = cell.sequence.load(memory_order_acquire);
+            balance = cell.balance.load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+        } while ((before & 1) || cell.sequence.load(memory_order_relaxed) != before);
+        mutate(balance);
+        commit(balance);
+    }
+};
+
+/* --- Logging and journaling --- */
+
+struct No_Log {
+    template <typename Op, typename Cell>
+    static void commit(Cell&, int, int, int, int) {
+    }
+};
+
+// The log.txt line of the unbatched paths; write_to_log_file also journals.
+// The line is built in a per-thread buffer that keeps its capacity.
+struct Text_Log {
+    template <typename Op, typename Cell>
+    static void commit(Cell& cell, int atm_id, int amount, int status, int balance) {
+        static thread_local string line;
+        line.clear();
+        if (status == WRONG_PASSWORD) {
+            append_log(line, "Error ", atm_id, ": Your transaction failed - password for account id ", cell.get_id(), " is incorrect");
+        } else if (status == NOT_ENOUGH_MONEY) {
+            append_log(line, "Error ", atm_id, ": Your transaction failed - account id ", cell.get_id(), " balance is lower than ", amount);
+        } else {
+            Op::describe(line, atm_id, cell.get_id(), amount, balance);
+        }
+        write_to_log_file(line);
+    }
+};
+
+/* Fixed-size record of Binary_Log, written to binary_log_file */
+struct Binary_Log_Record {
+    char operation;
+    signed char status;
+    short atm_id;
+    int account_id;
+    int amount;
+    int balance;
+};
+
+extern ofstream binary_log_file;
+
+// Appends the record under log_file_lock and journals, like write_to_log_file
+void write_binary_log_record(const Binary_Log_Record& record);
+
+template <typename Op> struct Op_Code;
+template <> struct Op_Code<Deposit_Op> { static const char value = 'D'; };
+template <> struct Op_Code<Withdraw_Op> { static const char value = 'W'; };
+template <> struct Op_Code<Balance_Op> { static const char value = 'B'; };
+
+struct Binary_Log {
+    template <typename Op, typename Cell>
+    static void commit(Cell& cell, int atm_id, int amount, int status, int balance) {
+        Binary_Log_Record record;
+        record.operation = Op_Code<Op>::value;
+        record.status = static_cast<signed char>(status);
+        record.atm_id = static_cast<short>(atm_id);
+        record.account_id = cell.get_id();
+        record.amount = amount;
+        record.balance = balance;
+        write_binary_log_record(record);
+    }
+};
+
+/* --- The composed handler --- */
+
+template <typename Op, typename Auth, typename Lock, typename Log>
+struct Operation_Handler {
+    // Returns the status; *new_balance is left alone on a wrong password
+    template <typename Cell>
+    static int run(Cell& cell, const string& password, int amount, int* new_balance, int atm_id) {
+        int status = SUCCESS;
+        Lock::template access<Op::writes>(cell, atm_id,
+            [&](int& balance) -> bool {
+                if (!Auth::check(cell, password)) {
+                    status = WRONG_PASSWORD;
+                    return false;
+                }
+                status = Op::apply(balance, amount);
+                return status == SUCCESS && Op::writes;
+            },
+            [&](int balance) {
+                if (status != WRONG_PASSWORD) {
+                    *new_balance = balance;
+                }
+                Log::template commit<Op>(cell, atm_id, amount, status, balance);
+            });
+        return status;
+    }
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "history.hpp"
+#include <atomic>
+#include <unordered_map>
+#include <cstdio>
+#include <pthread.h>
+
+#define HISTORY_COMPACT_MIN 64 // dropped versions kept before the vector is compacted
+
+static atomic<long long> account_version_clock(0);
+static atomic<long long> account_history_floor(0);
+
+/* The accounts one ATM changed, in version order */
+struct Atm_History {
+    vector<pair<long long, int>> changes;  // (version, account id)
+    size_t first;
+    long long dropped_through;
+
+    Atm_History() : first(0), dropped_through(0) {}
+};
+
+/*
+ * The ATM index entries one thread recorded. Only its owner appends, so the
+ * mutex is uncontended until a U ATM= rollback merges every thread's index.
+ * Owned by the registry so the entries outlive the thread.
+ */
+struct Atm_Index_Thread {
+    pthread_mutex_t mutex;
+    unordered_map<int, Atm_History> atms;
+
+    Atm_Index_Thread() {
+        if (pthread_mutex_init(&mutex, nullptr)) {
+            perror("Bank error: pthread_mutex_init failed");
+        }
+    }
+};
+
+static pthread_mutex_t atm_index_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+// Never destroyed, so the indexes stay reachable at exit
+static vector<Atm_Index_Thread*>& atm_index_threads = *new vector<Atm_Index_Thread*>();
+static thread_local Atm_Index_Thread* current_thread = nullptr;
+
+static Atm_Index_Thread* this_thread()
+{
+    if (current_thread == nullptr) {
+        Atm_Index_Thread* thread = new Atm_Index_Thread();
+        pthread_mutex_lock(&atm_index_threads_lock);
+        atm_index_threads.push_back(thread);
+        pthread_mutex_unlock(&atm_index_threads_lock);
+        current_thread = thread;
+    }
+    return current_thread;
+}
+
+long long current_account_version()
+{
+    return account_version_clock.load(memory_order_relaxed);
+}
+
+long long advance_account_version()
+{
+    return account_version_clock.fetch_add(1, memory_order_relaxed);
+}
+
+void set_account_history_floor(long long version)
+{
+    account_history_floor.store(version, memory_order_relaxed);
+}
+
+static void record_atm_change(int atm_id, long long version, int account_id)
+{
+    Atm_Index_Thread* thread = this_thread();
+    long long floor = account_history_floor.load(memory_order_relaxed);
+
+    pthread_mutex_lock(&thread->mutex);
+    Atm_History& atm = thread->atms[atm_id];
+    // Repeated changes of an account in one iteration need one entry
+    if (atm.changes.size() > atm.first && atm.changes.back() == make_pair(version, account_id)) {
+        pthread_mutex_unlock(&thread->mutex);
+        return;
+    }
+    atm.changes.push_back(make_pair(version, account_id));
+    while (atm.first < atm.changes.size() &&
+           (atm.changes[atm.first].first < floor || atm.changes.size() - atm.first > ATM_HISTORY_LIMIT)) {
+        atm.dropped_through = atm.changes[atm.first].first;
+        atm.first++;
+    }
+    if (atm.first >= HISTORY_COMPACT_MIN && atm.first * 2 >= atm.changes.size()) {
+        atm.changes.erase(atm.changes.begin(), atm.changes.begin() + atm.first);
+        atm.first = 0;
+    }
+    pthread_mutex_unlock(&thread->mutex);
+}
+
+bool atm_changed_accounts(int atm_id, long long version, vector<int>& account_ids)
+{
+    account_ids.clear();
+    bool complete = true;
+
+    pthread_mutex_lock(&atm_index_threads_lock);
+    for (Atm_Index_Thread* thread : atm_index_threads) {
+        pthread_mutex_lock(&thread->mutex);
+        auto atm = thread->atms.find(atm_id);
+        if (atm != thread->atms.end()) {
+            complete = complete && version >= atm->second.dropped_through;
+            const vector<pair<long long, int>>& changes = atm->second.changes;
+            for (size_t i = atm->second.first; i < changes.size(); i++) {
+                if (changes[i].first > version) {
+                    account_ids.push_back(changes[i].second);
+                }
+            }
+        }
+        pthread_mutex_unlock(&thread->mutex);
+    }
+    pthread_mutex_unlock(&atm_index_threads_lock);
+    return complete;
+}
+
+Account_History::Account_History() : first(0), dropped_through(0)
+{
+}
+
+void Account_History::drop_oldest()
+{
+    dropped_through = versions[first].version;
+    first++;
+}
+
+void Account_History::append(const Account_Version& change)
+{
+    versions.push_back(change);
+
+    // The newest version is never dropped, it anchors the balance before it
+    long long floor = account_history_floor.load(memory_order_relaxed);
+    while (versions.size() - first > 1 &&
+           (versions[first].version < floor || versions.size() - first > ACCOUNT_HISTORY_LIMIT)) {
+        drop_oldest();
+    }
+    if (first >= HISTORY_COMPACT_MIN && first * 2 >= versions.size()) {
+        versions.erase(versions.begin(), versions.begin() + first);
+        first = 0;
+    }
+}
+
+void Account_History::record(int account_id, int balance, int delta, int atm_id, bool undone)
+{
+    Account_Version change;
+    change.version = current_account_version();
+    change.atm_id = atm_id;
+    change.delta = delta;
+    change.balance = balance;
+    change.undone = undone;
+    append(change);
+
+    if (atm_id > 0 && !undone) {
+        record_atm_change(atm_id, change.version, account_id);
+    }
+}
+
+bool Account_History::balance_at(long long version, int current_balance, int* balance) const
+{
+    if (version < dropped_through) {
+        return false;
+    }
+
+    for (size_t i = versions.size(); i > first; i--) {
+        if (versions[i - 1].version <= version) {
+            *balance = versions[i - 1].balance;
+            return true;
+        }
+    }
+    // Every live version is newer: the balance before the oldest one
+    *balance = first < versions.size() ? versions[first].balance - versions[first].delta : current_balance;
+    return true;
+}
+
+void Account_History::undo_after(long long version)
+{
+    for (size_t i = versions.size(); i > first && versions[i - 1].version > version; i--) {
+        versions[i - 1].undone = true;
+    }
+}
+
+bool Account_History::atm_changes_after(int atm_id, long long version, int* delta) const
+{
+    *delta = 0;
+    for (size_t i = versions.size(); i > first && versions[i - 1].version > version; i--) {
+        if (versions[i - 1].atm_id == atm_id && !versions[i - 1].undone) {
+            *delta += versions[i - 1].delta;
+        }
+    }
+    return version >= dropped_through;
+}
+
+void Account_History::undo_atm_after(int atm_id, long long version)
+{
+    for (size_t i = versions.size(); i > first && versions[i - 1].version > version; i--) {
+        if (versions[i - 1].atm_id == atm_id) {
+            versions[i - 1].undone = true;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <vector>
+#include <utility>
+
+using namespace std;
+
+#define ACCOUNT_HISTORY_LIMIT 4096  // versions an account keeps at most; a busier account has a shorter window
+#define ATM_HISTORY_LIMIT 65536     // changed accounts a thread remembers per ATM at most
+
+/* One committed change of an account's balance */
+struct Account_Version {
+    long long version;  // bank iteration of the change, see current_account_version()
+    int atm_id;         // 0 for the bank itself: opening balances, commissions
+    int delta;
+    int balance;        // after the change
+    bool undone;        // reverted by a later rollback, or a rollback itself
+};
+
+/*
+ * Per-account version history for account scoped rollback. Every change made
+ * under the account's write lock is appended here with its ATM (a striped
+ * deposit when its stripe is folded), so restoring an account or reverting
+ * one ATM's changes only reads and locks the accounts involved. Versions older than the rollback window (the history floor) are
+ * dropped, as are the oldest ones past ACCOUNT_HISTORY_LIMIT.
+ *
+ * Not synchronized: the owning Account's write lock protects it.
+ */
+class Account_History {
+private:
+    vector<Account_Version> versions;
+    size_t first;                // oldest live version; dropped ones are erased in bulk
+    long long dropped_through;   // newest dropped version
+
+    void drop_oldest();
+    void append(const Account_Version& change);
+
+public:
+    Account_History();
+
+    void record(int account_id, int balance, int delta, int atm_id, bool undone);
+    // Balance right after `version`; false if the history no longer reaches back that far
+    bool balance_at(long long version, int current_balance, int* balance) const;
+    // Marks every change after `version` undone, once the balance was restored to it
+    void undo_after(long long version);
+    // Net change atm_id made after `version` and not yet undone; false if not fully known
+    bool atm_changes_after(int atm_id, long long version, int* delta) const;
+    void undo_atm_after(int atm_id, long long version);
+};
+
+// The version a change made now gets: the bank iteration it falls in. Changes
+// only read it, so a busy account never writes a shared counter; the order
+// within an account is the order of its history.
+long long current_account_version();
+// Ends the current bank iteration and returns its version; every change after
+// this has a higher one
+long long advance_account_version();
+// Start of the rollback window; older versions may be dropped
+void set_account_history_floor(long long version);
+
+// Ids of the accounts atm_id changed after `version`, merged from the per-thread
+// ATM indexes; false if one of them no longer reaches back that far. Ids may repeat.
+bool atm_changed_accounts(int atm_id, long long version, vector<int>& account_ids);
+
+#endif
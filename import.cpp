@@ -0,0 +1,214 @@
+#include "import.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <pthread.h>
+#include <unistd.h>
+
+/* A parsed line; the password stays in the file's text until the states are built */
+struct Import_Record {
+    int account_id;
+    int balance;
+    const char* password;
+    size_t password_length;
+};
+
+/* One parse thread's part of the file, from a line start to a line start */
+struct Import_Chunk {
+    const char* begin;
+    const char* end;
+    vector<Import_Record> records;
+    const char* bad;   // start of the first line that is not an account, or nullptr
+};
+
+static bool is_separator(char c)
+{
+    return c == ',' || c == ' ' || c == '\t';
+}
+
+static void skip_separators(const char*& p, const char* end)
+{
+    while (p < end && is_separator(*p)) {
+        p++;
+    }
+}
+
+static bool parse_number(const char*& p, const char* end, int* value)
+{
+    bool negative = p < end && *p == '-';
+    if (negative) {
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return false;
+    }
+    long long number = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        number = number * 10 + (*p - '0');
+        if (number > INT_MAX) {
+            return false;
+        }
+        p++;
+    }
+    *value = negative ? -number : number;
+    return true;
+}
+
+// One line without its newline; false if it is neither an account nor skipped.
+// *parsed tells whether it held an account.
+static bool parse_account_line(const char* p, const char* end, Import_Record& record, bool* parsed)
+{
+    *parsed = false;
+    skip_separators(p, end);
+    if (p == end || *p == '\r' || *p == '#') {
+        return true;
+    }
+
+    if (!parse_number(p, end, &record.account_id) || p == end || !is_separator(*p)) {
+        return false;
+    }
+    skip_separators(p, end);
+    const char* password = p;
+    while (p < end && !is_separator(*p) && *p != '\r') {
+        p++;
+    }
+    if (p == password || p == end || !is_separator(*p)) {
+        return false;
+    }
+    record.password = password;
+    record.password_length = p - password;
+    skip_separators(p, end);
+    if (!parse_number(p, end, &record.balance)) {
+        return false;
+    }
+    skip_separators(p, end);
+    if (p < end && *p == '\r') {
+        p++;
+    }
+    *parsed = p == end;
+    return *parsed;
+}
+
+static bool by_account_id(const Import_Record& a, const Import_Record& b)
+{
+    return a.account_id < b.account_id;
+}
+
+static void* parse_chunk(void* arg)
+{
+    Import_Chunk* chunk = static_cast<Import_Chunk*>(arg);
+    Import_Record record;
+    const char* line = chunk->begin;
+    while (line < chunk->end) {
+        const char* line_end = find(line, chunk->end, '\n');
+        bool parsed;
+        if (!parse_account_line(line, line_end, record, &parsed)) {
+            chunk->bad = line;
+            return nullptr;
+        }
+        if (parsed) {
+            chunk->records.push_back(record);
+        }
+        line = line_end + 1;
+    }
+    // Records are small, so sorting them is cheap; a file already in id order is left as it is
+    if (!is_sorted(chunk->records.begin(), chunk->records.end(), by_account_id)) {
+        sort(chunk->records.begin(), chunk->records.end(), by_account_id);
+    }
+    return nullptr;
+}
+
+static bool read_file(const string& path, string& contents)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    char buffer[1 << 16];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        contents.append(buffer, read);
+    }
+    bool failed = ferror(file);
+    fclose(file);
+    return !failed;
+}
+
+bool load_account_file(const string& path, vector<Account_State>& states, size_t* bad_line)
+{
+    string contents;
+    if (!read_file(path, contents)) {
+        *bad_line = 0;
+        return false;
+    }
+
+    // Chunk boundaries are moved forward to the next line start
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = min(static_cast<size_t>(cpus > 0 ? cpus : 1), static_cast<size_t>(IMPORT_MAX_THREADS));
+    threads = max(static_cast<size_t>(1), min(threads, contents.size() / IMPORT_MIN_CHUNK));
+    const char* text = contents.data();
+    const char* text_end = text + contents.size();
+    vector<Import_Chunk> chunks(threads);
+    const char* begin = text;
+    for (size_t i = 0; i < threads; i++) {
+        const char* end = i + 1 == threads ? text_end : text + contents.size() * (i + 1) / threads;
+        end = max(end, begin);
+        if (end < text_end) {
+            end = find(end, text_end, '\n');
+            end = end < text_end ? end + 1 : text_end;
+        }
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+        chunks[i].bad = nullptr;
+        begin = end;
+    }
+
+    // The calling thread parses the first chunk itself
+    vector<pthread_t> parse_threads(threads);
+    for (size_t i = 1; i < threads; i++) {
+        if (pthread_create(&parse_threads[i], nullptr, parse_chunk, &chunks[i])) {
+            perror("Bank error: pthread_create failed for import thread");
+            exit(1);
+        }
+    }
+    parse_chunk(&chunks[0]);
+    for (size_t i = 1; i < threads; i++) {
+        pthread_join(parse_threads[i], nullptr);
+    }
+
+    for (const Import_Chunk& chunk : chunks) {
+        if (chunk.bad != nullptr) {
+            *bad_line = count(text, chunk.bad, '\n') + 1;
+            return false;
+        }
+    }
+
+    // Appended in file order, then the sorted runs are merged pairwise
+    vector<Import_Record> records;
+    vector<size_t> run_starts;
+    for (const Import_Chunk& chunk : chunks) {
+        run_starts.push_back(records.size());
+        records.insert(records.end(), chunk.records.begin(), chunk.records.end());
+    }
+    run_starts.push_back(records.size());
+    while (run_starts.size() > 2) {
+        vector<size_t> merged_starts;
+        for (size_t i = 0; i + 1 < run_starts.size(); i += 2) {
+            merged_starts.push_back(run_starts[i]);
+            if (i + 2 < run_starts.size()) {
+                inplace_merge(records.begin() + run_starts[i], records.begin() + run_starts[i + 1],
+                              records.begin() + run_starts[i + 2], by_account_id);
+            }
+        }
+        merged_starts.push_back(records.size());
+        run_starts.swap(merged_starts);
+    }
+
+    states.resize(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        states[i].account_id = records[i].account_id;
+        states[i].balance = records[i].balance;
+        states[i].password.assign(records[i].password, records[i].password_length);
+    }
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <string>
+#include <vector>
+#include "status_history.hpp"
+
+using namespace std;
+
+#define IMPORT_MAX_THREADS 16        // parse threads of one import at most
+#define IMPORT_MIN_CHUNK (1 << 20)   // bytes of the file a parse thread takes at least
+
+/*
+ * Account files for bulk import (the I command and --import). One account per
+ * line: id, password and initial balance, separated by commas or blanks, e.g.
+ *
+ *     1001,secret,500
+ *
+ * Blank lines and lines starting with # are skipped. The file is read whole
+ * and split at line boundaries over up to IMPORT_MAX_THREADS threads, each of
+ * which parses and sorts its part; the sorted parts are then merged.
+ */
+// States come back sorted by id. False on error: *bad_line is the first line
+// that is not an account, or 0 if the file cannot be read.
+bool load_account_file(const string& path, vector<Account_State>& states, size_t* bad_line);
+
+#endif
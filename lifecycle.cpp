@@ -0,0 +1,124 @@
+#include "lifecycle.hpp"
+#include <ctime>
+#include <cstdio>
+#include "account.hpp"
+
+Bank_Lifecycle::Bank_Lifecycle(int atm_count)
+    : running_atms(atm_count), terminating(false), closed_atms(atm_count, false)
+{
+    if (pthread_mutex_init(&lifecycle_mutex, nullptr)) {
+        perror("Bank error: pthread_mutex_init failed");
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&lifecycle_cond, &cond_attr)) {
+        perror("Bank error: pthread_cond_init failed");
+    }
+    pthread_condattr_destroy(&cond_attr);
+}
+
+Bank_Lifecycle::~Bank_Lifecycle()
+{
+    pthread_mutex_destroy(&lifecycle_mutex);
+    pthread_cond_destroy(&lifecycle_cond);
+}
+
+template <typename Predicate>
+bool Bank_Lifecycle::wait_until(useconds_t microseconds, Predicate stop)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += microseconds / 1000000;
+    deadline.tv_nsec += (microseconds % 1000000) * 1000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (!stop()) {
+        if (pthread_cond_timedwait(&lifecycle_cond, &lifecycle_mutex, &deadline) != 0) {
+            break; // timed out
+        }
+    }
+    return stop();
+}
+
+void Bank_Lifecycle::atm_finished()
+{
+    pthread_mutex_lock(&lifecycle_mutex);
+    running_atms--;
+    pthread_cond_broadcast(&lifecycle_cond);
+    pthread_mutex_unlock(&lifecycle_mutex);
+}
+
+void Bank_Lifecycle::wait_for_atms()
+{
+    pthread_mutex_lock(&lifecycle_mutex);
+    while (running_atms > 0) {
+        pthread_cond_wait(&lifecycle_cond, &lifecycle_mutex);
+    }
+    pthread_mutex_unlock(&lifecycle_mutex);
+}
+
+bool Bank_Lifecycle::atm_delay(int atm_id, useconds_t microseconds)
+{
+    pthread_mutex_lock(&lifecycle_mutex);
+    bool closed;
+    if (latency_injection_enabled) {
+        closed = wait_until(microseconds, [this, atm_id]() { return closed_atms[atm_id - 1]; });
+    } else {
+        closed = closed_atms[atm_id - 1];
+    }
+    pthread_mutex_unlock(&lifecycle_mutex);
+    return !closed;
+}
+
+bool Bank_Lifecycle::atm_wait(int atm_id, useconds_t microseconds)
+{
+    pthread_mutex_lock(&lifecycle_mutex);
+    bool closed = wait_until(microseconds, [this, atm_id]() { return closed_atms[atm_id - 1]; });
+    pthread_mutex_unlock(&lifecycle_mutex);
+    return !closed;
+}
+
+bool Bank_Lifecycle::is_atm_closed(int atm_id)
+{
+    pthread_mutex_lock(&lifecycle_mutex);
+    bool closed = closed_atms[atm_id - 1];
+    pthread_mutex_unlock(&lifecycle_mutex);
+    return closed;
+}
+
+void Bank_Lifecycle::close_atm(int atm_id)
+{
+    pthread_mutex_lock(&lifecycle_mutex);
+    closed_atms[atm_id - 1] = true;
+    pthread_cond_broadcast(&lifecycle_cond);
+    pthread_mutex_unlock(&lifecycle_mutex);
+}
+
+void Bank_Lifecycle::request_termination()
+{
+    pthread_mutex_lock(&lifecycle_mutex);
+    terminating = true;
+    pthread_cond_broadcast(&lifecycle_cond);
+    pthread_mutex_unlock(&lifecycle_mutex);
+}
+
+bool Bank_Lifecycle::is_terminating()
+{
+    pthread_mutex_lock(&lifecycle_mutex);
+    bool result = terminating;
+    pthread_mutex_unlock(&lifecycle_mutex);
+    return result;
+}
+
+bool Bank_Lifecycle::wait_for_termination(useconds_t microseconds)
+{
+    pthread_mutex_lock(&lifecycle_mutex);
+    bool result = wait_until(microseconds, [this]() { return terminating; });
+    pthread_mutex_unlock(&lifecycle_mutex);
+    return result;
+}
@@ -0,0 +1,49 @@
+#ifndef LIFECYCLE_H
+#define LIFECYCLE_H
+
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+ * Start/stop coordination for the ATM and background threads. Everything that
+ * used to poll a flag with usleep/sleep waits on one condition variable
+ * instead, so ATM completion, ATM close requests and termination wake the
+ * waiting threads immediately.
+ */
+class Bank_Lifecycle {
+private:
+    pthread_mutex_t lifecycle_mutex;
+    pthread_cond_t lifecycle_cond;
+    int running_atms;
+    bool terminating;
+    vector<bool> closed_atms;
+
+    // Waits until the deadline or until stop() holds; caller holds lifecycle_mutex
+    template <typename Predicate>
+    bool wait_until(useconds_t microseconds, Predicate stop);
+
+public:
+    explicit Bank_Lifecycle(int atm_count);
+    ~Bank_Lifecycle();
+
+    // ATM threads
+    void atm_finished();
+    void wait_for_atms();
+    // Simulated delay of an ATM; returns false right away once the ATM is closed
+    bool atm_delay(int atm_id, useconds_t microseconds);
+    // Same, but waits even with latency injection off (rate limiting is real time)
+    bool atm_wait(int atm_id, useconds_t microseconds);
+    bool is_atm_closed(int atm_id);
+    void close_atm(int atm_id);
+
+    // Background threads
+    void request_termination();
+    bool is_terminating();
+    // Sleeps for the period; returns true as soon as termination is requested
+    bool wait_for_termination(useconds_t microseconds);
+};
+
+#endif
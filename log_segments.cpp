@@ -0,0 +1,335 @@
+#include "log_segments.hpp"
+#include <cstdio>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+Segmented_Log_Buffer::Segmented_Log_Buffer()
+    : segment_bytes(0), segment_seconds(0), compress(false), fd(-1), active_bytes(0), active_index(0),
+      rotation_due(false), roller_running(false), roller_stopping(false), next_fd(-1), next_index(0), linked_index(0)
+{
+    if (pthread_mutex_init(&roller_mutex, nullptr)) {
+        perror("Bank error: pthread_mutex_init failed");
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&roller_cond, &cond_attr)) {
+        perror("Bank error: pthread_cond_init failed");
+    }
+    pthread_condattr_destroy(&cond_attr);
+
+    setp(buffer, buffer + LOG_BUFFER_SIZE);
+}
+
+Segmented_Log_Buffer::~Segmented_Log_Buffer()
+{
+    close();
+    pthread_mutex_destroy(&roller_mutex);
+    pthread_cond_destroy(&roller_cond);
+}
+
+void Segmented_Log_Buffer::configure(size_t segment_bytes, int segment_seconds, bool compress)
+{
+    this->segment_bytes = segment_bytes;
+    this->segment_seconds = segment_seconds;
+    this->compress = compress;
+}
+
+bool Segmented_Log_Buffer::segmented() const
+{
+    return segment_bytes > 0 || segment_seconds > 0;
+}
+
+string Segmented_Log_Buffer::segment_name(long long index) const
+{
+    char suffix[24];
+    snprintf(suffix, sizeof(suffix), ".%06lld", index);
+    return path + suffix;
+}
+
+int Segmented_Log_Buffer::open_segment(long long index, bool preallocate)
+{
+    int segment_fd = ::open(segment_name(index).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (segment_fd < 0) {
+        perror("Bank error: unable to open log segment");
+        return -1;
+    }
+
+    // Reserve the blocks without changing the size, so readers never see a tail of zeros
+    if (preallocate && segment_bytes > 0 &&
+        fallocate(segment_fd, FALLOC_FL_KEEP_SIZE, 0, segment_bytes) && errno != EOPNOTSUPP) {
+        perror("Bank error: fallocate failed");
+    }
+    return segment_fd;
+}
+
+bool Segmented_Log_Buffer::open(const string& path)
+{
+    close();
+    this->path = path;
+    active_bytes = 0;
+
+    if (!segmented()) {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        return fd >= 0;
+    }
+
+    active_index = 1;
+    fd = open_segment(active_index, true);
+    if (fd < 0) {
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &active_started);
+    rotation_due.store(false);
+    next_fd = -1;
+    next_index = active_index + 1;
+    link_active(active_index);
+    linked_index = active_index;
+
+    roller_stopping = false;
+    if (pthread_create(&roller_thread, nullptr, roller_main, this)) {
+        perror("Bank error: pthread_create failed for log roller");
+    } else {
+        roller_running = true;
+    }
+    return true;
+}
+
+bool Segmented_Log_Buffer::is_open() const
+{
+    return fd >= 0;
+}
+
+void Segmented_Log_Buffer::close()
+{
+    if (fd < 0) {
+        return;
+    }
+    write_out();
+
+    if (roller_running) {
+        // The roller finishes the last segment (uncompressed, PATH keeps pointing at it)
+        pthread_mutex_lock(&roller_mutex);
+        Closed_Segment last = {fd, active_index, active_bytes, false};
+        closed_segments.push_back(last);
+        roller_stopping = true;
+        pthread_cond_signal(&roller_cond);
+        pthread_mutex_unlock(&roller_mutex);
+
+        pthread_join(roller_thread, nullptr);
+        roller_running = false;
+    } else if (segmented()) {
+        Closed_Segment last = {fd, active_index, active_bytes, false};
+        finish_segment(last);
+    } else {
+        ::close(fd);
+    }
+    fd = -1;
+}
+
+bool Segmented_Log_Buffer::write_out()
+{
+    const char* data = pbase();
+    size_t length = pptr() - pbase();
+    setp(buffer, buffer + LOG_BUFFER_SIZE);
+
+    while (length > 0) {
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Bank error: log write failed");
+            return false;
+        }
+        data += written;
+        length -= written;
+        active_bytes += written;
+    }
+    return true;
+}
+
+int Segmented_Log_Buffer::overflow(int c)
+{
+    if (fd < 0 || !write_out()) {
+        return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int Segmented_Log_Buffer::sync()
+{
+    if (fd < 0 || !write_out()) {
+        return -1;
+    }
+
+    if (segmented() && ((segment_bytes > 0 && active_bytes >= static_cast<off_t>(segment_bytes)) ||
+                        rotation_due.load(memory_order_relaxed))) {
+        rotate();
+    }
+    return 0;
+}
+
+// Runs under log_file_lock, between two lines
+void Segmented_Log_Buffer::rotate()
+{
+    pthread_mutex_lock(&roller_mutex);
+    if (next_fd >= 0) {
+        Closed_Segment closed = {fd, active_index, active_bytes, compress};
+        closed_segments.push_back(closed);
+        fd = next_fd;
+        active_index = next_index;
+        next_fd = -1;
+        next_index++;
+        active_bytes = 0;
+        rotation_due.store(false, memory_order_relaxed);
+        clock_gettime(CLOCK_MONOTONIC, &active_started);
+    }
+    pthread_cond_signal(&roller_cond);
+    pthread_mutex_unlock(&roller_mutex);
+}
+
+// PATH -> the segment's file name, replaced atomically
+void Segmented_Log_Buffer::link_active(long long index)
+{
+    string segment = segment_name(index);
+    size_t slash = segment.rfind('/');
+    string target = slash == string::npos ? segment : segment.substr(slash + 1);
+    string temporary = path + ".link";
+
+    unlink(temporary.c_str());
+    if (symlink(target.c_str(), temporary.c_str()) || rename(temporary.c_str(), path.c_str())) {
+        perror("Bank error: unable to link the active log segment");
+    }
+}
+
+void Segmented_Log_Buffer::finish_segment(const Closed_Segment& segment)
+{
+    // Truncating to the written size releases the preallocated blocks past it
+    if (ftruncate(segment.fd, segment.bytes)) {
+        perror("Bank error: ftruncate failed");
+    }
+    ::close(segment.fd);
+
+    if (segment.compress) {
+        string name = segment_name(segment.index);
+        char* argv[] = {const_cast<char*>("gzip"), const_cast<char*>("-f"), const_cast<char*>(name.c_str()), nullptr};
+        pid_t pid;
+        int status;
+        if (posix_spawnp(&pid, "gzip", nullptr, nullptr, argv, environ) || waitpid(pid, &status, 0) < 0 ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Bank error: gzip failed for %s\n", name.c_str());
+        }
+    }
+}
+
+void* Segmented_Log_Buffer::roller_main(void* arg)
+{
+    static_cast<Segmented_Log_Buffer*>(arg)->run_roller();
+    return nullptr;
+}
+
+void Segmented_Log_Buffer::run_roller()
+{
+    pthread_mutex_lock(&roller_mutex);
+    while (true) {
+        bool prepare_failed = false;
+        if (next_fd < 0 && !roller_stopping) {
+            long long index = next_index;
+            pthread_mutex_unlock(&roller_mutex);
+            int prepared = open_segment(index, true);
+            pthread_mutex_lock(&roller_mutex);
+            next_fd = prepared;
+            prepare_failed = prepared < 0;
+        }
+
+        if (linked_index != active_index) {
+            long long index = active_index;
+            pthread_mutex_unlock(&roller_mutex);
+            link_active(index);
+            pthread_mutex_lock(&roller_mutex);
+            linked_index = index;
+        }
+
+        if (!closed_segments.empty()) {
+            Closed_Segment segment = closed_segments.front();
+            closed_segments.pop_front();
+            pthread_mutex_unlock(&roller_mutex);
+            finish_segment(segment);
+            pthread_mutex_lock(&roller_mutex);
+            continue;
+        }
+
+        if (roller_stopping) {
+            break;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec deadline = now;
+        deadline.tv_sec += 1; // retry a failed prepare once a second
+        if (segment_seconds > 0 && !rotation_due.load(memory_order_relaxed)) {
+            deadline = active_started;
+            deadline.tv_sec += segment_seconds;
+            if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+                // The writer rotates at its next line
+                rotation_due.store(true, memory_order_relaxed);
+                continue;
+            }
+            pthread_cond_timedwait(&roller_cond, &roller_mutex, &deadline);
+        } else if (prepare_failed) {
+            pthread_cond_timedwait(&roller_cond, &roller_mutex, &deadline);
+        } else {
+            pthread_cond_wait(&roller_cond, &roller_mutex);
+        }
+    }
+
+    // The prepared segment was never used
+    if (next_fd >= 0) {
+        ::close(next_fd);
+        unlink(segment_name(next_index).c_str());
+        next_fd = -1;
+    }
+    pthread_mutex_unlock(&roller_mutex);
+}
+
+Segmented_Log::Segmented_Log() : ostream(nullptr)
+{
+    rdbuf(&log_buffer);
+}
+
+void Segmented_Log::configure(size_t segment_bytes, int segment_seconds, bool compress)
+{
+    log_buffer.configure(segment_bytes, segment_seconds, compress);
+}
+
+void Segmented_Log::open(const string& path)
+{
+    if (log_buffer.open(path)) {
+        clear();
+    } else {
+        setstate(failbit);
+    }
+}
+
+bool Segmented_Log::is_open() const
+{
+    return log_buffer.is_open();
+}
+
+void Segmented_Log::close()
+{
+    flush();
+    log_buffer.close();
+}
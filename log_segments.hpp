@@ -0,0 +1,102 @@
+#ifndef LOG_SEGMENTS_H
+#define LOG_SEGMENTS_H
+
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <deque>
+#include <atomic>
+#include <pthread.h>
+
+using namespace std;
+
+#define LOG_BUFFER_SIZE 65536
+
+/*
+ * Stream buffer behind log_file. Every sync (each endl) writes the buffered
+ * lines to the active segment, as ofstream did. Without segment limits the
+ * log is one plain file.
+ *
+ * With a size or age limit the log is a series of segments PATH.000001,
+ * PATH.000002, ... and PATH is a symlink to the active one, so `tail -F PATH`
+ * follows the rotation. A background roller thread opens and preallocates
+ * the next segment ahead of time. It also truncates, closes and optionally
+ * gzips the closed ones and moves the symlink. A writer that finds its
+ * segment full only swaps in the prepared descriptor. If the roller has not
+ * prepared one yet, the writer keeps appending to the active segment rather
+ * than wait.
+ *
+ * Writers are serialized by log_file_lock; roller_mutex only guards the
+ * handoff between the writer and the roller.
+ */
+class Segmented_Log_Buffer : public streambuf {
+private:
+    struct Closed_Segment {
+        int fd;
+        long long index;
+        off_t bytes;
+        bool compress;
+    };
+
+    char buffer[LOG_BUFFER_SIZE];
+    string path;
+    size_t segment_bytes;        // 0: no size limit
+    int segment_seconds;         // 0: no age limit
+    bool compress;
+
+    int fd;
+    off_t active_bytes;
+    long long active_index;
+    atomic<bool> rotation_due;   // set by the roller once the segment is too old
+
+    pthread_mutex_t roller_mutex;
+    pthread_cond_t roller_cond;
+    pthread_t roller_thread;
+    bool roller_running;
+    bool roller_stopping;
+    int next_fd;                 // prepared by the roller, -1 until ready
+    long long next_index;
+    long long linked_index;      // segment the PATH symlink points to
+    struct timespec active_started;
+    deque<Closed_Segment> closed_segments;
+
+    bool segmented() const;
+    string segment_name(long long index) const;
+    int open_segment(long long index, bool preallocate);
+    bool write_out();
+    void rotate();
+    void link_active(long long index);
+    void finish_segment(const Closed_Segment& segment);
+    static void* roller_main(void* arg);
+    void run_roller();
+
+protected:
+    int overflow(int c) override;
+    int sync() override;
+
+public:
+    Segmented_Log_Buffer();
+    ~Segmented_Log_Buffer();
+
+    void configure(size_t segment_bytes, int segment_seconds, bool compress);
+    bool open(const string& path);
+    bool is_open() const;
+    void close();
+};
+
+/* The ofstream interface the bank uses, over a Segmented_Log_Buffer */
+class Segmented_Log : public ostream {
+private:
+    Segmented_Log_Buffer log_buffer;
+
+public:
+    Segmented_Log();
+
+    // Before open: rotate after segment_bytes or segment_seconds (0 = no limit), gzip closed segments
+    void configure(size_t segment_bytes, int segment_seconds, bool compress);
+    void open(const string& path);
+    bool is_open() const;
+    void close();
+};
+
+#endif
@@ -7,10 +7,24 @@
 #include <csignal>
 #include <pthread.h>
 #include <unistd.h>
-#include <queue>
+#include <sched.h>
 #include <cstring>
+#include <getopt.h>
 #include "account.hpp"
 #include "bank.hpp"
+#include "replay.hpp"
+#include "mpmc_queue.hpp"
+#include "dedup.hpp"
+#include "retry_scheduler.hpp"
+#include "lifecycle.hpp"
+#include "batch.hpp"
+#include "session_pool.hpp"
+#include "server.hpp"
+#include "command_pool.hpp"
+#include "placement.hpp"
+#include "admission.hpp"
+#include "partition.hpp"
+#include "audit.hpp"
 
 #define SUCCESS 0
 #define ACCOUNT_EXIST -1
@@ -25,32 +39,23 @@ using namespace std;
 
 /* Global variables */
 Bank* bank_instance;
-ofstream log_file;
+Segmented_Log log_file;
 vector<string> atm_files;
-bool program_termination_flag;
+Bank_Lifecycle* lifecycle;
+Retry_Scheduler* retry_scheduler;
+int atm_batch_size = 1; // commands per Bank::execute_batch call, 1 = unbatched
+Admission_Controller* admission = nullptr; // rate limits and fair share, only with the admission options
+string trace_path; // --trace: the Chrome trace JSON written at exit
+Dedup_Table dedup_table; // idempotency keys of running and committed commands
+Partition_Router* partitions = nullptr; // --partitions: account commands go to the partition processes
+Balance_Auditor* auditor = nullptr;     // --audit: checks this process's bank; partitions run their own
 
-int completed_atms_count = 0;
-pthread_mutex_t completed_atms_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* VIP queue: lock-free, highest VIP level first; entries are Queued_Command_Pool nodes released by the VIP thread that runs them */
+Mpmc_Priority_Queue<Queued_Command*> vip_commands(VIP_PRIORITY_LEVELS, VIP_LEVEL_CAPACITY);
+Queue_Waiters vip_waiters; // idle VIP threads; closed once no ATM can add more VIP commands
+int vip_worker_count = 0;  // VIP threads; with none, ATMs run their VIP commands themselves
 
-/* VIP Command Structure and Queue */
-struct VipCommand {
-    int vip_level;
-    string command;
-
-    // Comparator to ensure that commands with higher VIP levels come first in the queue
-    bool operator<(const VipCommand& other) const {
-        return vip_level < other.vip_level;
-    }
-};
-
-priority_queue<VipCommand> vip_commands;
-pthread_mutex_t vip_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-/* --- Changes Begin: Track ATM threads to be closed --- */
-vector<bool> atm_threads_to_close;  // To track which ATM threads need to be closed
-pthread_mutex_t atm_threads_to_close_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t atm_mutex = PTHREAD_MUTEX_INITIALIZER;
-/* --- Changes End --- */
+#define VIP_PUSH_WAIT_NS 10000000 // how long an ATM waits for room on a full VIP level before running the command itself
 
 
 /* Function Declarations for Threads */
@@ -59,14 +64,705 @@ void* status_printer_thread(void* arg);
 void* commission_thread(void* arg);
 void* vip_thread(void* arg);
 
-/* Function to add a VIP command to the queue */
-void add_vip_command(const string& command, int vip_level) {
-    pthread_mutex_lock(&vip_queue_mutex);
-    vip_commands.push(VipCommand{vip_level, command});
-    pthread_mutex_unlock(&vip_queue_mutex);
+/* Creates a thread on the CPUs --affinity gives its role; node -1 is a background thread */
+void create_placed_thread(pthread_t* thread, void* (*start_routine)(void*), void* arg, int node, const string& role) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (node < 0) {
+        thread_placement.set_background_affinity(&attr);
+    } else {
+        thread_placement.set_worker_affinity(&attr, node);
+    }
+    if (pthread_create(thread, &attr, start_routine, arg)) {
+        perror(("Bank error: pthread_create failed for " + role + " thread").c_str());
+        exit(1);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/* Lets the VIP threads exit once they have drained the queue */
+void close_vip_queue() {
+    vip_waiters.close();
+}
+
+/* A keyed command that already committed succeeds without running again; one still running fails and may be retried */
+int duplicate_command(const vector<string>& operation_words, int atm_id, int state, int* new_balance) {
+    string key_word;
+    for (const string& word : operation_words) {
+        if (word.compare(0, 4, "KEY=") == 0) {
+            key_word = word;
+        }
+    }
+    stringstream log_line;
+    if (state == DEDUP_COMMITTED) {
+        if (new_balance != nullptr) {
+            *new_balance = -1;
+        }
+        log_line << atm_id << ": Command " << key_word << " was already applied, skipped";
+        write_to_log_file(log_line.str());
+        return SUCCESS;
+    }
+    log_line << "Error " << atm_id << ": Your transaction failed - command " << key_word << " is already running";
+    write_to_log_file(log_line.str());
+    return OPERATION_FAILED;
+}
+
+/* Runs one command against the bank, handling ATM close requests */
+int run_operation_with_balance(const vector<string>& operation_words, int atm_id, int* new_balance) {
+    // A command with an idempotency key runs at most once to a commit
+    unsigned long long key;
+    Dedup_Claim claim;
+    bool keyed = idempotency_key(operation_words, atm_id, &key);
+    if (keyed) {
+        int state = dedup_table.claim(key, &claim);
+        if (state != DEDUP_NEW) {
+            return duplicate_command(operation_words, atm_id, state, new_balance);
+        }
+    }
+
+    // ATM closes stay with the router, which owns the ATM state
+    int status;
+    if (partitions != nullptr && operation_words[0][0] != 'C') {
+        status = partitions->execute(operation_words, atm_id, new_balance);
+    } else {
+        status = bank_instance->execute_operation(operation_words, atm_id, new_balance);
+    }
+    if (keyed) {
+        dedup_table.finish(claim, status == SUCCESS);
+    }
+
+    if (operation_words[0][0] == 'C' && status == SUCCESS) { // tar_atm need to be closed
+        int target_atm_id = stoi(operation_words[1]);
+        lifecycle->close_atm(target_atm_id);  // Wakes the target out of its current delay
+        retry_scheduler->cancel_atm(target_atm_id);
+    }
+
+    return status;
+}
+
+int run_operation(const vector<string>& operation_words, int atm_id) {
+    return run_operation_with_balance(operation_words, atm_id, nullptr);
+}
+
+/* Runs a command received by the server; closed or unknown ATMs are refused */
+int serve_operation(const vector<string>& operation_words, int atm_id, int* new_balance) {
+    if (atm_id < 1 || atm_id > static_cast<int>(atm_files.size()) || lifecycle->is_atm_closed(atm_id)) {
+        return OPERATION_FAILED;
+    }
+    return run_operation_with_balance(operation_words, atm_id, new_balance);
+}
+
+/* Runs a PERSISTENT command; failed attempts are parked in the retry scheduler */
+void run_persistent_operation(const vector<string>& operation_words, const string& operation_line, int atm_id) {
+    if (run_operation(operation_words, atm_id) != SUCCESS) {
+        retry_scheduler->schedule_retry(atm_id, operation_words, operation_line, 1);
+    }
+}
+
+/* A command admission control turned away: PERSISTENT ones are parked for retry, others fail */
+void shed_command(const vector<string>& operation_words, const string& operation_line, int atm_id, bool is_persistent) {
+    if (is_persistent) {
+        retry_scheduler->schedule_retry(atm_id, operation_words, operation_line, 1);
+        admission->record_deferred(atm_id);
+        return;
+    }
+    stringstream log_line;
+    log_line << "Error " << atm_id << ": Your transaction failed - the bank is overloaded";
+    write_to_log_file(log_line.str());
+    admission->record_shed(atm_id);
+}
+
+/* Runs a command once admission control gives it an execution slot */
+void run_admitted_operation(const vector<string>& operation_words, const string& operation_line, int atm_id,
+                            int admission_class, bool is_persistent) {
+    if (admission != nullptr) {
+        Trace_Span span("admission");
+        if (admission->enter(admission_class, atm_id) == ADMISSION_SHED) {
+            shed_command(operation_words, operation_line, atm_id, is_persistent);
+            return;
+        }
+    }
+    if (is_persistent) {
+        run_persistent_operation(operation_words, operation_line, atm_id);
+    } else {
+        run_operation(operation_words, atm_id);
+    }
+    if (admission != nullptr) {
+        admission->leave();
+    }
+}
+
+/* Runs a VIP command on the calling thread, ahead of the ATM's own commands */
+void run_vip_inline(const vector<string>& operation_words, const string& operation_line, int atm_id, bool is_persistent) {
+    run_admitted_operation(operation_words, operation_line, atm_id, ADMISSION_VIP, is_persistent);
+}
+
+/* Function to add a VIP command to the queue; false if the queue is at --queue-limit */
+bool add_vip_command(const vector<string>& operation_words, const string& operation_line, int vip_level, int atm_id, bool is_persistent) {
+    // Checked without a lock, so ATMs pushing at the same moment may each take the last place
+    if (admission != nullptr && admission->queue_full(static_cast<size_t>(vip_commands.size()))) {
+        return false;
+    }
+    if (vip_worker_count == 0) {
+        run_vip_inline(operation_words, operation_line, atm_id, is_persistent);
+        return true;
+    }
+    Queued_Command* command = Queued_Command_Pool::acquire();
+    command->set(operation_line, atm_id, vip_level, is_persistent);
+    // A full level holds the ATM back for a while; if the VIP threads still
+    // make no room, the ATM runs the command itself rather than wait on them
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!vip_commands.try_push(vip_level, command)) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - start.tv_sec) * 1000000000LL + (now.tv_nsec - start.tv_nsec) > VIP_PUSH_WAIT_NS) {
+            Queued_Command_Pool::release(command);
+            run_vip_inline(operation_words, operation_line, atm_id, is_persistent);
+            return true;
+        }
+        sched_yield();
+    }
+    vip_waiters.notify();
+    return true;
+}
+
+/* Runs one queued VIP command and returns its node to the pool */
+void run_queued_vip_command(Queued_Command* command, vector<string>& operation_words, string& operation_line) {
+    Trace_Command trace_command("VIP command", command->atm_id);
+    command->get_words(operation_words);
+    if (command->is_persistent) {
+        command->get_line(operation_line);
+    }
+    run_admitted_operation(operation_words, operation_line, command->atm_id, ADMISSION_VIP, command->is_persistent);
+    Queued_Command_Pool::release(command);
+}
+
+/* Runs whatever is still queued once the VIP threads are gone, so no VIP command is dropped at exit */
+void drain_vip_queue() {
+    vector<string> operation_words;
+    string operation_line;
+    Queued_Command* command;
+    while (vip_commands.try_pop(command)) {
+        run_queued_vip_command(command, operation_words, operation_line);
+    }
+}
+
+void print_usage() {
+    cerr << "Usage: bank [--no-latency] [--seed N] [--record FILE] [--hot-account ID]... [--striped-account ID]..." << endl;
+    cerr << "            [--max-retries N] [--retry-delay USEC] [--retry-backoff FACTOR] [--atm-batch N] <number of VIP threads> <ATM input file 1> <ATM input file 2> ..." << endl;
+    cerr << "            [--affinity none|node|core [--cpu-nodes 0-3/4-7] [--background-cpus N]]" << endl;
+    cerr << "            [--atm-rate PER_SEC [--atm-burst N]] [--vip-share F [--admission-slots N]] [--queue-limit N]" << endl;
+    cerr << "            [--rollback-window ITERATIONS] [--history-memory MB] [--history-file PATH]" << endl;
+    cerr << "            [--log-segment-size MB] [--log-segment-seconds N] [--log-compress]" << endl;
+    cerr << "            [--trace FILE [--trace-sample N]] [--partitions N] [--audit MS] [--import FILE]" << endl;
+    cerr << "       bank [--no-latency] [--record FILE] --replay FILE [--replay-parallel]" << endl;
+    cerr << "       bank [options] --async [--async-threads N] [--atm-list FILE] <number of VIP threads> <ATM input file 1> ..." << endl;
+    cerr << "       bank [options] --server unix:PATH|tcp:PORT [--server-threads N] [--server-atms N]" << endl;
+    cerr << "       bank [--record FILE] --batch [--batch-threads N] <number of VIP threads> <ATM input file 1> ..." << endl;
+}
+
+/* Writes the --trace file once the traced threads are done */
+void export_trace() {
+    if (trace_enabled && !trace_path.empty() && !trace_export(trace_path)) {
+        cerr << "Bank error: unable to write trace file" << endl;
+    }
+}
+
+/* Opens the accounts of the --import file before any ATM runs; recorded like an ATM command */
+void import_at_startup(const string& import_path) {
+    if (import_path.empty()) {
+        return;
+    }
+    vector<string> operation_words = {"I", import_path};
+    if (bank_instance->execute_operation(operation_words, 0) != SUCCESS) {
+        cerr << "Bank error: unable to import account file" << endl;
+        exit(1);
+    }
+}
+
+/* Starts the --audit thread on this process's bank */
+void start_auditor() {
+    if (audit_enabled && partitions == nullptr) {
+        auditor = new Balance_Auditor(bank_instance, "the bank");
+        auditor->start();
+    }
+}
+
+/* Stops the auditor once no operation runs any more, and prints its summary */
+void finish_auditor() {
+    if (auditor == nullptr) {
+        return;
+    }
+    auditor->stop();
+    cout << "Audit: " << auditor->get_checks() << " checks, " << auditor->get_violations() << " violations" << endl;
+    delete auditor;
+    auditor = nullptr;
+}
+
+/* Prints the final balances' checksum so two runs can be compared */
+void print_final_state(const string& prefix) {
+    vector<pair<int, int>> balances;
+    int bank_balance;
+    if (partitions != nullptr) {
+        vector<Account_State> states;
+        partitions->get_account_states(states, &bank_balance);
+        for (const Account_State& state : states) {
+            balances.push_back(make_pair(state.account_id, state.balance));
+        }
+    } else {
+        bank_instance->get_balances(balances, &bank_balance);
+    }
+
+    cout << prefix << ", " << balances.size() << " accounts, bank balance " << bank_balance
+         << ", checksum " << hex << balances_checksum(balances) << dec << endl;
+}
+
+/* Creates the bank with the account options given on the command line */
+void create_bank(bool seed_given, unsigned int commission_seed, const vector<int>& hot_account_ids, const vector<int>& striped_account_ids) {
+    bank_instance = new Bank();
+    if (seed_given) {
+        bank_instance->set_commission_seed(commission_seed);
+    }
+    for (int account_id : hot_account_ids) {
+        bank_instance->set_hot_account(account_id);
+    }
+    for (int account_id : striped_account_ids) {
+        bank_instance->set_striped_account(account_id);
+    }
+}
+
+/* Re-executes a recorded run and prints its final state */
+int replay_main(const string& replay_path, bool replay_parallel, const string& record_path) {
+    Replay_Schedule schedule;
+    if (!load_replay(replay_path, schedule)) {
+        cerr << "Bank error: unable to open replay file" << endl;
+        exit(1);
+    }
+
+    bank_instance = new Bank();
+    bank_instance->set_commission_seed(schedule.commission_seed);
+    for (int i = 0; i < schedule.atm_count; ++i) {
+        bank_instance->set_atm_file("ATM " + to_string(i + 1));
+    }
+    bank_instance->set_atm_closed_to_false(schedule.atm_count);
+
+    log_file.open("log.txt");
+    if (!log_file.is_open()) {
+        cerr << "Bank error: unable to open log file" << endl;
+        exit(1);
+    }
+
+    // Recording a replay gives a second schedule to compare against the first
+    if (!record_path.empty()) {
+        replay_recorder = new Replay_Recorder();
+        if (!replay_recorder->open(record_path, schedule.commission_seed, schedule.atm_count)) {
+            cerr << "Bank error: unable to open record file" << endl;
+            exit(1);
+        }
+    }
+
+    start_auditor();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_replay(bank_instance, schedule, replay_parallel);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    finish_auditor();
+
+    bank_instance->print_status();
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    print_final_state("Replay: " + to_string(schedule.entries.size()) + " operations in " + to_string(elapsed) + " s");
+
+    if (replay_recorder != nullptr) {
+        replay_recorder->close();
+        delete replay_recorder;
+    }
+    log_file.close();
+    export_trace();
+    delete bank_instance;
+
+    return 0;
+}
+
+/* Reprocesses the ATM files as one bulk job and prints its final state */
+int batch_main(const vector<string>& batch_files, int batch_threads, const string& record_path) {
+    Batch_Plan plan;
+    if (!load_batch(batch_files, plan)) {
+        cerr << "Bank error: illegal arguments" << endl;
+        exit(1);
+    }
+    plan_batch_waves(plan);
+
+    for (const string& file_name : batch_files) {
+        bank_instance->set_atm_file(file_name);
+    }
+    bank_instance->set_atm_closed_to_false(batch_files.size());
+
+    log_file.open("log.txt");
+    if (!log_file.is_open()) {
+        cerr << "Bank error: unable to open log file" << endl;
+        exit(1);
+    }
+
+    if (!record_path.empty()) {
+        replay_recorder = new Replay_Recorder();
+        if (!replay_recorder->open(record_path, bank_instance->get_commission_seed(), batch_files.size())) {
+            cerr << "Bank error: unable to open record file" << endl;
+            exit(1);
+        }
+    }
+
+    start_auditor();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_batch(bank_instance, plan, batch_threads);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    finish_auditor();
+
+    bank_instance->print_status();
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    print_final_state("Batch: " + to_string(plan.operations.size()) + " operations in " + to_string(plan.waves.size()) +
+                      " waves, " + to_string(elapsed) + " s");
+
+    if (replay_recorder != nullptr) {
+        replay_recorder->close();
+        delete replay_recorder;
+    }
+    log_file.close();
+    export_trace();
+    delete bank_instance;
+
+    return 0;
+}
+
+/* Serves live clients over a socket until SIGINT or SIGTERM */
+int server_main(const string& server_address, int server_threads, int server_atms, const string& record_path, const string& import_path) {
+    // Before any thread starts, so the signals reach only the accept loop
+    Bank_Server::block_termination_signals();
+
+    for (int i = 0; i < server_atms; ++i) {
+        atm_files.push_back("ATM " + to_string(i + 1));
+        bank_instance->set_atm_file(atm_files.back());
+    }
+    bank_instance->set_atm_closed_to_false(server_atms);
+
+    log_file.open("log.txt");
+    if (!log_file.is_open()) {
+        cerr << "Bank error: unable to open log file" << endl;
+        exit(1);
+    }
+
+    if (!record_path.empty()) {
+        replay_recorder = new Replay_Recorder();
+        if (!replay_recorder->open(record_path, bank_instance->get_commission_seed(), server_atms)) {
+            cerr << "Bank error: unable to open record file" << endl;
+            exit(1);
+        }
+    }
+    import_at_startup(import_path);
+
+    lifecycle = new Bank_Lifecycle(server_atms);
+    retry_scheduler = new Retry_Scheduler(run_operation, 0, 0, 1.0); // only tracks closed ATMs here
+
+    Bank_Server server(serve_operation);
+    if (!server.listen_on(server_address)) {
+        cerr << "Bank error: illegal arguments" << endl;
+        exit(1);
+    }
+
+    pthread_t commission_worker_thread, status_printer_worker_thread;
+    if (pthread_create(&commission_worker_thread, nullptr, commission_thread, nullptr) ||
+        pthread_create(&status_printer_worker_thread, nullptr, status_printer_thread, nullptr)) {
+        perror("Bank error: pthread_create failed for commission or print thread");
+        exit(1);
+    }
+
+    start_auditor();
+    server.run(server_threads);
+
+    lifecycle->request_termination();
+    if (pthread_join(commission_worker_thread, nullptr) || pthread_join(status_printer_worker_thread, nullptr)) {
+        perror("Bank error: pthread_join failed for commission or print thread");
+        exit(1);
+    }
+    finish_auditor();
+
+    if (replay_recorder != nullptr) {
+        print_final_state("Final state");
+        replay_recorder->close();
+        delete replay_recorder;
+    }
+    log_file.close();
+    export_trace();
+    delete retry_scheduler;
+    delete lifecycle;
+    delete bank_instance;
+
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"no-latency", no_argument, nullptr, 'n'},
+        {"seed", required_argument, nullptr, 's'},
+        {"record", required_argument, nullptr, 'r'},
+        {"replay", required_argument, nullptr, 'p'},
+        {"replay-parallel", no_argument, nullptr, 'P'},
+        {"hot-account", required_argument, nullptr, 'h'},
+        {"striped-account", required_argument, nullptr, 'S'},
+        {"max-retries", required_argument, nullptr, 'm'},
+        {"retry-delay", required_argument, nullptr, 'd'},
+        {"retry-backoff", required_argument, nullptr, 'b'},
+        {"batch", no_argument, nullptr, 'B'},
+        {"batch-threads", required_argument, nullptr, 't'},
+        {"async", no_argument, nullptr, 'A'},
+        {"async-threads", required_argument, nullptr, 'T'},
+        {"atm-list", required_argument, nullptr, 'L'},
+        {"server", required_argument, nullptr, 'x'},
+        {"atm-batch", required_argument, nullptr, 'k'},
+        {"server-threads", required_argument, nullptr, 'y'},
+        {"server-atms", required_argument, nullptr, 'z'},
+        {"affinity", required_argument, nullptr, 'a'},
+        {"cpu-nodes", required_argument, nullptr, 'c'},
+        {"background-cpus", required_argument, nullptr, 'g'},
+        {"atm-rate", required_argument, nullptr, 'q'},
+        {"atm-burst", required_argument, nullptr, 'u'},
+        {"vip-share", required_argument, nullptr, 'v'},
+        {"admission-slots", required_argument, nullptr, 'w'},
+        {"queue-limit", required_argument, nullptr, 'l'},
+        {"rollback-window", required_argument, nullptr, 'W'},
+        {"history-memory", required_argument, nullptr, 'M'},
+        {"history-file", required_argument, nullptr, 'F'},
+        {"log-segment-size", required_argument, nullptr, 'E'},
+        {"log-segment-seconds", required_argument, nullptr, 'G'},
+        {"log-compress", no_argument, nullptr, 'Y'},
+        {"trace", required_argument, nullptr, 'o'},
+        {"trace-sample", required_argument, nullptr, 'O'},
+        {"partitions", required_argument, nullptr, 'N'},
+        {"audit", required_argument, nullptr, 'j'},
+        {"import", required_argument, nullptr, 'i'},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    string record_path, replay_path;
+    bool replay_parallel = false;
+    bool seed_given = false;
+    unsigned int commission_seed = 0;
+    vector<int> hot_account_ids;
+    vector<int> striped_account_ids;
+    int max_retries = MAX_RETRIES;
+    useconds_t retry_delay = RETRY_DELAY;
+    double retry_backoff = 2.0;
+    bool batch_mode = false;
+    int batch_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool async_mode = false;
+    int async_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    string atm_list_path;
+    string server_address;
+    int server_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int server_atms = 1;
+    int placement_mode = PLACEMENT_NONE;
+    string cpu_nodes;
+    int background_cpus = -1; // -1: one when there are CPUs to spare
+    bool admission_enabled = false;
+    double atm_rate = 0;
+    double atm_burst = 0;
+    double vip_share = 0.5;
+    int admission_slots = -1; // -1: one per ATM once --vip-share is given
+    int queue_limit = 0;
+    int rollback_window = ROLLBACK_ITERATIONS;
+    size_t history_memory = STATUS_HISTORY_MEMORY;
+    string history_file = STATUS_HISTORY_FILE;
+    size_t log_segment_bytes = 0;
+    int log_segment_seconds = 0;
+    bool log_compress = false;
+    int trace_sample = 1;
+    int partition_count = 0;
+    int audit_ms = 0;
+    string import_path;
+
+    int option;
+    while ((option = getopt_long(argc, argv, "+n", long_options, nullptr)) != -1) {
+        switch (option) {
+            case 'n':
+                latency_injection_enabled = false;
+                break;
+            case 's':
+                seed_given = true;
+                commission_seed = static_cast<unsigned int>(stoul(optarg));
+                break;
+            case 'r':
+                record_path = optarg;
+                break;
+            case 'p':
+                replay_path = optarg;
+                break;
+            case 'P':
+                replay_parallel = true;
+                break;
+            case 'h':
+                hot_account_ids.push_back(stoi(optarg));
+                break;
+            case 'S':
+                striped_account_ids.push_back(stoi(optarg));
+                break;
+            case 'm':
+                max_retries = stoi(optarg);
+                break;
+            case 'd':
+                retry_delay = static_cast<useconds_t>(stoul(optarg));
+                break;
+            case 'b':
+                retry_backoff = stod(optarg);
+                break;
+            case 'B':
+                batch_mode = true;
+                latency_injection_enabled = false;
+                break;
+            case 't':
+                batch_threads = stoi(optarg);
+                break;
+            case 'A':
+                async_mode = true;
+                break;
+            case 'T':
+                async_threads = stoi(optarg);
+                break;
+            case 'L':
+                atm_list_path = optarg;
+                break;
+            case 'x':
+                server_address = optarg;
+                break;
+            case 'k':
+                atm_batch_size = stoi(optarg);
+                break;
+            case 'y':
+                server_threads = stoi(optarg);
+                break;
+            case 'z':
+                server_atms = stoi(optarg);
+                break;
+            case 'a':
+                if (string(optarg) == "node") {
+                    placement_mode = PLACEMENT_NODE;
+                } else if (string(optarg) == "core") {
+                    placement_mode = PLACEMENT_CORE;
+                } else if (string(optarg) != "none") {
+                    print_usage();
+                    exit(1);
+                }
+                break;
+            case 'c':
+                cpu_nodes = optarg;
+                break;
+            case 'g':
+                background_cpus = stoi(optarg);
+                break;
+            case 'q':
+                admission_enabled = true;
+                atm_rate = stod(optarg);
+                break;
+            case 'u':
+                admission_enabled = true;
+                atm_burst = stod(optarg);
+                break;
+            case 'v':
+                admission_enabled = true;
+                vip_share = stod(optarg);
+                if (admission_slots < 0) {
+                    admission_slots = 0; // resolved once the ATM count is known
+                }
+                break;
+            case 'w':
+                admission_enabled = true;
+                admission_slots = stoi(optarg);
+                break;
+            case 'l':
+                admission_enabled = true;
+                queue_limit = stoi(optarg);
+                break;
+            case 'W':
+                rollback_window = stoi(optarg);
+                break;
+            case 'M':
+                history_memory = static_cast<size_t>(stod(optarg) * (1 << 20));
+                break;
+            case 'F':
+                history_file = optarg;
+                break;
+            case 'E':
+                log_segment_bytes = static_cast<size_t>(stod(optarg) * (1 << 20));
+                break;
+            case 'G':
+                log_segment_seconds = stoi(optarg);
+                break;
+            case 'Y':
+                log_compress = true;
+                break;
+            case 'o':
+                trace_path = optarg;
+                break;
+            case 'O':
+                trace_sample = stoi(optarg);
+                break;
+            case 'N':
+                partition_count = stoi(optarg);
+                break;
+            case 'i':
+                import_path = optarg;
+                break;
+            case 'j':
+                audit_ms = stoi(optarg);
+                if (audit_ms < 1) {
+                    print_usage();
+                    exit(1);
+                }
+                break;
+            default:
+                print_usage();
+                exit(1);
+        }
+    }
+
+    // Partitions share the log descriptor and run ATM commands one by one; a
+    // replay or batch needs the single bank's order, and segments its roller
+    if (partition_count < 0 || (partition_count > 0 && (!record_path.empty() || !replay_path.empty() || batch_mode ||
+                                                        !server_address.empty() || atm_batch_size > 1 ||
+                                                        log_segment_bytes > 0 || log_segment_seconds > 0))) {
+        cerr << "Bank error: illegal arguments" << endl;
+        exit(1);
+    }
+    // An import opens accounts in this process's bank, which partitions do not use
+    if (!import_path.empty() && (partition_count > 0 || !replay_path.empty() || batch_mode)) {
+        cerr << "Bank error: illegal arguments" << endl;
+        exit(1);
+    }
+
+    log_file.configure(log_segment_bytes, log_segment_seconds, log_compress);
+    if (audit_ms > 0) {
+        audit_start(static_cast<useconds_t>(audit_ms) * 1000);
+    }
+    if (!trace_path.empty()) {
+        trace_start(trace_sample);
+        trace_thread_name("main");
+    }
+
+    // Skip the parsed options, argv[0] stays the program name
+    argv += optind - 1;
+    argc -= optind - 1;
+
+    if (!replay_path.empty()) {
+        return replay_main(replay_path, replay_parallel, record_path);
+    }
+
+    // Live clients bring their own pacing, so the simulated delays are off
+    if (!server_address.empty()) {
+        latency_injection_enabled = false;
+        create_bank(seed_given, commission_seed, hot_account_ids, striped_account_ids);
+        bank_instance->configure_rollback(rollback_window, history_memory, history_file);
+        return server_main(server_address, server_threads, server_atms, record_path, import_path);
+    }
+
     if (argc <= 1) {
         cerr << "Bank error: illegal arguments" << endl;
         exit(1);
@@ -78,22 +774,54 @@ int main(int argc, char *argv[]) {
         num_vip_threads = stoi(argv[1]); // First argument is the number of VIP threads
     }
 
-   
-    // Create VIP threads
-    pthread_t* vip_threads = new pthread_t[num_vip_threads];
-    for (int i = 0; i < num_vip_threads; ++i) {
-        if (pthread_create(&vip_threads[i], nullptr, vip_thread, nullptr)) {
-            perror("Bank error: pthread_create failed for VIP thread");
+
+    // Batch mode runs the files as one job, without VIP, retry or background threads
+    if (batch_mode) {
+        create_bank(seed_given, commission_seed, hot_account_ids, striped_account_ids);
+        return batch_main(vector<string>(argv + 2, argv + argc), batch_threads, record_path);
+    }
+
+    // Sessions model their delays themselves and rank VIP commands in the ready
+    // queue, so the bank's in-lock sleeps and the VIP threads are not used
+    bool async_latency = latency_injection_enabled;
+    if (async_mode) {
+        latency_injection_enabled = false;
+        num_vip_threads = 0;
+    }
+
+    if (placement_mode != PLACEMENT_NONE) {
+        if (!thread_placement.load_topology(cpu_nodes)) {
+            cerr << "Bank error: illegal arguments" << endl;
             exit(1);
         }
+        thread_placement.set_mode(placement_mode);
+        if (background_cpus < 0) {
+            background_cpus = sysconf(_SC_NPROCESSORS_ONLN) > 2 ? 1 : 0;
+        }
+        thread_placement.reserve_background_cpus(background_cpus);
+        cout << thread_placement.describe() << endl;
     }
 
     // Initialize Bank instance
-    bank_instance = new Bank();
+    create_bank(seed_given, commission_seed, hot_account_ids, striped_account_ids);
+    bank_instance->configure_rollback(rollback_window, history_memory, history_file);
 
-    // Load ATM Files
-    for (int i = 2; i < argc; ++i) {
-        string file_name = argv[i];
+    // Load ATM Files, from the command line and from --atm-list (one path per line)
+    vector<string> atm_file_names(argv + 2, argv + argc);
+    if (!atm_list_path.empty()) {
+        ifstream atm_list(atm_list_path);
+        if (!atm_list.is_open()) {
+            cerr << "Bank error: illegal arguments" << endl;
+            exit(1);
+        }
+        string file_name;
+        while (getline(atm_list, file_name)) {
+            if (!file_name.empty()) {
+                atm_file_names.push_back(file_name);
+            }
+        }
+    }
+    for (const string& file_name : atm_file_names) {
         ifstream file(file_name);
         if (!file.is_open()) {
             cerr << "Bank error: illegal arguments" << endl;
@@ -113,52 +841,88 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-   /* --- Changes Begin: Initialize tracking vectors --- */
-    // Initialize vector to track ATM threads that need to be closed
-    atm_threads_to_close.resize(atm_files.size(), false);
-   
-    /* --- Changes End --- */
+    if (!record_path.empty()) {
+        replay_recorder = new Replay_Recorder();
+        if (!replay_recorder->open(record_path, bank_instance->get_commission_seed(), size)) {
+            cerr << "Bank error: unable to open record file" << endl;
+            exit(1);
+        }
+    }
+
+    import_at_startup(import_path);
+
+    // The partitions are forked from this process before any of its threads
+    // start, each with a copy of the still empty bank and the open log
+    if (partition_count > 0) {
+        int router_threads = (async_mode ? async_threads : size) + num_vip_threads + 1;
+        partitions = new Partition_Router(partition_count, router_threads);
+        if (!partitions->start(bank_instance)) {
+            cerr << "Bank error: unable to start partitions" << endl;
+            exit(1);
+        }
+    }
+
+    start_auditor();
 
+    vip_worker_count = num_vip_threads;
+    // Create VIP threads; they serve every ATM, so they are spread over the nodes
+    pthread_t* vip_threads = new pthread_t[num_vip_threads];
+    for (int i = 0; i < num_vip_threads; ++i) {
+        create_placed_thread(&vip_threads[i], vip_thread, nullptr, i % thread_placement.node_count(), "VIP");
+    }
 
-    // Create threads for ATM operations
-    pthread_t* atm_threads = new pthread_t[argc - 1];
-    int* atm_thread_ids = new int[argc - 1];
-    program_termination_flag = false;
+    retry_scheduler = new Retry_Scheduler(run_operation, max_retries, retry_delay, retry_backoff);
+    pthread_attr_t retry_attr;
+    pthread_attr_init(&retry_attr);
+    thread_placement.set_background_affinity(&retry_attr);
+    retry_scheduler->start(&retry_attr);
+    pthread_attr_destroy(&retry_attr);
 
+    // Tracks running and closed ATMs and wakes waiting threads on changes
+    lifecycle = new Bank_Lifecycle(size);
+
+    if (admission_enabled) {
+        if (admission_slots == 0) {
+            admission_slots = size;
+        }
+        admission = new Admission_Controller(size, atm_rate, atm_burst > 0 ? atm_burst : atm_rate, admission_slots, vip_share, queue_limit);
+    }
 
-    // Start ATM threads
-   for (int i = 0; i < argc - 2; ++i) {
-       atm_thread_ids[i] = i + 1;
-       if (pthread_create(&atm_threads[i], nullptr, atm_thread, static_cast<void*>(&atm_thread_ids[i]))) {
-           perror("Bank error: pthread_create failed for ATM thread");
-           exit(1);
-       }
-   }
+
+    // Create threads for ATM operations, or sessions on a worker pool in async mode
+    pthread_t* atm_threads = new pthread_t[size];
+    int* atm_thread_ids = new int[size];
+    Session_Pool* session_pool = nullptr;
+
+    if (async_mode) {
+        session_pool = new Session_Pool(run_operation, lifecycle, async_threads, max_retries, retry_delay, retry_backoff, async_latency);
+        session_pool->start(atm_files);
+    } else {
+        // Start ATM threads, spread over the nodes like the VIP threads
+        for (int i = 0; i < size; ++i) {
+            atm_thread_ids[i] = i + 1;
+            create_placed_thread(&atm_threads[i], atm_thread, static_cast<void*>(&atm_thread_ids[i]), i % thread_placement.node_count(), "ATM");
+        }
+    }
 
    // Start commission thread
    pthread_t commission_worker_thread;
-   if (pthread_create(&commission_worker_thread, nullptr, commission_thread, nullptr)) {
-       perror("Bank error: pthread_create failed for commission thread");
-       exit(1);
-   }
+   create_placed_thread(&commission_worker_thread, commission_thread, nullptr, -1, "commission");
 
    // Start status printing thread
    pthread_t status_printer_worker_thread;
-   if (pthread_create(&status_printer_worker_thread, nullptr, status_printer_thread, nullptr)) {
-       perror("Bank error: pthread_create failed for status printer thread");
-       exit(1);
-   }
+   create_placed_thread(&status_printer_worker_thread, status_printer_thread, nullptr, -1, "status printer");
 
-   // Ensure final status is printed after all ATM threads finish
-   while (completed_atms_count < (argc - 2)) {
-       usleep(100000); // Wait until all ATM threads finish
-   }
-
-   program_termination_flag = true;
-   usleep(500000); // Wait a bit before final print to allow thread to run
+   // Shutdown: wait for the ATMs, then drain VIP work and parked retries
+   // before the background threads are told to stop
+   lifecycle->wait_for_atms();
 
    // Join all threads
-   for (int i = 0; i < argc - 2; ++i) {
+   if (session_pool != nullptr) {
+       session_pool->join();
+       delete session_pool;
+   }
+   for (int i = 0; i < size && !async_mode; ++i) {
        int ret = pthread_join(atm_threads[i], nullptr);
        if (ret != 0) {
            cerr << "Bank error: pthread_join failed for ATM thread " << i << ": " << strerror(ret) << endl;
@@ -166,25 +930,50 @@ int main(int argc, char *argv[]) {
        }
    }
 
-   // Join commission and print threads
-   if (pthread_join(commission_worker_thread, nullptr) || pthread_join(status_printer_worker_thread, nullptr)) {
-       perror("Bank error: pthread_join failed for commission or print thread");
-       exit(1);
-   }
-
-   // Join VIP threads after they finish
+   // Join VIP threads once the queue is drained
+   close_vip_queue();
    for (int i = 0; i < num_vip_threads; ++i) {
        if (pthread_join(vip_threads[i], nullptr)) {
            perror("Bank error: pthread_join failed for VIP thread");
            exit(1);
        }
    }
+   drain_vip_queue();
+
+   // Let parked PERSISTENT commands finish their retries
+   retry_scheduler->stop();
+
+   // Join commission and print threads; the printer prints the final status on its way out
+   lifecycle->request_termination();
+   if (pthread_join(commission_worker_thread, nullptr) || pthread_join(status_printer_worker_thread, nullptr)) {
+       perror("Bank error: pthread_join failed for commission or print thread");
+       exit(1);
+   }
+   finish_auditor();
+
+   if (admission != nullptr) {
+       admission->print_metrics(cout);
+   }
 
    // Close the log file and clean up resources
+   if (replay_recorder != nullptr) {
+       print_final_state("Final state");
+       replay_recorder->close();
+       delete replay_recorder;
+   }
+   if (partitions != nullptr) {
+       print_final_state("Final state, " + to_string(partition_count) + " partitions");
+       partitions->stop();
+       delete partitions;
+   }
    log_file.close();
+   export_trace();
    delete[] atm_threads;
    delete[] atm_thread_ids;
    delete[] vip_threads;
+   delete retry_scheduler;
+   delete admission;
+   delete lifecycle;
    delete bank_instance;
 
     return 0;
@@ -193,6 +982,7 @@ int main(int argc, char *argv[]) {
 void* atm_thread(void* arg) {
    int atm_id = *(static_cast<int*>(arg));
    string atm_file_name = atm_files[atm_id - 1];
+   trace_thread_name("ATM " + to_string(atm_id));
 
    ifstream atm_file(atm_file_name);
    if (!atm_file.is_open()) {
@@ -201,35 +991,60 @@ void* atm_thread(void* arg) {
    }
 
    string operation_line;
-   int target_atm_id = 0;
-   int iterations = 0;
-
+   vector<string> operation_words; // reused line to line, so its strings keep their storage
+   // With --atm-batch, plain D/W/B/T commands are collected into bursts that
+   // go through Bank::execute_batch; the ATM delay is paid once per burst
+   vector<vector<string>> pending_batch;
+   vector<int> batch_statuses;
+   long long line_number = 0;
+   auto flush_batch = [&]() {
+       if (pending_batch.empty()) {
+           return;
+       }
+       if (admission != nullptr && admission->enter(ADMISSION_REGULAR, atm_id) == ADMISSION_SHED) {
+           for (const vector<string>& batched_words : pending_batch) {
+               shed_command(batched_words, "", atm_id, false);
+           }
+       } else {
+           bank_instance->execute_batch(pending_batch, atm_id, batch_statuses);
+           if (admission != nullptr) {
+               admission->leave();
+           }
+       }
+       pending_batch.clear();
+   };
 
    while (getline(atm_file, operation_line)) {
-       string account, password, amount, target_account;
-       int new_balance, new_target_balance;
-       stringstream log_file_line;
-       vector<string> operation_words;
-       bool thread_need_to_term = false;
-
-       usleep(100000); // Simulate delay
+       line_number++;
+       Trace_Command command("ATM command", atm_id);
+       if (pending_batch.empty()) {
+           Trace_Span span("ATM delay");
+           if (!lifecycle->atm_delay(atm_id, 100000)) { // Simulate delay, cut short by a close
+               break;
+           }
+       }
 
        // Tokenize the operation line into words
-       string word;
-       for (char c : operation_line) {
-           if (c != ' ' && c != '\n') {
-               word += c;
-           } else {
-               operation_words.push_back(word);
-               word.clear();
-           }
+       {
+           Trace_Span span("parse");
+           tokenize_operation(operation_line, operation_words);
        }
-       if (!word.empty()) {
-           operation_words.push_back(word);
-       } else {
+       if (operation_words.empty()) {
            continue;
        }
 
+       // Rate limit: an ATM over its token budget waits here, in its own thread
+       if (admission != nullptr) {
+           useconds_t throttle_wait = admission->throttle(atm_id, Admission_Controller::command_cost(operation_words));
+           if (throttle_wait > 0) {
+               Trace_Span span("throttle");
+               if (!lifecycle->atm_wait(atm_id, throttle_wait)) {
+                   break;
+               }
+               admission->record_throttle_wait(atm_id, throttle_wait);
+           }
+       }
+
        // Check if the operation contains VIP or PERSISTENT
        bool is_vip = false;
        bool is_persistent = false;
@@ -245,135 +1060,96 @@ void* atm_thread(void* arg) {
            }
        }
 
-       // If the operation is VIP, add it to the VIP queue
-       if (is_vip) {
-           add_vip_command(operation_line, vip_level);
-           continue;  // Skip further processing of this command in the ATM thread
+       // A PERSISTENT command is keyed by its line, so a resend of it is applied once
+       if (is_persistent) {
+           add_idempotency_key(operation_words, operation_line, line_number);
        }
 
-       // Handle PERSISTENT commands within the ATM thread
-       if (is_persistent) {
-           bool success = false;
-           int retry_count = 0;
-           while (!success && retry_count < MAX_RETRIES) {
-               success = bank_instance->process_operation(operation_line);  // Try to process the operation
-               if (!success) {
-                   ++retry_count;
-                   usleep(RETRY_DELAY);  // Wait before retrying
-               }
+       if (atm_batch_size > 1 && !is_vip && !is_persistent && batchable_operation(operation_words) &&
+           !retry_scheduler->defer_if_blocked(atm_id, operation_words, operation_line, false)) {
+           pending_batch.push_back(operation_words);
+           if (static_cast<int>(pending_batch.size()) >= atm_batch_size) {
+               flush_batch();
            }
-           if (!success) {
-               log_file << "Persistent command failed after " << retry_count << " retries: " << operation_line << endl;
+           continue;
+       }
+       flush_batch();
+
+       // If the operation is VIP, add it to the VIP queue
+       if (is_vip) {
+           Trace_Span span("enqueue");
+           if (!add_vip_command(operation_words, operation_line, vip_level, atm_id, is_persistent)) {
+               shed_command(operation_words, operation_line, atm_id, is_persistent);
            }
            continue;  // Skip further processing of this command in the ATM thread
        }
 
-       // Process the operation (non-VIP, non-PERSISTENT)
-       char operation = operation_words[0][0];
-       switch (operation) {
-           case 'O': // Open account
-               account = operation_words[1];
-               password = operation_words[2];
-               amount = operation_words[3];
-               bank_instance->create_account(stoi(account), password, stoi(amount), atm_id);
-               break;
-
-           case 'D': // Deposit
-               account = operation_words[1];
-               password = operation_words[2];
-               amount = operation_words[3];
-               bank_instance->deposit(stoi(account), password, stoi(amount), &new_balance, atm_id);
-               break;
-
-           case 'W': // Withdraw
-               account = operation_words[1];
-               password = operation_words[2];
-               amount = operation_words[3];
-               bank_instance->withdraw(stoi(account), password, stoi(amount), &new_balance, atm_id);
-               break;
-
-           case 'B': // Balance inquiry
-               account = operation_words[1];
-               password = operation_words[2];
-               bank_instance->get_balance(stoi(account), password, &new_balance, atm_id);
-               break;
-
-           case 'Q': // Delete account
-               account = operation_words[1];
-               password = operation_words[2];
-               bank_instance->delete_account(stoi(account), password, &new_balance, atm_id);
-               break;
-
-           case 'T': // Transfer money
-               account = operation_words[1];
-               password = operation_words[2];
-               target_account = operation_words[3];
-               amount = operation_words[4];
-               bank_instance->transfer_money(stoi(account), password, stoi(target_account), stoi(amount), &new_balance, &new_target_balance, atm_id);
-               break;
-
-           case 'C': // Close ATM
-               target_atm_id = stoi(operation_words[1]);
-               if(bank_instance->close_atm(atm_id, target_atm_id)){ // tar_atm need to be closed
-                   pthread_mutex_lock(&atm_threads_to_close_mutex);
-                   atm_threads_to_close[target_atm_id - 1] = true;  // Mark ATM to close
-                   pthread_mutex_unlock(&atm_threads_to_close_mutex);
-               }
-               break;
-
-           case 'R': // Rollback
-               iterations = stoi(operation_words[1]);
-               bank_instance->rollback(atm_id, iterations);
-               break;
+       // Commands on an account with a pending retry from this ATM wait behind it
+       if (retry_scheduler->defer_if_blocked(atm_id, operation_words, operation_line, is_persistent)) {
+           continue;
        }
 
-        pthread_mutex_lock(&atm_threads_to_close_mutex);
-         if (atm_threads_to_close[atm_id - 1]) {
-            thread_need_to_term = true;
-         }
-         pthread_mutex_unlock(&atm_threads_to_close_mutex);
-         if(thread_need_to_term)
-            break;  // Exit the loop if the thread is signaled to close
-        
-
+       // PERSISTENT commands are handled within the ATM thread too
+       run_admitted_operation(operation_words, operation_line, atm_id, ADMISSION_REGULAR, is_persistent);
 
+       if (lifecycle->is_atm_closed(atm_id)) {
+           break;  // Exit the loop if the thread is signaled to close
+       }
+   }
+   if (!lifecycle->is_atm_closed(atm_id)) {
+       flush_batch();
    }
    atm_file.close();
-   pthread_mutex_lock(&completed_atms_mutex);
-   completed_atms_count++;
-   pthread_mutex_unlock(&completed_atms_mutex);
+   lifecycle->atm_finished();
     
    pthread_exit(nullptr);
 }
 
 void* status_printer_thread(void* arg) {
-    while (!program_termination_flag) {
-        usleep(500000);
+    trace_thread_name("status printer");
+    while (!lifecycle->wait_for_termination(500000)) {
+        if (partitions != nullptr) {
+            partitions->print_status();
+            continue;
+        }
+        bank_instance->print_status();
+        bank_instance->save_current_status();
+        bank_instance->mark_iteration();
+    }
+    // Final status, after all work has drained
+    if (partitions != nullptr) {
+        partitions->print_status();
+    } else {
         bank_instance->print_status();
     }
     pthread_exit(nullptr);
 }
 
 void* commission_thread(void* arg) {
-    while (!program_termination_flag) {
-        sleep(3);
+    trace_thread_name("commission");
+    while (!lifecycle->wait_for_termination(3000000)) {
         bank_instance->commission();
     }
     pthread_exit(nullptr);
 }
 
 void* vip_thread(void* arg) {
-    while (!program_termination_flag) {
-        pthread_mutex_lock(&vip_queue_mutex);
-        if (!vip_commands.empty()) {
-            VipCommand vip_command = vip_commands.top();
-            vip_commands.pop();
-            pthread_mutex_unlock(&vip_queue_mutex);
-
-        } else {
-            pthread_mutex_unlock(&vip_queue_mutex);
-            usleep(100000); // No command to process, sleep briefly
+    // Reused for every command, so running a queued command does not allocate
+    vector<string> operation_words;
+    string operation_line;
+    trace_thread_name("VIP");
+
+    while (true) {
+        Queued_Command* command;
+        if (!vip_commands.try_pop(command)) {
+            // Queue is drained and no ATM can add more commands
+            if (!vip_waiters.wait([]() { return vip_commands.size() > 0; })) {
+                break;
+            }
+            continue;
         }
+
+        run_queued_vip_command(command, operation_words, operation_line);
     }
     pthread_exit(nullptr);
 }
@@ -0,0 +1,291 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <pthread.h>
+
+using namespace std;
+
+#define QUEUE_CACHE_LINE 64
+#define VIP_PRIORITY_LEVELS 128  // VIP=0..127 get a level each; higher levels share the top one
+#define VIP_LEVEL_CAPACITY 1024  // commands per VIP level before ATMs wait for room
+
+/*
+ * Bounded lock-free multi-producer multi-consumer FIFO (Dmitry Vyukov's
+ * array queue). Every cell carries a sequence number: a producer may fill
+ * cell `pos` once its sequence equals pos, a consumer may empty it once it
+ * equals pos + 1. Producers and consumers each claim a position with one
+ * compare-and-swap on their own index, so the two sides never touch the same
+ * cache line unless the queue is nearly empty or full.
+ *
+ * try_push fails when the queue is full and try_pop when it is empty; neither
+ * blocks. Items of one producer are popped in the order it pushed them.
+ *
+ * The cells may live in caller-provided memory: placed in a shared mapping
+ * together with the queue object, the queue connects processes.
+ */
+template <typename T>
+class Mpmc_Queue {
+private:
+    struct Cell {
+        atomic<size_t> sequence;
+        T value;
+    };
+
+    char pad0[QUEUE_CACHE_LINE];
+    Cell* cells;
+    size_t mask;
+    bool owns_cells;
+    char pad1[QUEUE_CACHE_LINE];
+    atomic<size_t> enqueue_position;
+    char pad2[QUEUE_CACHE_LINE - sizeof(atomic<size_t>)];
+    atomic<size_t> dequeue_position;
+    char pad3[QUEUE_CACHE_LINE - sizeof(atomic<size_t>)];
+
+    static size_t round_capacity(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+    void init_cells(size_t size) {
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+public:
+    // Capacity is rounded up to a power of two
+    explicit Mpmc_Queue(size_t capacity) : enqueue_position(0), dequeue_position(0) {
+        size_t size = round_capacity(capacity);
+        cells = new Cell[size];
+        owns_cells = true;
+        init_cells(size);
+    }
+    // Cells in `storage`, which holds storage_bytes(capacity) bytes and outlives the queue
+    Mpmc_Queue(size_t capacity, void* storage) : enqueue_position(0), dequeue_position(0) {
+        size_t size = round_capacity(capacity);
+        cells = static_cast<Cell*>(storage);
+        for (size_t i = 0; i < size; i++) {
+            new (&cells[i]) Cell();
+        }
+        owns_cells = false;
+        init_cells(size);
+    }
+    ~Mpmc_Queue() {
+        if (owns_cells) {
+            delete[] cells;
+        }
+    }
+    Mpmc_Queue(const Mpmc_Queue&) = delete;
+    Mpmc_Queue& operator=(const Mpmc_Queue&) = delete;
+
+    bool try_push(const T& value) {
+        size_t position = enqueue_position.load(memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(memory_order_acquire);
+            long difference = static_cast<long>(sequence) - static_cast<long>(position);
+            if (difference == 0) {
+                if (enqueue_position.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false; // full: the cell still holds the item from one lap ago
+            } else {
+                position = enqueue_position.load(memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(position + 1, memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& value) {
+        size_t position = dequeue_position.load(memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(memory_order_acquire);
+            long difference = static_cast<long>(sequence) - static_cast<long>(position + 1);
+            if (difference == 0) {
+                if (dequeue_position.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false; // empty
+            } else {
+                position = dequeue_position.load(memory_order_relaxed);
+            }
+        }
+        value = cell->value;
+        cell->sequence.store(position + mask + 1, memory_order_release);
+        return true;
+    }
+
+    // Approximate while other threads push or pop; a claimed but unfinished push counts
+    bool empty() const {
+        return enqueue_position.load(memory_order_seq_cst) == dequeue_position.load(memory_order_seq_cst);
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    static size_t storage_bytes(size_t capacity) {
+        return round_capacity(capacity) * sizeof(Cell);
+    }
+};
+
+/*
+ * Priority variant: one Mpmc_Queue per level and a bitmap of the levels that
+ * may hold items. try_pop takes from the highest marked level, FIFO within a
+ * level. A producer marks its level after publishing the item; a consumer that
+ * finds a marked level empty clears the bit and then looks again, setting it
+ * back if an item slipped in, so a published item is never left unmarked.
+ * Levels outside 0..level_count-1 are clamped.
+ */
+template <typename T>
+class Mpmc_Priority_Queue {
+private:
+    int level_count;
+    int word_count;
+    Mpmc_Queue<T>** levels;
+    atomic<unsigned long long>* nonempty;
+    char pad0[QUEUE_CACHE_LINE];
+    atomic<long> count;
+    char pad1[QUEUE_CACHE_LINE - sizeof(atomic<long>)];
+
+public:
+    Mpmc_Priority_Queue(int level_count, size_t level_capacity)
+        : level_count(level_count), word_count((level_count + 63) / 64), count(0) {
+        levels = new Mpmc_Queue<T>*[level_count];
+        for (int i = 0; i < level_count; i++) {
+            levels[i] = new Mpmc_Queue<T>(level_capacity);
+        }
+        nonempty = new atomic<unsigned long long>[word_count];
+        for (int i = 0; i < word_count; i++) {
+            nonempty[i].store(0, memory_order_relaxed);
+        }
+    }
+    ~Mpmc_Priority_Queue() {
+        for (int i = 0; i < level_count; i++) {
+            delete levels[i];
+        }
+        delete[] levels;
+        delete[] nonempty;
+    }
+    Mpmc_Priority_Queue(const Mpmc_Priority_Queue&) = delete;
+    Mpmc_Priority_Queue& operator=(const Mpmc_Priority_Queue&) = delete;
+
+    // False when the item's level is full
+    bool try_push(int level, const T& value) {
+        level = level < 0 ? 0 : (level >= level_count ? level_count - 1 : level);
+        if (!levels[level]->try_push(value)) {
+            return false;
+        }
+        count.fetch_add(1, memory_order_seq_cst);
+        nonempty[level / 64].fetch_or(1ULL << (level % 64), memory_order_seq_cst);
+        return true;
+    }
+
+    bool try_pop(T& value) {
+        for (int word = word_count - 1; word >= 0; word--) {
+            unsigned long long bits = nonempty[word].load(memory_order_seq_cst);
+            while (bits != 0) {
+                int bit = 63 - __builtin_clzll(bits);
+                Mpmc_Queue<T>* queue = levels[word * 64 + bit];
+                if (queue->try_pop(value)) {
+                    count.fetch_sub(1, memory_order_seq_cst);
+                    return true;
+                }
+                nonempty[word].fetch_and(~(1ULL << bit), memory_order_seq_cst);
+                if (!queue->empty()) {
+                    nonempty[word].fetch_or(1ULL << bit, memory_order_seq_cst);
+                }
+                bits &= ~(1ULL << bit);
+            }
+        }
+        return false;
+    }
+
+    // Items pushed and not yet popped; exact once the queue is quiet
+    long size() const {
+        return count.load(memory_order_seq_cst);
+    }
+};
+
+/*
+ * Sleeping for consumers of the lock-free queues. A consumer that finds
+ * nothing registers as a sleeper and checks again before waiting; a producer
+ * only takes the mutex when someone sleeps, so a busy handoff never locks.
+ * Process-shared waiters work across fork() when placed in a shared mapping.
+ */
+class Queue_Waiters {
+private:
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    atomic<int> sleepers;
+    bool closed;
+
+public:
+    explicit Queue_Waiters(bool process_shared = false) : sleepers(0), closed(false) {
+        pthread_mutexattr_t mutex_attr;
+        pthread_condattr_t cond_attr;
+        pthread_mutexattr_init(&mutex_attr);
+        pthread_condattr_init(&cond_attr);
+        if (process_shared) {
+            pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+            pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+        }
+        pthread_mutex_init(&mutex, &mutex_attr);
+        pthread_cond_init(&cond, &cond_attr);
+        pthread_mutexattr_destroy(&mutex_attr);
+        pthread_condattr_destroy(&cond_attr);
+    }
+    ~Queue_Waiters() {
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&cond);
+    }
+
+    // After a push
+    void notify() {
+        // Orders the push before the load; a consumer orders its registration before its check
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleepers.load(memory_order_seq_cst) > 0) {
+            pthread_mutex_lock(&mutex);
+            pthread_cond_signal(&cond);
+            pthread_mutex_unlock(&mutex);
+        }
+    }
+
+    // Waits until ready() holds; false once closed with nothing ready
+    template <typename Ready>
+    bool wait(Ready ready) {
+        pthread_mutex_lock(&mutex);
+        sleepers.fetch_add(1, memory_order_seq_cst);
+        while (!ready() && !closed) {
+            pthread_cond_wait(&cond, &mutex);
+        }
+        sleepers.fetch_sub(1, memory_order_seq_cst);
+        bool result = ready();
+        pthread_mutex_unlock(&mutex);
+        return result;
+    }
+
+    // No more pushes will come; wakes every sleeper
+    void close() {
+        pthread_mutex_lock(&mutex);
+        closed = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+};
+
+#endif
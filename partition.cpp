@@ -0,0 +1,472 @@
+#include "partition.hpp"
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <algorithm>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "bank.hpp"
+#include "lifecycle.hpp"
+#include "audit.hpp"
+
+#define PARTITION_DUMP_READ_SIZE 65536
+#define PARTITION_COMMISSION_INTERVAL 3000000
+
+/* What a partition's threads share, in the forked process */
+struct Partition_Process {
+    Partition_Channel* channel;
+    Partition_Reply* replies;
+    Bank* shard;
+    int dump_fd;
+    Bank_Lifecycle* lifecycle;  // only its termination wait, for the commission thread
+};
+
+static thread_local int router_reply_slot = -1;
+
+static size_t align_up(size_t bytes)
+{
+    return (bytes + QUEUE_CACHE_LINE - 1) / QUEUE_CACHE_LINE * QUEUE_CACHE_LINE;
+}
+
+static string join_words(const vector<string>& operation_words)
+{
+    string line;
+    for (const string& word : operation_words) {
+        if (!line.empty()) {
+            line += ' ';
+        }
+        line += word;
+    }
+    return line;
+}
+
+static bool write_all(int fd, const string& data)
+{
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t bytes = write(fd, data.data() + written, data.size() - written);
+        if (bytes <= 0) {
+            return false;
+        }
+        written += bytes;
+    }
+    return true;
+}
+
+Partition_Router::Partition_Router(int partitions, int threads)
+    : partition_count(partitions), worker_count(threads), shared_bytes(0), shared(nullptr), channels(nullptr),
+      replies(nullptr), next_reply(0)
+{
+    pthread_mutex_init(&dump_mutex, nullptr);
+}
+
+Partition_Router::~Partition_Router()
+{
+    for (int fd : dump_fds) {
+        close(fd);
+    }
+    if (shared != nullptr) {
+        munmap(shared, shared_bytes);
+    }
+    delete[] channels;
+    pthread_mutex_destroy(&dump_mutex);
+}
+
+bool Partition_Router::start(Bank* bank)
+{
+    // One mapping: a channel and its ring cells per partition, then the reply slots
+    size_t channel_bytes = align_up(sizeof(Partition_Channel)) +
+                           align_up(Mpmc_Queue<Partition_Request>::storage_bytes(PARTITION_RING_SLOTS));
+    shared_bytes = partition_count * channel_bytes + worker_count * align_up(sizeof(Partition_Reply));
+    shared = mmap(nullptr, shared_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("Bank error: mmap failed");
+        shared = nullptr;
+        return false;
+    }
+
+    char* base = static_cast<char*>(shared);
+    channels = new Partition_Channel*[partition_count];
+    for (int i = 0; i < partition_count; i++) {
+        char* channel = base + i * channel_bytes;
+        channels[i] = new (channel) Partition_Channel(channel + align_up(sizeof(Partition_Channel)));
+    }
+    replies = reinterpret_cast<Partition_Reply*>(base + partition_count * channel_bytes);
+    for (int i = 0; i < worker_count; i++) {
+        new (&replies[i]) Partition_Reply();
+    }
+
+    vector<int> partition_fds;
+    for (int i = 0; i < partition_count; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds)) {
+            perror("Bank error: socketpair failed");
+            return false;
+        }
+        dump_fds.push_back(fds[0]);
+        partition_fds.push_back(fds[1]);
+    }
+
+    // Nothing may sit in the stream buffers, or every partition would write it again
+    cout.flush();
+    for (int i = 0; i < partition_count; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("Bank error: fork failed");
+            return false;
+        }
+        if (pid == 0) {
+            prctl(PR_SET_PDEATHSIG, SIGTERM); // a partition does not outlive its router
+            for (int j = 0; j < partition_count; j++) {
+                close(dump_fds[j]);
+                if (j != i) {
+                    close(partition_fds[j]);
+                }
+            }
+            run_partition(i, partition_fds[i], bank);
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    for (int fd : partition_fds) {
+        close(fd);
+    }
+    return true;
+}
+
+int Partition_Router::partition_of(int account_id) const
+{
+    int partition = account_id % partition_count;
+    return partition < 0 ? partition + partition_count : partition;
+}
+
+Partition_Reply* Partition_Router::reply_slot()
+{
+    if (router_reply_slot < 0) {
+        router_reply_slot = next_reply.fetch_add(1);
+        if (router_reply_slot >= worker_count) {
+            cerr << "Bank error: too many threads for the partitions" << endl;
+            exit(1);
+        }
+    }
+    return &replies[router_reply_slot];
+}
+
+void Partition_Router::send(int partition, const Partition_Request& request)
+{
+    Partition_Channel* channel = channels[partition];
+    // A full ring holds the sender back until a worker makes room
+    while (!channel->requests.try_push(request)) {
+        sched_yield();
+    }
+    channel->request_waiters.notify();
+}
+
+int Partition_Router::call(int partition, int kind, int atm_id, const string& line, int* balance, int target_exists)
+{
+    if (line.size() >= PARTITION_LINE_BYTES) {
+        return OPERATION_FAILED;
+    }
+    Trace_Span span("partition");
+    Partition_Reply* reply = reply_slot();
+
+    Partition_Request request;
+    request.kind = kind;
+    request.atm_id = atm_id;
+    request.reply_slot = reply - replies;
+    request.target_exists = target_exists;
+    memcpy(request.line, line.c_str(), line.size() + 1);
+
+    reply->ready.store(0, memory_order_relaxed);
+    send(partition, request);
+    reply->waiters.wait([reply]() { return reply->ready.load(memory_order_acquire) != 0; });
+
+    *balance = reply->balance;
+    return reply->status;
+}
+
+int Partition_Router::execute(const vector<string>& operation_words, int atm_id, int* new_balance)
+{
+    int balance_out;
+    if (new_balance == nullptr) {
+        new_balance = &balance_out;
+    }
+    if (operation_words.size() < 2) {
+        return OPERATION_FAILED;
+    }
+
+    switch (operation_words[0][0]) {
+        case 'O': case 'D': case 'W': case 'B': case 'Q':
+            break;
+        case 'T':
+            if (operation_words.size() >= 5 && partition_of(stoi(operation_words[1])) != partition_of(stoi(operation_words[3]))) {
+                return transfer(operation_words, atm_id, new_balance);
+            }
+            break;
+        default: {
+            // Rollbacks would need one snapshot across every partition
+            stringstream log_line;
+            log_line << "Error " << atm_id << ": Your transaction failed - " << operation_words[0] << " is not supported by a partitioned bank";
+            write_to_log_file(log_line.str());
+            return OPERATION_FAILED;
+        }
+    }
+
+    return call(partition_of(stoi(operation_words[1])), PARTITION_COMMAND, atm_id, join_words(operation_words), new_balance);
+}
+
+int Partition_Router::transfer(const vector<string>& operation_words, int atm_id, int* new_balance)
+{
+    int source_account = stoi(operation_words[1]);
+    int target_account = stoi(operation_words[3]);
+    int amount = stoi(operation_words[4]);
+    int target_partition = partition_of(target_account);
+    int unused;
+
+    // Phase 1: the target's partition holds its account open, then the source is checked and debited
+    bool target_exists = call(target_partition, PARTITION_RESERVE_CREDIT, atm_id, to_string(target_account), &unused) == SUCCESS;
+    int status = call(partition_of(source_account), PARTITION_TRANSFER_OUT, atm_id, join_words(operation_words), new_balance, target_exists);
+    if (status != SUCCESS) {
+        if (target_exists) {
+            Partition_Request request;
+            request.kind = PARTITION_RELEASE_CREDIT;
+            request.atm_id = atm_id;
+            request.reply_slot = -1;
+            request.target_exists = 0;
+            snprintf(request.line, PARTITION_LINE_BYTES, "%d", target_account);
+            send(target_partition, request);
+        }
+        return status;
+    }
+
+    // Phase 2: the debit is done, so the credit always commits
+    int new_target_balance;
+    call(target_partition, PARTITION_TRANSFER_IN, atm_id, to_string(target_account) + " " + to_string(amount), &new_target_balance);
+
+    stringstream log_line;
+    log_line << atm_id << ": Transfer " << amount << " from account " << source_account << " to account " << target_account << " new account balance is " << *new_balance << " new target account balance is " << new_target_balance;
+    write_to_log_file(log_line.str());
+    return SUCCESS;
+}
+
+bool Partition_Router::read_dump_line(int fd, string& line)
+{
+    size_t end;
+    while ((end = dump_input.find('\n')) == string::npos) {
+        char buffer[PARTITION_DUMP_READ_SIZE];
+        ssize_t bytes = read(fd, buffer, sizeof(buffer));
+        if (bytes <= 0) {
+            return false;
+        }
+        dump_input.append(buffer, bytes);
+    }
+    line = dump_input.substr(0, end);
+    dump_input.erase(0, end + 1);
+    return true;
+}
+
+void Partition_Router::get_account_states(vector<Account_State>& states, int* bank_balance)
+{
+    pthread_mutex_lock(&dump_mutex);
+    states.clear();
+    *bank_balance = 0;
+
+    // The partitions dump one after the other, each consistent on its own
+    for (int i = 0; i < partition_count; i++) {
+        Partition_Request request;
+        request.kind = PARTITION_DUMP;
+        request.atm_id = 0;
+        request.reply_slot = -1;
+        request.target_exists = 0;
+        request.line[0] = '\0';
+        send(i, request);
+
+        dump_input.clear();
+        string line;
+        while (read_dump_line(dump_fds[i], line)) {
+            stringstream fields(line);
+            string first;
+            fields >> first;
+            if (first == "end") {
+                int partition_balance;
+                fields >> partition_balance;
+                *bank_balance += partition_balance;
+                break;
+            }
+            Account_State state;
+            state.account_id = stoi(first);
+            fields >> state.balance >> state.password;
+            states.push_back(state);
+        }
+    }
+    pthread_mutex_unlock(&dump_mutex);
+
+    sort(states.begin(), states.end(), [](const Account_State& a, const Account_State& b) { return a.account_id < b.account_id; });
+}
+
+void Partition_Router::print_status()
+{
+    vector<Account_State> states;
+    int bank_balance;
+    get_account_states(states, &bank_balance);
+
+    string print_out;
+    for (const Account_State& state : states) {
+        print_out.append("Account " + to_string(state.account_id) + ": Balance - " + to_string(state.balance) +
+                         " $, Account Password - " + state.password + "\n");
+    }
+
+    cout << "\033[2J";
+    cout << "\033[1;1H";
+    cout << "Current Bank Status" << endl;
+    cout << print_out;
+}
+
+void Partition_Router::stop()
+{
+    Partition_Request request;
+    request.kind = PARTITION_STOP;
+    request.atm_id = 0;
+    request.reply_slot = -1;
+    request.target_exists = 0;
+    request.line[0] = '\0';
+    for (int i = 0; i < partition_count; i++) {
+        for (int j = 0; j < worker_count; j++) {
+            send(i, request);
+        }
+    }
+    for (pid_t pid : pids) {
+        int status;
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            cerr << "Bank error: partition process failed" << endl;
+        }
+    }
+    pids.clear();
+}
+
+static void handle_request(Partition_Process* process, const Partition_Request& request, vector<string>& words)
+{
+    Bank* shard = process->shard;
+    int status = SUCCESS;
+    int balance = 0;
+
+    tokenize_operation(request.line, words);
+    switch (request.kind) {
+        case PARTITION_COMMAND:
+            status = shard->execute_operation(words, request.atm_id, &balance);
+            break;
+        case PARTITION_RESERVE_CREDIT:
+            status = shard->reserve_credit(stoi(words[0]));
+            break;
+        case PARTITION_TRANSFER_OUT:
+            status = shard->transfer_out(stoi(words[1]), words[2], stoi(words[3]), request.target_exists != 0, stoi(words[4]), &balance, request.atm_id);
+            break;
+        case PARTITION_TRANSFER_IN:
+            status = shard->transfer_in(stoi(words[0]), stoi(words[1]), &balance, request.atm_id);
+            break;
+        case PARTITION_RELEASE_CREDIT:
+            shard->release_credit(stoi(words[0]));
+            break;
+        case PARTITION_DUMP: {
+            vector<Account_State> states;
+            int bank_balance;
+            shard->get_account_states(states, &bank_balance);
+            string dump;
+            for (const Account_State& state : states) {
+                dump += to_string(state.account_id) + " " + to_string(state.balance) + " " + state.password + "\n";
+            }
+            dump += "end " + to_string(bank_balance) + "\n";
+            if (!write_all(process->dump_fd, dump)) {
+                perror("Bank error: partition dump failed");
+            }
+            break;
+        }
+    }
+
+    if (request.reply_slot >= 0) {
+        Partition_Reply* reply = &process->replies[request.reply_slot];
+        reply->status = status;
+        reply->balance = balance;
+        reply->ready.store(1, memory_order_release);
+        reply->waiters.notify();
+    }
+}
+
+static void* partition_worker(void* arg)
+{
+    Partition_Process* process = static_cast<Partition_Process*>(arg);
+    Partition_Channel* channel = process->channel;
+    Partition_Request request;
+    vector<string> words;
+
+    while (true) {
+        if (!channel->requests.try_pop(request)) {
+            channel->request_waiters.wait([channel]() { return !channel->requests.empty(); });
+            continue;
+        }
+        if (request.kind == PARTITION_STOP) {
+            break;
+        }
+        handle_request(process, request, words);
+    }
+    return nullptr;
+}
+
+static void* partition_commission(void* arg)
+{
+    Partition_Process* process = static_cast<Partition_Process*>(arg);
+    while (!process->lifecycle->wait_for_termination(PARTITION_COMMISSION_INTERVAL)) {
+        process->shard->commission();
+    }
+    return nullptr;
+}
+
+void Partition_Router::run_partition(int partition, int dump_fd, Bank* shard)
+{
+    trace_enabled = false; // the router exports the trace; partitions are not traced
+    shard->set_commission_seed(shard->get_commission_seed() + partition);
+
+    Partition_Process process;
+    process.channel = channels[partition];
+    process.replies = replies;
+    process.shard = shard;
+    process.dump_fd = dump_fd;
+    process.lifecycle = new Bank_Lifecycle(0);
+
+    // Each partition audits its own bank; a transfer's debit and credit are
+    // money leaving one partition and entering another
+    Balance_Auditor* auditor = nullptr;
+    if (audit_enabled) {
+        auditor = new Balance_Auditor(shard, "partition " + to_string(partition));
+        auditor->start();
+    }
+
+    vector<pthread_t> workers(worker_count);
+    pthread_t commission_thread;
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i], nullptr, partition_worker, &process)) {
+            perror("Bank error: pthread_create failed for partition thread");
+            _exit(1);
+        }
+    }
+    if (pthread_create(&commission_thread, nullptr, partition_commission, &process)) {
+        perror("Bank error: pthread_create failed for commission thread");
+        _exit(1);
+    }
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], nullptr);
+    }
+    process.lifecycle->request_termination();
+    pthread_join(commission_thread, nullptr);
+    if (auditor != nullptr) {
+        auditor->stop();
+        delete auditor;
+    }
+    delete process.lifecycle;
+    close(dump_fd);
+}
@@ -0,0 +1,113 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <sys/types.h>
+#include <pthread.h>
+#include "mpmc_queue.hpp"
+#include "status_history.hpp"
+
+using namespace std;
+
+#define PARTITION_RING_SLOTS 1024  // requests in flight to one partition before senders wait
+#define PARTITION_LINE_BYTES 240   // longest command line a request carries
+
+#define PARTITION_COMMAND 0        // an ATM command on the partition's accounts
+#define PARTITION_RESERVE_CREDIT 1 // transfer phase 1, on the target's partition
+#define PARTITION_TRANSFER_OUT 2   // transfer phase 1, on the source's partition
+#define PARTITION_TRANSFER_IN 3    // transfer phase 2, on the target's partition
+#define PARTITION_RELEASE_CREDIT 4 // transfer abort, on the target's partition
+#define PARTITION_DUMP 5           // write the accounts to the partition's dump socket
+#define PARTITION_STOP 6           // the receiving worker thread exits
+
+class Bank;
+
+struct Partition_Request {
+    int kind;
+    int atm_id;
+    int reply_slot;    // -1: no reply
+    int target_exists; // PARTITION_TRANSFER_OUT: whether phase 1 found the target account
+    char line[PARTITION_LINE_BYTES];
+};
+
+/* Where a router thread waits for the answers to its requests */
+struct Partition_Reply {
+    Queue_Waiters waiters;
+    atomic<int> ready;
+    int status;
+    int balance;
+
+    Partition_Reply() : waiters(true), ready(0), status(0), balance(0) {}
+};
+
+/* One partition's request ring, in memory shared with its process */
+struct Partition_Channel {
+    Mpmc_Queue<Partition_Request> requests;
+    Queue_Waiters request_waiters; // the partition's idle worker threads
+
+    explicit Partition_Channel(void* cells) : requests(PARTITION_RING_SLOTS, cells), request_waiters(true) {}
+};
+
+/*
+ * Horizontally partitioned bank. Account id modulo the partition count picks
+ * one of N worker processes, each forked from the router with a copy of its
+ * empty bank and owning the accounts of its partition. Router threads (ATMs,
+ * VIP threads, retries) send a command to its partition's ring in a shared
+ * mapping and sleep on their own reply slot; each partition runs it on a pool
+ * of worker threads against its own Bank, with its own locks and allocator.
+ *
+ * A transfer between partitions is a two-phase commit driven by the router:
+ * the target's partition reserves a credit (and says whether the account
+ * exists), the source's partition checks and debits exactly as
+ * Bank::transfer_money would, and then the target's partition applies the
+ * credit, or releases it if the debit failed. A reserved credit keeps its
+ * account from being closed, so a debit that succeeded always commits.
+ *
+ * Every process writes log.txt through the descriptor it inherited, one
+ * write per line. Each partition runs its own commission thread.
+ */
+class Partition_Router {
+private:
+    int partition_count;
+    int worker_count;
+    size_t shared_bytes;
+    void* shared;                    // the mapping shared with every partition
+    Partition_Channel** channels;
+    Partition_Reply* replies;
+    atomic<int> next_reply;
+    vector<pid_t> pids;
+    vector<int> dump_fds;            // router ends of the dump socketpairs
+    pthread_mutex_t dump_mutex;
+    string dump_input;
+
+    int partition_of(int account_id) const;
+    Partition_Reply* reply_slot();
+    void send(int partition, const Partition_Request& request);
+    // Sends a request and waits for its status; *balance gets the balance it reports
+    int call(int partition, int kind, int atm_id, const string& line, int* balance, int target_exists = 0);
+    int transfer(const vector<string>& operation_words, int atm_id, int* new_balance);
+
+    // Partition side, in the forked process
+    void run_partition(int partition, int dump_fd, Bank* shard);
+    bool read_dump_line(int fd, string& line);
+
+public:
+    // threads: router threads that may send at once, and the worker threads of each
+    // partition, so a request never waits behind requests that wait on it
+    Partition_Router(int partitions, int threads);
+    ~Partition_Router();
+
+    // Forks the partitions, each from a copy of `bank`; call before starting any thread
+    bool start(Bank* bank);
+    // Runs an ATM command (O/D/W/B/Q/T) on the partitions holding its accounts
+    int execute(const vector<string>& operation_words, int atm_id, int* new_balance);
+    // The accounts of every partition in id order, and the sum of the partitions' own balances
+    void get_account_states(vector<Account_State>& states, int* bank_balance);
+    void print_status();
+    // Stops the partitions and waits for their processes
+    void stop();
+};
+
+#endif
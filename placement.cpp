@@ -0,0 +1,193 @@
+#include "placement.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+
+#define PLACEMENT_SYSFS_NODES "/sys/devices/system/node"
+
+Thread_Placement thread_placement;
+
+Thread_Placement::Thread_Placement() : mode(PLACEMENT_NONE), next_background_cpu(0)
+{
+}
+
+// cpulist syntax as in sysfs and numactl: "0-3,8,10-11"
+bool Thread_Placement::parse_cpu_list(const string& list, vector<int>& cpus)
+{
+    stringstream ranges(list);
+    string range;
+    while (getline(ranges, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        char* end;
+        long first = strtol(range.c_str(), &end, 10);
+        long last = first;
+        if (*end == '-') {
+            last = strtol(end + 1, &end, 10);
+        }
+        if (end == range.c_str() || (*end != '\0' && *end != '\n') || first < 0 || last < first || last >= CPU_SETSIZE) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return true;
+}
+
+bool Thread_Placement::load_topology(const string& spec)
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        perror("Bank error: sched_getaffinity failed");
+        return false;
+    }
+
+    vector<vector<int>> nodes;
+    if (!spec.empty()) {
+        stringstream node_lists(spec);
+        string node_list;
+        while (getline(node_lists, node_list, '/')) {
+            nodes.push_back(vector<int>());
+            if (!parse_cpu_list(node_list, nodes.back())) {
+                return false;
+            }
+        }
+    } else {
+        ifstream online(PLACEMENT_SYSFS_NODES "/online");
+        string online_list;
+        vector<int> node_ids;
+        if (getline(online, online_list) && parse_cpu_list(online_list, node_ids)) {
+            for (int node : node_ids) {
+                ifstream cpulist(PLACEMENT_SYSFS_NODES "/node" + to_string(node) + "/cpulist");
+                string cpus;
+                nodes.push_back(vector<int>());
+                if (!getline(cpulist, cpus) || !parse_cpu_list(cpus, nodes.back())) {
+                    nodes.pop_back();
+                }
+            }
+        }
+    }
+
+    // Keep the CPUs this process may run on; nodes left without any are dropped
+    node_cpus.clear();
+    for (const vector<int>& cpus : nodes) {
+        vector<int> usable;
+        for (int cpu : cpus) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                usable.push_back(cpu);
+            }
+        }
+        if (!usable.empty()) {
+            node_cpus.push_back(usable);
+        }
+    }
+
+    if (node_cpus.empty()) {
+        // No NUMA information: a single node with every allowed CPU
+        if (!spec.empty()) {
+            cerr << "Bank error: --cpu-nodes names no usable CPU, using a single node" << endl;
+        }
+        node_cpus.push_back(vector<int>());
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                node_cpus.back().push_back(cpu);
+            }
+        }
+    }
+
+    background_cpus.clear();
+    next_cpu.assign(node_cpus.size(), 0);
+    next_background_cpu = 0;
+    return true;
+}
+
+void Thread_Placement::reserve_background_cpus(int count)
+{
+    // A node always keeps one CPU for its workers
+    vector<int>& last_node = node_cpus.back();
+    while (count-- > 0 && last_node.size() > 1) {
+        background_cpus.insert(background_cpus.begin(), last_node.back());
+        last_node.pop_back();
+    }
+}
+
+void Thread_Placement::set_mode(int placement_mode)
+{
+    mode = placement_mode;
+}
+
+int Thread_Placement::get_mode() const
+{
+    return mode;
+}
+
+int Thread_Placement::node_count() const
+{
+    return node_cpus.empty() ? 1 : node_cpus.size();
+}
+
+static bool set_affinity(pthread_attr_t* attr, const vector<int>& cpus)
+{
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &cpu_set);
+    }
+    if (pthread_attr_setaffinity_np(attr, sizeof(cpu_set), &cpu_set)) {
+        perror("Bank error: pthread_attr_setaffinity_np failed");
+        return false;
+    }
+    return true;
+}
+
+bool Thread_Placement::set_worker_affinity(pthread_attr_t* attr, int node)
+{
+    if (mode == PLACEMENT_NONE || node_cpus.empty()) {
+        return false;
+    }
+
+    const vector<int>& cpus = node_cpus[node % node_cpus.size()];
+    if (mode == PLACEMENT_CORE) {
+        size_t& next = next_cpu[node % node_cpus.size()];
+        return set_affinity(attr, vector<int>(1, cpus[next++ % cpus.size()]));
+    }
+    return set_affinity(attr, cpus);
+}
+
+bool Thread_Placement::set_background_affinity(pthread_attr_t* attr)
+{
+    if (mode == PLACEMENT_NONE || background_cpus.empty()) {
+        return false;
+    }
+
+    if (mode == PLACEMENT_CORE) {
+        return set_affinity(attr, vector<int>(1, background_cpus[next_background_cpu++ % background_cpus.size()]));
+    }
+    return set_affinity(attr, background_cpus);
+}
+
+string Thread_Placement::describe() const
+{
+    stringstream description;
+    description << "Placement: " << (mode == PLACEMENT_CORE ? "core" : mode == PLACEMENT_NODE ? "node" : "none");
+    for (size_t node = 0; node < node_cpus.size(); node++) {
+        description << (node == 0 ? ", workers " : " / ");
+        for (size_t i = 0; i < node_cpus[node].size(); i++) {
+            description << (i ? "," : "") << node_cpus[node][i];
+        }
+    }
+    description << ", background ";
+    if (background_cpus.empty()) {
+        description << "unpinned";
+    }
+    for (size_t i = 0; i < background_cpus.size(); i++) {
+        description << (i ? "," : "") << background_cpus[i];
+    }
+    return description.str();
+}
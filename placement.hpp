@@ -0,0 +1,57 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+using namespace std;
+
+#define PLACEMENT_NONE 0   // default attributes, the scheduler places every thread
+#define PLACEMENT_NODE 1   // a worker may run on any CPU of its NUMA node
+#define PLACEMENT_CORE 2   // a worker is pinned to one CPU of its node
+
+/*
+ * CPU affinity for the bank's threads. The topology is read from
+ * /sys/devices/system/node and limited to the CPUs this process may use (so
+ * numactl --cpunodebind and taskset are respected); without NUMA information it
+ * is one node holding every allowed CPU. The last background_cpus CPUs are set
+ * aside for the commission, status printer and retry threads, the rest run the
+ * ATM and VIP threads, which are spread round robin over the nodes.
+ *
+ * Only threads are placed. Account memory is not bound to a node, so there is
+ * no node an account belongs to and no point in steering ATMs by account.
+ */
+class Thread_Placement {
+private:
+    int mode;
+    vector<vector<int>> node_cpus;  // worker CPUs per node
+    vector<int> background_cpus;
+    vector<size_t> next_cpu;        // per node, for PLACEMENT_CORE
+    size_t next_background_cpu;
+
+    static bool parse_cpu_list(const string& list, vector<int>& cpus);
+
+public:
+    Thread_Placement();
+
+    // spec overrides sysfs: nodes separated by '/', CPUs in cpulist syntax, e.g. "0-3/4-7"
+    bool load_topology(const string& spec);
+    // Takes count CPUs from the end of the last node for the background threads
+    void reserve_background_cpus(int count);
+    void set_mode(int placement_mode);
+    int get_mode() const;
+
+    int node_count() const;
+
+    // Set the CPU set of a thread created with attr; false leaves attr untouched
+    bool set_worker_affinity(pthread_attr_t* attr, int node);
+    bool set_background_affinity(pthread_attr_t* attr);
+
+    string describe() const;
+};
+
+// From the command line; PLACEMENT_NONE unless --affinity is given
+extern Thread_Placement thread_placement;
+
+#endif
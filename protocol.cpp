@@ -0,0 +1,128 @@
+#include "protocol.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+static const char* find_line_end(const char* data, size_t length)
+{
+    return static_cast<const char*>(memchr(data, '\n', length));
+}
+
+int parse_request(const char* data, size_t length, bool* binary, int* atm_id, vector<string>& operation_words)
+{
+    operation_words.clear();
+    if (length == 0) {
+        return PROTOCOL_INCOMPLETE;
+    }
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    if (bytes[0] == PROTOCOL_BINARY_REQUEST) {
+        *binary = true;
+        if (length < 4) {
+            return PROTOCOL_INCOMPLETE;
+        }
+        int word_count = bytes[1];
+        *atm_id = (bytes[2] << 8) | bytes[3];
+
+        size_t offset = 4;
+        for (int i = 0; i < word_count; i++) {
+            if (offset >= length) {
+                return PROTOCOL_INCOMPLETE;
+            }
+            size_t word_length = bytes[offset++];
+            if (offset + word_length > length) {
+                return PROTOCOL_INCOMPLETE;
+            }
+            operation_words.push_back(string(data + offset, word_length));
+            offset += word_length;
+        }
+        return word_count == 0 ? PROTOCOL_MALFORMED : static_cast<int>(offset);
+    }
+
+    *binary = false;
+    const char* line_end = find_line_end(data, length);
+    if (line_end == nullptr) {
+        return length > PROTOCOL_MAX_LINE ? PROTOCOL_MALFORMED : PROTOCOL_INCOMPLETE;
+    }
+
+    stringstream line(string(data, line_end - data));
+    string word;
+    if (!(line >> *atm_id)) {
+        return PROTOCOL_MALFORMED;
+    }
+    while (line >> word) {
+        operation_words.push_back(word);
+    }
+    if (operation_words.empty()) {
+        return PROTOCOL_MALFORMED;
+    }
+    return line_end - data + 1;
+}
+
+int parse_response(const char* data, size_t length, int* status, int* balance)
+{
+    if (length == 0) {
+        return PROTOCOL_INCOMPLETE;
+    }
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    if (bytes[0] == PROTOCOL_BINARY_RESPONSE) {
+        if (length < PROTOCOL_BINARY_RESPONSE_SIZE) {
+            return PROTOCOL_INCOMPLETE;
+        }
+        *status = static_cast<signed char>(bytes[1]);
+        unsigned int value = (static_cast<unsigned int>(bytes[2]) << 24) | (bytes[3] << 16) | (bytes[4] << 8) | bytes[5];
+        *balance = static_cast<int>(value);
+        return PROTOCOL_BINARY_RESPONSE_SIZE;
+    }
+
+    const char* line_end = find_line_end(data, length);
+    if (line_end == nullptr) {
+        return length > PROTOCOL_MAX_LINE ? PROTOCOL_MALFORMED : PROTOCOL_INCOMPLETE;
+    }
+    char* end;
+    *status = strtol(data, &end, 10);
+    *balance = strtol(end, &end, 10);
+    return line_end - data + 1;
+}
+
+void append_text_request(string& out, int atm_id, const vector<string>& operation_words)
+{
+    out += to_string(atm_id);
+    for (const string& word : operation_words) {
+        out += ' ';
+        out += word;
+    }
+    out += '\n';
+}
+
+void append_binary_request(string& out, int atm_id, const vector<string>& operation_words)
+{
+    out += static_cast<char>(PROTOCOL_BINARY_REQUEST);
+    out += static_cast<char>(operation_words.size());
+    out += static_cast<char>((atm_id >> 8) & 0xff);
+    out += static_cast<char>(atm_id & 0xff);
+    for (const string& word : operation_words) {
+        out += static_cast<char>(word.size());
+        out += word;
+    }
+}
+
+void append_response(string& out, bool binary, int status, int balance)
+{
+    if (!binary) {
+        out += to_string(status);
+        out += ' ';
+        out += to_string(balance);
+        out += '\n';
+        return;
+    }
+
+    unsigned int value = static_cast<unsigned int>(balance);
+    out += static_cast<char>(PROTOCOL_BINARY_RESPONSE);
+    out += static_cast<char>(static_cast<signed char>(status));
+    out += static_cast<char>((value >> 24) & 0xff);
+    out += static_cast<char>((value >> 16) & 0xff);
+    out += static_cast<char>((value >> 8) & 0xff);
+    out += static_cast<char>(value & 0xff);
+}
@@ -0,0 +1,39 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+using namespace std;
+
+/*
+ * Wire format of the server front-end. A connection may mix both forms.
+ *
+ * Text request:    "<atm id> <command words...>\n", e.g. "1 D 12 pw12 50"
+ * Text response:   "<status> <balance>\n"
+ * Binary request:  0x80, word count (1 byte), ATM id (2 bytes, big endian),
+ *                  then every word as length (1 byte) + bytes
+ * Binary response: 0x81, status (1 byte, signed), balance (4 bytes, big endian)
+ *
+ * Responses come back in request order. The balance is -1 when the command
+ * does not report one.
+ */
+#define PROTOCOL_BINARY_REQUEST 0x80
+#define PROTOCOL_BINARY_RESPONSE 0x81
+#define PROTOCOL_BINARY_RESPONSE_SIZE 6
+#define PROTOCOL_MAX_LINE 4096
+
+#define PROTOCOL_INCOMPLETE 0
+#define PROTOCOL_MALFORMED -1
+
+// Decodes one request; returns the bytes consumed, PROTOCOL_INCOMPLETE or PROTOCOL_MALFORMED
+int parse_request(const char* data, size_t length, bool* binary, int* atm_id, vector<string>& operation_words);
+// Decodes one response of either form, with the same return values
+int parse_response(const char* data, size_t length, int* status, int* balance);
+
+void append_text_request(string& out, int atm_id, const vector<string>& operation_words);
+void append_binary_request(string& out, int atm_id, const vector<string>& operation_words);
+void append_response(string& out, bool binary, int status, int balance);
+
+#endif
@@ -0,0 +1,255 @@
+#include "replay.hpp"
+#include <map>
+#include "bank.hpp"
+
+Replay_Recorder* replay_recorder = nullptr;
+
+/* Operation armed by the current thread, consumed by its commit */
+static thread_local bool armed_operation = false;
+static thread_local int armed_atm_id = 0;
+static thread_local string armed_operation_line;
+
+Replay_Recorder::Replay_Recorder() : next_sequence(1)
+{
+}
+
+bool Replay_Recorder::open(const string& path, unsigned int commission_seed, int atm_count)
+{
+    record_file.open(path.c_str());
+    if (!record_file.is_open()) {
+        return false;
+    }
+
+    record_file << "# bank replay v1" << "\n";
+    record_file << "SEED " << commission_seed << "\n";
+    record_file << "ATMS " << atm_count << "\n";
+    return true;
+}
+
+void Replay_Recorder::record(int atm_id, const string& operation_line)
+{
+    record_file << next_sequence++ << " " << atm_id << " " << operation_line << "\n";
+}
+
+void Replay_Recorder::close()
+{
+    record_file.close();
+}
+
+void replay_begin_operation(int atm_id, const vector<string>& operation_words)
+{
+    if (replay_recorder == nullptr) {
+        return;
+    }
+
+    string operation_line;
+    for (unsigned i = 0; i < operation_words.size(); i++) {
+        if (i > 0) {
+            operation_line += ' ';
+        }
+        operation_line += operation_words[i];
+    }
+    replay_begin_operation(atm_id, operation_line);
+}
+
+void replay_begin_operation(int atm_id, const string& operation_line)
+{
+    if (replay_recorder == nullptr) {
+        return;
+    }
+
+    armed_operation = true;
+    armed_atm_id = atm_id;
+    armed_operation_line = operation_line;
+}
+
+void replay_end_operation()
+{
+    armed_operation = false;
+}
+
+bool replay_detach_operation(int* atm_id, string* operation_line)
+{
+    if (replay_recorder == nullptr || !armed_operation) {
+        return false;
+    }
+
+    *atm_id = armed_atm_id;
+    *operation_line = armed_operation_line;
+    armed_operation = false;
+    return true;
+}
+
+void replay_record_commit()
+{
+    if (replay_recorder == nullptr || !armed_operation) {
+        return;
+    }
+
+    replay_recorder->record(armed_atm_id, armed_operation_line);
+    armed_operation = false;
+}
+
+bool load_replay(const string& path, Replay_Schedule& schedule)
+{
+    ifstream replay_file(path.c_str());
+    if (!replay_file.is_open()) {
+        return false;
+    }
+
+    schedule.commission_seed = 0;
+    schedule.atm_count = 0;
+    schedule.entries.clear();
+
+    string line;
+    while (getline(replay_file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        stringstream line_stream(line);
+        string first;
+        line_stream >> first;
+
+        if (first == "SEED") {
+            line_stream >> schedule.commission_seed;
+        } else if (first == "ATMS") {
+            line_stream >> schedule.atm_count;
+        } else {
+            Replay_Entry entry;
+            entry.sequence = stoll(first);
+            line_stream >> entry.atm_id;
+            getline(line_stream >> ws, entry.operation_line);
+            schedule.entries.push_back(entry);
+        }
+    }
+
+    return true;
+}
+
+/* Shared state of a parallel replay */
+struct Replay_Run {
+    Bank* bank;
+    const Replay_Schedule* schedule;
+    vector<vector<size_t>> dependencies; // per entry, earlier entries it must wait for
+    vector<bool> done;
+    pthread_mutex_t done_mutex;
+    pthread_cond_t done_cond;
+};
+
+struct Replay_Worker {
+    Replay_Run* run;
+    vector<size_t> entries; // indexes into the schedule, in commit order
+};
+
+static void execute_entry(Bank* bank, const Replay_Entry& entry)
+{
+    vector<string> operation_words = tokenize_operation(entry.operation_line);
+    if (!operation_words.empty()) {
+        bank->execute_operation(operation_words, entry.atm_id);
+    }
+}
+
+static void* replay_worker_thread(void* arg)
+{
+    Replay_Worker* worker = static_cast<Replay_Worker*>(arg);
+    Replay_Run* run = worker->run;
+
+    for (size_t index : worker->entries) {
+        pthread_mutex_lock(&run->done_mutex);
+        for (size_t dependency : run->dependencies[index]) {
+            while (!run->done[dependency]) {
+                pthread_cond_wait(&run->done_cond, &run->done_mutex);
+            }
+        }
+        pthread_mutex_unlock(&run->done_mutex);
+
+        execute_entry(run->bank, run->schedule->entries[index]);
+
+        pthread_mutex_lock(&run->done_mutex);
+        run->done[index] = true;
+        pthread_cond_broadcast(&run->done_cond);
+        pthread_mutex_unlock(&run->done_mutex);
+    }
+
+    return nullptr;
+}
+
+void run_replay(Bank* bank, const Replay_Schedule& schedule, bool parallel)
+{
+    if (!parallel) {
+        for (const Replay_Entry& entry : schedule.entries) {
+            execute_entry(bank, entry);
+        }
+        return;
+    }
+
+    Replay_Run run;
+    run.bank = bank;
+    run.schedule = &schedule;
+    run.dependencies.resize(schedule.entries.size());
+    run.done.assign(schedule.entries.size(), false);
+    pthread_mutex_init(&run.done_mutex, nullptr);
+    pthread_cond_init(&run.done_cond, nullptr);
+
+    // Dependency graph: last entry per account, plus barriers for C and R
+    unordered_map<int, size_t> last_for_account;
+    vector<size_t> since_barrier;
+    bool has_barrier = false;
+    size_t last_barrier = 0;
+    vector<int> accounts;
+
+    for (size_t i = 0; i < schedule.entries.size(); i++) {
+        vector<string> operation_words = tokenize_operation(schedule.entries[i].operation_line);
+        if (!operation_accounts(operation_words, accounts)) {
+            run.dependencies[i] = since_barrier;
+            if (has_barrier) {
+                run.dependencies[i].push_back(last_barrier);
+            }
+            has_barrier = true;
+            last_barrier = i;
+            since_barrier.clear();
+            last_for_account.clear();
+            continue;
+        }
+
+        if (has_barrier) {
+            run.dependencies[i].push_back(last_barrier);
+        }
+        for (int account : accounts) {
+            auto last = last_for_account.find(account);
+            if (last != last_for_account.end()) {
+                run.dependencies[i].push_back(last->second);
+            }
+            last_for_account[account] = i;
+        }
+        since_barrier.push_back(i);
+    }
+
+    // One worker per ATM id seen in the schedule (0 is the bank itself)
+    map<int, Replay_Worker> workers;
+    for (size_t i = 0; i < schedule.entries.size(); i++) {
+        Replay_Worker& worker = workers[schedule.entries[i].atm_id];
+        worker.run = &run;
+        worker.entries.push_back(i);
+    }
+
+    vector<pthread_t> threads;
+    for (auto& worker : workers) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, replay_worker_thread, &worker.second)) {
+            perror("Bank error: pthread_create failed for replay thread");
+            exit(1);
+        }
+        threads.push_back(thread);
+    }
+    for (pthread_t thread : threads) {
+        if (pthread_join(thread, nullptr)) {
+            perror("Bank error: pthread_join failed for replay thread");
+            exit(1);
+        }
+    }
+
+    pthread_mutex_destroy(&run.done_mutex);
+    pthread_cond_destroy(&run.done_cond);
+}
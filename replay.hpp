@@ -0,0 +1,67 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <pthread.h>
+
+using namespace std;
+
+class Bank;
+
+/*
+ * Commit order recording. Every bank operation writes exactly one log line while
+ * holding the locks that order it against conflicting operations, so the log
+ * call is used as its commit point: an operation armed with
+ * replay_begin_operation is appended to the record from inside
+ * write_to_log_file, under log_file_lock.
+ */
+class Replay_Recorder {
+private:
+    ofstream record_file;
+    long long next_sequence;
+
+public:
+    Replay_Recorder();
+
+    bool open(const string& path, unsigned int commission_seed, int atm_count);
+    void record(int atm_id, const string& operation_line); // caller holds log_file_lock
+    void close();
+};
+
+extern Replay_Recorder* replay_recorder;
+
+// Arms the calling thread's next commit with the operation about to run
+void replay_begin_operation(int atm_id, const vector<string>& operation_words);
+void replay_begin_operation(int atm_id, const string& operation_line);
+// Disarms it, for operations that finished without committing
+void replay_end_operation();
+// Hands the armed operation to another thread that will commit it (see Account_Combiner)
+bool replay_detach_operation(int* atm_id, string* operation_line);
+// Called by write_to_log_file with log_file_lock held
+void replay_record_commit();
+
+struct Replay_Entry {
+    long long sequence;
+    int atm_id;
+    string operation_line;
+};
+
+struct Replay_Schedule {
+    unsigned int commission_seed;
+    int atm_count;
+    vector<Replay_Entry> entries;
+};
+
+bool load_replay(const string& path, Replay_Schedule& schedule);
+
+/*
+ * Re-executes a recorded schedule. Sequentially, entries run in commit order.
+ * In parallel, every ATM gets a thread and an entry only waits for the earlier
+ * entries that touch one of its accounts (C and R wait for everything), which
+ * yields the same final state.
+ */
+void run_replay(Bank* bank, const Replay_Schedule& schedule, bool parallel);
+
+#endif
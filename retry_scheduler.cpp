@@ -0,0 +1,316 @@
+#include "retry_scheduler.hpp"
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include "trace.hpp"
+#include "account.hpp"
+#include "bank.hpp"
+#include "command_pool.hpp"
+
+static long long monotonic_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+Retry_Scheduler::Retry_Scheduler(Retry_Executor executor, int max_attempts, useconds_t initial_delay, double backoff)
+    : executor(executor), max_attempts(max_attempts), initial_delay(initial_delay), backoff(backoff),
+      running(false), stopping(false), outstanding(0)
+{
+    if (pthread_mutex_init(&scheduler_mutex, nullptr)) {
+        perror("Bank error: pthread_mutex_init failed");
+    }
+
+    // Due times are CLOCK_MONOTONIC, so the condition waits on it too
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&scheduler_cond, &cond_attr)) {
+        perror("Bank error: pthread_cond_init failed");
+    }
+    pthread_condattr_destroy(&cond_attr);
+}
+
+Retry_Scheduler::~Retry_Scheduler()
+{
+    stop();
+    pthread_mutex_destroy(&scheduler_mutex);
+    pthread_cond_destroy(&scheduler_cond);
+}
+
+void Retry_Scheduler::start(const pthread_attr_t* attr)
+{
+    running = true;
+    if (pthread_create(&retry_thread, attr, retry_thread_main, this)) {
+        perror("Bank error: pthread_create failed for retry thread");
+        exit(1);
+    }
+}
+
+void Retry_Scheduler::stop()
+{
+    if (!running) {
+        return;
+    }
+
+    pthread_mutex_lock(&scheduler_mutex);
+    stopping = true;
+    pthread_cond_broadcast(&scheduler_cond);
+    pthread_mutex_unlock(&scheduler_mutex);
+
+    if (pthread_join(retry_thread, nullptr)) {
+        perror("Bank error: pthread_join failed for retry thread");
+        exit(1);
+    }
+    running = false;
+}
+
+void* Retry_Scheduler::retry_thread_main(void* arg)
+{
+    trace_thread_name("retry");
+    static_cast<Retry_Scheduler*>(arg)->run();
+    return nullptr;
+}
+
+useconds_t retry_backoff_delay(useconds_t initial_delay, double backoff, int attempts)
+{
+    double delay = initial_delay;
+    double max_delay = static_cast<double>(initial_delay) * RETRY_MAX_BACKOFF;
+    for (int i = 1; i < attempts && delay < max_delay; i++) {
+        delay *= backoff;
+    }
+    if (delay > max_delay) {
+        delay = max_delay;
+    }
+    return static_cast<useconds_t>(delay);
+}
+
+long long Retry_Scheduler::retry_delay_ns(int attempts)
+{
+    // Delays follow latency injection, like the blocking retries they replace
+    if (!latency_injection_enabled) {
+        return 0;
+    }
+    return static_cast<long long>(retry_backoff_delay(initial_delay, backoff, attempts)) * 1000;
+}
+
+// Retry chain nodes come from a pool, so parking a command reuses an old node's storage
+static Retry_Command* acquire_command(int atm_id, const vector<string>& operation_words, const string& operation_line,
+                                      bool is_persistent, int attempts)
+{
+    Retry_Command* command = Object_Pool<Retry_Command>::acquire();
+    command->atm_id = atm_id;
+    command->operation_line.assign(operation_line);
+    command->operation_words.resize(operation_words.size());
+    for (size_t i = 0; i < operation_words.size(); i++) {
+        command->operation_words[i].assign(operation_words[i]);
+    }
+    command->is_persistent = is_persistent;
+    command->attempts = attempts;
+    command->due_ns = 0;
+    command->followers.clear();
+    return command;
+}
+
+static void release_command(Retry_Command* command)
+{
+    Object_Pool<Retry_Command>::release(command);
+}
+
+void Retry_Scheduler::hold_accounts(Retry_Command* holder, const vector<string>& operation_words, int atm_id)
+{
+    vector<int> accounts;
+    operation_accounts(operation_words, accounts);
+    for (int account : accounts) {
+        held_accounts[make_pair(atm_id, account)] = holder;
+    }
+}
+
+void Retry_Scheduler::release_accounts(Retry_Command* holder)
+{
+    for (auto it = held_accounts.begin(); it != held_accounts.end();) {
+        if (it->second == holder) {
+            it = held_accounts.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool Retry_Scheduler::defer_if_blocked(int atm_id, const vector<string>& operation_words, const string& operation_line, bool is_persistent)
+{
+    // Every ATM command passes through here; the account list is per thread scratch
+    static thread_local vector<int> accounts;
+    operation_accounts(operation_words, accounts);
+
+    pthread_mutex_lock(&scheduler_mutex);
+
+    Retry_Command* holder = nullptr;
+    for (int account : accounts) {
+        auto held = held_accounts.find(make_pair(atm_id, account));
+        if (held != held_accounts.end()) {
+            holder = held->second;
+            break;
+        }
+    }
+
+    if (holder == nullptr) {
+        pthread_mutex_unlock(&scheduler_mutex);
+        return false;
+    }
+
+    Retry_Command* follower = acquire_command(atm_id, operation_words, operation_line, is_persistent, 0);
+    holder->followers.push_back(follower);
+    hold_accounts(holder, operation_words, atm_id);
+
+    pthread_mutex_unlock(&scheduler_mutex);
+    return true;
+}
+
+void Retry_Scheduler::schedule_retry(int atm_id, const vector<string>& operation_words, const string& operation_line, int attempts)
+{
+    Retry_Command* command = acquire_command(atm_id, operation_words, operation_line, true, attempts);
+
+    pthread_mutex_lock(&scheduler_mutex);
+    outstanding++;
+    park(command);
+    pthread_mutex_unlock(&scheduler_mutex);
+}
+
+void Retry_Scheduler::cancel_atm(int atm_id)
+{
+    pthread_mutex_lock(&scheduler_mutex);
+
+    cancelled_atms.insert(atm_id);
+    for (auto it = due_commands.begin(); it != due_commands.end();) {
+        if (it->second->atm_id == atm_id) {
+            discard(it->second);
+            it = due_commands.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    pthread_cond_broadcast(&scheduler_cond);
+
+    pthread_mutex_unlock(&scheduler_mutex);
+}
+
+// Frees a parked chain without running it; called with scheduler_mutex held
+void Retry_Scheduler::discard(Retry_Command* command)
+{
+    for (Retry_Command* follower : command->followers) {
+        release_command(follower);
+    }
+    release_accounts(command);
+    release_command(command);
+    outstanding--;
+}
+
+// Called with scheduler_mutex held
+void Retry_Scheduler::park(Retry_Command* command)
+{
+    if (cancelled_atms.count(command->atm_id)) {
+        discard(command);
+        pthread_cond_broadcast(&scheduler_cond);
+        return;
+    }
+
+    if (command->attempts >= max_attempts) {
+        // Nothing left to retry; the retry thread logs it and releases its followers
+        command->due_ns = 0;
+    } else {
+        command->due_ns = monotonic_now_ns() + retry_delay_ns(command->attempts);
+    }
+    hold_accounts(command, command->operation_words, command->atm_id);
+    due_commands.insert(make_pair(command->due_ns, command));
+    pthread_cond_broadcast(&scheduler_cond);
+}
+
+void Retry_Scheduler::run()
+{
+    pthread_mutex_lock(&scheduler_mutex);
+
+    while (true) {
+        if (due_commands.empty()) {
+            if (stopping && outstanding == 0) {
+                break;
+            }
+            pthread_cond_wait(&scheduler_cond, &scheduler_mutex);
+            continue;
+        }
+
+        auto next = due_commands.begin();
+        long long now = monotonic_now_ns();
+        if (next->first > now) {
+            struct timespec deadline;
+            deadline.tv_sec = next->first / 1000000000LL;
+            deadline.tv_nsec = next->first % 1000000000LL;
+            pthread_cond_timedwait(&scheduler_cond, &scheduler_mutex, &deadline);
+            continue;
+        }
+
+        Retry_Command* command = next->second;
+        due_commands.erase(next);
+
+        pthread_mutex_unlock(&scheduler_mutex);
+        process(command);
+        pthread_mutex_lock(&scheduler_mutex);
+    }
+
+    pthread_mutex_unlock(&scheduler_mutex);
+}
+
+void Retry_Scheduler::process(Retry_Command* command)
+{
+    bool success = false;
+    if (command->attempts < max_attempts) {
+        command->attempts++;
+        success = (executor(command->operation_words, command->atm_id) == SUCCESS);
+        if (!success && command->attempts < max_attempts) {
+            pthread_mutex_lock(&scheduler_mutex);
+            park(command);
+            pthread_mutex_unlock(&scheduler_mutex);
+            return;
+        }
+    }
+    if (!success) {
+        stringstream log_line;
+        log_line << "Persistent command failed after " << command->attempts << " retries: " << command->operation_line;
+        write_to_log_file(log_line.str());
+    }
+
+    // The command is resolved; run what queued up behind it, in ATM order
+    pthread_mutex_lock(&scheduler_mutex);
+    while (!command->followers.empty()) {
+        Retry_Command* follower = command->followers.front();
+        command->followers.erase(command->followers.begin());
+        pthread_mutex_unlock(&scheduler_mutex);
+
+        follower->attempts++;
+        bool success = executor(follower->operation_words, follower->atm_id) == SUCCESS;
+
+        pthread_mutex_lock(&scheduler_mutex);
+        if (!success && follower->is_persistent) {
+            // The follower becomes the new holder of the chain
+            follower->followers.swap(command->followers);
+            for (auto& held : held_accounts) {
+                if (held.second == command) {
+                    held.second = follower;
+                }
+            }
+            park(follower);
+            release_command(command);
+            pthread_mutex_unlock(&scheduler_mutex);
+            return;
+        }
+        release_command(follower);
+    }
+
+    release_accounts(command);
+    release_command(command);
+    outstanding--;
+    pthread_cond_broadcast(&scheduler_cond);
+    pthread_mutex_unlock(&scheduler_mutex);
+}
@@ -0,0 +1,84 @@
+#ifndef RETRY_SCHEDULER_H
+#define RETRY_SCHEDULER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <utility>
+#include <pthread.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define RETRY_MAX_BACKOFF 16   // retry delays stop growing at this multiple of the first one
+
+// Runs one command and returns its status (SUCCESS on success)
+typedef int (*Retry_Executor)(const vector<string>& operation_words, int atm_id);
+
+struct Retry_Command {
+    int atm_id;
+    string operation_line;
+    vector<string> operation_words;
+    bool is_persistent;
+    int attempts;                       // attempts made so far
+    long long due_ns;
+    vector<Retry_Command*> followers;   // later commands of the same ATM on the same accounts
+};
+
+// Exponential backoff before the next attempt of a command that ran `attempts` times,
+// shared by the retry thread and the async sessions
+useconds_t retry_backoff_delay(useconds_t initial_delay, double backoff, int attempts);
+
+/*
+ * Delay queue for PERSISTENT commands. A failed persistent command is parked here
+ * with exponential backoff instead of blocking its ATM in usleep; one retry
+ * thread re-dispatches it when due. Until it succeeds or runs out of attempts,
+ * later commands from the same ATM that touch one of its accounts are queued
+ * behind it (and run by the retry thread in ATM order), so per-account order
+ * is kept while the rest of the ATM stream carries on.
+ */
+class Retry_Scheduler {
+private:
+    Retry_Executor executor;
+    int max_attempts;
+    useconds_t initial_delay;
+    double backoff;
+
+    pthread_mutex_t scheduler_mutex;
+    pthread_cond_t scheduler_cond;
+    pthread_t retry_thread;
+    bool running;
+    bool stopping;
+    int outstanding;                                   // commands parked or being retried
+    multimap<long long, Retry_Command*> due_commands;  // by due time
+    map<pair<int, int>, Retry_Command*> held_accounts; // (ATM, account) -> command holding it
+    set<int> cancelled_atms;
+
+    static void* retry_thread_main(void* arg);
+    void run();
+    void process(Retry_Command* command);
+    void park(Retry_Command* command);
+    void hold_accounts(Retry_Command* holder, const vector<string>& operation_words, int atm_id);
+    void release_accounts(Retry_Command* holder);
+    void discard(Retry_Command* command);
+    long long retry_delay_ns(int attempts);
+
+public:
+    Retry_Scheduler(Retry_Executor executor, int max_attempts, useconds_t initial_delay, double backoff);
+    ~Retry_Scheduler();
+
+    // attr sets the retry thread's attributes (CPU placement); nullptr for defaults
+    void start(const pthread_attr_t* attr = nullptr);
+    // Waits for every parked command to finish, then stops the retry thread
+    void stop();
+
+    // Queues the command behind a pending retry of the same ATM on one of its accounts
+    bool defer_if_blocked(int atm_id, const vector<string>& operation_words, const string& operation_line, bool is_persistent);
+    // Parks a persistent command after a failed attempt
+    void schedule_retry(int atm_id, const vector<string>& operation_words, const string& operation_line, int attempts);
+    // Drops everything parked for a closed ATM
+    void cancel_atm(int atm_id);
+};
+
+#endif
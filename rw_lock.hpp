@@ -0,0 +1,106 @@
+#ifndef RW_LOCK_H
+#define RW_LOCK_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+
+/*
+ * The readers-writers lock of the bank and of every account. The first reader
+ * takes the write mutex and the last reader, often another thread, releases
+ * it; readers count under the read mutex.
+ *
+ * ThreadSanitizer cannot model a mutex released by another thread than the
+ * one that took it, so the sanitizer builds (-DBANK_PTHREAD_RWLOCK) use a
+ * pthread_rwlock_t behind the same calls. Like the two mutexes, glibc's
+ * default rwlock lets readers in while other readers hold it.
+ */
+class Readers_Writers_Lock {
+private:
+#ifdef BANK_PTHREAD_RWLOCK
+    pthread_rwlock_t lock;
+#else
+    pthread_mutex_t read_lock_mutex;
+    pthread_mutex_t write_lock_mutex;
+    int read_count;
+#endif
+
+    static void check(int error, const char* message) {
+        if (error) {
+            perror(message);
+            exit(1);
+        }
+    }
+
+public:
+#ifdef BANK_PTHREAD_RWLOCK
+    Readers_Writers_Lock() {
+        if (pthread_rwlock_init(&lock, nullptr)) {
+            perror("Bank error: pthread_rwlock_init failed");
+        }
+    }
+    ~Readers_Writers_Lock() {
+        if (pthread_rwlock_destroy(&lock)) {
+            perror("Bank error: pthread_rwlock_destroy failed");
+        }
+    }
+
+    void read_lock() {
+        check(pthread_rwlock_rdlock(&lock), "Bank error: pthread_rwlock_rdlock failed");
+    }
+    void read_unlock() {
+        check(pthread_rwlock_unlock(&lock), "Bank error: pthread_rwlock_unlock failed");
+    }
+    void write_lock() {
+        check(pthread_rwlock_wrlock(&lock), "Bank error: pthread_rwlock_wrlock failed");
+    }
+    void write_unlock() {
+        check(pthread_rwlock_unlock(&lock), "Bank error: pthread_rwlock_unlock failed");
+    }
+#else
+    Readers_Writers_Lock() : read_count(0) {
+        if (pthread_mutex_init(&read_lock_mutex, nullptr)) {
+            perror("Bank error: pthread_mutex_init failed");
+        }
+        if (pthread_mutex_init(&write_lock_mutex, nullptr)) {
+            perror("Bank error: pthread_mutex_init failed");
+        }
+    }
+    ~Readers_Writers_Lock() {
+        if (pthread_mutex_destroy(&read_lock_mutex)) {
+            perror("Bank error: pthread_mutex_destroy failed");
+        }
+        if (pthread_mutex_destroy(&write_lock_mutex)) {
+            perror("Bank error: pthread_mutex_destroy failed");
+        }
+    }
+
+    void read_lock() {
+        check(pthread_mutex_lock(&read_lock_mutex), "Bank error: pthread_mutex_lock failed");
+        read_count++;
+        if (read_count == 1) {
+            check(pthread_mutex_lock(&write_lock_mutex), "Bank error: pthread_mutex_lock failed");
+        }
+        check(pthread_mutex_unlock(&read_lock_mutex), "Bank error: pthread_mutex_unlock failed");
+    }
+    void read_unlock() {
+        check(pthread_mutex_lock(&read_lock_mutex), "Bank error: pthread_mutex_lock failed");
+        read_count--;
+        if (read_count == 0) {
+            check(pthread_mutex_unlock(&write_lock_mutex), "Bank error: pthread_mutex_unlock failed");
+        }
+        check(pthread_mutex_unlock(&read_lock_mutex), "Bank error: pthread_mutex_unlock failed");
+    }
+    void write_lock() {
+        check(pthread_mutex_lock(&write_lock_mutex), "Bank error: pthread_mutex_lock failed");
+    }
+    void write_unlock() {
+        check(pthread_mutex_unlock(&write_lock_mutex), "Bank error: pthread_mutex_unlock failed");
+    }
+#endif
+
+    Readers_Writers_Lock(const Readers_Writers_Lock&) = delete;
+    Readers_Writers_Lock& operator=(const Readers_Writers_Lock&) = delete;
+};
+
+#endif
@@ -0,0 +1,384 @@
+#include "server.hpp"
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "bank.hpp"
+#include "protocol.hpp"
+
+#define SERVER_READ_SIZE 65536
+#define SERVER_MAX_EVENTS 64
+#define SERVER_INPUT_LIMIT (256 * 1024)  // unparsed request bytes a connection may hold; far above PROTOCOL_MAX_LINE
+#define SERVER_OUTPUT_LIMIT (256 * 1024) // unsent reply bytes before the loop stops reading a connection
+
+struct Server_Connection {
+    int fd;
+    string input;
+    string output;
+    uint32_t events;    // epoll interest currently registered
+    bool read_closed;   // the peer shut down its side; replies may still be owed
+};
+
+static bool set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+Bank_Server::Bank_Server(Server_Executor executor) : executor(executor), listen_fd(-1), signal_fd(-1)
+{
+}
+
+Bank_Server::~Bank_Server()
+{
+    if (listen_fd != -1) {
+        close(listen_fd);
+    }
+    if (signal_fd != -1) {
+        close(signal_fd);
+    }
+    if (!unix_path.empty()) {
+        unlink(unix_path.c_str());
+    }
+}
+
+void Bank_Server::block_termination_signals()
+{
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &signals, nullptr)) {
+        perror("Bank error: pthread_sigmask failed");
+        exit(1);
+    }
+}
+
+bool Bank_Server::listen_on(const string& address)
+{
+    if (address.compare(0, 5, "unix:") == 0) {
+        unix_path = address.substr(5);
+        struct sockaddr_un local;
+        if (unix_path.empty() || unix_path.size() >= sizeof(local.sun_path)) {
+            return false;
+        }
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        strcpy(local.sun_path, unix_path.c_str());
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(unix_path.c_str());
+        if (listen_fd == -1 || bind(listen_fd, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)) == -1) {
+            perror("Bank error: unable to bind server socket");
+            return false;
+        }
+    } else if (address.compare(0, 4, "tcp:") == 0) {
+        struct sockaddr_in local;
+        memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons(atoi(address.c_str() + 4));
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        if (listen_fd == -1 || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1 ||
+            bind(listen_fd, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)) == -1) {
+            perror("Bank error: unable to bind server socket");
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    if (listen(listen_fd, SOMAXCONN) == -1 || !set_nonblocking(listen_fd)) {
+        perror("Bank error: unable to listen on server socket");
+        return false;
+    }
+    return true;
+}
+
+void Bank_Server::close_connection(Server_Loop* loop, Server_Connection* connection)
+{
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, connection->fd, nullptr);
+    close(connection->fd);
+
+    pthread_mutex_lock(&loop->connections_mutex);
+    loop->connections.erase(connection);
+    pthread_mutex_unlock(&loop->connections_mutex);
+    delete connection;
+}
+
+void Bank_Server::update_events(Server_Loop* loop, Server_Connection* connection)
+{
+    // Reads stop while replies are backed up past the limit, so a client that
+    // sends without reading cannot grow the output without bound
+    uint32_t events = 0;
+    if (!connection->read_closed && connection->output.size() < SERVER_OUTPUT_LIMIT) {
+        events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (!connection->output.empty()) {
+        events |= EPOLLOUT;
+    }
+    if (events != connection->events) {
+        struct epoll_event event;
+        event.events = events;
+        event.data.ptr = connection;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->events = events;
+    }
+}
+
+bool Bank_Server::flush_connection(Server_Connection* connection)
+{
+    size_t written = 0;
+    while (written < connection->output.size()) {
+        ssize_t count = send(connection->fd, connection->output.data() + written,
+                             connection->output.size() - written, MSG_NOSIGNAL);
+        if (count == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += count;
+    }
+    connection->output.erase(0, written);
+    return true;
+}
+
+void Bank_Server::handle_readable(Server_Loop* loop, Server_Connection* connection)
+{
+    // Reading stops at the input limit; the rest stays in the socket until
+    // the buffered requests have run
+    char buffer[SERVER_READ_SIZE];
+    while (!connection->read_closed && connection->input.size() < SERVER_INPUT_LIMIT) {
+        ssize_t count = recv(connection->fd, buffer, sizeof(buffer), 0);
+        if (count > 0) {
+            connection->input.append(buffer, count);
+            continue;
+        }
+        if (count == 0) {
+            connection->read_closed = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            connection->read_closed = true;
+        }
+        break;
+    }
+    serve_connection(loop, connection);
+}
+
+void Bank_Server::serve_connection(Server_Loop* loop, Server_Connection* connection)
+{
+    // Run every complete request, in order, and batch the replies; requests
+    // past the output limit wait in the input until the client reads
+    vector<string> operation_words;
+    bool held_back = true;
+    while (held_back) {
+        size_t offset = 0;
+        held_back = false;
+        while (offset < connection->input.size()) {
+            if (connection->output.size() >= SERVER_OUTPUT_LIMIT) {
+                held_back = true;
+                break;
+            }
+            bool binary;
+            int atm_id = 0;
+            int consumed = parse_request(connection->input.data() + offset, connection->input.size() - offset,
+                                         &binary, &atm_id, operation_words);
+            if (consumed == PROTOCOL_INCOMPLETE) {
+                break;
+            }
+            if (consumed == PROTOCOL_MALFORMED) {
+                connection->read_closed = true;
+                offset = connection->input.size();
+                break;
+            }
+            offset += consumed;
+
+            int balance = -1;
+            int status;
+            try {
+                status = loop->executor(operation_words, atm_id, &balance);
+            } catch (const logic_error&) {
+                status = OPERATION_FAILED; // non-numeric field from the client
+            }
+            append_response(connection->output, binary, status, balance);
+        }
+        connection->input.erase(0, offset);
+
+        if (!flush_connection(connection)) {
+            close_connection(loop, connection);
+            return;
+        }
+        // Go on with the held back requests if the socket took enough of the replies
+        held_back = held_back && connection->output.size() < SERVER_OUTPUT_LIMIT;
+    }
+
+    // A half-closed peer is done once its last complete request is answered;
+    // a trailing partial request can never complete
+    if (connection->read_closed && connection->output.empty()) {
+        close_connection(loop, connection);
+        return;
+    }
+    update_events(loop, connection);
+}
+
+void* Bank_Server::loop_main(void* arg)
+{
+    Server_Loop* loop = static_cast<Server_Loop*>(arg);
+    struct epoll_event events[SERVER_MAX_EVENTS];
+
+    while (true) {
+        int count = epoll_wait(loop->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Bank error: epoll_wait failed");
+            exit(1);
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == nullptr) {
+                return nullptr; // wake_fd: the server is stopping
+            }
+            Server_Connection* connection = static_cast<Server_Connection*>(events[i].data.ptr);
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                close_connection(loop, connection); // nothing more can be sent or received
+            } else if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                handle_readable(loop, connection);
+            } else if (events[i].events & EPOLLOUT) {
+                // Draining the replies may let the requests held back behind them run
+                if (!flush_connection(connection)) {
+                    close_connection(loop, connection);
+                } else {
+                    serve_connection(loop, connection);
+                }
+            }
+        }
+    }
+}
+
+void Bank_Server::run(int loop_count)
+{
+    if (loop_count < 1) {
+        loop_count = 1;
+    }
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    signal_fd = signalfd(-1, &signals, 0);
+
+    int accept_epoll_fd = epoll_create1(0);
+    if (signal_fd == -1 || accept_epoll_fd == -1) {
+        perror("Bank error: unable to create server event loop");
+        exit(1);
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = listen_fd;
+    epoll_ctl(accept_epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.fd = signal_fd;
+    epoll_ctl(accept_epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+
+    for (int i = 0; i < loop_count; i++) {
+        Server_Loop* loop = new Server_Loop();
+        loop->executor = executor;
+        loop->epoll_fd = epoll_create1(0);
+        loop->wake_fd = eventfd(0, 0);
+        pthread_mutex_init(&loop->connections_mutex, nullptr);
+        if (loop->epoll_fd == -1 || loop->wake_fd == -1) {
+            perror("Bank error: unable to create server event loop");
+            exit(1);
+        }
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event);
+
+        if (pthread_create(&loop->thread, nullptr, loop_main, loop)) {
+            perror("Bank error: pthread_create failed for server loop thread");
+            exit(1);
+        }
+        loops.push_back(loop);
+    }
+
+    size_t next_loop = 0;
+    bool stopping = false;
+    while (!stopping) {
+        struct epoll_event events[2];
+        int count = epoll_wait(accept_epoll_fd, events, 2, -1);
+        if (count == -1 && errno != EINTR) {
+            perror("Bank error: epoll_wait failed");
+            exit(1);
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.fd == signal_fd) {
+                stopping = true;
+                continue;
+            }
+
+            int client_fd;
+            while ((client_fd = accept(listen_fd, nullptr, nullptr)) != -1) {
+                int no_delay = 1;
+                setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay)); // fails harmlessly on unix sockets
+                set_nonblocking(client_fd);
+
+                Server_Loop* loop = loops[next_loop++ % loops.size()];
+                Server_Connection* connection = new Server_Connection();
+                connection->fd = client_fd;
+                connection->events = EPOLLIN | EPOLLRDHUP;
+                connection->read_closed = false;
+
+                pthread_mutex_lock(&loop->connections_mutex);
+                loop->connections.insert(connection);
+                pthread_mutex_unlock(&loop->connections_mutex);
+
+                struct epoll_event client_event;
+                client_event.events = connection->events;
+                client_event.data.ptr = connection;
+                epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client_fd, &client_event);
+            }
+        }
+    }
+
+    // Stop the loops and drop the connections still open
+    for (Server_Loop* loop : loops) {
+        uint64_t wake = 1;
+        if (write(loop->wake_fd, &wake, sizeof(wake)) != sizeof(wake)) {
+            perror("Bank error: unable to stop server loop");
+        }
+        if (pthread_join(loop->thread, nullptr)) {
+            perror("Bank error: pthread_join failed for server loop thread");
+            exit(1);
+        }
+        for (Server_Connection* connection : loop->connections) {
+            close(connection->fd);
+            delete connection;
+        }
+        close(loop->epoll_fd);
+        close(loop->wake_fd);
+        pthread_mutex_destroy(&loop->connections_mutex);
+        delete loop;
+    }
+    loops.clear();
+    close(accept_epoll_fd);
+}
@@ -0,0 +1,65 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <pthread.h>
+
+using namespace std;
+
+// Runs one command for a client, returning its status and the balance it reports
+typedef int (*Server_Executor)(const vector<string>& operation_words, int atm_id, int* new_balance);
+
+struct Server_Connection;
+
+/* One epoll loop thread; connections stay on the loop they were handed to */
+struct Server_Loop {
+    int epoll_fd;
+    int wake_fd;     // eventfd, written to stop the loop
+    pthread_t thread;
+    Server_Executor executor;
+    pthread_mutex_t connections_mutex;
+    set<Server_Connection*> connections;
+};
+
+/*
+ * Socket front-end for live clients (see protocol.hpp for the wire format).
+ * The calling thread accepts connections and spreads them over the loop
+ * threads. A loop reads everything a connection has sent, runs each complete
+ * request in order, and sends all the responses of that pass in one write, so
+ * pipelined clients get batched replies. A connection buffers a bounded
+ * amount of input and output; while its replies are backed up the loop stops
+ * reading it. A loop runs its commands itself, so one command that blocks in
+ * the bank (a lock, a PERSISTENT retry) stalls every connection on that loop.
+ * The server runs until SIGINT or SIGTERM.
+ */
+class Bank_Server {
+private:
+    Server_Executor executor;
+    int listen_fd;
+    int signal_fd;
+    string unix_path;
+    vector<Server_Loop*> loops;
+
+    static void* loop_main(void* arg);
+    static void handle_readable(Server_Loop* loop, Server_Connection* connection);
+    // Runs the buffered requests the output limit allows, flushes, and closes or re-arms the connection
+    static void serve_connection(Server_Loop* loop, Server_Connection* connection);
+    static bool flush_connection(Server_Connection* connection);
+    static void update_events(Server_Loop* loop, Server_Connection* connection);
+    static void close_connection(Server_Loop* loop, Server_Connection* connection);
+
+public:
+    Bank_Server(Server_Executor executor);
+    ~Bank_Server();
+
+    // "unix:<path>" or "tcp:<port>" (bound to localhost)
+    bool listen_on(const string& address);
+    // Call before any thread starts, so only the accept loop sees SIGINT/SIGTERM
+    static void block_termination_signals();
+    // Accepts and serves until a termination signal arrives
+    void run(int loop_count);
+};
+
+#endif
@@ -0,0 +1,326 @@
+#include "session_pool.hpp"
+#include <ctime>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include "bank.hpp"
+#include "lifecycle.hpp"
+#include "dedup.hpp"
+#include "retry_scheduler.hpp"
+
+static long long monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+bool Session_Pool::Timer::operator<(const Timer& other) const
+{
+    if (due_ns != other.due_ns) {
+        return due_ns > other.due_ns;
+    }
+    return sequence > other.sequence;
+}
+
+bool Session_Pool::Ready::operator<(const Ready& other) const
+{
+    if (vip_level != other.vip_level) {
+        return vip_level < other.vip_level;
+    }
+    return sequence > other.sequence;
+}
+
+Session_Pool::Session_Pool(Session_Executor executor, Bank_Lifecycle* lifecycle, int worker_count,
+                           int max_attempts, useconds_t retry_delay, double retry_backoff, bool simulate_latency)
+    : executor(executor), lifecycle(lifecycle), worker_count(worker_count < 1 ? 1 : worker_count),
+      max_attempts(max_attempts), retry_delay(retry_delay), retry_backoff(retry_backoff),
+      simulate_latency(simulate_latency), active_sessions(0), next_sequence(0)
+{
+    if (pthread_mutex_init(&pool_mutex, nullptr)) {
+        perror("Bank error: pthread_mutex_init failed");
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&pool_cond, &cond_attr)) {
+        perror("Bank error: pthread_cond_init failed");
+    }
+    pthread_condattr_destroy(&cond_attr);
+}
+
+Session_Pool::~Session_Pool()
+{
+    pthread_mutex_destroy(&pool_mutex);
+    pthread_cond_destroy(&pool_cond);
+}
+
+void Session_Pool::start(const vector<string>& files)
+{
+    atm_files = files;
+    sessions.resize(atm_files.size());
+    active_sessions = sessions.size();
+
+    pthread_mutex_lock(&pool_mutex);
+    for (size_t i = 0; i < sessions.size(); i++) {
+        Atm_Session& session = sessions[i];
+        session.atm_id = i + 1;
+        session.state = SESSION_START;
+        session.file_offset = 0;
+        session.next_line = 0;
+        session.vip_level = 0;
+        session.is_persistent = false;
+        session.attempts = 0;
+        make_ready(&session);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    workers.resize(worker_count);
+    for (int i = 0; i < worker_count; i++) {
+        if (pthread_create(&workers[i], nullptr, worker_main, this)) {
+            perror("Bank error: pthread_create failed for session worker thread");
+            exit(1);
+        }
+    }
+}
+
+void Session_Pool::join()
+{
+    for (pthread_t worker : workers) {
+        if (pthread_join(worker, nullptr)) {
+            perror("Bank error: pthread_join failed for session worker thread");
+            exit(1);
+        }
+    }
+    workers.clear();
+}
+
+void* Session_Pool::worker_main(void* arg)
+{
+    static_cast<Session_Pool*>(arg)->run_worker();
+    return nullptr;
+}
+
+void Session_Pool::run_worker()
+{
+    pthread_mutex_lock(&pool_mutex);
+    while (true) {
+        long long now = monotonic_ns();
+        while (!timers.empty() && timers.top().due_ns <= now) {
+            Atm_Session* session = timers.top().session;
+            timers.pop();
+            ready.push(Ready{session->vip_level, next_sequence++, session});
+        }
+
+        if (!ready.empty()) {
+            Atm_Session* session = ready.top().session;
+            ready.pop();
+            pthread_mutex_unlock(&pool_mutex);
+            step(session);
+            pthread_mutex_lock(&pool_mutex);
+            continue;
+        }
+
+        if (active_sessions == 0) {
+            break;
+        }
+
+        if (timers.empty()) {
+            pthread_cond_wait(&pool_cond, &pool_mutex);
+        } else {
+            long long due_ns = timers.top().due_ns;
+            struct timespec deadline;
+            deadline.tv_sec = due_ns / 1000000000LL;
+            deadline.tv_nsec = due_ns % 1000000000LL;
+            pthread_cond_timedwait(&pool_cond, &pool_mutex, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void Session_Pool::make_ready(Atm_Session* session)
+{
+    ready.push(Ready{session->vip_level, next_sequence++, session});
+    pthread_cond_signal(&pool_cond);
+}
+
+void Session_Pool::suspend_for(Atm_Session* session, useconds_t microseconds)
+{
+    if (microseconds == 0) {
+        make_ready(session);
+        return;
+    }
+    timers.push(Timer{monotonic_ns() + microseconds * 1000LL, next_sequence++, session});
+    // A sleeping worker may be waiting for a later deadline
+    pthread_cond_signal(&pool_cond);
+}
+
+bool Session_Pool::try_reserve(Atm_Session* session)
+{
+    for (int account : session->accounts) {
+        auto owner = reserved_accounts.find(account);
+        if (owner != reserved_accounts.end() && owner->second != session) {
+            account_waiters[account].push_back(session);
+            return false;
+        }
+    }
+    for (int account : session->accounts) {
+        reserved_accounts[account] = session;
+    }
+    return true;
+}
+
+void Session_Pool::release(Atm_Session* session)
+{
+    for (int account : session->accounts) {
+        reserved_accounts.erase(account);
+
+        auto waiters = account_waiters.find(account);
+        if (waiters != account_waiters.end()) {
+            for (Atm_Session* waiter : waiters->second) {
+                make_ready(waiter);
+            }
+            account_waiters.erase(waiters);
+        }
+    }
+}
+
+bool Session_Pool::can_open(Atm_Session* session)
+{
+    int fd = open(atm_files[session->atm_id - 1].c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+bool Session_Pool::read_next_line(Atm_Session* session)
+{
+    int fd = open(atm_files[session->atm_id - 1].c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    session->operation_line.clear();
+    off_t consumed = 0;
+    char buffer[256];
+    while (true) {
+        ssize_t bytes = pread(fd, buffer, sizeof(buffer), session->file_offset + consumed);
+        if (bytes <= 0) {
+            break;
+        }
+        char* newline = static_cast<char*>(memchr(buffer, '\n', bytes));
+        if (newline) {
+            session->operation_line.append(buffer, newline - buffer);
+            consumed += newline - buffer + 1;
+            break;
+        }
+        session->operation_line.append(buffer, bytes);
+        consumed += bytes;
+    }
+    close(fd);
+
+    if (consumed == 0) {
+        return false;
+    }
+    session->file_offset += consumed;
+    session->next_line++;
+    return true;
+}
+
+void Session_Pool::step(Atm_Session* session)
+{
+    while (true) {
+        switch (session->state) {
+            case SESSION_START:
+                if (!can_open(session)) {
+                    cerr << "Bank error: failed to open ATM file" << endl;
+                    exit(1);
+                }
+                session->state = SESSION_NEXT;
+                break;
+
+            case SESSION_NEXT:
+                if (lifecycle->is_atm_closed(session->atm_id) || !read_next_line(session)) {
+                    session->state = SESSION_DONE;
+                    break;
+                }
+                session->operation_words = tokenize_operation(session->operation_line);
+                session->vip_level = 0;
+                session->is_persistent = false;
+                session->attempts = 0;
+                for (const string& op_word : session->operation_words) {
+                    if (op_word.compare(0, 4, "VIP=") == 0) {
+                        session->vip_level = stoi(op_word.substr(4));
+                    } else if (op_word == "PERSISTENT") {
+                        session->is_persistent = true;
+                    }
+                }
+                // Keyed by its line, as in the threaded ATMs
+                if (session->is_persistent) {
+                    add_idempotency_key(session->operation_words, session->operation_line, session->next_line);
+                }
+                operation_accounts(session->operation_words, session->accounts);
+
+                // Simulated delay before the command
+                session->state = SESSION_RESERVE;
+                pthread_mutex_lock(&pool_mutex);
+                suspend_for(session, simulate_latency ? ASYNC_ATM_DELAY : 0);
+                pthread_mutex_unlock(&pool_mutex);
+                return;
+
+            case SESSION_RESERVE:
+                if (session->operation_words.empty() || lifecycle->is_atm_closed(session->atm_id)) {
+                    session->state = SESSION_NEXT;
+                    break;
+                }
+
+                pthread_mutex_lock(&pool_mutex);
+                if (!try_reserve(session)) {
+                    pthread_mutex_unlock(&pool_mutex); // resumed by release()
+                    return;
+                }
+                // The operation's own delay, spent holding its accounts
+                session->state = SESSION_EXECUTE;
+                suspend_for(session, simulate_latency ? ASYNC_OPERATION_DELAY : 0);
+                pthread_mutex_unlock(&pool_mutex);
+                return;
+
+            case SESSION_EXECUTE: {
+                bool success = executor(session->operation_words, session->atm_id) == SUCCESS;
+                session->attempts++;
+
+                pthread_mutex_lock(&pool_mutex);
+                release(session);
+                if (session->is_persistent && !success && session->attempts < max_attempts) {
+                    session->state = SESSION_RESERVE;
+                    suspend_for(session, simulate_latency ? retry_backoff_delay(retry_delay, retry_backoff, session->attempts) : 0);
+                    pthread_mutex_unlock(&pool_mutex);
+                    return;
+                }
+                pthread_mutex_unlock(&pool_mutex);
+
+                if (session->is_persistent && !success) {
+                    stringstream log_line;
+                    log_line << "Persistent command failed after " << session->attempts << " retries: " << session->operation_line;
+                    write_to_log_file(log_line.str());
+                }
+                session->state = SESSION_NEXT;
+                break;
+            }
+
+            case SESSION_DONE:
+                lifecycle->atm_finished();
+
+                pthread_mutex_lock(&pool_mutex);
+                if (--active_sessions == 0) {
+                    pthread_cond_broadcast(&pool_cond);
+                }
+                pthread_mutex_unlock(&pool_mutex);
+                return;
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#ifndef SESSION_POOL_H
+#define SESSION_POOL_H
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <pthread.h>
+#include <unistd.h>
+
+using namespace std;
+
+class Bank_Lifecycle;
+
+#define ASYNC_ATM_DELAY 100000        // usec between two commands of an ATM
+#define ASYNC_OPERATION_DELAY 1000000 // usec an operation holds its accounts
+
+// Runs one command and returns its status (SUCCESS on success)
+typedef int (*Session_Executor)(const vector<string>& operation_words, int atm_id);
+
+enum Session_State {
+    SESSION_START,    // ATM file not opened yet
+    SESSION_NEXT,     // about to take the next command
+    SESSION_RESERVE,  // waiting for the command's accounts
+    SESSION_EXECUTE,  // accounts held, command runs when resumed
+    SESSION_DONE
+};
+
+/*
+ * One simulated ATM as a stackless state machine. step() runs until the
+ * session has to wait and then returns, so a suspended session is just this
+ * struct sitting in the timer heap, the ready queue or an account wait list.
+ * Commands are read one line per step from the session's file offset, so a
+ * suspended session holds neither a descriptor nor the rest of its file.
+ */
+struct Atm_Session {
+    int atm_id;
+    Session_State state;
+    off_t file_offset;      // where the next command starts in the ATM file
+    size_t next_line;       // commands read so far, the line number of operation_line
+    string operation_line;
+    vector<string> operation_words;
+    vector<int> accounts;   // accounts of the current command, reserved in SESSION_EXECUTE
+    int vip_level;          // ready queue priority of the current command
+    bool is_persistent;
+    int attempts;           // executions of the current command so far
+};
+
+/*
+ * Runs ATM sessions over a small worker pool instead of a pthread per ATM.
+ * The ATM delay, the operation delay and PERSISTENT backoff suspend the
+ * session on a timer. Lock waits are modeled by account reservations taken
+ * before the operation delay: a session that finds one of its accounts
+ * reserved parks on that account and is resumed when it is released. The
+ * bank's own mutexes are then only held for the short, sleep-free execution,
+ * so no worker ever blocks for simulated time.
+ */
+class Session_Pool {
+private:
+    struct Timer {
+        long long due_ns;
+        long long sequence;
+        Atm_Session* session;
+        bool operator<(const Timer& other) const;   // min-heap order
+    };
+    struct Ready {
+        int vip_level;
+        long long sequence;
+        Atm_Session* session;
+        bool operator<(const Ready& other) const;   // VIP first, then FIFO
+    };
+
+    Session_Executor executor;
+    Bank_Lifecycle* lifecycle;
+    int worker_count;
+    int max_attempts;
+    useconds_t retry_delay;
+    double retry_backoff;       // PERSISTENT backoff, see retry_backoff_delay()
+    bool simulate_latency;      // the bank's own latency injection is off in async mode
+
+    pthread_mutex_t pool_mutex;
+    pthread_cond_t pool_cond;
+    vector<pthread_t> workers;
+    vector<string> atm_files;
+    vector<Atm_Session> sessions;
+    int active_sessions;
+    long long next_sequence;
+    priority_queue<Timer> timers;
+    priority_queue<Ready> ready;
+    unordered_map<int, Atm_Session*> reserved_accounts;
+    unordered_map<int, vector<Atm_Session*>> account_waiters;
+
+    static void* worker_main(void* arg);
+    void run_worker();
+    void step(Atm_Session* session);
+
+    // Callers hold pool_mutex
+    void make_ready(Atm_Session* session);
+    void suspend_for(Atm_Session* session, useconds_t microseconds);
+    bool try_reserve(Atm_Session* session);
+    void release(Atm_Session* session);
+
+    bool can_open(Atm_Session* session);
+    // Reads the command at the session's file offset into operation_line; false at end of file
+    bool read_next_line(Atm_Session* session);
+
+public:
+    Session_Pool(Session_Executor executor, Bank_Lifecycle* lifecycle, int worker_count,
+                 int max_attempts, useconds_t retry_delay, double retry_backoff, bool simulate_latency);
+    ~Session_Pool();
+
+    // Creates one session per ATM file and starts the workers
+    void start(const vector<string>& atm_files);
+    // Waits for every session to finish, then joins the workers
+    void join();
+};
+
+#endif
@@ -0,0 +1,290 @@
+#include "status_history.hpp"
+#include <algorithm>
+#include <unordered_map>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define CHANGE_BALANCE 0   // open in both snapshots: the balance difference
+#define CHANGE_REOPEN 1    // closed since (or reopened with another password): balance and password
+#define CHANGE_CLOSE 2     // opened since
+
+#define COMPACT_CHUNK 65536
+
+static void put_varint(vector<unsigned char>& bytes, unsigned long long value)
+{
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<unsigned char>(value));
+}
+
+static unsigned long long get_varint(const unsigned char*& bytes)
+{
+    unsigned long long value = 0;
+    int shift = 0;
+    while (*bytes & 0x80) {
+        value |= static_cast<unsigned long long>(*bytes++ & 0x7f) << shift;
+        shift += 7;
+    }
+    return value | static_cast<unsigned long long>(*bytes++) << shift;
+}
+
+static unsigned long long zigzag(long long value)
+{
+    return (static_cast<unsigned long long>(value) << 1) ^ static_cast<unsigned long long>(value >> 63);
+}
+
+static long long unzigzag(unsigned long long value)
+{
+    return static_cast<long long>(value >> 1) ^ -static_cast<long long>(value & 1);
+}
+
+Status_History::Status_History()
+    : window(0), memory_limit(STATUS_HISTORY_MEMORY), spill_path(STATUS_HISTORY_FILE), has_latest(false),
+      memory_bytes(0), memory_first(0), spill_fd(-1), spill_start(0), spill_end(0)
+{
+}
+
+Status_History::~Status_History()
+{
+    if (spill_fd >= 0) {
+        close(spill_fd);
+        unlink(spill_path.c_str());
+    }
+}
+
+void Status_History::configure(size_t window, size_t memory_limit, const string& spill_path)
+{
+    this->window = window;
+    this->memory_limit = memory_limit;
+    if (spill_fd < 0) {
+        this->spill_path = spill_path;
+    }
+}
+
+// The changes that turn `newer` back into `older`, both sorted by id
+void Status_History::encode(const vector<Account_State>& older, const vector<Account_State>& newer, vector<unsigned char>& bytes)
+{
+    long long previous_id = 0;
+    size_t i = 0, j = 0;
+    while (i < older.size() || j < newer.size()) {
+        const Account_State* state;
+        int kind;
+        if (j == newer.size() || (i < older.size() && older[i].account_id < newer[j].account_id)) {
+            state = &older[i++];
+            kind = CHANGE_REOPEN;
+        } else if (i == older.size() || newer[j].account_id < older[i].account_id) {
+            state = &newer[j++];
+            kind = CHANGE_CLOSE;
+        } else {
+            const Account_State& before = older[i++];
+            const Account_State& after = newer[j++];
+            if (before.password != after.password) {
+                state = &before;
+                kind = CHANGE_REOPEN;
+            } else if (before.balance != after.balance) {
+                state = &before;
+                kind = CHANGE_BALANCE;
+            } else {
+                continue;
+            }
+        }
+
+        put_varint(bytes, zigzag(state->account_id - previous_id) << 2 | kind);
+        previous_id = state->account_id;
+        if (kind == CHANGE_BALANCE) {
+            put_varint(bytes, zigzag(static_cast<long long>(state->balance) - newer[j - 1].balance));
+        } else if (kind == CHANGE_REOPEN) {
+            put_varint(bytes, zigzag(state->balance));
+            put_varint(bytes, state->password.size());
+            bytes.insert(bytes.end(), state->password.begin(), state->password.end());
+        }
+    }
+}
+
+static void apply_changes(const unsigned char* bytes, size_t length, unordered_map<int, Account_State>& state)
+{
+    const unsigned char* end = bytes + length;
+    long long account_id = 0;
+    while (bytes < end) {
+        unsigned long long header = get_varint(bytes);
+        account_id += unzigzag(header >> 2);
+        int id = static_cast<int>(account_id);
+
+        switch (header & 3) {
+            case CHANGE_BALANCE:
+                state[id].balance += static_cast<int>(unzigzag(get_varint(bytes)));
+                break;
+            case CHANGE_REOPEN: {
+                Account_State& account = state[id];
+                account.account_id = id;
+                account.balance = static_cast<int>(unzigzag(get_varint(bytes)));
+                size_t password_length = get_varint(bytes);
+                account.password.assign(reinterpret_cast<const char*>(bytes), password_length);
+                bytes += password_length;
+                break;
+            }
+            case CHANGE_CLOSE:
+                state.erase(id);
+                break;
+        }
+    }
+}
+
+void Status_History::push(const vector<Account_State>& accounts)
+{
+    if (has_latest) {
+        deltas.push_back(Delta());
+        Delta& delta = deltas.back();
+        encode(latest, accounts, delta.bytes);
+        delta.bytes.shrink_to_fit();
+        delta.offset = -1;
+        delta.length = delta.bytes.size();
+        memory_bytes += delta.length;
+    }
+    latest = accounts;
+    has_latest = true;
+
+    while (size() > window && !deltas.empty()) {
+        drop_oldest();
+    }
+    // Without a usable spill file the memory limit wins over the window
+    while (memory_bytes > memory_limit && memory_first < deltas.size()) {
+        if (!spill_oldest()) {
+            drop_oldest();
+        }
+    }
+}
+
+bool Status_History::spill_oldest()
+{
+    if (spill_fd < 0) {
+        if (spill_path.empty()) {
+            return false;
+        }
+        spill_fd = open(spill_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (spill_fd < 0) {
+            perror("Bank error: open failed");
+            spill_path.clear();
+            return false;
+        }
+    }
+
+    Delta& delta = deltas[memory_first];
+    if (pwrite(spill_fd, delta.bytes.data(), delta.length, spill_end) != static_cast<ssize_t>(delta.length)) {
+        perror("Bank error: pwrite failed");
+        return false;
+    }
+    delta.offset = spill_end;
+    spill_end += delta.length;
+    memory_bytes -= delta.length;
+    vector<unsigned char>().swap(delta.bytes);
+    memory_first++;
+    return true;
+}
+
+void Status_History::drop_oldest()
+{
+    Delta& delta = deltas.front();
+    if (delta.offset >= 0) {
+        spill_start = delta.offset + delta.length;
+        memory_first--;
+    } else {
+        memory_bytes -= delta.length;
+    }
+    deltas.pop_front();
+
+    if (spill_start >= STATUS_HISTORY_COMPACT && spill_start >= spill_end - spill_start) {
+        compact_spill_file();
+    }
+}
+
+// Moves the live part of the spill file to its start; copying forward never overwrites unread bytes
+void Status_History::compact_spill_file()
+{
+    vector<unsigned char> chunk(COMPACT_CHUNK);
+    off_t live = spill_end - spill_start;
+    for (off_t copied = 0; copied < live; copied += COMPACT_CHUNK) {
+        size_t length = min(static_cast<off_t>(COMPACT_CHUNK), live - copied);
+        if (pread(spill_fd, chunk.data(), length, spill_start + copied) != static_cast<ssize_t>(length) ||
+            pwrite(spill_fd, chunk.data(), length, copied) != static_cast<ssize_t>(length)) {
+            perror("Bank error: spill file compaction failed");
+            return;
+        }
+    }
+    if (ftruncate(spill_fd, live)) {
+        perror("Bank error: ftruncate failed");
+    }
+
+    for (size_t i = 0; i < memory_first; i++) {
+        deltas[i].offset -= spill_start;
+    }
+    spill_end = live;
+    spill_start = 0;
+}
+
+size_t Status_History::size() const
+{
+    return has_latest ? deltas.size() + 1 : 0;
+}
+
+bool Status_History::get(size_t iterations, vector<Account_State>& accounts)
+{
+    if (iterations < 1 || iterations > size()) {
+        return false;
+    }
+
+    unordered_map<int, Account_State> state;
+    for (const Account_State& account : latest) {
+        state[account.account_id] = account;
+    }
+
+    // Spilled deltas are read through one mapping of the file
+    void* spill_map = nullptr;
+    size_t spill_map_length = 0;
+    for (size_t i = deltas.size(); i > deltas.size() - (iterations - 1); i--) {
+        const Delta& delta = deltas[i - 1];
+        const unsigned char* bytes = delta.bytes.data();
+        if (delta.length == 0) {
+            continue;
+        }
+        if (delta.offset >= 0) {
+            if (spill_map == nullptr) {
+                spill_map_length = spill_end;
+                spill_map = mmap(nullptr, spill_map_length, PROT_READ, MAP_SHARED, spill_fd, 0);
+                if (spill_map == MAP_FAILED) {
+                    perror("Bank error: mmap failed");
+                    return false;
+                }
+            }
+            bytes = static_cast<const unsigned char*>(spill_map) + delta.offset;
+        }
+        apply_changes(bytes, delta.length, state);
+    }
+    if (spill_map != nullptr) {
+        munmap(spill_map, spill_map_length);
+    }
+
+    accounts.clear();
+    accounts.reserve(state.size());
+    for (const auto& account : state) {
+        accounts.push_back(account.second);
+    }
+    sort(accounts.begin(), accounts.end(), [](const Account_State& a, const Account_State& b) {
+        return a.account_id < b.account_id;
+    });
+    return true;
+}
+
+size_t Status_History::resident_bytes() const
+{
+    return memory_bytes;
+}
+
+size_t Status_History::spilled_bytes() const
+{
+    return spill_end - spill_start;
+}
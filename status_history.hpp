@@ -0,0 +1,81 @@
+#ifndef STATUS_HISTORY_H
+#define STATUS_HISTORY_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <sys/types.h>
+
+using namespace std;
+
+#define STATUS_HISTORY_MEMORY (8 << 20)     // default bytes of deltas kept in memory
+#define STATUS_HISTORY_FILE "bank_history.bin"
+#define STATUS_HISTORY_COMPACT (1 << 20)    // dropped spill bytes before the file is rewritten
+
+/* What a whole bank rollback restores of an account */
+struct Account_State {
+    int account_id;
+    int balance;
+    string password;
+};
+
+/*
+ * The bank snapshots R rolls back to, one per bank iteration. Only the newest
+ * snapshot is kept whole; every older one is a reverse delta that turns the
+ * snapshot after it back into it, holding just the accounts that changed,
+ * opened or closed in between. A delta is packed on creation: accounts in id
+ * order, the id gap and change kind in one varint, then the balance difference
+ * (or, for a closed account, its balance and password) as zigzag varints.
+ *
+ * The newest deltas stay in memory up to memory_limit bytes; older ones are
+ * appended to a spill file that is only mmapped while a rollback reads it.
+ * Deltas past `window` snapshots are dropped, and the file is rewritten once
+ * the dropped part outgrows the live part.
+ *
+ * Not synchronized: Bank guards it with status_mutex.
+ */
+class Status_History {
+private:
+    struct Delta {
+        vector<unsigned char> bytes;  // empty once spilled
+        off_t offset;                 // in the spill file, -1 while in memory
+        size_t length;
+    };
+
+    size_t window;
+    size_t memory_limit;
+    string spill_path;
+
+    vector<Account_State> latest;     // sorted by id
+    bool has_latest;
+    deque<Delta> deltas;              // oldest first; deltas[i] turns snapshot i + 1 into snapshot i
+    size_t memory_bytes;
+    size_t memory_first;              // deltas before this index are spilled
+    int spill_fd;
+    off_t spill_start;                // file bytes before this belong to dropped deltas
+    off_t spill_end;
+
+    static void encode(const vector<Account_State>& older, const vector<Account_State>& newer, vector<unsigned char>& bytes);
+    bool spill_oldest();
+    void drop_oldest();
+    void compact_spill_file();
+
+public:
+    Status_History();
+    ~Status_History();
+
+    // window: snapshots kept; memory_limit: delta bytes kept in memory before spilling
+    void configure(size_t window, size_t memory_limit, const string& spill_path);
+
+    // Adds the newest snapshot; accounts sorted by id
+    void push(const vector<Account_State>& accounts);
+    size_t size() const;
+    // The snapshot `iterations` back (1 is the newest); false if out of range
+    bool get(size_t iterations, vector<Account_State>& accounts);
+
+    // Delta bytes in memory and in the spill file
+    size_t resident_bytes() const;
+    size_t spilled_bytes() const;
+};
+
+#endif
@@ -0,0 +1,39 @@
+#!/bin/sh
+# The balance auditor finds no violation while four ATMs and two VIP threads
+# open, close, deposit, withdraw and transfer on plain, hot and striped
+# accounts, threaded, batched, as async sessions and as one --batch job.
+# Usage: tests/audit.sh <path to bank>
+bank=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+for atm in 1 2 3 4; do
+    awk -v atm=$atm 'BEGIN {
+        srand(atm)
+        for (id = atm; id <= 16; id += 4) print "O", id, "pw" id, 500
+        for (i = 0; i < 3000; i++) {
+            id = int(rand() * 16) + 1; op = int(rand() * 20); amount = int(rand() * 80) + 1
+            vip = rand() < 0.1 ? " VIP=" int(rand() * 100) + 1 : ""
+            if (op < 6) print "D", id, "pw" id, amount vip
+            else if (op < 11) print "W", id, "pw" id, amount vip
+            else if (op < 12) print "B", id, "pw" id
+            else if (op < 18) print "T", id, "pw" id, int(rand() * 16) + 1, amount vip
+            else if (op < 19) print "Q", id, "pw" id
+            else print "O", id, "pw" id, 500
+        }
+    }' > atm_$atm.txt
+done
+
+status=0
+for mode in "" "--atm-batch 8" "--async" "--batch"; do
+    "$bank" --no-latency --audit 1 $mode --hot-account 1 --hot-account 2 --striped-account 3 --striped-account 4 \
+        2 atm_*.txt > out.txt 2>&1
+    if ! grep -q "^Audit: [1-9][0-9]* checks, 0 violations$" out.txt; then
+        echo "FAIL: audit with options '$mode':"
+        grep -i "audit" out.txt
+        status=1
+    fi
+done
+[ $status -eq 0 ] && echo "PASS: audit"
+exit $status
@@ -0,0 +1,69 @@
+#!/bin/sh
+# Batched execution gives the same results as running commands one by one.
+# One ATM with small balances, so withdrawals fail and the order matters: its
+# log and final state must not change with --atm-batch, with or without hot
+# and striped accounts among the batched commands. A --batch job over four
+# such files must end the same at any thread count and in a sequential replay
+# of its recorded order.
+# Usage: tests/batch_equivalence.sh <path to bank>
+bank=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+# Each ATM opens a few accounts, then works on all of them; some commands hit
+# accounts that are not open yet, others close and reopen one
+for atm in 1 2 3 4; do
+    awk -v atm=$atm 'BEGIN {
+        srand(atm)
+        for (id = atm; id <= 8; id += 4) print "O", id, "pw" id, 50
+        for (i = 0; i < 500; i++) {
+            id = int(rand() * 8) + 1; op = int(rand() * 10); amount = int(rand() * 40) + 1
+            if (op < 3) print "D", id, "pw" id, amount
+            else if (op < 6) print "W", id, "pw" id, amount
+            else if (op < 7) print "B", id, "pw" id
+            else if (op < 9) print "T", id, "pw" id, int(rand() * 8) + 1, amount
+            else if (rand() < 0.3) print "Q", id, "pw" id
+            else print "O", id, "pw" id, 50
+        }
+    }' > atm_$atm.txt
+done
+cat atm_1.txt atm_2.txt > single.txt
+
+status=0
+reference=""
+for mode in "" "--atm-batch 4" "--atm-batch 16" "--atm-batch 16 --hot-account 1 --striped-account 2"; do
+    rm -f log.txt
+    "$bank" --no-latency $mode --record rec.txt 0 single.txt > out.txt 2>&1
+    checksum=$(sed -n 's/^Final state.*checksum //p' out.txt)
+    if [ -z "$reference" ]; then
+        reference=$checksum
+        mv log.txt reference_log.txt
+    elif ! cmp -s log.txt reference_log.txt; then
+        echo "FAIL: log with options '$mode' differs from the unbatched log"
+        status=1
+    fi
+    if [ -z "$checksum" ] || [ "$checksum" != "$reference" ]; then
+        echo "FAIL: checksum $checksum with options '$mode', unbatched $reference"
+        status=1
+    fi
+done
+
+reference=""
+for threads in 1 4; do
+    "$bank" --record rec_$threads.txt --batch --batch-threads $threads 0 atm_*.txt > out.txt 2>&1
+    checksum=$(sed -n 's/^Batch:.*checksum //p' out.txt)
+    [ -z "$reference" ] && reference=$checksum
+    if [ -z "$checksum" ] || [ "$checksum" != "$reference" ]; then
+        echo "FAIL: --batch checksum $checksum with $threads threads, $reference with 1"
+        status=1
+    fi
+done
+"$bank" --no-latency --replay rec_4.txt > replay.txt 2>&1
+replayed=$(sed -n 's/^Replay:.*checksum //p' replay.txt)
+if [ "$replayed" != "$reference" ]; then
+    echo "FAIL: --batch checksum $reference, sequential replay $replayed"
+    status=1
+fi
+[ $status -eq 0 ] && echo "PASS: batch_equivalence"
+exit $status
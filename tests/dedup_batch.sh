@@ -0,0 +1,21 @@
+#!/bin/sh
+# A resent keyed deposit is applied once, whether or not the ATM batches it.
+# Usage: tests/dedup_batch.sh <path to bank>
+bank=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+printf 'O 1 pw 100\nD 1 pw 10 KEY=5\nD 1 pw 10 KEY=5\nB 1 pw\n' > atm.txt
+status=0
+for batch in 1 4; do
+    rm -f log.txt
+    "$bank" --no-latency --atm-batch $batch 0 atm.txt > /dev/null 2>&1
+    if ! grep -q "^1: Account 1 balance is 110$" log.txt; then
+        echo "FAIL: duplicate key with --atm-batch $batch:"
+        cat log.txt
+        status=1
+    fi
+done
+[ $status -eq 0 ] && echo "PASS: dedup_batch"
+exit $status
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Importing an account file opens the same accounts as one O per line, in
+# any order, with --import or with an I command between ATM commands. A file
+# with a repeated id opens nothing.
+# Usage: tests/import.sh <path to bank>
+bank=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+awk 'BEGIN {
+    srand(5)
+    for (id = 200; id >= 1; id--) print id "," "pw" id "," int(rand() * 1000)
+}' > accounts.txt
+awk -F, '{ print "O", $1, $2, $3 }' accounts.txt > open.txt
+awk 'BEGIN { for (id = 1; id <= 200; id += 7) print "D", id, "pw" id, id }' > atm.txt
+cat open.txt atm.txt > opened.txt
+{ echo "I accounts.txt"; cat atm.txt; } > imported.txt
+
+status=0
+"$bank" --no-latency --record rec.txt 0 opened.txt > out.txt 2>&1
+reference=$(sed -n 's/^Final state.*checksum //p' out.txt)
+for run in "--import accounts.txt 0 atm.txt" "0 imported.txt"; do
+    "$bank" --no-latency --record rec.txt $run > out.txt 2>&1
+    checksum=$(sed -n 's/^Final state.*checksum //p' out.txt)
+    if [ -z "$checksum" ] || [ "$checksum" != "$reference" ]; then
+        echo "FAIL: checksum $checksum for '$run', $reference with O commands"
+        status=1
+    fi
+done
+
+printf '7,a,5\n8,b,6\n7,c,7\n' > repeated.txt
+printf 'I repeated.txt\nB 8 b\n' > atm.txt
+"$bank" --no-latency 0 atm.txt > /dev/null 2>&1
+if ! grep -q "account id 7 appears twice" log.txt || ! grep -q "account id 8 does not exist" log.txt; then
+    echo "FAIL: an account file with a repeated id:"
+    cat log.txt
+    status=1
+fi
+[ $status -eq 0 ] && echo "PASS: import"
+exit $status
@@ -0,0 +1,41 @@
+#!/bin/sh
+# One ATM's commands, many of them transfers between accounts of different
+# partitions, give the same log and final state at any partition count as the
+# bank without partitions.
+# Usage: tests/partitions.sh <path to bank>
+bank=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+awk 'BEGIN {
+    srand(3)
+    for (id = 1; id <= 10; id++) print "O", id, "pw" id, 100
+    for (i = 0; i < 1000; i++) {
+        id = int(rand() * 12) + 1; op = int(rand() * 5); amount = int(rand() * 60) + 1
+        if (op == 0) print "D", id, "pw" id, amount
+        else if (op == 1) print "W", id, "pw" id, amount
+        else if (op == 2) print "B", id, "pw" id
+        else print "T", id, "pw" id, int(rand() * 12) + 1, amount
+    }
+}' > atm.txt
+
+status=0
+"$bank" --no-latency --record rec.txt 0 atm.txt > out.txt 2>&1
+reference=$(sed -n 's/^Final state.*checksum //p' out.txt)
+mv log.txt reference_log.txt
+for count in 2 3; do
+    rm -f log.txt
+    "$bank" --no-latency --partitions $count 0 atm.txt > out.txt 2>&1
+    checksum=$(sed -n "s/^Final state, $count partitions.*checksum //p" out.txt)
+    if [ -z "$checksum" ] || [ "$checksum" != "$reference" ]; then
+        echo "FAIL: checksum $checksum with $count partitions, $reference without"
+        status=1
+    fi
+    if ! cmp -s log.txt reference_log.txt; then
+        echo "FAIL: log with $count partitions differs from the log without"
+        status=1
+    fi
+done
+[ $status -eq 0 ] && echo "PASS: partitions"
+exit $status
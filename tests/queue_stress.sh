@@ -0,0 +1,20 @@
+#!/bin/sh
+# Stress test of the VIP queues: producers and consumers hand items through
+# the mutex and lock-free queues, and no item may be lost, handed out twice or
+# taken out of level order. bank_bench --queue exits non-zero on any of these.
+# Usage: tests/queue_stress.sh <path to bank>; bank_bench must be next to it
+bench=$(cd "$(dirname "$1")" && pwd)/bank_bench
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+status=0
+for threads in 1 4; do
+    if ! "$bench" --queue 400000 --queue-threads $threads > out.txt 2>&1; then
+        echo "FAIL: queue stress with $threads producers and consumers:"
+        cat out.txt
+        status=1
+    fi
+done
+[ $status -eq 0 ] && echo "PASS: queue_stress"
+exit $status
@@ -0,0 +1,40 @@
+#!/bin/sh
+# A threaded run is recorded and replayed, one operation at a time and in
+# parallel. Balances are small, so the ATMs' withdrawals and transfers fail or
+# succeed depending on the interleaving; both replays must still reach the
+# recorded run's final state.
+# Usage: tests/replay_parallel.sh <path to bank>
+bank=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+for id in 1 2 3 4 5 6 7 8 9 10 11 12; do
+    echo "$id pw$id 100"
+done > accounts.txt
+for atm in 1 2 3 4; do
+    awk -v atm=$atm 'BEGIN {
+        srand(atm)
+        for (i = 0; i < 1000; i++) {
+            id = int(rand() * 12) + 1; op = int(rand() * 4); amount = int(rand() * 60) + 1
+            if (op == 0) print "D", id, "pw" id, amount
+            else if (op == 1) print "W", id, "pw" id, amount
+            else if (op == 2) print "B", id, "pw" id
+            else print "T", id, "pw" id, int(rand() * 12) + 1, amount
+        }
+    }' > atm_$atm.txt
+done
+
+status=0
+"$bank" --no-latency --striped-account 1 --hot-account 2 --record rec.txt --import accounts.txt 0 atm_*.txt > out.txt 2>&1
+live=$(sed -n 's/^Final state.*checksum //p' out.txt)
+for mode in "" "--replay-parallel"; do
+    "$bank" --no-latency --replay rec.txt $mode > replay.txt 2>&1
+    replayed=$(sed -n 's/^Replay:.*checksum //p' replay.txt)
+    if [ -z "$live" ] || [ "$live" != "$replayed" ]; then
+        echo "FAIL: recorded checksum $live, replay $mode $replayed"
+        status=1
+    fi
+done
+[ $status -eq 0 ] && echo "PASS: replay_parallel"
+exit $status
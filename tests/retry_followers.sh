@@ -0,0 +1,29 @@
+#!/bin/sh
+# Commands behind a parked PERSISTENT command on the same account wait for it
+# and then run in file order. The first withdrawal can never succeed; if the
+# deposit behind it ran first, a retry would take the money and the balance
+# would end at 800 instead of 950. A sequential replay of the recorded order
+# must end in the same state.
+# Usage: tests/retry_followers.sh <path to bank>
+bank=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+printf 'O 1 pw 100\nO 2 pw 100\nW 1 pw 150 PERSISTENT\nD 1 pw 1000\nD 2 pw 5\nW 1 pw 150 PERSISTENT\nB 1 pw\nB 2 pw\n' > atm.txt
+status=0
+"$bank" --no-latency --max-retries 3 --record rec.txt 0 atm.txt > out.txt 2>&1
+live=$(sed -n 's/^Final state.*checksum //p' out.txt)
+"$bank" --no-latency --replay rec.txt > replay.txt 2>&1
+replayed=$(sed -n 's/^Replay:.*checksum //p' replay.txt)
+if ! grep -q "^1: Account 1 balance is 950$" log.txt || ! grep -q "^1: Account 2 balance is 105$" log.txt; then
+    echo "FAIL: PERSISTENT followers ran out of order:"
+    cat log.txt
+    status=1
+fi
+if [ -z "$live" ] || [ "$live" != "$replayed" ]; then
+    echo "FAIL: live checksum $live, replayed $replayed"
+    status=1
+fi
+[ $status -eq 0 ] && echo "PASS: retry_followers"
+exit $status
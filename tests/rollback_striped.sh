@@ -0,0 +1,30 @@
+#!/bin/sh
+# An R rollback restores a striped account like a plain one: pending stripes
+# are not added on top of the restored balance, and the audit stays clean.
+# Runs with latency on, so the status thread saves a snapshot during the R.
+# Commissions may land anywhere, so the restored balance is checked against
+# 120 less the commissions charged before it.
+# Usage: tests/rollback_striped.sh <path to bank>
+bank=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+printf 'O 1 pw 100\nD 1 pw 10\nD 1 pw 10\nR 1\nW 1 pw 5\n' > atm.txt
+status=0
+for mode in "" "--striped-account 1"; do
+    rm -f log.txt
+    "$bank" $mode --audit 100 0 atm.txt > out.txt 2>&1
+    restored=$(awk '
+        /gained/ { charged += $(NF - 4) }
+        /after 5 \$ was withdrew/ { print $7 + 5 " " charged; exit }' log.txt)
+    set -- $restored
+    if [ -z "$1" ] || [ "$1" -gt 120 ] || [ "$1" -lt $((120 - $2)) ] || ! grep -q " 0 violations$" out.txt; then
+        echo "FAIL: R on account 1 with options '$mode':"
+        cat log.txt
+        grep Audit out.txt
+        status=1
+    fi
+done
+[ $status -eq 0 ] && echo "PASS: rollback_striped"
+exit $status
@@ -0,0 +1,55 @@
+#!/bin/sh
+# Four ATMs deposit, withdraw and transfer between eight accounts that hold
+# far more than any run can take out, so no command fails and the final
+# balances do not depend on the interleaving. They must match the sums of the
+# ATM files with plain, striped and hot accounts alike, and the checksums of
+# all modes must agree. Runs without latency, well before the first commission.
+# Usage: tests/striped_deposits.sh <path to bank>
+bank=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+for id in 1 2 3 4 5 6 7 8; do
+    echo "$id pw$id 1000000"
+done > accounts.txt
+for atm in 1 2 3 4; do
+    awk -v seed=$atm 'BEGIN {
+        srand(seed)
+        for (i = 0; i < 2000; i++) {
+            id = int(rand() * 8) + 1; op = int(rand() * 4); amount = int(rand() * 50) + 1
+            if (op == 0 || op == 3) print "D", id, "pw" id, amount
+            else if (op == 1) print "W", id, "pw" id, amount
+            else print "T", id, "pw" id, int(rand() * 8) + 1, amount
+        }
+    }' > atm_$atm.txt
+done
+
+# Deposits and withdrawals change one account, a transfer moves between two
+expected=$(cat atm_*.txt | awk '
+    $1 == "D" { delta[$2] += $4 }
+    $1 == "W" { delta[$2] -= $4 }
+    $1 == "T" { delta[$2] -= $5; delta[$4] += $5 }
+    END { for (id = 1; id <= 8; id++) printf "%d:%d ", id, 1000000 + delta[id] }')
+
+status=0
+reference=""
+for mode in "" "--striped-account 1 --striped-account 2" "--hot-account 1 --hot-account 3" \
+            "--striped-account 1 --hot-account 2 --atm-batch 8"; do
+    "$bank" --no-latency $mode --record rec.txt --import accounts.txt 0 atm_*.txt > out.txt 2>&1
+    # The last status block is printed after every ATM finished
+    balances=$(awk '
+        /Current Bank Status/ { delete balance }
+        /^Account [0-9]+: Balance/ { sub(":", "", $2); balance[$2] = $5 }
+        END { for (id = 1; id <= 8; id++) printf "%d:%d ", id, balance[id] }' out.txt)
+    checksum=$(sed -n 's/^Final state.*checksum //p' out.txt)
+    [ -z "$reference" ] && reference=$checksum
+    if [ "$balances" != "$expected" ] || [ -z "$checksum" ] || [ "$checksum" != "$reference" ]; then
+        echo "FAIL: balances with options '$mode':"
+        echo "  expected $expected"
+        echo "  got      $balances (checksum $checksum, plain $reference)"
+        status=1
+    fi
+done
+[ $status -eq 0 ] && echo "PASS: striped_deposits"
+exit $status
@@ -0,0 +1,190 @@
+#include "trace.hpp"
+#include <vector>
+#include <cstdio>
+#include <ctime>
+#include <pthread.h>
+
+struct Trace_Event {
+    const char* name;
+    long long start_ns;
+    long long duration_ns;
+    int atm_id;
+};
+
+/* One thread's ring; owned by the registry so it outlives the thread */
+struct Trace_Thread {
+    int tid;
+    string name;
+    vector<Trace_Event> events;
+    unsigned long long recorded; // events ever recorded; the ring holds the last TRACE_RING_EVENTS
+    int depth;                   // nesting of Trace_Commands
+    bool sampled;                // the outermost command is recorded
+    int atm_id;
+    unsigned long long commands;
+};
+
+bool trace_enabled = false;
+
+static int trace_sample_every = 1;
+static long long trace_epoch_ns = 0;
+static pthread_mutex_t trace_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+// Never destroyed, so the rings stay reachable at exit
+static vector<Trace_Thread*>& trace_threads = *new vector<Trace_Thread*>();
+static thread_local Trace_Thread* current_thread = nullptr;
+
+static long long now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static Trace_Thread* this_thread()
+{
+    if (current_thread == nullptr) {
+        Trace_Thread* thread = new Trace_Thread();
+        thread->events.resize(TRACE_RING_EVENTS);
+        thread->recorded = 0;
+        thread->depth = 0;
+        thread->sampled = true;
+        thread->atm_id = 0;
+        thread->commands = 0;
+
+        pthread_mutex_lock(&trace_threads_lock);
+        thread->tid = trace_threads.size() + 1;
+        trace_threads.push_back(thread);
+        pthread_mutex_unlock(&trace_threads_lock);
+        current_thread = thread;
+    }
+    return current_thread;
+}
+
+static void record(Trace_Thread* thread, const char* name, long long start_ns, long long end_ns)
+{
+    Trace_Event& event = thread->events[thread->recorded++ % TRACE_RING_EVENTS];
+    event.name = name;
+    event.start_ns = start_ns;
+    event.duration_ns = end_ns - start_ns;
+    event.atm_id = thread->atm_id;
+}
+
+void trace_start(int sample_every)
+{
+    trace_sample_every = sample_every < 1 ? 1 : sample_every;
+    trace_epoch_ns = now_ns();
+    trace_enabled = true;
+}
+
+void trace_thread_name(const string& name)
+{
+    if (trace_enabled) {
+        this_thread()->name = name;
+    }
+}
+
+long long trace_begin_span()
+{
+    Trace_Thread* thread = this_thread();
+    return thread->depth == 0 || thread->sampled ? now_ns() : -1;
+}
+
+void trace_end_span(const char* name, long long start_ns)
+{
+    record(current_thread, name, start_ns, now_ns());
+}
+
+long long trace_begin_command(int atm_id)
+{
+    Trace_Thread* thread = this_thread();
+    if (thread->depth++ == 0) {
+        thread->sampled = thread->commands++ % trace_sample_every == 0;
+        thread->atm_id = atm_id;
+    }
+    return thread->sampled ? now_ns() : -1;
+}
+
+void trace_end_command(const char* name, long long start_ns)
+{
+    Trace_Thread* thread = current_thread;
+    if (start_ns >= 0) {
+        record(thread, name, start_ns, now_ns());
+    }
+    if (--thread->depth == 0) {
+        thread->atm_id = 0;
+    }
+}
+
+const char* trace_operation_name(char operation)
+{
+    switch (operation) {
+        case 'O': return "O open";
+        case 'D': return "D deposit";
+        case 'W': return "W withdraw";
+        case 'B': return "B balance";
+        case 'Q': return "Q close";
+        case 'T': return "T transfer";
+        case 'C': return "C close ATM";
+        case 'R': return "R rollback";
+        case 'I': return "I import";
+        case 'U': return "U undo";
+        case 'S': return "S restore";
+        case 'Z': return "Z restore bank";
+        case 'K': return "K commission";
+        default: return "command";
+    }
+}
+
+// Event names are string literals without quotes or backslashes; thread names are escaped
+static void write_json_string(FILE* file, const string& text)
+{
+    fputc('"', file);
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            fputc('\\', file);
+        }
+        fputc(static_cast<unsigned char>(c) < 0x20 ? ' ' : c, file);
+    }
+    fputc('"', file);
+}
+
+bool trace_export(const string& path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        perror("Bank error: unable to open trace file");
+        return false;
+    }
+
+    pthread_mutex_lock(&trace_threads_lock);
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"bank\"}}");
+    for (const Trace_Thread* thread : trace_threads) {
+        string name = thread->name;
+        if (name.empty()) {
+            name = "thread " + to_string(thread->tid);
+        }
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", thread->tid);
+        write_json_string(file, name);
+        fprintf(file, "}}");
+
+        unsigned long long first = thread->recorded > TRACE_RING_EVENTS ? thread->recorded - TRACE_RING_EVENTS : 0;
+        for (unsigned long long i = first; i < thread->recorded; i++) {
+            const Trace_Event& event = thread->events[i % TRACE_RING_EVENTS];
+            // Complete events, in microseconds with nanosecond decimals
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"bank\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                    event.name, thread->tid, (event.start_ns - trace_epoch_ns) / 1000.0, event.duration_ns / 1000.0);
+            if (event.atm_id > 0) {
+                fprintf(file, ",\"args\":{\"atm\":%d}", event.atm_id);
+            }
+            fprintf(file, "}");
+        }
+    }
+    fprintf(file, "\n]}\n");
+    pthread_mutex_unlock(&trace_threads_lock);
+
+    if (fclose(file)) {
+        perror("Bank error: unable to write trace file");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+
+using namespace std;
+
+#define TRACE_RING_EVENTS 16384 // events kept per thread; older ones are overwritten
+
+/*
+ * Optional per-phase timing trace (--trace FILE). Each thread records complete
+ * events (a name, start and duration) into its own ring buffer, so recording
+ * takes no lock. At exit the rings are written as Chrome trace JSON, which
+ * chrome://tracing and ui.perfetto.dev open as one timeline per thread.
+ *
+ * A Trace_Command marks one ATM command; the Trace_Spans inside it (parse,
+ * enqueue, bank lock, account lock, mutate, log, sleep) are its phases. With
+ * --trace-sample N only every Nth command of a thread is recorded. Work outside
+ * any command (commissions, status prints) is always recorded.
+ *
+ * Disabled, every span is a test of trace_enabled.
+ */
+
+extern bool trace_enabled;
+
+// Turns tracing on; call before the traced threads start
+void trace_start(int sample_every);
+// Names the calling thread in the timeline
+void trace_thread_name(const string& name);
+// Writes every thread's ring as Chrome trace JSON; call once the traced threads are done
+bool trace_export(const string& path);
+
+long long trace_begin_span();
+void trace_end_span(const char* name, long long start_ns);
+long long trace_begin_command(int atm_id);
+void trace_end_command(const char* name, long long start_ns);
+
+/* One phase; recorded if the thread is outside a command or in a sampled one */
+class Trace_Span {
+private:
+    const char* name;
+    long long start_ns; // -1: not recorded
+
+public:
+    explicit Trace_Span(const char* name) : name(name), start_ns(trace_enabled ? trace_begin_span() : -1) {}
+    ~Trace_Span() {
+        if (start_ns >= 0) {
+            trace_end_span(name, start_ns);
+        }
+    }
+};
+
+/* One command of atm_id; nested inside another command it is a plain span */
+class Trace_Command {
+private:
+    const char* name;
+    long long start_ns;
+    bool active;
+
+public:
+    Trace_Command(const char* name, int atm_id) : name(name), start_ns(-1), active(trace_enabled) {
+        if (active) {
+            start_ns = trace_begin_command(atm_id);
+        }
+    }
+    ~Trace_Command() {
+        if (active) {
+            trace_end_command(name, start_ns);
+        }
+    }
+};
+
+// Static event name for an operation letter, e.g. "D" for deposits
+const char* trace_operation_name(char operation);
+
+#endif
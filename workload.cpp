@@ -0,0 +1,202 @@
+#include "workload.hpp"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+string account_password(int account_id)
+{
+    return "pw" + to_string(account_id);
+}
+
+int random_int(mt19937& generator, int low, int high)
+{
+    // Rejects the top partial block of values so every result is equally likely
+    unsigned long long range = static_cast<unsigned long long>(static_cast<long long>(high) - low) + 1;
+    unsigned long long limit = (1ULL << 32) - (1ULL << 32) % range;
+    unsigned long long value;
+    do {
+        value = generator();
+    } while (value >= limit);
+    return static_cast<int>(low + static_cast<long long>(value % range));
+}
+
+double random_fraction(mt19937& generator)
+{
+    return generator() / 4294967296.0;
+}
+
+/* Index of a weight drawn with probability proportional to it; the total must be positive */
+static int random_weighted(mt19937& generator, const int* weights, int count)
+{
+    int pick = random_int(generator, 0, accumulate(weights, weights + count, 0) - 1);
+    int index = 0;
+    while (pick >= weights[index]) {
+        pick -= weights[index];
+        index++;
+    }
+    return index;
+}
+
+bool parse_operation_mix(const string& mix, Workload_Config& config)
+{
+    stringstream mix_stream(mix);
+    string weight;
+    int parsed[MIX_SIZE] = {0, 0, 0, 0, 0, 0};
+    int count = 0;
+
+    while (getline(mix_stream, weight, ':')) {
+        if (count == MIX_SIZE || weight.empty()) {
+            return false;
+        }
+        parsed[count] = stoi(weight);
+        if (parsed[count] < 0) {
+            return false;
+        }
+        count++;
+    }
+    if (count < 4 || accumulate(parsed, parsed + MIX_SIZE, 0) == 0) {
+        return false;
+    }
+
+    copy(parsed, parsed + MIX_SIZE, config.mix);
+    return true;
+}
+
+bool parse_workload_option(const string& name, const char* value, Workload_Config& config)
+{
+    if (name == "accounts") {
+        config.accounts = stoi(value);
+    } else if (name == "atms") {
+        config.atms = stoi(value);
+    } else if (name == "ops") {
+        config.operations_per_atm = stoi(value);
+    } else if (name == "zipf") {
+        config.zipf_skew = stod(value);
+    } else if (name == "vip") {
+        config.vip_fraction = stod(value);
+    } else if (name == "persistent") {
+        config.persistent_fraction = stod(value);
+    } else if (name == "mix") {
+        return parse_operation_mix(value, config);
+    } else if (name == "initial-balance") {
+        config.initial_balance = stoi(value);
+    } else if (name == "seed") {
+        config.seed = static_cast<unsigned int>(stoul(value));
+    } else {
+        return false;
+    }
+
+    return config.accounts > 0 && config.atms > 0 && config.operations_per_atm >= 0;
+}
+
+/* Samples account ranks 1..n with probability proportional to 1 / rank^skew */
+class Zipf_Sampler {
+private:
+    vector<double> cdf;
+
+public:
+    Zipf_Sampler(int n, double skew) : cdf(n)
+    {
+        double sum = 0;
+        for (int rank = 1; rank <= n; rank++) {
+            sum += 1.0 / pow(static_cast<double>(rank), skew);
+            cdf[rank - 1] = sum;
+        }
+        for (int i = 0; i < n; i++) {
+            cdf[i] /= sum;
+        }
+    }
+
+    int sample(mt19937& generator)
+    {
+        double u = random_fraction(generator);
+        size_t index = lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        return static_cast<int>(min(index, cdf.size() - 1)) + 1;
+    }
+};
+
+void generate_workload(const Workload_Config& config, Workload& workload)
+{
+    mt19937 generator(config.seed);
+    Zipf_Sampler accounts(config.accounts, config.zipf_skew);
+    int next_new_account = config.accounts + 1;
+
+    workload.setup_lines.clear();
+    for (int id = 1; id <= config.accounts; id++) {
+        workload.setup_lines.push_back("O " + to_string(id) + " " + account_password(id) + " " + to_string(config.initial_balance));
+    }
+
+    workload.atm_lines.assign(config.atms, vector<string>());
+    for (int atm = 0; atm < config.atms; atm++) {
+        vector<string>& lines = workload.atm_lines[atm];
+        lines.reserve(config.operations_per_atm);
+
+        for (int i = 0; i < config.operations_per_atm; i++) {
+            int account = accounts.sample(generator);
+            string password = account_password(account);
+            stringstream line;
+
+            switch (random_weighted(generator, config.mix, MIX_SIZE)) {
+                case MIX_DEPOSIT:
+                    line << "D " << account << " " << password << " " << random_int(generator, 1, 100);
+                    break;
+                case MIX_WITHDRAW:
+                    line << "W " << account << " " << password << " " << random_int(generator, 1, 100);
+                    break;
+                case MIX_BALANCE:
+                    line << "B " << account << " " << password;
+                    break;
+                case MIX_TRANSFER:
+                    line << "T " << account << " " << password << " " << accounts.sample(generator) << " " << random_int(generator, 1, 100);
+                    break;
+                case MIX_OPEN:
+                    // New accounts get ids past the preloaded range
+                    line << "O " << next_new_account << " " << account_password(next_new_account) << " " << config.initial_balance;
+                    next_new_account++;
+                    break;
+                case MIX_CLOSE:
+                    line << "Q " << account << " " << password;
+                    break;
+            }
+
+            if (random_fraction(generator) < config.persistent_fraction) {
+                line << " PERSISTENT";
+            }
+            if (random_fraction(generator) < config.vip_fraction) {
+                line << " VIP=" << random_int(generator, 1, 100);
+            }
+            lines.push_back(line.str());
+        }
+    }
+}
+
+static bool write_lines(const vector<string>& lines, const string& path)
+{
+    ofstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    for (const string& line : lines) {
+        file << line << "\n";
+    }
+    return file.good();
+}
+
+bool write_workload(const Workload& workload, const string& directory, vector<string>& atm_files)
+{
+    atm_files.clear();
+    if (!write_lines(workload.setup_lines, directory + "/setup.txt")) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < workload.atm_lines.size(); i++) {
+        string path = directory + "/atm_" + to_string(i + 1) + ".txt";
+        if (!write_lines(workload.atm_lines[i], path)) {
+            return false;
+        }
+        atm_files.push_back(path);
+    }
+    return true;
+}
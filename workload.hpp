@@ -0,0 +1,56 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <string>
+#include <vector>
+#include <random>
+
+using namespace std;
+
+// Operation mix indexes, in the order of Workload_Config::mix
+#define MIX_DEPOSIT 0
+#define MIX_WITHDRAW 1
+#define MIX_BALANCE 2
+#define MIX_TRANSFER 3
+#define MIX_OPEN 4
+#define MIX_CLOSE 5
+#define MIX_SIZE 6
+
+struct Workload_Config {
+    int accounts = 1000;
+    int atms = 4;
+    int operations_per_atm = 10000;
+    double zipf_skew = 0.0;           // 0 = uniform account hotness
+    double vip_fraction = 0.0;
+    double persistent_fraction = 0.0;
+    int mix[MIX_SIZE] = {40, 30, 20, 10, 0, 0}; // D W B T O Q weights
+    int initial_balance = 1000;
+    unsigned int seed = 1;
+};
+
+struct Workload {
+    vector<string> setup_lines;          // opens every account, run before the ATMs
+    vector<vector<string>> atm_lines;    // one command stream per ATM
+};
+
+// Parses a "D:W:B:T:O:Q" weight list into config.mix
+bool parse_operation_mix(const string& mix, Workload_Config& config);
+
+// Applies one generator command line option (by long name), false if not a generator option
+bool parse_workload_option(const string& name, const char* value, Workload_Config& config);
+
+// Builds a reproducible workload; the same config always yields the same lines
+void generate_workload(const Workload_Config& config, Workload& workload);
+
+// Writes setup.txt and atm_<n>.txt into directory, returning the ATM file paths
+bool write_workload(const Workload& workload, const string& directory, vector<string>& atm_files);
+
+string account_password(int account_id);
+
+// Ranges drawn straight from mt19937, whose output the standard fixes. The
+// <random> distributions are left to each standard library, so they would
+// give other workloads and checksums on another toolchain.
+int random_int(mt19937& generator, int low, int high); // uniform in [low, high]
+double random_fraction(mt19937& generator);            // uniform in [0, 1)
+
+#endif
@@ -0,0 +1,56 @@
+#include <iostream>
+#include <cstdlib>
+#include <getopt.h>
+#include "workload.hpp"
+
+/* Writes a synthetic ATM workload (setup.txt + atm_<n>.txt) for ./bank and ./bank_bench */
+
+static struct option long_options[] = {
+    {"accounts", required_argument, nullptr, 0},
+    {"atms", required_argument, nullptr, 0},
+    {"ops", required_argument, nullptr, 0},
+    {"zipf", required_argument, nullptr, 0},
+    {"vip", required_argument, nullptr, 0},
+    {"persistent", required_argument, nullptr, 0},
+    {"mix", required_argument, nullptr, 0},
+    {"initial-balance", required_argument, nullptr, 0},
+    {"seed", required_argument, nullptr, 0},
+    {nullptr, 0, nullptr, 0}
+};
+
+void print_usage() {
+    cerr << "Usage: bank_workload [--accounts N] [--atms N] [--ops N] [--zipf S] [--vip F] [--persistent F]" << endl;
+    cerr << "                     [--mix D:W:B:T[:O:Q]] [--initial-balance N] [--seed N] <output directory>" << endl;
+}
+
+int main(int argc, char *argv[]) {
+    Workload_Config config;
+    int option, option_index;
+
+    while ((option = getopt_long(argc, argv, "", long_options, &option_index)) != -1) {
+        if (option != 0 || !parse_workload_option(long_options[option_index].name, optarg, config)) {
+            print_usage();
+            exit(1);
+        }
+    }
+    if (optind != argc - 1) {
+        print_usage();
+        exit(1);
+    }
+
+    Workload workload;
+    vector<string> atm_files;
+    generate_workload(config, workload);
+    if (!write_workload(workload, argv[optind], atm_files)) {
+        cerr << "Bank error: unable to write workload files" << endl;
+        exit(1);
+    }
+
+    cout << argv[optind] << "/setup.txt";
+    for (const string& file : atm_files) {
+        cout << " " << file;
+    }
+    cout << endl;
+
+    return 0;
+}